@@ -32,103 +32,25 @@ namespace AutomatedTests {
             BerkeliumSharp.Update();
         }
 
-        public unsafe Bitmap HandlePaint (Window window, string outputFilename) {
-            var wid = window.Widget;
-            var windowBitmap = new Bitmap(wid.Rect.Width, wid.Rect.Height, PixelFormat.Format32bppArgb);
-
-            window.Paint += delegate(Window w, IntPtr sourceBuffer, Rect rect, int dx, int dy, Rect scrollRect) {
-                BitmapData sourceData;
-                var clientRect = new Rectangle(rect.Left, rect.Top, rect.Width, rect.Height);
-
-                if (dx != 0 || dy != 0) {
-                    var sourceRect = new Rectangle(scrollRect.Left, scrollRect.Top, scrollRect.Width, scrollRect.Height);
-                    var destRect = sourceRect;
-                    destRect.X += dx;
-                    destRect.Y += dy;
-
-                    // We want to only draw the overlapping portion of the scrolled and unscrolled
-                    //  rectangles, since the scrolled rectangle is probably partially offscreen
-                    var overlap = Rectangle.Intersect(destRect, sourceRect);
-
-                    // We need to handle scrolling to the left
-                    if (destRect.Left < 0) {
-                        sourceRect.X -= destRect.Left;
-                        destRect.X = 0;
-                    }
-                    // And upward
-                    if (destRect.Top < 0) {
-                        sourceRect.Y -= destRect.Top;
-                        destRect.Y = 0;
-                    }
-
-                    destRect.Width = sourceRect.Width = overlap.Width;
-                    destRect.Height = sourceRect.Height = overlap.Height;
-
-                    // If the clipping calculations resulted in a rect that contains zero pixels, 
-                    //  don't bother trying to do the blit.
-                    if ((sourceRect.Width > 0) && (sourceRect.Height > 0)) {
-                        sourceData = windowBitmap.LockBits(
-                            sourceRect, ImageLockMode.ReadOnly,
-                            PixelFormat.Format32bppRgb
-                        );
-
-                        int totalSize = sourceData.Stride * sourceData.Height;
-
-                        if ((TemporaryBuffer == null) || (totalSize > TemporaryBuffer.Length))
-                            TemporaryBuffer = new byte[totalSize];
-
-                        Marshal.Copy(sourceData.Scan0, TemporaryBuffer, 0, totalSize);
-                        windowBitmap.UnlockBits(sourceData);
-
-                        fixed (byte* ptr = &(TemporaryBuffer[0])) {
-                            sourceData.Scan0 = new IntPtr(ptr);
-
-                            var destData = windowBitmap.LockBits(
-                                destRect, ImageLockMode.WriteOnly | ImageLockMode.UserInputBuffer,
-                                PixelFormat.Format32bppRgb, sourceData
-                            );
-
-                            windowBitmap.UnlockBits(destData);
-                        }
-
-                        windowBitmap.Save(outputFilename, ImageFormat.Png);
-                    }
-                }
+        public Bitmap HandlePaint (Window window, string outputFilename) {
+            window.UseBackingStore = true;
+
+            // The bitmap shares its pixels with the window's backing store, which
+            //  already has every paint (and scroll) applied to it natively.
+            // Note that resizing the window invalidates the bitmap.
+            var store = window.BackingStore;
+            var windowBitmap = new Bitmap(
+                store.Width, store.Height, store.Stride,
+                PixelFormat.Format32bppRgb, store.Buffer
+            );
 
-                // If we get a paint event after a resize, the rect can be larger than the buffer.
-                if ((clientRect.Right > windowBitmap.Width) || (clientRect.Bottom > windowBitmap.Height))
+            window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                if (!store.IsDirty)
                     return;
 
-                // This probably looks wrong when you first read it, but we're filling
-                //  out a BitmapData structure to represent the source buffer.
-                sourceData = new BitmapData();
-                sourceData.Width = clientRect.Width;
-                sourceData.Height = clientRect.Height;
-                sourceData.PixelFormat = PixelFormat.Format32bppRgb;
-                sourceData.Stride = clientRect.Width * 4;
-                sourceData.Scan0 = sourceBuffer;
-
-                // Sometimes this can fail if we process an old paint event after we
-                //  request a resize, so we just eat the exception in that case.
-                // Yes, this is terrible.
-
-                try {
-                    // This oddball form of LockBits performs a write to the bitmap's
-                    //  internal buffer by copying from another BitmapData you pass in.
-                    // In this case we're passing in the source buffer.
-                    var bd = windowBitmap.LockBits(
-                        clientRect,
-                        ImageLockMode.WriteOnly | ImageLockMode.UserInputBuffer,
-                        PixelFormat.Format32bppRgb, sourceData
-                    );
-
-                    // For some reason we still have to unlock the bits afterward.
-                    windowBitmap.UnlockBits(bd);
-
-                } catch {
-                }
-
-                windowBitmap.Save(outputFilename, ImageFormat.Png);
+                store.ClearDirty();
+                // Disposing the capture waits for its encoder, so the file is complete before the next paint.
+                w.CaptureFrame(outputFilename).Dispose();
             };
 
             return windowBitmap;
@@ -153,7 +75,8 @@ namespace AutomatedTests {
                         expectedValue, holder.Value
                     ));
 
-                BerkeliumSharp.Update();
+                // Sleeps until Berkelium has something to do instead of spinning.
+                BerkeliumSharp.Update(new TimeSpan(end - DateTime.UtcNow.Ticks));
             }
         }
     }
@@ -230,6 +153,23 @@ namespace AutomatedTests {
             }
         }
 
+        [Test]
+        public void TestUnescapedUnicodeUrlIsEncodedAsUtf8 () {
+            var testUrl = String.Format(
+                "data:text/html;charset=utf-8,<html><head><title>{0}</title></head></html>", UnicodeText
+            );
+
+            var titleText = new Holder<string>();
+
+            using (var window = new Window(Context)) {
+                window.TitleChanged += (w, title) => titleText.Value = title;
+
+                window.NavigateTo(testUrl);
+
+                WaitFor(titleText, UnicodeText, 5);
+            }
+        }
+
         [Test]
         public void TestAlertUnicode () {
             var alertText = new Holder<string>();
@@ -266,6 +206,381 @@ namespace AutomatedTests {
             }
         }
 
+        [Test]
+        public void TestPaintCopyRectsAreInsideSourceRect () {
+            var testUrl = MakeDataUrl(
+                "<html><body>" + UnicodeText + "</body></html>"
+            );
+
+            var painted = new Holder<bool>();
+
+            using (var window = new Window(Context)) {
+                window.Paint += (w, sourceBuffer, rect, copyRects, dx, dy, scrollRect) => {
+                    Assert.IsNotNull(copyRects);
+
+                    foreach (var copyRect in copyRects) {
+                        Assert.GreaterOrEqual(copyRect.Left, rect.Left);
+                        Assert.GreaterOrEqual(copyRect.Top, rect.Top);
+                        Assert.LessOrEqual(copyRect.Right, rect.Right);
+                        Assert.LessOrEqual(copyRect.Bottom, rect.Bottom);
+                    }
+
+                    painted.Value = true;
+                };
+
+                window.Resize(128, 128);
+                window.NavigateTo(testUrl);
+
+                WaitFor(painted, true, 5);
+            }
+        }
+
+        [Test]
+        public void TestPaintFrameMatchesPaint () {
+            var testUrl = MakeDataUrl(
+                "<html><body>" + UnicodeText + "</body></html>"
+            );
+
+            var painted = new Holder<bool>();
+            long lastSequenceNumber = -1;
+            PaintFrame lastFrame = new PaintFrame();
+
+            using (var window = new Window(Context)) {
+                window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                    Assert.Greater(frame.SequenceNumber, lastSequenceNumber);
+                    Assert.AreEqual(BufferFormat.Bgra32, frame.Format);
+                    Assert.AreEqual(frame.SourceRect.Width * 4, frame.Stride);
+                    Assert.AreEqual(frame.Stride * frame.SourceRect.Height, frame.ByteLength);
+
+                    lastSequenceNumber = frame.SequenceNumber;
+                    lastFrame = frame;
+                };
+                window.Paint += (w, sourceBuffer, rect, copyRects, dx, dy, scrollRect) => {
+                    Assert.AreEqual(lastFrame.Buffer, sourceBuffer);
+                    Assert.AreEqual(rect.Width, lastFrame.SourceRect.Width);
+                    Assert.AreEqual(copyRects.Length, lastFrame.CopyRectCount);
+
+                    for (int i = 0; i < copyRects.Length; i++) {
+                        var copyRect = lastFrame.GetCopyRect(i);
+                        Assert.AreEqual(copyRects[i].Left, copyRect.Left);
+                        Assert.AreEqual(copyRects[i].Top, copyRect.Top);
+                        Assert.AreEqual(copyRects[i].Width, copyRect.Width);
+                        Assert.AreEqual(copyRects[i].Height, copyRect.Height);
+                    }
+
+                    painted.Value = true;
+                };
+
+                window.Resize(128, 128);
+                window.NavigateTo(testUrl);
+
+                WaitFor(painted, true, 5);
+            }
+        }
+
+        [Test]
+        public void TestBackingStoreTracksPaints () {
+            var testUrl = MakeDataUrl(
+                "<html><body style=\"background-color: #00FF00\"></body></html>"
+            );
+
+            var painted = new Holder<bool>();
+
+            using (var window = new Window(Context)) {
+                window.Resize(64, 64);
+                window.UseBackingStore = true;
+
+                var store = window.BackingStore;
+                Assert.AreEqual(64, store.Width);
+                Assert.AreEqual(64, store.Height);
+                Assert.GreaterOrEqual(store.Stride, store.Width * 4);
+
+                window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                    if (store.IsDirty)
+                        painted.Value = (Marshal.ReadInt32(store.Buffer, (32 * store.Stride) + (32 * 4)) & 0xFFFFFF) == 0x00FF00;
+                };
+
+                window.NavigateTo(testUrl);
+
+                WaitFor(painted, true, 5);
+
+                store.ClearDirty();
+                Assert.AreEqual(0, store.DirtyRects.Length);
+                store.MarkDirty();
+                Assert.AreEqual(1, store.DirtyRects.Length);
+                Assert.AreEqual(64, store.DirtyRects[0].Width);
+                Assert.AreEqual(64, store.DirtyRects[0].Height);
+
+                window.UseBackingStore = false;
+                Assert.IsNull(window.BackingStore);
+            }
+        }
+
+        [Test]
+        public void TestCaptureFrameWritesPng () {
+            var testUrl = MakeDataUrl(
+                "<html><body style=\"background-color: #00FF00\"></body></html>"
+            );
+
+            var painted = new Holder<bool>();
+            var outputFilename = Path.Combine(Path.GetTempPath(), "TestCaptureFrameWritesPng.png");
+            File.Delete(outputFilename);
+
+            using (var window = new Window(Context)) {
+                window.Resize(64, 64);
+                window.UseBackingStore = true;
+
+                var store = window.BackingStore;
+                window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                    if (store.IsDirty)
+                        painted.Value = (Marshal.ReadInt32(store.Buffer, (32 * store.Stride) + (32 * 4)) & 0xFFFFFF) == 0x00FF00;
+                };
+
+                window.NavigateTo(testUrl);
+
+                WaitFor(painted, true, 5);
+
+                using (var capture = window.CaptureFrame(outputFilename)) {
+                    Assert.IsTrue(capture.WaitForPendingFrames(5000));
+                    Assert.AreEqual(1, capture.FramesEncoded, "{0}", capture.LastError);
+                    Assert.AreEqual(0, capture.FramesDropped);
+                }
+            }
+
+            using (var bitmap = new Bitmap(outputFilename)) {
+                Assert.AreEqual(64, bitmap.Width);
+                Assert.AreEqual(64, bitmap.Height);
+                Assert.AreEqual(0x00FF00, bitmap.GetPixel(32, 32).ToArgb() & 0xFFFFFF);
+            }
+
+            File.Delete(outputFilename);
+        }
+
+        [Test]
+        public void TestRecordedTraceReplaysPaints () {
+            var testUrl = MakeDataUrl(
+                "<html><head><title>Traced</title></head><body style=\"background-color: #00FF00\"></body></html>"
+            );
+
+            var painted = new Holder<bool>();
+            var titleText = new Holder<string>();
+            var traceFilename = Path.Combine(Path.GetTempPath(), "TestRecordedTraceReplaysPaints.trace");
+
+            using (var window = new Window(Context)) {
+                window.Resize(64, 64);
+                window.UseBackingStore = true;
+
+                var store = window.BackingStore;
+                window.TitleChanged += (w, title) => titleText.Value = title;
+                window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                    painted.Value = (Marshal.ReadInt32(store.Buffer, (32 * store.Stride) + (32 * 4)) & 0xFFFFFF) == 0x00FF00;
+                };
+
+                using (var recorder = window.StartRecording(traceFilename)) {
+                    Assert.AreSame(recorder, window.ActiveRecording);
+
+                    window.NavigateTo(testUrl);
+                    WaitFor(painted, true, 5);
+                    WaitFor(titleText, "Traced", 5);
+
+                    recorder.Stop();
+                    Assert.IsNull(window.ActiveRecording);
+                    Assert.IsNull(recorder.LastError);
+                    Assert.Greater(recorder.RecordCount, 1);
+                }
+            }
+
+            using (var trace = new EventTrace(traceFilename))
+            using (var window = new Window(Context)) {
+                window.UseBackingStore = true;
+
+                string title = null;
+                int paintCount = 0;
+                window.TitleChanged += (w, newTitle) => title = newTitle;
+                window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                    paintCount += 1;
+                };
+
+                trace.Replay(window);
+
+                Assert.AreEqual("Traced", title);
+                Assert.Greater(paintCount, 0);
+                Assert.AreEqual(64, window.BackingStore.Width);
+                var store = window.BackingStore;
+                Assert.AreEqual(0x00FF00, Marshal.ReadInt32(store.Buffer, (32 * store.Stride) + (32 * 4)) & 0xFFFFFF);
+            }
+
+            File.Delete(traceFilename);
+        }
+
+        [Test]
+        public void TestCoalescedPaintsArriveOncePerUpdate () {
+            var testUrl = MakeDataUrl(
+                "<html><body style=\"background-color: #00FF00\">" + UnicodeText + "</body></html>"
+            );
+
+            int paintsThisUpdate = 0, totalPaintCount = 0;
+
+            using (var window = new Window(Context)) {
+                window.Resize(64, 64);
+                window.CoalescePaints = true;
+                Assert.IsTrue(window.UseBackingStore);
+
+                window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                    Assert.AreEqual(window.BackingStore.Buffer, frame.Buffer);
+                    Assert.LessOrEqual(frame.CopyRectCount, 1);
+                    Assert.GreaterOrEqual(frame.PaintCount, 1);
+
+                    paintsThisUpdate += 1;
+                    totalPaintCount += frame.PaintCount;
+                };
+
+                window.NavigateTo(testUrl);
+
+                long end = DateTime.UtcNow.Ticks + TimeSpan.FromSeconds(5).Ticks;
+                while (totalPaintCount == 0) {
+                    if (DateTime.UtcNow.Ticks > end)
+                        throw new TimeoutException("Timed out while waiting for a coalesced paint");
+
+                    paintsThisUpdate = 0;
+                    BerkeliumSharp.Update();
+                    Assert.LessOrEqual(paintsThisUpdate, 1);
+                }
+
+                window.CoalescePaints = false;
+                Assert.IsTrue(window.UseBackingStore);
+            }
+        }
+
+        [Test]
+        public void TestStatsCountPaints () {
+            var testUrl = MakeDataUrl(
+                "<html><body style=\"background-color: #00FF00\">" + UnicodeText + "</body></html>"
+            );
+
+            var before = BerkeliumSharp.Stats;
+
+            using (var window = new Window(Context)) {
+                window.Resize(64, 64);
+                window.CoalescePaints = true;
+
+                int paintCount = 0;
+                window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                    paintCount += 1;
+                };
+
+                window.NavigateTo(testUrl);
+
+                long end = DateTime.UtcNow.Ticks + TimeSpan.FromSeconds(5).Ticks;
+                while (paintCount == 0) {
+                    if (DateTime.UtcNow.Ticks > end)
+                        throw new TimeoutException("Timed out while waiting for a paint");
+
+                    BerkeliumSharp.Update();
+                }
+
+                var stats = window.Stats;
+                Assert.AreEqual(paintCount, stats.PaintsDelivered);
+                Assert.GreaterOrEqual(stats.PaintCallbacks, stats.PaintsDelivered);
+                Assert.AreEqual(stats.PaintCallbacks, stats.GetCallbackCount(CallbackType.Paint));
+                Assert.Greater(stats.PixelsDelivered, 0);
+                Assert.AreEqual(stats.PixelsDelivered * 4, stats.BytesDelivered);
+                Assert.Greater(stats.CallbackTime, TimeSpan.Zero);
+
+                var after = BerkeliumSharp.Stats;
+                Assert.Greater(after.Updates, before.Updates);
+                Assert.GreaterOrEqual(after.PaintsDelivered - before.PaintsDelivered, stats.PaintsDelivered);
+            }
+        }
+
+        [Test]
+        public void TestInputLatencyIsMeasured () {
+            var testUrl = MakeDataUrl(
+                "<html><body style=\"margin: 0; background-color: #00FF00\" " +
+                "onmousemove=\"document.body.style.backgroundColor = '#0000FF'\"></body></html>"
+            );
+
+            using (var window = new Window(Context)) {
+                window.Resize(64, 64);
+
+                int paintCount = 0;
+                window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                    paintCount += 1;
+                };
+
+                window.NavigateTo(testUrl);
+
+                long end = DateTime.UtcNow.Ticks + TimeSpan.FromSeconds(5).Ticks;
+                while (paintCount == 0) {
+                    if (DateTime.UtcNow.Ticks > end)
+                        throw new TimeoutException("Timed out while waiting for a paint");
+
+                    BerkeliumSharp.Update();
+                }
+
+                window.MouseMoved(32, 32);
+                Assert.AreEqual(1, window.Stats.InputEvents);
+
+                end = DateTime.UtcNow.Ticks + TimeSpan.FromSeconds(5).Ticks;
+                while (window.Stats.InputLatency.Count == 0) {
+                    if (DateTime.UtcNow.Ticks > end)
+                        throw new TimeoutException("Timed out while waiting for the mouse move to be painted");
+
+                    BerkeliumSharp.Update();
+                }
+
+                var latency = window.Stats.InputLatency;
+                Assert.AreEqual(1, latency.Count);
+                Assert.Greater(latency.P50, TimeSpan.Zero);
+                Assert.LessOrEqual(latency.P50, latency.P99);
+                Assert.LessOrEqual(latency.P99, latency.Max);
+                Assert.GreaterOrEqual(BerkeliumSharp.Stats.InputLatency.Count, 1);
+            }
+        }
+
+        [Test]
+        public void TestProfilerWritesChromeTrace () {
+            var testUrl = MakeDataUrl(
+                "<html><body style=\"background-color: #00FF00\">" + UnicodeText + "</body></html>"
+            );
+
+            var traceFilename = Path.Combine(Path.GetTempPath(), "TestProfilerWritesChromeTrace.json");
+
+            Profiler.Clear();
+            Profiler.Enabled = true;
+            try {
+                using (var window = new Window(Context)) {
+                    window.Resize(64, 64);
+
+                    int paintCount = 0;
+                    window.FramePainted += delegate(Window w, ref PaintFrame frame) {
+                        paintCount += 1;
+                    };
+
+                    window.NavigateTo(testUrl);
+
+                    long end = DateTime.UtcNow.Ticks + TimeSpan.FromSeconds(5).Ticks;
+                    while (paintCount == 0) {
+                        if (DateTime.UtcNow.Ticks > end)
+                            throw new TimeoutException("Timed out while waiting for a paint");
+
+                        BerkeliumSharp.Update();
+                    }
+                }
+            } finally {
+                Profiler.Enabled = false;
+            }
+
+            Profiler.WriteChromeTrace(traceFilename);
+            var trace = File.ReadAllText(traceFilename);
+            File.Delete(traceFilename);
+
+            Assert.IsTrue(trace.StartsWith("{"));
+            Assert.IsTrue(trace.Contains("\"traceEvents\":["));
+            Assert.IsTrue(trace.Contains("\"name\":\"Berkelium::update\""));
+            Assert.IsTrue(trace.Contains("\"name\":\"onPaint\""));
+        }
+
         [Test]
         public void TestClickButton () {
             var testUrl = MakeDataUrl(
@@ -337,5 +652,185 @@ namespace AutomatedTests {
                 WaitFor(chromeSendText, UnicodeText, 5);
             }
         }
+
+        [Test]
+        public void TestHostMessagesArriveTyped () {
+            var testUrl = MakeDataUrl(
+                "<html><body><script>" + HostMessage.BridgeScript + "</script><script>" +
+                "berkeliumHost.send('ready', 1.5, '" + UnicodeText + "', null);" +
+                "window.externalHost.postMessage('plain', '*');" +
+                "</script></body></html>"
+            );
+
+            var ready = new Holder<string>();
+            var plain = new Holder<string>();
+            var readyId = HostMessage.GetId("ready");
+
+            using (var window = new Window(Context))
+            using (var listener = new HostMessageListener(window)) {
+                Assert.AreEqual(readyId, listener.Register("ready", (w, message) => {
+                    Assert.AreEqual(readyId, message.Id);
+                    Assert.AreEqual(3, message.ArgumentCount);
+                    Assert.AreEqual(1.5, message.GetNumber(0));
+                    Assert.AreEqual(UnicodeText, message.GetString(1));
+                    Assert.AreEqual(HostArgumentType.Null, message.GetArgumentType(2));
+
+                    ready.Value = message.Name;
+                }));
+
+                listener.Unhandled += (w, message) => {
+                    if (message.Id == HostMessage.Plain)
+                        plain.Value = message.GetString(0);
+                };
+
+                window.NavigateTo(testUrl);
+
+                WaitFor(ready, "ready", 5);
+                WaitFor(plain, "plain", 5);
+            }
+        }
+
+        [Test]
+        public void TestScriptTemplateFormatsArguments () {
+            using (var template = new ScriptTemplate("f($0, $1, $2, $3, $4); $ $$")) {
+                Assert.AreEqual(5, template.ParameterCount);
+                Assert.AreEqual(
+                    "f(\"a\\\"b\\n\", 1.5, null, true, undefined); $ $$",
+                    template.Format("a\"b\n", 1.5, null, true)
+                );
+                Assert.AreEqual("f([1,2], 7, \"x\", undefined, undefined); $ $$", template.Format(new ScriptLiteral("[1,2]"), 7, 'x'));
+            }
+        }
+
+        [Test]
+        public void TestQueuedScriptsRunInOrder () {
+            var testUrl = MakeDataUrl("<html><body></body></html>");
+
+            var loaded = new Holder<bool>();
+            var total = new Holder<string>();
+
+            using (var window = new Window(Context))
+            using (var add = new ScriptTemplate("window.total = (window.total * 10) + $0;")) {
+                window.Load += (w) => loaded.Value = true;
+                window.HostMessages += (w, messages) => {
+                    for (int i = 0; i < messages.Count; i++)
+                        total.Value = messages[i].GetString(0);
+                };
+
+                window.NavigateTo(testUrl);
+
+                WaitFor(loaded, true, 5);
+
+                window.QueueJavascript("window.total = 0;");
+                for (int i = 1; i <= 3; i++)
+                    window.QueueJavascript(add, i);
+                window.QueueJavascript("throw new Error('ignored');");
+                window.QueueJavascript("window.externalHost.postMessage(String(window.total), '*');");
+
+                WaitFor(total, "123", 5);
+            }
+        }
+
+        [Test]
+        public void TestQueuedInputIsCoalesced () {
+            var testUrl = MakeDataUrl("<html><body><input id='t' autofocus oninput=\"window.externalHost.postMessage(this.value, '*')\"></body></html>");
+
+            var loaded = new Holder<bool>();
+            var value = new Holder<string>();
+
+            using (var window = new Window(Context)) {
+                window.Load += (w) => loaded.Value = true;
+                window.HostMessages += (w, messages) => {
+                    for (int i = 0; i < messages.Count; i++)
+                        value.Value = messages[i].GetString(0);
+                };
+
+                window.Resize(320, 240);
+                window.NavigateTo(testUrl);
+
+                WaitFor(loaded, true, 5);
+
+                window.QueueInput = true;
+                window.Focus();
+                for (int i = 0; i < 4; i++)
+                    window.MouseMoved(i, i);
+                window.MouseWheel(0, 1);
+                window.MouseWheel(0, 2);
+                window.TextEvent("ab");
+                window.TextEvent("cd");
+
+                Assert.AreEqual(9, window.InputEventsQueued);
+                Assert.AreEqual(5, window.InputEventsCoalesced);
+
+                WaitFor(value, "abcd", 5);
+            }
+        }
+
+        [Test]
+        public void TestResizesAreDebounced () {
+            using (var window = new Window(Context)) {
+                window.UseBackingStore = true;
+                window.Resize(128, 128);
+                window.FlushResize();
+
+                var store = window.BackingStore;
+                var buffer = store.Buffer;
+
+                for (int i = 1; i <= 16; i++)
+                    window.Resize(128 - i, 128 - (i * 2));
+
+                Assert.AreEqual(112, window.Width);
+                Assert.AreEqual(96, window.Height);
+                Assert.AreEqual(15, window.Stats.ResizesCoalesced);
+
+                BerkeliumSharp.Update();
+
+                Assert.AreEqual(2, window.Stats.Resizes);
+                Assert.AreEqual(112, store.Width);
+                Assert.AreEqual(96, store.Height);
+                Assert.GreaterOrEqual(store.Stride, 128 * 4);
+
+                // Shrinking the store, and growing it back, reuse its buffer.
+                window.Resize(128, 128);
+                window.FlushResize();
+                Assert.AreEqual(buffer, store.Buffer);
+            }
+        }
+
+        [Test]
+        public void TestUpdateAppliesQueuedResizes () {
+            // Run the tests with --pump-thread to cover Update on the pump thread as well.
+            using (var window = new Window(Context)) {
+                window.Resize(200, 150);
+                BerkeliumSharp.Update();
+
+                // With the pump thread running, reading the size waits for the resize Update queued for it.
+                Assert.AreEqual(200, window.Width);
+                Assert.AreEqual(150, window.Height);
+                Assert.AreEqual(1, window.Stats.Resizes);
+            }
+        }
+
+        [Test]
+        public void TestWindowPoolRecyclesWindows () {
+            using (var pool = new WindowPool(Context, 320, 240, 1, 2)) {
+                Assert.AreEqual(1, pool.IdleCount);
+
+                var first = pool.Acquire();
+                var id = first.Id;
+
+                first.Resize(100, 100);
+                pool.Release(first);
+
+                var second = pool.Acquire();
+                Assert.AreNotSame(first, second);
+                Assert.AreEqual(id, second.Id);
+                Assert.AreEqual(320, second.Width);
+                Assert.AreEqual(240, second.Height);
+
+                pool.Release(second);
+                Assert.LessOrEqual(pool.IdleCount, pool.HighWatermark);
+            }
+        }
     }
 }
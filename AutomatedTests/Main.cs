@@ -33,7 +33,7 @@ namespace AutomatedTests {
 
             Directory.CreateDirectory(dataPath);
 
-            BerkeliumSharp.Init(dataPath);
+            BerkeliumSharp.Init(dataPath, Environment.CommandLine.Contains("--pump-thread"));
 
             RunTestFixture<BasicTests>(ref exitCode);
             RunTestFixture<ProtocolHandlerTests>(ref exitCode);
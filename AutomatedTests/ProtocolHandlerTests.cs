@@ -64,5 +64,153 @@ namespace AutomatedTests {
                 WaitFor(filename, "test/two.html", 5);
             }
         }
+
+        [Test]
+        public void TestCachedResponseSkipsHandler () {
+            var filename = new Holder<string>();
+            int openCount = 0;
+
+            Func<string, Stream> openFile = (fn) => {
+                openCount += 1;
+                return FilenameProtocolHandler(fn);
+            };
+
+            using (var protocolHandler = new FileProtocolHandler(Context, "cached", openFile, (fn) => "text/html"))
+            using (var window = new Window(Context)) {
+                protocolHandler.CacheByteBudget = 1024 * 1024;
+
+                window.ChromeSend += (w, msg, args) => {
+                    if (msg == "filename")
+                        filename.Value = args[0];
+                };
+
+                window.NavigateTo("cached://test/one.html");
+                WaitFor(filename, "test/one.html", 5);
+
+                filename.Value = null;
+                window.Refresh();
+                WaitFor(filename, "test/one.html", 5);
+
+                Assert.AreEqual(1, openCount);
+                Assert.AreEqual(1, protocolHandler.CacheHits);
+                Assert.Greater(protocolHandler.CachedBytes, 0);
+
+                Assert.IsTrue(protocolHandler.InvalidateCachedResponse("cached://test/one.html"));
+                Assert.AreEqual(0, protocolHandler.CachedBytes);
+            }
+        }
+
+        [Test]
+        public void TestSlowHandlerRunsOnWorkerThread () {
+            int testThreadId = System.Threading.Thread.CurrentThread.ManagedThreadId;
+            int openThreadId = testThreadId;
+            bool succeeded = false;
+
+            Func<string, Stream> openFile = (fn) => {
+                openThreadId = System.Threading.Thread.CurrentThread.ManagedThreadId;
+                System.Threading.Thread.Sleep(250);
+                return FilenameProtocolHandler(fn);
+            };
+
+            using (var completed = new System.Threading.ManualResetEvent(false))
+            using (var protocolHandler = new FileProtocolHandler(Context, "slow", openFile, (fn) => "text/html")) {
+                protocolHandler.BeginRequest("slow://test/one.html", new string[0], (response) => {
+                    succeeded = (response != null) && response.Succeeded;
+                    if (response != null)
+                        response.Dispose();
+                    completed.Set();
+                });
+
+                Assert.IsTrue(completed.WaitOne(5000));
+            }
+
+            Assert.IsTrue(succeeded);
+            Assert.AreNotEqual(testThreadId, openThreadId);
+        }
+
+        [Test]
+        public void TestRangeRequestReturnsPartialContent () {
+            var result = new Holder<string>();
+
+            Func<string, Stream> openFile = (fn) => {
+                if (fn == "test/data.txt")
+                    return new MemoryStream(Encoding.ASCII.GetBytes("0123456789"));
+
+                return new MemoryStream(Encoding.UTF8.GetBytes(
+                    "<body><script type='text/javascript'>" +
+                    "var xhr = new XMLHttpRequest(); xhr.open('GET', 'data.txt', false); " +
+                    "xhr.setRequestHeader('Range', 'bytes=2-4'); xhr.send(); " +
+                    "chrome.send('result', [xhr.status + ':' + xhr.responseText]);" +
+                    "</script></body>"
+                ));
+            };
+
+            using (var protocolHandler = new FileProtocolHandler(Context, "ranged", openFile))
+            using (var window = new Window(Context)) {
+                window.ChromeSend += (w, msg, args) => {
+                    if (msg == "result")
+                        result.Value = args[0];
+                };
+
+                window.NavigateTo("ranged://test/page.html");
+                WaitFor(result, "206:234", 5);
+            }
+        }
+
+        [Test]
+        public void TestAssetBundleProtocolHandler () {
+            var filename = new Holder<string>();
+            var bundleFilename = Path.GetTempFileName();
+
+            try {
+                var writer = new AssetBundleWriter();
+                writer.Add("test/one.html", ((MemoryStream)FilenameProtocolHandler("test/one.html")).ToArray());
+                writer.Add("test/two.html", ((MemoryStream)FilenameProtocolHandler("test/two.html")).ToArray());
+                writer.Save(bundleFilename);
+
+                using (var protocolHandler = new AssetBundleProtocolHandler(Context, "bundle", bundleFilename))
+                using (var window = new Window(Context)) {
+                    Assert.AreEqual(2, protocolHandler.EntryCount);
+
+                    window.ChromeSend += (w, msg, args) => {
+                        if (msg == "filename")
+                            filename.Value = args[0];
+                    };
+
+                    window.NavigateTo("bundle://test/two.html");
+                    WaitFor(filename, "test/two.html", 5);
+                }
+            } finally {
+                File.Delete(bundleFilename);
+            }
+        }
+
+        [Test]
+        public void TestResponseHeadersEncoding () {
+            var extraHeaders = new HeaderBlock("Cache-Control: no-transform", "X-Served-By: tests");
+
+            var headers = new ResponseHeaders(200) {
+                ContentType = "text/html",
+                Charset = "utf-8",
+                ContentLength = 1234,
+                ETag = "\"abc\"",
+                LastModified = new DateTime(1994, 11, 6, 8, 49, 37, DateTimeKind.Utc)
+            };
+            headers.Add("X-Extra: 1");
+            headers.Add(extraHeaders);
+
+            Assert.AreEqual(new[] {
+                "HTTP/1.1 200 OK",
+                "Content-Type: text/html; charset=utf-8",
+                "Content-Length: 1234",
+                "ETag: \"abc\"",
+                "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT",
+                "X-Extra: 1",
+                "Cache-Control: no-transform",
+                "X-Served-By: tests"
+            }, headers.ToArray());
+
+            Assert.AreEqual("HTTP/1.1 404 Not Found", new ResponseHeaders(404).ToArray()[0]);
+        }
     }
 }
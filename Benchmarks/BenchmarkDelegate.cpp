@@ -0,0 +1,272 @@
+// BenchmarkDelegate.cpp : see BenchmarkDelegate.h
+
+#include "BenchmarkDelegate.h"
+
+#include "NativeStrings.h"
+
+#include <string.h>
+
+#include <string>
+
+using namespace Berkelium::Managed;
+
+namespace Berkelium {
+  namespace Benchmarks {
+
+    namespace {
+      const char ResponseHeaders[] = "HTTP/1.1 200 OK\0Content-Type: text/javascript\0Cache-Control: max-age=3600\0";
+      const size_t ResponseBodyLength = 4096;
+
+      const double ZeroAllocationBudget = 0.01;
+      const double URLStringAllocationBudget = 1;
+
+      // The same as URLStringHelper and WideStringHelper.
+      const size_t URLInlineCapacity = 256;
+      const size_t WideInlineCapacity = 64;
+    }
+
+    BenchmarkDelegate::BenchmarkDelegate (FakeEngine & engine, size_t cacheByteBudget)
+      : mWindow(engine.window())
+      , mCache(new NativeResponseCache())
+      , mChecksum(0)
+      , mMalformedMessages(0)
+      , mCoalescedInput(0)
+      // Buffers only grow, so these paths should allocate next to nothing once warmed up; the
+      //  budgets leave room for the odd update that's busier than any before it.
+      , Paints("onPaint", ZeroAllocationBudget)
+      , WidgetPaints("onWidgetPaint", ZeroAllocationBudget)
+      , HostMessages("onExternalHost", ZeroAllocationBudget)
+      // A hit copies out the body and the headers, and looking it up builds the key.
+      , ProtocolRequests("HandleRequest", 3)
+      , InputEvents("queueInput", ZeroAllocationBudget)
+      , Resizes("resize", ZeroAllocationBudget)
+      // Only URLs too long for the inline buffer, or with characters that need escaping, build a string.
+      , URLStrings("URLStringHelper", URLStringAllocationBudget)
+      , WideStrings("WideStringHelper", ZeroAllocationBudget)
+      , Flushes("flush", ZeroAllocationBudget) {
+
+      mWindow->setDelegate(this);
+      engine.setProtocolHandler(this);
+
+      const FakeEngineSettings & settings = engine.settings();
+      mStore.resize(settings.Width, settings.Height);
+      mCache->setByteBudget(cacheByteBudget);
+
+      mInputTargets.push_back(mWindow);
+      for (int i = 0; i < engine.widgetCount(); i++) {
+        WidgetState * state = new WidgetState();
+        state->Native = engine.widget(i);
+        state->Store.resize(settings.WidgetWidth, settings.WidgetHeight);
+        mWidgets.push_back(state);
+        mInputTargets.push_back(state->Native);
+      }
+    }
+
+    BenchmarkDelegate::~BenchmarkDelegate () {
+      for (size_t i = 0; i < mWidgets.size(); i++)
+        delete mWidgets[i];
+      mCache->release();
+    }
+
+    // The wrapper looks widgets up in a handle table; a short linear search costs about the same.
+    BenchmarkDelegate::WidgetState * BenchmarkDelegate::findWidget (::Berkelium::Widget * widget) {
+      for (size_t i = 0; i < mWidgets.size(); i++) {
+        if (mWidgets[i]->Native == widget)
+          return mWidgets[i];
+      }
+      return 0;
+    }
+
+    void BenchmarkDelegate::onPaint (::Berkelium::Window * win, const unsigned char * sourceBuffer, const ::Berkelium::Rect & sourceBufferRect,
+      size_t numCopyRects, const ::Berkelium::Rect * copyRects, int dx, int dy, const ::Berkelium::Rect & scrollRect) {
+      ScopedSample sample (Paints);
+
+      mStore.applyPaint(sourceBuffer, sourceBufferRect, numCopyRects, copyRects, dx, dy, scrollRect);
+      mPendingPaint.add(numCopyRects, copyRects, dx, dy, scrollRect);
+    }
+
+    void BenchmarkDelegate::onWidgetPaint (::Berkelium::Window * win, ::Berkelium::Widget * wid, const unsigned char * sourceBuffer, const ::Berkelium::Rect & sourceBufferRect,
+      size_t numCopyRects, const ::Berkelium::Rect * copyRects, int dx, int dy, const ::Berkelium::Rect & scrollRect) {
+      ScopedSample sample (WidgetPaints);
+
+      WidgetState * state = findWidget(wid);
+      if (!state)
+        return;
+
+      state->Store.applyPaint(sourceBuffer, sourceBufferRect, numCopyRects, copyRects, dx, dy, scrollRect);
+      state->PendingPaint.add(numCopyRects, copyRects, dx, dy, scrollRect);
+    }
+
+    void BenchmarkDelegate::onExternalHost (::Berkelium::Window * win, ::Berkelium::WideString message, ::Berkelium::URLString origin, ::Berkelium::URLString target) {
+      ScopedSample sample (HostMessages);
+
+      if (!mPendingMessages.add(message.data(), message.length(), origin.data(), origin.length(), target.data(), target.length()))
+        mMalformedMessages += 1;
+    }
+
+    bool BenchmarkDelegate::HandleRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL & responseBody, HGLOBAL & responseHeaders) {
+      ScopedSample sample (ProtocolRequests);
+
+      bool conditional = IsConditionalRequest(requestHeaders, requestHeadersLength);
+
+      bool succeeded;
+      if (!conditional && mCache->serve(url, urlLength, responseBody, responseHeaders, succeeded))
+        return succeeded;
+
+      return handleUncachedRequest(url, urlLength, !conditional, responseBody, responseHeaders);
+    }
+
+    // Stands in for the trip through ProtocolHandler: the response is made up, but it's cached the same way.
+    bool BenchmarkDelegate::handleUncachedRequest (const wchar_t * url, size_t urlLength, bool cache, HGLOBAL & responseBody, HGLOBAL & responseHeaders) {
+      NativeCachedResponse * response = new NativeCachedResponse(url, urlLength, ResponseHeaders, sizeof(ResponseHeaders), true);
+
+      unsigned char chunk[512];
+      for (size_t i = 0; i < sizeof(chunk); i++)
+        chunk[i] = (unsigned char)(urlLength + i);
+      for (size_t written = 0; written < ResponseBodyLength; written += sizeof(chunk))
+        response->appendBody(chunk, sizeof(chunk));
+
+      responseBody = response->copyBody();
+      responseHeaders = response->copyHeaders();
+
+      if (cache)
+        mCache->insert(response);
+      response->release();
+      return true;
+    }
+
+    void BenchmarkDelegate::queueInput (int kind, int target, int a, int b, int c, int d) {
+      ScopedSample sample (InputEvents);
+
+      if (mInput.push(kind, target, a, b, c, d))
+        mCoalescedInput += 1;
+    }
+
+    void BenchmarkDelegate::queueText (int target, const wchar_t * text, size_t length) {
+      ScopedSample sample (InputEvents);
+
+      if (mInput.pushText(target, text, length))
+        mCoalescedInput += 1;
+    }
+
+    void BenchmarkDelegate::resize (int width, int height) {
+      ScopedSample sample (Resizes);
+
+      mStore.resize(width, height);
+      mChecksum += mStore.stride();
+    }
+
+    void BenchmarkDelegate::marshalURL (const wchar_t * url, size_t length) {
+      ScopedSample sample (URLStrings);
+
+      char inlineBuffer[URLInlineCapacity];
+      std::string encoded;
+      char * output = inlineBuffer;
+      if (length > URLInlineCapacity) {
+        encoded.resize(length);
+        output = &encoded[0];
+      }
+
+      const char * data = output;
+      if (NarrowAscii(url, length, output) != length) {
+        encoded.clear();
+        AppendPercentEncodedUtf8(url, length, encoded);
+        data = encoded.data();
+        length = encoded.length();
+      }
+
+      mChecksum += length + (length ? (unsigned char)data[length - 1] : 0);
+    }
+
+    void BenchmarkDelegate::marshalWide (const wchar_t * text, size_t length) {
+      ScopedSample sample (WideStrings);
+
+      // Longer strings are pinned where they are, which natively is just passing the pointer along.
+      wchar_t inlineBuffer[WideInlineCapacity];
+      const wchar_t * data = text;
+      if (length <= WideInlineCapacity) {
+        memcpy(inlineBuffer, text, length * sizeof(wchar_t));
+        data = inlineBuffer;
+      }
+
+      mChecksum += length + (length ? (unsigned int)data[length - 1] : 0);
+    }
+
+    // What the window does once an update is over: each accumulated paint goes out as one merged paint,
+    //  the host message batch is swapped out and read, and the queued input is sent.
+    void BenchmarkDelegate::flush () {
+      ScopedSample sample (Flushes);
+
+      if (mPendingPaint.isPending()) {
+        mPendingPaint.clip(mStore.width(), mStore.height());
+        mChecksum += (unsigned long long)mPendingPaint.dirtyRect().mWidth * mPendingPaint.dirtyRect().mHeight;
+        mPendingPaint.reset();
+        mStore.clearDirty();
+      }
+
+      for (size_t i = 0; i < mWidgets.size(); i++) {
+        WidgetState * state = mWidgets[i];
+        if (!state->PendingPaint.isPending())
+          continue;
+
+        state->PendingPaint.clip(state->Store.width(), state->Store.height());
+        mChecksum += (unsigned long long)state->PendingPaint.dirtyRect().mWidth * state->PendingPaint.dirtyRect().mHeight;
+        state->PendingPaint.reset();
+        state->Store.clearDirty();
+      }
+
+      mFlushingMessages.swap(mPendingMessages);
+      for (size_t i = 0; i < mFlushingMessages.count(); i++) {
+        const NativeHostMessage & message = mFlushingMessages.message(i);
+        mChecksum += message.Id + message.ArgumentCount;
+        for (size_t j = 0; j < message.ArgumentCount; j++)
+          mChecksum += (unsigned long long)mFlushingMessages.argument(message, j).Length;
+      }
+      mFlushingMessages.clear();
+
+      mFlushingInput.swap(mInput);
+      for (size_t i = 0, count = mFlushingInput.count(); i < count; i++) {
+        const NativeInputEvent & evt = mFlushingInput.event(i);
+        ::Berkelium::InputTarget * target = mInputTargets[evt.Target < (int)mInputTargets.size() ? evt.Target : 0];
+
+        switch (evt.Kind) {
+          case InputMouseMoved:
+            target->mouseMoved(evt.A, evt.B);
+            break;
+          case InputMouseWheel:
+            target->mouseWheel(evt.A, evt.B);
+            break;
+          case InputMouseButton:
+            target->mouseButton((unsigned)evt.A, evt.B != 0);
+            break;
+          case InputKey:
+            target->keyEvent(evt.A != 0, evt.B, evt.C, evt.D);
+            break;
+          case InputText:
+            target->textEvent(mFlushingInput.text(evt), evt.TextLength);
+            break;
+          case InputFocus:
+            target->focus();
+            break;
+          case InputUnfocus:
+            target->unfocus();
+            break;
+        }
+      }
+      mFlushingInput.clear();
+    }
+
+    void BenchmarkDelegate::resetStats () {
+      Paints.reset();
+      WidgetPaints.reset();
+      HostMessages.reset();
+      ProtocolRequests.reset();
+      InputEvents.reset();
+      Resizes.reset();
+      URLStrings.reset();
+      WideStrings.reset();
+      Flushes.reset();
+      mCoalescedInput = 0;
+    }
+
+  }}
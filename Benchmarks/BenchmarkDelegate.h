@@ -0,0 +1,81 @@
+// BenchmarkDelegate.h : the native half of WindowDelegateWrapper and NativeProtocolHandler, without the managed hops
+
+#pragma once
+
+#include "FakeEngine.h"
+#include "BenchmarkStats.h"
+
+#include "NativeBackingStore.h"
+#include "NativeHostMessages.h"
+#include "NativeInputQueue.h"
+#include "NativeResponseCache.h"
+
+#include <vector>
+
+namespace Berkelium {
+  namespace Benchmarks {
+
+    // Does per callback what the real wrapper does before it hands off to managed code: paints go into a
+    //  backing store and a paint accumulator, host messages into a batch, protocol requests through the
+    //  response cache, and input through the input queue. flush() stands in for the end of an update.
+    class BenchmarkDelegate : public ::Berkelium::WindowDelegate, public FakeProtocolHandler {
+      struct WidgetState {
+        ::Berkelium::Widget * Native;
+        Berkelium::Managed::NativeBackingStore Store;
+        Berkelium::Managed::NativePaintAccumulator PendingPaint;
+      };
+
+      ::Berkelium::Window * mWindow;
+      Berkelium::Managed::NativeBackingStore mStore;
+      Berkelium::Managed::NativePaintAccumulator mPendingPaint;
+      std::vector<WidgetState *> mWidgets;
+      Berkelium::Managed::NativeHostMessageBatch mPendingMessages, mFlushingMessages;
+      Berkelium::Managed::NativeResponseCache * mCache;
+      Berkelium::Managed::NativeInputQueue mInput, mFlushingInput;
+      std::vector< ::Berkelium::InputTarget *> mInputTargets;
+
+      // Results are folded in here so that none of the work can be optimized away.
+      unsigned long long mChecksum;
+      long long mMalformedMessages, mCoalescedInput;
+
+      BenchmarkDelegate (const BenchmarkDelegate &);
+      BenchmarkDelegate & operator= (const BenchmarkDelegate &);
+
+      WidgetState * findWidget (::Berkelium::Widget * widget);
+      bool handleUncachedRequest (const wchar_t * url, size_t urlLength, bool cache, HGLOBAL & responseBody, HGLOBAL & responseHeaders);
+
+    public:
+      LatencyRecorder Paints, WidgetPaints, HostMessages, ProtocolRequests, InputEvents, Resizes, URLStrings, WideStrings, Flushes;
+
+      // Becomes the delegate of the engine's window and its protocol handler.
+      BenchmarkDelegate (FakeEngine & engine, size_t cacheByteBudget);
+      ~BenchmarkDelegate ();
+
+      virtual void onPaint (::Berkelium::Window * win, const unsigned char * sourceBuffer, const ::Berkelium::Rect & sourceBufferRect,
+        size_t numCopyRects, const ::Berkelium::Rect * copyRects, int dx, int dy, const ::Berkelium::Rect & scrollRect);
+      virtual void onWidgetPaint (::Berkelium::Window * win, ::Berkelium::Widget * wid, const unsigned char * sourceBuffer, const ::Berkelium::Rect & sourceBufferRect,
+        size_t numCopyRects, const ::Berkelium::Rect * copyRects, int dx, int dy, const ::Berkelium::Rect & scrollRect);
+      virtual void onExternalHost (::Berkelium::Window * win, ::Berkelium::WideString message, ::Berkelium::URLString origin, ::Berkelium::URLString target);
+
+      virtual bool HandleRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL & responseBody, HGLOBAL & responseHeaders);
+
+      // Queues an input event for the window (target 0) or a widget (its index plus one), as Window.QueueInput does.
+      void queueInput (int kind, int target, int a, int b, int c, int d);
+      void queueText (int target, const wchar_t * text, size_t length);
+      // Resizes the window's backing store, as applying a queued Window.Resize does.
+      void resize (int width, int height);
+      // Converts a managed string's characters the way URLStringHelper and WideStringHelper do on the way into
+      //  Berkelium. The IDN step for non-ASCII hosts goes through the BCL, so it isn't part of this.
+      void marshalURL (const wchar_t * url, size_t length);
+      void marshalWide (const wchar_t * text, size_t length);
+
+      void flush ();
+      void resetStats ();
+
+      unsigned long long checksum () const { return mChecksum; }
+      long long malformedMessages () const { return mMalformedMessages; }
+      long long coalescedInput () const { return mCoalescedInput; }
+      Berkelium::Managed::NativeResponseCache & cache () { return *mCache; }
+    };
+
+  }}
@@ -0,0 +1,125 @@
+// BenchmarkStats.cpp : see BenchmarkStats.h
+
+#include "BenchmarkStats.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+namespace {
+  std::atomic<unsigned long long> Allocations (0);
+
+  void * CountedAllocate (size_t size) {
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    void * result = malloc(size ? size : 1);
+    if (!result)
+      throw std::bad_alloc();
+    return result;
+  }
+}
+
+void * operator new (size_t size) {
+  return CountedAllocate(size);
+}
+
+void * operator new[] (size_t size) {
+  return CountedAllocate(size);
+}
+
+void operator delete (void * memory) noexcept {
+  free(memory);
+}
+
+void operator delete[] (void * memory) noexcept {
+  free(memory);
+}
+
+void operator delete (void * memory, size_t) noexcept {
+  free(memory);
+}
+
+void operator delete[] (void * memory, size_t) noexcept {
+  free(memory);
+}
+
+#ifndef _WIN32
+HLOCAL LocalAlloc (UINT flags, SIZE_T bytes) {
+  Allocations.fetch_add(1, std::memory_order_relaxed);
+  return malloc(bytes ? bytes : 1);
+}
+
+HLOCAL LocalFree (HLOCAL memory) {
+  free(memory);
+  return 0;
+}
+#endif
+
+namespace Berkelium {
+  namespace Benchmarks {
+
+    unsigned long long AllocationCount () {
+      return Allocations.load(std::memory_order_relaxed);
+    }
+
+    unsigned long long Now () {
+      return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+      ).count();
+    }
+
+    LatencyRecorder::LatencyRecorder (const char * name, double allocationBudget)
+      : mName(name)
+      , mAllocationBudget(allocationBudget)
+      , mTotal(0)
+      , mAllocations(0)
+      , mSorted(true) {
+    }
+
+    void LatencyRecorder::reserve (size_t count) {
+      mSamples.reserve(count);
+    }
+
+    void LatencyRecorder::reset () {
+      mSamples.clear();
+      mTotal = 0;
+      mAllocations = 0;
+      mSorted = true;
+    }
+
+    void LatencyRecorder::add (unsigned long long nanoseconds, unsigned long long allocations) {
+      mSamples.push_back(nanoseconds);
+      mTotal += nanoseconds;
+      mAllocations += allocations;
+      mSorted = false;
+    }
+
+    double LatencyRecorder::allocationsPerEvent () const {
+      return mSamples.empty() ? 0 : (double)mAllocations / mSamples.size();
+    }
+
+    void LatencyRecorder::sort () const {
+      if (mSorted)
+        return;
+
+      std::sort(mSamples.begin(), mSamples.end());
+      mSorted = true;
+    }
+
+    unsigned long long LatencyRecorder::percentile (double percentile) const {
+      if (mSamples.empty())
+        return 0;
+
+      sort();
+      // Nearest rank.
+      size_t rank = (size_t)((percentile / 100.0) * mSamples.size() + 0.5);
+      if (rank > 0)
+        rank -= 1;
+      if (rank >= mSamples.size())
+        rank = mSamples.size() - 1;
+      return mSamples[rank];
+    }
+
+  }}
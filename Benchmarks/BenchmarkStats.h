@@ -0,0 +1,70 @@
+// BenchmarkStats.h : latency samples and allocation counts for each kind of callback
+
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+namespace Berkelium {
+  namespace Benchmarks {
+
+    // Every operator new and LocalAlloc in the process since it started.
+    unsigned long long AllocationCount ();
+
+    // Nanoseconds from a monotonic clock.
+    unsigned long long Now ();
+
+    class LatencyRecorder {
+      const char * mName;
+      // A regression check fails if a callback allocates more than this, on average, once warmed up.
+      double mAllocationBudget;
+      // Sorted lazily, the first time a percentile is asked for.
+      mutable std::vector<unsigned long long> mSamples;
+      unsigned long long mTotal, mAllocations;
+      mutable bool mSorted;
+
+      void sort () const;
+
+    public:
+      LatencyRecorder (const char * name, double allocationBudget);
+
+      const char * name () const { return mName; }
+      double allocationBudget () const { return mAllocationBudget; }
+
+      // Recording doesn't allocate as long as the samples fit.
+      void reserve (size_t count);
+      void reset ();
+
+      void add (unsigned long long nanoseconds, unsigned long long allocations);
+
+      size_t count () const { return mSamples.size(); }
+      unsigned long long totalNanoseconds () const { return mTotal; }
+      double allocationsPerEvent () const;
+      // percentile is between 0 and 100.
+      unsigned long long percentile (double percentile) const;
+    };
+
+    // Times the enclosing scope and charges it, with whatever it allocated, to a recorder.
+    class ScopedSample {
+      LatencyRecorder & mRecorder;
+      // The clock is read last, so counting allocations isn't part of the sample.
+      unsigned long long mAllocations, mStart;
+
+      ScopedSample (const ScopedSample &);
+      ScopedSample & operator= (const ScopedSample &);
+
+    public:
+      explicit ScopedSample (LatencyRecorder & recorder)
+        : mRecorder(recorder)
+        , mAllocations(AllocationCount())
+        , mStart(Now()) {
+      }
+
+      ~ScopedSample () {
+        unsigned long long elapsed = Now() - mStart;
+        mRecorder.add(elapsed, AllocationCount() - mAllocations);
+      }
+    };
+
+  }}
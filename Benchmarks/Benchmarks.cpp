@@ -0,0 +1,302 @@
+// Benchmarks.cpp : drives the native dispatch layer with FakeEngine and reports how each callback performs
+//
+// Usage: BerkeliumBenchmarks [--updates N] [--warmup N] [--paints N] [--copy-rects N] [--scroll-every N]
+//          [--widgets N] [--widget-paints N] [--messages N] [--requests N] [--urls N] [--conditional-every N]
+//          [--input N] [--resize-every N] [--strings N] [--cache-bytes N] [--width N] [--height N] [--seed N] [--quick] [--check]
+//
+// Rates are per update. With --check, the exit code is 1 if any callback allocates more per event than its
+//  budget once warmed up, so allocation regressions fail the build instead of shipping.
+
+#include "BenchmarkDelegate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <string>
+
+using namespace Berkelium::Benchmarks;
+using namespace Berkelium::Managed;
+
+namespace {
+  struct Options {
+    FakeEngineSettings Engine;
+    int Updates, Warmup;
+    int InputEventsPerUpdate;
+    int ResizeEvery;
+    int StringsPerUpdate;
+    size_t CacheByteBudget;
+    bool Check;
+
+    Options ()
+      : Updates(20000)
+      , Warmup(500)
+      , InputEventsPerUpdate(16)
+      , ResizeEvery(4)
+      , StringsPerUpdate(8)
+      , CacheByteBudget(8 * 1024 * 1024)
+      , Check(false) {
+    }
+  };
+
+  bool ParseOptions (int argc, char ** argv, Options & options) {
+    struct IntOption {
+      const char * Name;
+      int * Value;
+    } intOptions[] = {
+      { "--updates", &options.Updates },
+      { "--warmup", &options.Warmup },
+      { "--paints", &options.Engine.PaintsPerUpdate },
+      { "--copy-rects", &options.Engine.CopyRectsPerPaint },
+      { "--scroll-every", &options.Engine.ScrollEvery },
+      { "--widgets", &options.Engine.Widgets },
+      { "--widget-paints", &options.Engine.WidgetPaintsPerUpdate },
+      { "--messages", &options.Engine.HostMessagesPerUpdate },
+      { "--requests", &options.Engine.ProtocolRequestsPerUpdate },
+      { "--urls", &options.Engine.DistinctUrls },
+      { "--conditional-every", &options.Engine.ConditionalRequestEvery },
+      { "--input", &options.InputEventsPerUpdate },
+      { "--resize-every", &options.ResizeEvery },
+      { "--strings", &options.StringsPerUpdate },
+      { "--width", &options.Engine.Width },
+      { "--height", &options.Engine.Height },
+    };
+
+    for (int i = 1; i < argc; i++) {
+      const char * arg = argv[i];
+
+      if (strcmp(arg, "--quick") == 0) {
+        options.Updates = 1000;
+        options.Warmup = 100;
+        continue;
+      } else if (strcmp(arg, "--check") == 0) {
+        options.Check = true;
+        continue;
+      } else if (i + 1 >= argc) {
+        fprintf(stderr, "Unknown option or missing value: %s\n", arg);
+        return false;
+      }
+
+      const char * value = argv[++i];
+      bool found = false;
+
+      if (strcmp(arg, "--cache-bytes") == 0) {
+        options.CacheByteBudget = (size_t)strtoull(value, 0, 10);
+        found = true;
+      } else if (strcmp(arg, "--seed") == 0) {
+        options.Engine.Seed = (unsigned int)strtoul(value, 0, 10);
+        found = true;
+      }
+
+      for (size_t j = 0; !found && (j < sizeof(intOptions) / sizeof(intOptions[0])); j++) {
+        if (strcmp(arg, intOptions[j].Name) == 0) {
+          *intOptions[j].Value = atoi(value);
+          found = true;
+        }
+      }
+
+      if (!found) {
+        fprintf(stderr, "Unknown option: %s\n", arg);
+        return false;
+      }
+    }
+
+    if ((options.Updates <= 0) || (options.Warmup < 0) || (options.Engine.Width <= 0) || (options.Engine.Height <= 0)) {
+      fprintf(stderr, "--updates, --width and --height must be positive\n");
+      return false;
+    }
+
+    return true;
+  }
+
+  // Input the way a game's UI produces it: mostly mouse moves and wheel ticks, with typing and clicks mixed in.
+  void GenerateInput (FakeEngine & engine, BenchmarkDelegate & delegate, int count) {
+    static const wchar_t Typed[] = L"the quick brown fox";
+    int targets = engine.widgetCount() + 1;
+
+    for (int i = 0; i < count; i++) {
+      unsigned int roll = engine.random();
+      int target = (roll % 8 == 0) ? (int)((roll >> 3) % (unsigned int)targets) : 0;
+      int x = (int)((roll >> 8) % 1024), y = (int)((roll >> 18) % 768);
+
+      switch ((roll >> 4) % 16) {
+        case 0:
+          delegate.queueInput(InputMouseButton, target, 0, 1, 0, 0);
+          delegate.queueInput(InputMouseButton, target, 0, 0, 0, 0);
+          break;
+        case 1:
+        case 2:
+          delegate.queueInput(InputMouseWheel, target, 0, -120, 0, 0);
+          break;
+        case 3:
+        case 4:
+          delegate.queueText(target, Typed + (roll % 18), 1);
+          break;
+        case 5:
+          delegate.queueInput(InputKey, target, 1, 0, 0x41, 0x1E);
+          break;
+        default:
+          delegate.queueInput(InputMouseMoved, target, x, y, 0, 0);
+          break;
+      }
+    }
+  }
+
+  // A drag along the window's bottom-right corner: it shrinks and grows back by up to 64 pixels each way, as the
+  //  window would when the queued size is applied at the start of each update.
+  void Resize (const Options & options, BenchmarkDelegate & delegate, int update) {
+    if ((options.ResizeEvery <= 0) || (update % options.ResizeEvery != 0))
+      return;
+
+    int step = (update / options.ResizeEvery) % 128;
+    int offset = (step < 64) ? step : 127 - step;
+    delegate.resize(options.Engine.Width - offset, options.Engine.Height - (offset / 2));
+  }
+
+  // Half URLs, as navigation and protocol requests pass them, and half JavaScript and other text. Most of both
+  //  are short and ASCII; the rest are long enough to leave the inline buffers or need escaping.
+  void MarshalStrings (FakeEngine & engine, BenchmarkDelegate & delegate, int count) {
+    static const wchar_t * const URLs[] = {
+      L"http://localhost/index.html",
+      L"berkelium://assets/ui/inventory.js?v=42",
+      L"http://example.com/search?q=caf\u00E9",
+      L"http://example.com/\u30B2\u30FC\u30E0/\U0001F3AE",
+    };
+    static const wchar_t * const Text[] = {
+      L"updateHealth(87);",
+      L"document.getElementById('chat').appendChild(line);",
+      L"Caf\u00E9 \u30B2\u30FC\u30E0",
+    };
+    static std::wstring longURL, longText;
+    if (longURL.empty()) {
+      longURL = L"http://localhost/";
+      while (longURL.length() <= 300)
+        longURL += L"query=state&";
+      longText.assign(1024, L'x');
+    }
+
+    for (int i = 0; i < count; i++) {
+      unsigned int roll = engine.random();
+
+      if (roll & 1) {
+        unsigned int pick = (roll >> 1) % 16;
+        if (pick == 0)
+          delegate.marshalURL(longURL.data(), longURL.length());
+        else {
+          const wchar_t * url = URLs[pick < 12 ? pick % 2 : 2 + pick % 2];
+          delegate.marshalURL(url, wcslen(url));
+        }
+      } else {
+        unsigned int pick = (roll >> 1) % 8;
+        if (pick == 0)
+          delegate.marshalWide(longText.data(), longText.length());
+        else {
+          const wchar_t * text = Text[pick % 3];
+          delegate.marshalWide(text, wcslen(text));
+        }
+      }
+    }
+  }
+
+  void Report (const LatencyRecorder & recorder) {
+    if (recorder.count() == 0) {
+      printf("%-16s %10s\n", recorder.name(), "-");
+      return;
+    }
+
+    printf(
+      "%-16s %10zu %12.0f %9llu %9llu %9llu %9llu %10.4f\n",
+      recorder.name(), recorder.count(),
+      recorder.count() / (recorder.totalNanoseconds() / 1e9),
+      recorder.percentile(50), recorder.percentile(90), recorder.percentile(99), recorder.percentile(100),
+      recorder.allocationsPerEvent()
+    );
+  }
+
+  bool CheckBudget (const LatencyRecorder & recorder) {
+    if (recorder.allocationsPerEvent() <= recorder.allocationBudget())
+      return true;
+
+    fprintf(stderr, "%s: %.4f allocations per event, over its budget of %.4f\n", recorder.name(), recorder.allocationsPerEvent(), recorder.allocationBudget());
+    return false;
+  }
+}
+
+int main (int argc, char ** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options))
+    return 2;
+
+  FakeEngine engine (options.Engine);
+  BenchmarkDelegate delegate (engine, options.CacheByteBudget);
+
+  // Warming up grows every buffer to its working size and fills the cache, so that what's measured is the steady state.
+  for (int i = 0; i < options.Warmup; i++) {
+    Resize(options, delegate, i);
+    engine.update();
+    GenerateInput(engine, delegate, options.InputEventsPerUpdate);
+    MarshalStrings(engine, delegate, options.StringsPerUpdate);
+    delegate.flush();
+  }
+
+  delegate.resetStats();
+
+  size_t expected = (size_t)options.Updates;
+  delegate.Paints.reserve(expected * (options.Engine.PaintsPerUpdate > 0 ? options.Engine.PaintsPerUpdate : 0));
+  delegate.WidgetPaints.reserve(expected * (options.Engine.WidgetPaintsPerUpdate > 0 ? options.Engine.WidgetPaintsPerUpdate : 0));
+  delegate.HostMessages.reserve(expected * (options.Engine.HostMessagesPerUpdate > 0 ? options.Engine.HostMessagesPerUpdate : 0));
+  delegate.ProtocolRequests.reserve(expected * (options.Engine.ProtocolRequestsPerUpdate > 0 ? options.Engine.ProtocolRequestsPerUpdate : 0));
+  // Clicks queue two events.
+  delegate.InputEvents.reserve(expected * (options.InputEventsPerUpdate > 0 ? options.InputEventsPerUpdate : 0) * 2);
+  delegate.Resizes.reserve(options.ResizeEvery > 0 ? expected / options.ResizeEvery + 1 : 0);
+  size_t strings = expected * (options.StringsPerUpdate > 0 ? options.StringsPerUpdate : 0);
+  delegate.URLStrings.reserve(strings);
+  delegate.WideStrings.reserve(strings);
+  delegate.Flushes.reserve(expected);
+
+  unsigned long long start = Now();
+  for (int i = 0; i < options.Updates; i++) {
+    Resize(options, delegate, i);
+    engine.update();
+    GenerateInput(engine, delegate, options.InputEventsPerUpdate);
+    MarshalStrings(engine, delegate, options.StringsPerUpdate);
+    delegate.flush();
+  }
+  double seconds = (Now() - start) / 1e9;
+
+  const LatencyRecorder * recorders[] = {
+    &delegate.Paints, &delegate.WidgetPaints, &delegate.HostMessages,
+    &delegate.ProtocolRequests, &delegate.InputEvents, &delegate.Resizes,
+    &delegate.URLStrings, &delegate.WideStrings, &delegate.Flushes
+  };
+  const size_t recorderCount = sizeof(recorders) / sizeof(recorders[0]);
+
+  size_t events = 0;
+  for (size_t i = 0; i < recorderCount; i++)
+    events += recorders[i]->count();
+
+  printf("%d updates in %.3f s: %.0f updates/s, %.0f callbacks/s\n\n", options.Updates, seconds, options.Updates / seconds, events / seconds);
+  printf("%-16s %10s %12s %9s %9s %9s %9s %10s\n", "callback", "events", "events/s", "p50 ns", "p90 ns", "p99 ns", "max ns", "allocs/ev");
+  for (size_t i = 0; i < recorderCount; i++)
+    Report(*recorders[i]);
+
+  printf(
+    "\n%lld input events coalesced, %lld malformed host messages, %lld cache hits, %lld cache misses (checksum %llu)\n",
+    delegate.coalescedInput(), delegate.malformedMessages(), delegate.cache().hits(), delegate.cache().misses(), delegate.checksum()
+  );
+
+  if (!options.Check)
+    return 0;
+
+  fflush(stdout);
+
+  bool passed = (delegate.malformedMessages() == 0);
+  if (!passed)
+    fprintf(stderr, "FakeEngine sent host messages the parser rejected\n");
+
+  for (size_t i = 0; i < recorderCount; i++)
+    passed = CheckBudget(*recorders[i]) && passed;
+
+  return passed ? 0 : 1;
+}
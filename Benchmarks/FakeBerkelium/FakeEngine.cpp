@@ -0,0 +1,201 @@
+// FakeEngine.cpp : see FakeEngine.h
+
+#include "FakeEngine.h"
+
+#include <stdio.h>
+
+namespace Berkelium {
+  namespace Benchmarks {
+
+    namespace {
+      ::Berkelium::Rect MakeRect (int left, int top, int width, int height) {
+        ::Berkelium::Rect result;
+        result.mLeft = left;
+        result.mTop = top;
+        result.mWidth = width;
+        result.mHeight = height;
+        return result;
+      }
+
+      std::wstring Widen (const char * text) {
+        std::wstring result;
+        while (*text)
+          result += (wchar_t)(unsigned char)*text++;
+        return result;
+      }
+
+      // Builds a message in the host bridge format (see NativeHostMessages.h).
+      std::wstring BridgeMessage (const char * name, const char * arguments) {
+        wchar_t prefix[16];
+        swprintf(prefix, sizeof(prefix) / sizeof(wchar_t), L"%d:", (int)Widen(name).length());
+        return std::wstring(1, (wchar_t)0x1F) + prefix + Widen(name) + Widen(arguments);
+      }
+
+      const char RequestHeaders[] = "Accept: */*\0User-Agent: FakeEngine\0";
+      const char ConditionalRequestHeaders[] = "Accept: */*\0Range: bytes=0-\0";
+    }
+
+    FakeEngineSettings::FakeEngineSettings ()
+      : Width(1024)
+      , Height(768)
+      , PaintsPerUpdate(4)
+      , CopyRectsPerPaint(2)
+      , ScrollEvery(16)
+      , Widgets(1)
+      , WidgetWidth(200)
+      , WidgetHeight(300)
+      , WidgetPaintsPerUpdate(1)
+      , HostMessagesPerUpdate(8)
+      , ProtocolRequestsPerUpdate(2)
+      , DistinctUrls(64)
+      , ConditionalRequestEvery(0)
+      , Seed(12345) {
+    }
+
+    FakeEngine::FakeEngine (const FakeEngineSettings & settings)
+      : mSettings(settings)
+      , mProtocol(0)
+      , mWidgets(settings.Widgets > 0 ? settings.Widgets : 0)
+      , mOrigin("bench://host")
+      , mTarget("*")
+      , mRandom(settings.Seed ? settings.Seed : 1)
+      , mPaints(0)
+      , mRequests(0) {
+
+      int maxWidth = (mSettings.Width > mSettings.WidgetWidth) ? mSettings.Width : mSettings.WidgetWidth;
+      int maxHeight = (mSettings.Height > mSettings.WidgetHeight) ? mSettings.Height : mSettings.WidgetHeight;
+      mPixels.resize((size_t)maxWidth * maxHeight * 4);
+      for (size_t i = 0; i < mPixels.size(); i++)
+        mPixels[i] = (unsigned char)(i * 31);
+
+      mCopyRects.resize(mSettings.CopyRectsPerPaint > 0 ? mSettings.CopyRectsPerPaint : 1);
+
+      mMessages.push_back(BridgeMessage("tick", "n4:16.5"));
+      mMessages.push_back(BridgeMessage("pointer", "n3:120n3:340s4:move"));
+      mMessages.push_back(BridgeMessage("state", "s25:{\"level\":3,\"score\":12000}u0:"));
+      mMessages.push_back(BridgeMessage("blob", "b8:\x01\x02\x03\x04\x7F\x7E\x7D\x7C"));
+      mMessages.push_back(L"a plain message, as older pages send them");
+
+      int urls = (mSettings.DistinctUrls > 0) ? mSettings.DistinctUrls : 1;
+      for (int i = 0; i < urls; i++) {
+        wchar_t url[64];
+        swprintf(url, sizeof(url) / sizeof(wchar_t), L"bench://assets/scripts/module%d.js", i);
+        mUrls.push_back(url);
+      }
+    }
+
+    // xorshift32; all that matters is that it's cheap and repeatable.
+    unsigned int FakeEngine::next () {
+      mRandom ^= mRandom << 13;
+      mRandom ^= mRandom >> 17;
+      mRandom ^= mRandom << 5;
+      return mRandom;
+    }
+
+    int FakeEngine::range (int low, int high) {
+      if (high <= low)
+        return low;
+      return low + (int)(next() % (unsigned int)(high - low + 1));
+    }
+
+    void FakeEngine::emitPaint (::Berkelium::Widget * widget, int width, int height, bool scroll) {
+      int dx = 0, dy = 0;
+      ::Berkelium::Rect scrollRect = MakeRect(0, 0, 0, 0), sourceRect;
+
+      if (scroll) {
+        // Scrolling down exposes a band at the bottom, which is all that gets repainted.
+        dy = -range(1, height / 8);
+        scrollRect = MakeRect(0, 0, width, height);
+        sourceRect = MakeRect(0, height + dy, width, -dy);
+      } else {
+        int w = range(8, width / 2), h = range(8, height / 2);
+        sourceRect = MakeRect(range(0, width - w), range(0, height - h), w, h);
+      }
+
+      // The copy rects split the source rect into horizontal bands.
+      size_t count = mCopyRects.size();
+      if ((int)count > sourceRect.mHeight)
+        count = sourceRect.mHeight;
+      for (size_t i = 0; i < count; i++) {
+        int top = (int)(sourceRect.mHeight * i / count);
+        int bottom = (int)(sourceRect.mHeight * (i + 1) / count);
+        mCopyRects[i] = MakeRect(sourceRect.mLeft, sourceRect.mTop + top, sourceRect.mWidth, bottom - top);
+      }
+
+      ::Berkelium::WindowDelegate * delegate = mWindow.getDelegate();
+      if (!delegate)
+        return;
+
+      if (widget)
+        delegate->onWidgetPaint(&mWindow, widget, &mPixels[0], sourceRect, count, &mCopyRects[0], dx, dy, scrollRect);
+      else
+        delegate->onPaint(&mWindow, &mPixels[0], sourceRect, count, &mCopyRects[0], dx, dy, scrollRect);
+    }
+
+    void FakeEngine::emitHostMessage () {
+      ::Berkelium::WindowDelegate * delegate = mWindow.getDelegate();
+      if (!delegate)
+        return;
+
+      const std::wstring & message = mMessages[next() % mMessages.size()];
+      delegate->onExternalHost(&mWindow,
+        ::Berkelium::WideString::point(message.data(), message.length()),
+        ::Berkelium::URLString::point(mOrigin.data(), mOrigin.length()),
+        ::Berkelium::URLString::point(mTarget.data(), mTarget.length())
+      );
+    }
+
+    void FakeEngine::emitProtocolRequest () {
+      if (!mProtocol)
+        return;
+
+      mRequests += 1;
+      const std::wstring & url = mUrls[(size_t)(mRequests % (long long)mUrls.size())];
+      bool conditional = (mSettings.ConditionalRequestEvery > 0) && ((mRequests % mSettings.ConditionalRequestEvery) == 0);
+
+      HGLOBAL responseBody = 0, responseHeaders = 0;
+      if (conditional)
+        mProtocol->HandleRequest(url.data(), url.length(), ConditionalRequestHeaders, sizeof(ConditionalRequestHeaders), responseBody, responseHeaders);
+      else
+        mProtocol->HandleRequest(url.data(), url.length(), RequestHeaders, sizeof(RequestHeaders), responseBody, responseHeaders);
+
+      // Chromium owns the response once it's handed over.
+      if (responseBody)
+        LocalFree(responseBody);
+      if (responseHeaders)
+        LocalFree(responseHeaders);
+    }
+
+    void FakeEngine::update () {
+      int paints = mSettings.PaintsPerUpdate;
+      int widgetPaints = mWidgets.empty() ? 0 : mSettings.WidgetPaintsPerUpdate;
+      int messages = mSettings.HostMessagesPerUpdate;
+      int requests = mSettings.ProtocolRequestsPerUpdate;
+
+      // Round-robin between the kinds of traffic until each has had its share.
+      while ((paints > 0) || (widgetPaints > 0) || (messages > 0) || (requests > 0)) {
+        if (paints > 0) {
+          paints -= 1;
+          mPaints += 1;
+          bool scroll = (mSettings.ScrollEvery > 0) && ((mPaints % mSettings.ScrollEvery) == 0);
+          emitPaint(0, mSettings.Width, mSettings.Height, scroll);
+        }
+
+        if (widgetPaints > 0) {
+          widgetPaints -= 1;
+          emitPaint(&mWidgets[next() % mWidgets.size()], mSettings.WidgetWidth, mSettings.WidgetHeight, false);
+        }
+
+        if (messages > 0) {
+          messages -= 1;
+          emitHostMessage();
+        }
+
+        if (requests > 0) {
+          requests -= 1;
+          emitProtocolRequest();
+        }
+      }
+    }
+
+  }}
@@ -0,0 +1,89 @@
+// FakeEngine.h : an in-process stand-in for Berkelium that raises synthetic callbacks at configurable rates
+
+#pragma once
+
+#include <windows.h>
+
+#include "berkelium/WindowDelegate.hpp"
+
+#include <string>
+#include <vector>
+
+namespace Berkelium {
+  namespace Benchmarks {
+
+    // How much of each kind of traffic a single update produces. The defaults are roughly a busy page:
+    //  an animation, a popup, a trickle of host messages and a few asset requests.
+    struct FakeEngineSettings {
+      int Width, Height;
+      int PaintsPerUpdate;
+      int CopyRectsPerPaint;
+      // Every Nth window paint scrolls the whole window; 0 for never.
+      int ScrollEvery;
+      int Widgets;
+      int WidgetWidth, WidgetHeight;
+      int WidgetPaintsPerUpdate;
+      int HostMessagesPerUpdate;
+      int ProtocolRequestsPerUpdate;
+      // Requests cycle through this many URLs, so a cache big enough for them all only misses while warming up.
+      int DistinctUrls;
+      // Every Nth request carries a Range header, which the cache never answers; 0 for never.
+      int ConditionalRequestEvery;
+      unsigned int Seed;
+
+      FakeEngineSettings ();
+    };
+
+    // Answers requests the way NativeProtocolHandler::HandleRequest does.
+    class FakeProtocolHandler {
+    public:
+      virtual ~FakeProtocolHandler () {
+      }
+
+      virtual bool HandleRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL & responseBody, HGLOBAL & responseHeaders) = 0;
+    };
+
+    // Everything is generated up front, so raising callbacks costs the engine next to nothing and
+    //  the benchmarks only measure the delegate. The same seed always produces the same traffic.
+    class FakeEngine {
+      FakeEngineSettings mSettings;
+      FakeProtocolHandler * mProtocol;
+      ::Berkelium::Window mWindow;
+      std::vector< ::Berkelium::Widget> mWidgets;
+      std::vector<unsigned char> mPixels;
+      std::vector< ::Berkelium::Rect> mCopyRects;
+      std::vector<std::wstring> mMessages;
+      std::vector<std::wstring> mUrls;
+      std::string mOrigin, mTarget;
+      unsigned int mRandom;
+      long long mPaints, mRequests;
+
+      FakeEngine (const FakeEngine &);
+      FakeEngine & operator= (const FakeEngine &);
+
+      unsigned int next ();
+      int range (int low, int high);
+
+      void emitPaint (::Berkelium::Widget * widget, int width, int height, bool scroll);
+      void emitHostMessage ();
+      void emitProtocolRequest ();
+
+    public:
+      FakeEngine (const FakeEngineSettings & settings);
+
+      // Callbacks go to whatever delegate the window has, as with Berkelium itself.
+      void setProtocolHandler (FakeProtocolHandler * protocol) { mProtocol = protocol; }
+
+      const FakeEngineSettings & settings () const { return mSettings; }
+      ::Berkelium::Window * window () { return &mWindow; }
+      int widgetCount () const { return (int)mWidgets.size(); }
+      ::Berkelium::Widget * widget (int index) { return &mWidgets[index]; }
+
+      // Raises one update's worth of callbacks, interleaved the way a real update would deliver them.
+      void update ();
+
+      // Draws from the same repeatable sequence the engine uses.
+      unsigned int random () { return next(); }
+    };
+
+  }}
@@ -0,0 +1,7 @@
+// Platform.hpp : stand-in for Berkelium's header of the same name, for the Linux benchmarks
+
+#pragma once
+
+#include <stddef.h>
+
+#define BERKELIUM_EXPORT
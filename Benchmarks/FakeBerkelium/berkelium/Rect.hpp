@@ -0,0 +1,23 @@
+// Rect.hpp : stand-in for Berkelium's header of the same name, with the same layout
+
+#pragma once
+
+#include "berkelium/Platform.hpp"
+
+namespace Berkelium {
+
+  struct Rect {
+    int mTop;
+    int mLeft;
+    int mWidth;
+    int mHeight;
+
+    int top () const { return mTop; }
+    int left () const { return mLeft; }
+    int width () const { return mWidth; }
+    int height () const { return mHeight; }
+    int right () const { return mLeft + mWidth; }
+    int bottom () const { return mTop + mHeight; }
+  };
+
+}
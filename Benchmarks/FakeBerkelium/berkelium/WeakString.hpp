@@ -0,0 +1,32 @@
+// WeakString.hpp : stand-in for Berkelium's header of the same name
+
+#pragma once
+
+#include "berkelium/Platform.hpp"
+
+namespace Berkelium {
+
+  // A pointer and a length, not owned; only valid for the duration of the callback it was passed to.
+  template <class CharType>
+  struct WeakString {
+    const CharType * mData;
+    size_t mLength;
+
+    const CharType * data () const { return mData; }
+    size_t length () const { return mLength; }
+
+    static WeakString point (const CharType * data, size_t length) {
+      WeakString result = { data, length };
+      return result;
+    }
+
+    static WeakString empty () {
+      WeakString result = { 0, 0 };
+      return result;
+    }
+  };
+
+  typedef WeakString<char> URLString;
+  typedef WeakString<wchar_t> WideString;
+
+}
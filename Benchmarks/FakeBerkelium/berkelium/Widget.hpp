@@ -0,0 +1,33 @@
+// Widget.hpp : stand-in for Berkelium's header of the same name. Input is counted instead of being delivered anywhere.
+
+#pragma once
+
+#include "berkelium/Platform.hpp"
+
+namespace Berkelium {
+
+  // Window and Widget share the input half of their interface, which is all the benchmarks need.
+  class InputTarget {
+  public:
+    long long mInputEvents;
+
+    InputTarget ()
+      : mInputEvents(0) {
+    }
+
+    virtual ~InputTarget () {
+    }
+
+    virtual void focus () { mInputEvents += 1; }
+    virtual void unfocus () { mInputEvents += 1; }
+    virtual void mouseMoved (int xPos, int yPos) { mInputEvents += 1; }
+    virtual void mouseButton (unsigned int buttonID, bool down) { mInputEvents += 1; }
+    virtual void mouseWheel (int xScroll, int yScroll) { mInputEvents += 1; }
+    virtual void textEvent (const wchar_t * evt, size_t evtLength) { mInputEvents += 1; }
+    virtual void keyEvent (bool pressed, int mods, int vk_code, int scancode) { mInputEvents += 1; }
+  };
+
+  class Widget : public InputTarget {
+  };
+
+}
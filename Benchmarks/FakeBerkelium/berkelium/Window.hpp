@@ -0,0 +1,23 @@
+// Window.hpp : stand-in for Berkelium's header of the same name
+
+#pragma once
+
+#include "berkelium/Widget.hpp"
+
+namespace Berkelium {
+
+  class WindowDelegate;
+
+  class Window : public InputTarget {
+    WindowDelegate * mDelegate;
+
+  public:
+    Window ()
+      : mDelegate(0) {
+    }
+
+    WindowDelegate * getDelegate () const { return mDelegate; }
+    void setDelegate (WindowDelegate * delegate) { mDelegate = delegate; }
+  };
+
+}
@@ -0,0 +1,29 @@
+// WindowDelegate.hpp : stand-in for Berkelium's header of the same name, reduced to the callbacks FakeEngine raises
+
+#pragma once
+
+#include "berkelium/Rect.hpp"
+#include "berkelium/WeakString.hpp"
+#include "berkelium/Widget.hpp"
+#include "berkelium/Window.hpp"
+
+namespace Berkelium {
+
+  class WindowDelegate {
+  public:
+    virtual ~WindowDelegate () {
+    }
+
+    virtual void onPaint (Window * win, const unsigned char * sourceBuffer, const Rect & sourceBufferRect,
+      size_t numCopyRects, const Rect * copyRects, int dx, int dy, const Rect & scrollRect) {
+    }
+
+    virtual void onWidgetPaint (Window * win, Widget * wid, const unsigned char * sourceBuffer, const Rect & sourceBufferRect,
+      size_t numCopyRects, const Rect * copyRects, int dx, int dy, const Rect & scrollRect) {
+    }
+
+    virtual void onExternalHost (Window * win, WideString message, URLString origin, URLString target) {
+    }
+  };
+
+}
@@ -0,0 +1,65 @@
+// windows.h : the few Win32 and CRT pieces the native dispatch layer uses, on top of POSIX, for the Linux benchmarks
+
+#pragma once
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef long LONG;
+typedef long long LONGLONG;
+typedef unsigned int UINT;
+typedef size_t SIZE_T;
+typedef void * HANDLE;
+typedef void * HGLOBAL;
+typedef void * HLOCAL;
+
+#define LMEM_FIXED 0
+#define _TRUNCATE ((size_t)-1)
+
+// Allocations made for responses are counted along with operator new; see BenchmarkStats.cpp.
+HLOCAL LocalAlloc (UINT flags, SIZE_T bytes);
+HLOCAL LocalFree (HLOCAL memory);
+
+inline LONG InterlockedIncrement (volatile LONG * value) {
+  return __sync_add_and_fetch(value, 1);
+}
+
+inline LONG InterlockedDecrement (volatile LONG * value) {
+  return __sync_sub_and_fetch(value, 1);
+}
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+inline void InitializeCriticalSection (CRITICAL_SECTION * section) {
+  pthread_mutexattr_t attributes;
+  pthread_mutexattr_init(&attributes);
+  // Critical sections are re-entrant.
+  pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(section, &attributes);
+  pthread_mutexattr_destroy(&attributes);
+}
+
+inline void DeleteCriticalSection (CRITICAL_SECTION * section) {
+  pthread_mutex_destroy(section);
+}
+
+inline void EnterCriticalSection (CRITICAL_SECTION * section) {
+  pthread_mutex_lock(section);
+}
+
+inline void LeaveCriticalSection (CRITICAL_SECTION * section) {
+  pthread_mutex_unlock(section);
+}
+
+// Only the _TRUNCATE form is used: returns -1 if the output didn't fit.
+inline int _snprintf_s (char * buffer, size_t size, size_t count, const char * format, ...) {
+  (void)count;
+  va_list arguments;
+  va_start(arguments, format);
+  int result = vsnprintf(buffer, size, format, arguments);
+  va_end(arguments);
+  return ((result < 0) || ((size_t)result >= size)) ? -1 : result;
+}
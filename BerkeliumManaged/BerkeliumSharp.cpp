@@ -7,18 +7,186 @@
 using namespace System::Text;
 using namespace System::Resources;
 using namespace System::Reflection;
+using namespace System::Diagnostics;
 
 namespace Berkelium {
   namespace Managed {
 
     namespace {
       String ^ URLToString(const URLString &str) {
-        std::wstring wideURL (str.data(), str.data()+str.length());
-        return gcnew String(wideURL.data(), 0, wideURL.length());
+        if (str.length() == 0)
+          return String::Empty;
+
+        return gcnew String((signed char *)str.data(), 0, (int)str.length(), Encoding::UTF8);
+      }
+
+      void TraceUrl(NativeTraceWriter * trace, int kind, const URLString &url) {
+        NativeTraceRecord record (kind);
+        record.addNarrow(url.data(), url.length());
+        trace->write(record);
+      }
+
+      void TraceText(NativeTraceWriter * trace, int kind, const WideString &text) {
+        NativeTraceRecord record (kind);
+        record.addWide(text.data(), text.length());
+        trace->write(record);
+      }
+
+      // Finds the host name in a URL of the form scheme://[user@]host[:port]/...
+      bool FindHost(String ^ url, int & hostStart, int & hostEnd) {
+        int schemeEnd = url->IndexOf("://", StringComparison::Ordinal);
+        if (schemeEnd <= 0)
+          return false;
+
+        for (int i = 0; i < schemeEnd; i++) {
+          wchar_t ch = url[i];
+          if (!Char::IsLetterOrDigit(ch) && (ch != '+') && (ch != '-') && (ch != '.'))
+            return false;
+        }
+
+        int authorityStart = schemeEnd + 3;
+        int authorityEnd = url->IndexOfAny(gcnew array<wchar_t> { '/', '\\', '?', '#' }, authorityStart);
+        if (authorityEnd < 0)
+          authorityEnd = url->Length;
+
+        hostStart = authorityStart;
+        for (int i = authorityEnd - 1; i >= authorityStart; i--) {
+          if (url[i] == '@') {
+            hostStart = i + 1;
+            break;
+          }
+        }
+
+        hostEnd = url->IndexOf(':', hostStart, authorityEnd - hostStart);
+        if (hostEnd < 0)
+          hostEnd = authorityEnd;
+
+        return hostEnd > hostStart;
+      }
+
+      Rect ^ ToManagedRect(const ::Berkelium::Rect &rect) {
+        return gcnew Rect(rect.left(), rect.top(), rect.width(), rect.height());
+      }
+
+      array<Rect ^> ^ CopyRectsToArray(size_t numCopyRects, const ::Berkelium::Rect *copyRects) {
+        array<Rect ^> ^ result = gcnew array<Rect ^>(numCopyRects);
+        for (size_t i = 0; i < numCopyRects; i++)
+          result[i] = ToManagedRect(copyRects[i]);
+        return result;
+      }
+
+      void FillPaintFrame(PaintFrame % frame, System::Int64 sequenceNumber, const unsigned char *sourceBuffer, const ::Berkelium::Rect &rect, size_t stride, size_t numCopyRects, const ::Berkelium::Rect *copyRects, int dx, int dy, const ::Berkelium::Rect &scrollRect, int paintCount) {
+        frame.SequenceNumber = sequenceNumber;
+        frame.SourceRect = PaintRect::FromNative(rect);
+        frame.Buffer = IntPtr((void *)sourceBuffer);
+        frame.Stride = (int)stride;
+        frame.ByteLength = frame.Stride * rect.height();
+        frame.Format = BufferFormat::Bgra32;
+        frame.Dx = dx;
+        frame.Dy = dy;
+        frame.ScrollRect = PaintRect::FromNative(scrollRect);
+        frame.CopyRectCount = (int)numCopyRects;
+        frame.NativeCopyRects = copyRects;
+        frame.PaintCount = paintCount;
+      }
+
+      // The legacy paint events promise rows that are sourceBufferRect.Width * 4 bytes apart (see Rect.GetBufferOffset),
+      //  but a backing store that has been shrunk keeps its wider stride. Handlers only read the copy rects, so those
+      //  are all that gets packed into the buffer handed to them.
+      const unsigned char * PackLegacyPaint (std::vector<unsigned char> & packed, const unsigned char * sourceBuffer, const ::Berkelium::Rect & rect,
+        size_t stride, size_t numCopyRects, const ::Berkelium::Rect * copyRects) {
+        size_t packedStride = (size_t)rect.width() * NativeBackingStore::BytesPerPixel;
+        if ((stride == packedStride) || (packedStride == 0) || (rect.height() <= 0))
+          return sourceBuffer;
+
+        if (packed.size() < packedStride * rect.height())
+          packed.resize(packedStride * rect.height());
+
+        for (size_t i = 0; i < numCopyRects; i++) {
+          const ::Berkelium::Rect & copyRect = copyRects[i];
+          size_t rowBytes = (size_t)copyRect.width() * NativeBackingStore::BytesPerPixel;
+          size_t left = (size_t)(copyRect.left() - rect.left()) * NativeBackingStore::BytesPerPixel;
+
+          for (int y = copyRect.top() - rect.top(), bottom = y + copyRect.height(); y < bottom; y++)
+            memcpy(&packed[(y * packedStride) + left], sourceBuffer + (y * stride) + left, rowBytes);
+        }
+
+        return &packed[0];
+      }
+
+      // Turns an accumulated set of paints into a single paint whose source buffer
+      //  is the entire backing store, and resets the accumulator.
+      struct CoalescedPaint {
+        const unsigned char * SourceBuffer;
+        ::Berkelium::Rect SourceRect, CopyRect, ScrollRect;
+        // The store's, which is wider than the source rect once it has been shrunk.
+        size_t Stride;
+        int Dx, Dy, PaintCount;
+
+        CoalescedPaint (NativeBackingStore * store, NativePaintAccumulator * pending) {
+          pending->clip(store->width(), store->height());
+
+          SourceBuffer = store->data();
+          SourceRect = MakeRect(0, 0, store->width(), store->height());
+          Stride = store->stride();
+          CopyRect = pending->dirtyRect();
+          ScrollRect = pending->scrollRect();
+          Dx = pending->dx();
+          Dy = pending->dy();
+          PaintCount = pending->paintCount();
+
+          pending->reset();
+        }
+
+        size_t CopyRectCount () const {
+          return ((CopyRect.mWidth > 0) && (CopyRect.mHeight > 0)) ? 1 : 0;
+        }
+      };
+
+      bool OverridesMethod(Type ^ type, String ^ methodName) {
+        try {
+          MethodInfo ^ method = type->GetMethod(
+            methodName, BindingFlags::Instance | BindingFlags::Public | BindingFlags::NonPublic
+          );
+
+          return (method != nullptr) && (method->DeclaringType != Window::typeid);
+        } catch (AmbiguousMatchException ^) {
+          // A subclass added an overload, so assume the worst.
+          return true;
+        }
+      }
+    }
+
+    void URLStringHelper::EncodeNonAscii (String ^ url) {
+      String ^ asciiHost = nullptr;
+      int hostStart = 0, hostEnd = 0;
+
+      if (FindHost(url, hostStart, hostEnd)) {
+        try {
+          asciiHost = (gcnew System::Globalization::IdnMapping())->GetAscii(url, hostStart, hostEnd - hostStart);
+        } catch (ArgumentException ^) {
+          // Not a valid IDN, so let Chromium make what it can of the escaped UTF-8.
+        }
+      }
+
+      pin_ptr<const wchar_t> pinnedData = PtrToStringChars(url);
+      size_t length = url->Length;
+
+      mString.clear();
+      if (asciiHost != nullptr) {
+        pin_ptr<const wchar_t> hostData = PtrToStringChars(asciiHost);
+        AppendPercentEncodedUtf8(pinnedData, hostStart, mString);
+        AppendPercentEncodedUtf8(hostData, asciiHost->Length, mString);
+        AppendPercentEncodedUtf8(pinnedData + hostEnd, length - hostEnd, mString);
+      } else {
+        AppendPercentEncodedUtf8(pinnedData, length, mString);
       }
+
+      this->mData = mString.data();
+      this->mLength = mString.length();
     }
 
-    void BerkeliumSharp::Init (String ^ homeDirectory) {
+    void BerkeliumSharp::Init (String ^ homeDirectory, bool usePumpThread) {
         if (IsInitialized)
           return;
 
@@ -48,6 +216,9 @@ namespace Berkelium {
         Assembly ^ assembly = Assembly::GetExecutingAssembly();
         DateTime fileTime = File::GetLastWriteTimeUtc(assembly->Location);
 
+        NativeProfiler::nameThread("Berkelium UI");
+        NativeProfileScope extractSpan ("init", "BerkeliumSharp::ExtractResources");
+
         array<unsigned char> ^ buffer = gcnew array<unsigned char>(32768);
         for each (String ^ name in assembly->GetManifestResourceNames()) {
           bool shouldExtract = false;
@@ -109,6 +280,17 @@ namespace Berkelium {
           SetEnvironmentVariable(L"PATH", pathBuf);
         }
 
+        if (usePumpThread)
+          PumpThread::Start(homeDirectory);
+        else
+          InitNative(homeDirectory);
+
+        IsInitialized = true;
+    }
+
+    void BerkeliumSharp::InitNative (String ^ homeDirectory) {
+        NativeProfileScope span ("init", "Berkelium::init");
+
         if (homeDirectory != nullptr) {
           WideStringHelper homeDirPtr(homeDirectory);
           ::Berkelium::init(homeDirPtr);
@@ -118,8 +300,124 @@ namespace Berkelium {
 
         Wrapper = new ErrorDelegateWrapper();
         ::Berkelium::setErrorHandler(Wrapper);
+    }
 
-        IsInitialized = true;
+    int BerkeliumSharp::ToTimeout (TimeSpan timeout) {
+      if (timeout <= TimeSpan::Zero)
+        return 0;
+      else if (timeout.TotalMilliseconds >= Int32::MaxValue)
+        return System::Threading::Timeout::Infinite;
+      else
+        return (int)Math::Ceiling(timeout.TotalMilliseconds);
+    }
+
+    // Chromium wakes the message loop of the thread that called init by posting it a window message,
+    //  and schedules delayed work with SetTimer, so that thread's message queue is a precise signal
+    //  for whether update() has anything to do.
+    bool BerkeliumSharp::HasPendingWork () {
+      return HIWORD(GetQueueStatus(QS_ALLINPUT)) != 0;
+    }
+
+    bool BerkeliumSharp::WaitForWork (TimeSpan maxWait, System::Threading::WaitHandle ^ wakeHandle) {
+      HANDLE handle = 0;
+      if (wakeHandle != nullptr)
+        handle = wakeHandle->SafeWaitHandle->DangerousGetHandle().ToPointer();
+
+      DWORD result = MsgWaitForMultipleObjectsEx(
+        handle ? 1 : 0, handle ? &handle : 0, (DWORD)ToTimeout(maxWait), QS_ALLINPUT, MWMO_INPUTAVAILABLE
+      );
+
+      return (result != WAIT_TIMEOUT) && (result != WAIT_FAILED);
+    }
+
+    bool BerkeliumSharp::Update (TimeSpan maxWait, TimeSpan wallClockBudget) {
+      if (!IsInitialized)
+        return false;
+
+      FlushQueuedWindows();
+
+      if (PumpThread::IsRunning)
+        return PumpThread::Update(maxWait, wallClockBudget);
+
+      WaitForWork(maxWait, nullptr);
+
+      NativeProfileScope span ("update", "BerkeliumSharp::Update");
+      // Elapsed time, not CPU time: GetThreadTimes only moves in scheduler ticks, far too coarse for a budget of a few
+      //  milliseconds, and a frame that misses its deadline has done so whether or not this thread was running.
+      System::Int64 deadline = Int64::MaxValue;
+      if (wallClockBudget < TimeSpan::MaxValue)
+        deadline = Stopwatch::GetTimestamp() + (Int64)(wallClockBudget.TotalSeconds * Stopwatch::Frequency);
+
+      do {
+        UpdateNative();
+        FlushCoalescedPaints();
+      } while (HasPendingWork() && (Stopwatch::GetTimestamp() < deadline));
+
+      return HasPendingWork();
+    }
+
+    void BerkeliumSharp::UpdateNative () {
+      NativeProfileScope span ("update", "Berkelium::update");
+      NativeStatCounters::Process.add(StatUpdates, 1);
+      NativeTimeScope updateTime (&NativeStatCounters::Process, StatUpdateTicks);
+      ::Berkelium::update();
+    }
+
+    ProcessStats ^ BerkeliumSharp::Stats::get () {
+      return gcnew ProcessStats();
+    }
+
+    void BerkeliumSharp::QueueCoalescedPaint (Window ^ window) {
+      if (CoalescedWindows == nullptr) {
+        CoalescedWindows = gcnew System::Collections::Generic::List<Window ^>();
+        FlushingWindows = gcnew System::Collections::Generic::List<Window ^>();
+      }
+
+      CoalescedWindows->Add(window);
+    }
+
+    void BerkeliumSharp::FlushCoalescedPaints () {
+      if ((CoalescedWindows == nullptr) || (CoalescedWindows->Count == 0))
+        return;
+
+      // Paint handlers are free to pump again, so swap the lists before dispatching
+      //  and anything they queue ends up in the next flush. A nested flush finds the
+      //  spare list checked out and has to allocate its own.
+      System::Collections::Generic::List<Window ^> ^ windows = CoalescedWindows;
+      CoalescedWindows = FlushingWindows ? FlushingWindows : gcnew System::Collections::Generic::List<Window ^>();
+      FlushingWindows = nullptr;
+
+      for (int i = 0; i < windows->Count; i++)
+        windows[i]->FlushCoalescedPaints();
+
+      windows->Clear();
+      FlushingWindows = windows;
+    }
+
+    void BerkeliumSharp::QueueWindowFlush (Window ^ window) {
+      if (QueuedWindows == nullptr)
+        QueuedWindows = gcnew System::Collections::Generic::List<Window ^>();
+
+      QueuedWindows->Add(window);
+    }
+
+    // Runs at the start of every update, so that each window's queued resize, input and scripts reach the page in one go.
+    void BerkeliumSharp::FlushQueuedWindows () {
+      if ((QueuedWindows == nullptr) || (QueuedWindows->Count == 0))
+        return;
+
+      NativeProfileScope span ("update", "BerkeliumSharp::FlushQueuedWindows");
+      for (int i = 0; i < QueuedWindows->Count; i++) {
+        Window ^ window = QueuedWindows[i];
+        if (window->Native) {
+          // Resized first, so the queued input lands on the layout it was aimed at.
+          window->FlushResize();
+          window->FlushInput();
+          window->FlushJavascript();
+        }
+      }
+
+      QueuedWindows->Clear();
     }
 
     void GrowBufferForText (Decoder ^ decoder, const char * source, size_t length, wchar_t * &target, size_t &targetSize) {
@@ -134,241 +432,2377 @@ namespace Berkelium {
       }
     }
 
-    static void CopyToGlobal (array<unsigned char> ^ source, HGLOBAL & target) {
-      if (source != nullptr) {
-        pin_ptr<unsigned char> ptr = &source[0];
-        target = Marshal::AllocHGlobal(source->Length).ToPointer();
-        memcpy(target, ptr, source->Length);
-      } else
+    // Returns the number of bytes copied.
+    static size_t CopyToGlobal (ProtocolResponse ^ response, HGLOBAL & target) {
+      if (response->Body == nullptr) {
         target = 0;
-    }
+        return 0;
+      }
 
-    ProtocolHandler::ProtocolHandler (
-      Managed::Context ^ context, 
-      String ^ scheme
-    )
-      : Scheme(scheme)
-      , Context(context)
-    {
-      Native = new NativeProtocolHandler(this);
+      Int64 length = response->GetRemainingLength();
+      if (length < 0) {
+        // There's no way to know how big the body is without reading all of it.
+        MemoryStream ^ buffer = gcnew MemoryStream();
+        array<unsigned char> ^ chunk = gcnew array<unsigned char>(ProtocolResponse::ChunkSize);
+        int readBytes;
+        while ((readBytes = response->Body->Read(chunk, 0, chunk->Length)) > 0)
+          buffer->Write(chunk, 0, readBytes);
+
+        delete response->Body;
+        response->Body = buffer;
+        response->BodyBuffer = buffer->GetBuffer();
+        buffer->Position = 0;
+        length = buffer->Length;
+      }
 
-      IntPtr schemePtr = Marshal::StringToHGlobalAnsi(scheme);
+      target = Marshal::AllocHGlobal(IntPtr(length)).ToPointer();
 
-      // FIXME: registerProtocol not defined.
-      // context->Native->registerProtocol((const char *)schemePtr.ToPointer(), scheme->Length, Native);
+      unsigned char * ptr = (unsigned char *)(void *)target;
+      size_t position = 0, readBytes;
+      while ((position < (size_t)length) && ((readBytes = response->Read(ptr + position, (size_t)length - position)) > 0))
+        position += readBytes;
 
-      Marshal::FreeHGlobal(schemePtr);
+      return position;
     }
 
-    ProtocolHandler::~ProtocolHandler () {
-      if (Native) {
-        IntPtr schemePtr = Marshal::StringToHGlobalAnsi(Scheme);
-        // FIXME: unregisterProtocol not defined.
-        // Context->Native->unregisterProtocol((const char *)schemePtr.ToPointer(), Scheme->Length);
-        Marshal::FreeHGlobal(schemePtr);
+    // Header text is sent as Latin-1, one byte per character, so lengths are known before anything is written.
+    static unsigned char * WriteLatin1 (unsigned char * output, String ^ text) {
+      int length = text->Length;
+      if (length == 0)
+        return output;
 
-        delete Native;
-        Native = 0;
-        
-        Scheme = nullptr;
-        Context = nullptr;
+      pin_ptr<const wchar_t> chars = PtrToStringChars(text);
+      for (int i = 0; i < length; i++) {
+        wchar_t ch = chars[i];
+        *output++ = (ch < 0x100) ? (unsigned char)ch : '?';
       }
+
+      return output;
     }
 
-    bool NativeProtocolHandler::HandleRequest(const wchar_t * url, size_t urlLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders) {
-      return Owner->DoHandleRequest(url, urlLength, responseBody, responseHeaders);
+    static unsigned char * WriteAscii (unsigned char * output, const char * text) {
+      while (*text)
+        *output++ = (unsigned char)*text++;
+      return output;
     }
 
-    bool ProtocolHandler::DoHandleRequest(const wchar_t * urlPtr, size_t urlLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders) {
-      String ^ url = gcnew String(urlPtr, 0, urlLength);
-      array<unsigned char> ^ body = nullptr;
-      array<String ^> ^ headers = nullptr;
+    static unsigned char * WriteDecimal (unsigned char * output, System::UInt64 value) {
+      unsigned char digits[20];
+      int count = 0;
+      do {
+        digits[count++] = (unsigned char)('0' + (int)(value % 10));
+        value /= 10;
+      } while (value > 0);
+
+      while (count > 0)
+        *output++ = digits[--count];
+      return output;
+    }
 
-      bool result = this->HandleRequest(
-        url, body, headers
-      );
+    static unsigned char * WriteTwoDigits (unsigned char * output, int value) {
+      *output++ = (unsigned char)('0' + (value / 10));
+      *output++ = (unsigned char)('0' + (value % 10));
+      return output;
+    }
 
-      CopyToGlobal(body, responseBody);
+    // Writes an RFC 1123 date, such as "Sun, 06 Nov 1994 08:49:37 GMT".
+    static unsigned char * WriteHttpDate (unsigned char * output, DateTime value) {
+      static const char * const days[] = { "Sun, ", "Mon, ", "Tue, ", "Wed, ", "Thu, ", "Fri, ", "Sat, " };
+      static const char * const months[] = { " Jan ", " Feb ", " Mar ", " Apr ", " May ", " Jun ", " Jul ", " Aug ", " Sep ", " Oct ", " Nov ", " Dec " };
+
+      value = value.ToUniversalTime();
+      output = WriteAscii(output, days[(int)value.DayOfWeek]);
+      output = WriteTwoDigits(output, value.Day);
+      output = WriteAscii(output, months[value.Month - 1]);
+      output = WriteDecimal(output, (System::UInt64)value.Year);
+      *output++ = ' ';
+      output = WriteTwoDigits(output, value.Hour);
+      *output++ = ':';
+      output = WriteTwoDigits(output, value.Minute);
+      *output++ = ':';
+      output = WriteTwoDigits(output, value.Second);
+      return WriteAscii(output, " GMT");
+    }
+
+    static const char * ReasonPhrase (int statusCode) {
+      switch (statusCode) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 410: return "Gone";
+        case 416: return "Requested Range Not Satisfiable";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        default: return "";
+      }
+    }
 
+    static HGLOBAL CopyHeadersToGlobal (array<String ^> ^ headers, size_t & length) {
+      length = 0;
       if (headers == nullptr)
-          responseHeaders = 0;
-      else {
-        {
-          int sz = 1;
-          for (int i = 0; i < headers->Length; i++)
-            sz += headers[i]->Length + 1;
-          responseHeaders = Marshal::AllocHGlobal(sz).ToPointer();
-          memset(responseHeaders, 0, sz);
-        }
+        return 0;
 
-        {
-          int pos = 0;
-          unsigned char * ptr = (unsigned char *)(void *)responseHeaders;
-          for (int i = 0; i < headers->Length; i++) {
-            int len = headers[i]->Length;
-            IntPtr headerPtr = Marshal::StringToHGlobalAnsi(headers[i]);
-            memcpy(ptr + pos, headerPtr.ToPointer(), len);
-            Marshal::FreeHGlobal(headerPtr);
-            pos += len + 1;
-          }
-        }
+      size_t size = 1;
+      for (int i = 0; i < headers->Length; i++)
+        size += headers[i]->Length + 1;
+
+      unsigned char * result = (unsigned char *)Marshal::AllocHGlobal(IntPtr((Int64)size)).ToPointer();
+      unsigned char * ptr = result;
+      for (int i = 0; i < headers->Length; i++) {
+        ptr = WriteLatin1(ptr, headers[i]);
+        *ptr++ = 0;
       }
+      *ptr = 0;
 
+      length = size;
       return result;
     }
 
-    Context ^ Context::GetContext(::Berkelium::Context * context, bool ownsHandle) {
-      if (!Table)
-        Table = new ContextTable();
-
-      ContextTable::iterator iter = Table->find(context);
-
-      if (iter != Table->end())
-        return iter->second;
-
-      Context ^ result = gcnew Context(context, ownsHandle);
-      Table->operator [](context) = result;
+    static HGLOBAL EncodeHeaders (ProtocolResponse ^ response, size_t & length) {
+      if (response->HeaderFields != nullptr)
+        return response->HeaderFields->Encode(length);
 
-      return result;
+      return CopyHeadersToGlobal(response->Headers, length);
     }
 
-    bool Context::ContextDestroyed (::Berkelium::Context * context) {
-      ContextTable::iterator iter = Table->find(context);
+    HeaderBlock::HeaderBlock (... array<String ^> ^ lines) {
+      int size = 0;
+      for (int i = 0; i < lines->Length; i++)
+        size += lines[i]->Length + 1;
 
-      if (iter != Table->end()) {
-        Table->erase(iter);
-        return true;
-      }
+      Bytes = gcnew array<unsigned char>(size);
+      if (size == 0)
+        return;
 
-      return false;
+      pin_ptr<unsigned char> bytes = &Bytes[0];
+      unsigned char * ptr = bytes;
+      for (int i = 0; i < lines->Length; i++) {
+        ptr = WriteLatin1(ptr, lines[i]);
+        *ptr++ = 0;
+      }
     }
 
-    void ErrorDelegateWrapper::onPureCall() {
-      BerkeliumSharp::OnPureCall();
+    void ResponseHeaders::Add (String ^ line) {
+      if (Lines == nullptr)
+        Lines = gcnew System::Collections::Generic::List<String ^>();
+      Lines->Add(line);
     }
 
-    void ErrorDelegateWrapper::onInvalidParameter(const wchar_t *expression, const wchar_t *function, const wchar_t *file, unsigned int line, uintptr_t reserved) {
-      BerkeliumSharp::OnInvalidParameter(
-        gcnew String(expression),
-        gcnew String(function),
-        gcnew String(file),
-        line
-        );
+    void ResponseHeaders::Add (HeaderBlock ^ block) {
+      if (Blocks == nullptr)
+        Blocks = gcnew System::Collections::Generic::List<HeaderBlock ^>();
+      Blocks->Add(block);
     }
 
-    void ErrorDelegateWrapper::onOutOfMemory() {
-      BerkeliumSharp::OnOutOfMemory();
+    // An upper bound: numbers are assumed to take 20 digits. Each sizeof() includes room for the line's null.
+    size_t ResponseHeaders::GetMaximumLength () {
+      const int NumberLength = 20, DateLength = 29;
+
+      size_t length = sizeof("HTTP/1.1 ") + NumberLength + 1 +
+        ((StatusText != nullptr) ? StatusText->Length : strlen(ReasonPhrase(StatusCode)));
+
+      if (ContentType != nullptr)
+        length += sizeof("Content-Type: ") + ContentType->Length + ((Charset != nullptr) ? (sizeof("; charset=") + Charset->Length) : 0);
+      if (ContentLength >= 0)
+        length += sizeof("Content-Length: ") + NumberLength;
+      if (RangeLength >= 0)
+        length += sizeof("Content-Range: bytes ") + (NumberLength * 3) + 2;
+      if (ContentEncoding != nullptr)
+        length += sizeof("Content-Encoding: ") + ContentEncoding->Length;
+      if (CacheControl != nullptr)
+        length += sizeof("Cache-Control: ") + CacheControl->Length;
+      if (ETag != nullptr)
+        length += sizeof("ETag: ") + ETag->Length;
+      if (LastModified.HasValue)
+        length += sizeof("Last-Modified: ") + DateLength;
+      if (AcceptRanges)
+        length += sizeof("Accept-Ranges: bytes");
+
+      if (Lines != nullptr)
+        for (int i = 0; i < Lines->Count; i++)
+          length += Lines[i]->Length + 1;
+      if (Blocks != nullptr)
+        for (int i = 0; i < Blocks->Count; i++)
+          length += Blocks[i]->Bytes->Length;
+
+      return length + 1;
     }
 
-    void ErrorDelegateWrapper::onAssertion(const char *assertMessage) {
-      BerkeliumSharp::OnAssertion(
-        gcnew String(assertMessage)
-        );
-    }
+    size_t ResponseHeaders::EncodeTo (unsigned char * buffer) {
+      unsigned char * ptr = buffer;
 
-    Widget ^ WindowDelegateWrapper::GetWidget (::Berkelium::Widget * widget, bool ownsHandle) {
-      TWidgetTable::iterator iter = WidgetTable.find(widget);
+      ptr = WriteAscii(ptr, "HTTP/1.1 ");
+      ptr = WriteDecimal(ptr, (System::UInt64)Math::Max(StatusCode, 0));
+      *ptr++ = ' ';
+      ptr = (StatusText != nullptr) ? WriteLatin1(ptr, StatusText) : WriteAscii(ptr, ReasonPhrase(StatusCode));
+      *ptr++ = 0;
 
-      if (iter != WidgetTable.end())
-        return iter->second;
+      if (ContentType != nullptr) {
+        ptr = WriteLatin1(WriteAscii(ptr, "Content-Type: "), ContentType);
+        if (Charset != nullptr)
+          ptr = WriteLatin1(WriteAscii(ptr, "; charset="), Charset);
+        *ptr++ = 0;
+      }
 
-      return (WidgetTable[widget] = gcnew Widget(Owner, widget, ownsHandle));
-    }
+      if (ContentLength >= 0) {
+        ptr = WriteDecimal(WriteAscii(ptr, "Content-Length: "), (System::UInt64)ContentLength);
+        *ptr++ = 0;
+      }
 
-    bool WindowDelegateWrapper::WidgetDestroyed (::Berkelium::Widget * widget) {
-      TWidgetTable::iterator iter = WidgetTable.find(widget);
+      if (RangeLength >= 0) {
+        ptr = WriteAscii(ptr, "Content-Range: bytes ");
+        if (StatusCode == 206) {
+          ptr = WriteDecimal(ptr, (System::UInt64)RangeFirst);
+          *ptr++ = '-';
+          ptr = WriteDecimal(ptr, (System::UInt64)RangeLast);
+        } else {
+          *ptr++ = '*';
+        }
+        *ptr++ = '/';
+        ptr = WriteDecimal(ptr, (System::UInt64)RangeLength);
+        *ptr++ = 0;
+      }
 
-      if (iter != WidgetTable.end()) {
-        WidgetTable.erase(iter);
-        return true;
+      if (ContentEncoding != nullptr) {
+        ptr = WriteLatin1(WriteAscii(ptr, "Content-Encoding: "), ContentEncoding);
+        *ptr++ = 0;
       }
 
-      return false;
-    }
+      if (CacheControl != nullptr) {
+        ptr = WriteLatin1(WriteAscii(ptr, "Cache-Control: "), CacheControl);
+        *ptr++ = 0;
+      }
 
-    void WindowDelegateWrapper::onCursorUpdated (::Berkelium::Window *win, const Berkelium::Cursor &newCursor) {
-      Owner->OnCursorChanged(
-        (IntPtr)newCursor.GetCursor()
-      );
-    }
+      if (ETag != nullptr) {
+        ptr = WriteLatin1(WriteAscii(ptr, "ETag: "), ETag);
+        *ptr++ = 0;
+      }
 
-    void WindowDelegateWrapper::onAddressBarChanged (::Berkelium::Window *win, URLString newURL) {
-      Owner->OnAddressBarChanged(
-        URLToString(newURL)
-        );
+      if (LastModified.HasValue) {
+        ptr = WriteHttpDate(WriteAscii(ptr, "Last-Modified: "), LastModified.Value);
+        *ptr++ = 0;
+      }
+
+      if (AcceptRanges) {
+        ptr = WriteAscii(ptr, "Accept-Ranges: bytes");
+        *ptr++ = 0;
+      }
+
+      if (Lines != nullptr) {
+        for (int i = 0; i < Lines->Count; i++) {
+          ptr = WriteLatin1(ptr, Lines[i]);
+          *ptr++ = 0;
+        }
+      }
+
+      if (Blocks != nullptr) {
+        for (int i = 0; i < Blocks->Count; i++) {
+          array<unsigned char> ^ bytes = Blocks[i]->Bytes;
+          if (bytes->Length == 0)
+            continue;
+
+          pin_ptr<unsigned char> source = &bytes[0];
+          memcpy(ptr, source, bytes->Length);
+          ptr += bytes->Length;
+        }
+      }
+
+      *ptr++ = 0;
+      return (size_t)(ptr - buffer);
     }
 
-    void WindowDelegateWrapper::onStartLoading (::Berkelium::Window *win, URLString newURL) {
-      Owner->OnStartLoading(
-        URLToString(newURL)
-        );
+    HGLOBAL ResponseHeaders::Encode (size_t & length) {
+      unsigned char * result = (unsigned char *)Marshal::AllocHGlobal(IntPtr((Int64)GetMaximumLength())).ToPointer();
+      length = EncodeTo(result);
+      return result;
     }
 
-    void WindowDelegateWrapper::onLoad (::Berkelium::Window *win) {
-      Owner->OnLoad();
+    // The validators and any extra lines carry over to a 304 or 416 response; the entity fields don't.
+    ResponseHeaders ^ ResponseHeaders::CopyForStatus (int statusCode) {
+      ResponseHeaders ^ result = gcnew ResponseHeaders(statusCode);
+      result->CacheControl = CacheControl;
+      result->ETag = ETag;
+      result->LastModified = LastModified;
+      result->Lines = Lines;
+      result->Blocks = Blocks;
+      return result;
     }
 
-    void WindowDelegateWrapper::onProvisionalLoadError(::Berkelium::Window *win, URLString url, int errorCode, bool isMainFrame) {
-      Owner->OnProvisionalLoadError(
-        URLToString(url), errorCode, isMainFrame
-        );
+    array<String ^> ^ ResponseHeaders::ToArray () {
+      array<unsigned char> ^ buffer = gcnew array<unsigned char>((int)GetMaximumLength());
+      size_t length;
+      {
+        pin_ptr<unsigned char> ptr = &buffer[0];
+        length = EncodeTo(ptr);
+      }
+
+      return Encoding::GetEncoding("iso-8859-1")->GetString(buffer, 0, (int)length)->Split(
+        gcnew array<wchar_t> { '\0' }, StringSplitOptions::RemoveEmptyEntries
+      );
     }
 
-    void WindowDelegateWrapper::onCrashed (::Berkelium::Window *win) {
-      Owner->OnCrashed();
+    static array<String ^> ^ HeaderBlockToArray (const char * headers, size_t length) {
+      if (!headers || (length == 0))
+        return gcnew array<String ^>(0);
+
+      String ^ block = gcnew String((signed char *)headers, 0, (int)length);
+      return block->Split(gcnew array<wchar_t> { '\0' }, StringSplitOptions::RemoveEmptyEntries);
     }
 
-    void WindowDelegateWrapper::onUnresponsive (::Berkelium::Window *win) {
-      Owner->OnUnresponsive();
+    // Returns the trimmed value of the first header with the given name, or null.
+    static String ^ FindHeader (array<String ^> ^ headers, String ^ name) {
+      if (headers == nullptr)
+        return nullptr;
+
+      for (int i = 0; i < headers->Length; i++) {
+        String ^ header = headers[i];
+        if ((header->Length > name->Length) && (header[name->Length] == ':') &&
+            (String::Compare(header, 0, name, 0, name->Length, StringComparison::OrdinalIgnoreCase) == 0))
+          return header->Substring(name->Length + 1)->Trim();
+      }
+
+      return nullptr;
     }
 
-    void WindowDelegateWrapper::onResponsive (::Berkelium::Window *win) {
-      Owner->OnResponsive();
+    // Replaces the status line and drops the named headers, then appends extraHeaders.
+    static array<String ^> ^ RewriteHeaders (array<String ^> ^ headers, String ^ statusLine, array<String ^> ^ removedNames, ... array<String ^> ^ extraHeaders) {
+      System::Collections::Generic::List<String ^> ^ result = gcnew System::Collections::Generic::List<String ^>();
+      result->Add(statusLine);
+
+      if (headers != nullptr) {
+        for (int i = 0; i < headers->Length; i++) {
+          String ^ header = headers[i];
+          if (header->StartsWith("HTTP/", StringComparison::Ordinal))
+            continue;
+
+          bool removed = false;
+          for (int j = 0; j < removedNames->Length; j++) {
+            String ^ name = removedNames[j];
+            if ((header->Length > name->Length) && (header[name->Length] == ':') &&
+                (String::Compare(header, 0, name, 0, name->Length, StringComparison::OrdinalIgnoreCase) == 0)) {
+              removed = true;
+              break;
+            }
+          }
+
+          if (!removed)
+            result->Add(header);
+        }
+      }
+
+      for (int i = 0; i < extraHeaders->Length; i++)
+        if (extraHeaders[i] != nullptr)
+          result->Add(extraHeaders[i]);
+
+      return result->ToArray();
     }
 
-    void WindowDelegateWrapper::onExternalHost (::Berkelium::Window *win, WideString message, URLString origin, URLString target) {
-      // FIXME: Add external host support.
+    static bool IsStatus (array<String ^> ^ headers, String ^ code) {
+      if ((headers == nullptr) || (headers->Length == 0) || !headers[0]->StartsWith("HTTP/", StringComparison::Ordinal))
+        return false;
+
+      array<String ^> ^ parts = headers[0]->Split(gcnew array<wchar_t> { ' ' }, StringSplitOptions::RemoveEmptyEntries);
+      return (parts->Length >= 2) && (parts[1] == code);
     }
 
-    void WindowDelegateWrapper::onCreatedWindow (::Berkelium::Window *win, ::Berkelium::Window *newWindow, const ::Berkelium::Rect &initialRect) {
-      Owner->OnCreatedWindow(
-        gcnew Window(Owner->Context, newWindow, true),
-        gcnew Rect(initialRect.left(), initialRect.top(), initialRect.width(), initialRect.height()),
-        gcnew String("", 0, 0) // FIXME: Chromium no longer sends us the URL.
-      );
+    static String ^ FormatHttpDate (DateTime value) {
+      return value.ToUniversalTime().ToString("r", System::Globalization::CultureInfo::InvariantCulture);
     }
 
-    void WindowDelegateWrapper::onPaint (::Berkelium::Window *win, const unsigned char *sourceBuffer, const ::Berkelium::Rect &rect, size_t numCopyRects, const ::Berkelium::Rect *copyRects, int dx, int dy, const ::Berkelium::Rect &scrollRect) {
-      Owner->OnPaint(
-        IntPtr((void *)sourceBuffer),
-        gcnew Rect(rect.left(), rect.top(), rect.width(), rect.height()),
-        // FIXME: Need to pass on copy rects to avoid extra copy.
-        // numCopyRects,
-        // gcnew Array<Rect>(copyRects[i].leftcopyRects[i].top(), copyRects[i].width(), copyRects[i].height()), 
-        dx, dy,
-        gcnew Rect(scrollRect.left(), scrollRect.top(), scrollRect.width(), scrollRect.height())
+    static bool TryParseHttpDate (String ^ value, DateTime % result) {
+      return DateTime::TryParse(
+        value, System::Globalization::CultureInfo::InvariantCulture,
+        System::Globalization::DateTimeStyles::AdjustToUniversal | System::Globalization::DateTimeStyles::AssumeUniversal,
+        result
       );
     }
 
-    void WindowDelegateWrapper::onCrashedWorker(::Berkelium::Window *win) {
-      Owner->OnCrashedWorker();
+    // HTTP dates only have a resolution of one second.
+    static DateTime TruncateToSeconds (DateTime value) {
+      value = value.ToUniversalTime();
+      return DateTime(value.Ticks - (value.Ticks % TimeSpan::TicksPerSecond), DateTimeKind::Utc);
     }
 
-    void WindowDelegateWrapper::onCrashedPlugin(::Berkelium::Window *win, WideString pluginName) {
-      Owner->OnCrashedPlugin(
-        gcnew String(pluginName.data(), 0, pluginName.length())
-        );
-    }
+    // Weak comparison, as If-None-Match uses.
+    static bool MatchesAnyETag (String ^ etag, String ^ candidates) {
+      if (candidates->Trim() == "*")
+        return true;
 
-    void WindowDelegateWrapper::onConsoleMessage(::Berkelium::Window *win, WideString sourceId, WideString message, int line_no) {
-      Owner->OnConsoleMessage(
-        gcnew String(sourceId.data(), 0, sourceId.length()),
-        gcnew String(message.data(), 0, message.length()),
-        line_no
-        );
+      String ^ tag = etag->StartsWith("W/", StringComparison::Ordinal) ? etag->Substring(2) : etag;
+      array<String ^> ^ list = candidates->Split(',');
+      for (int i = 0; i < list->Length; i++) {
+        String ^ candidate = list[i]->Trim();
+        if (candidate->StartsWith("W/", StringComparison::Ordinal))
+          candidate = candidate->Substring(2);
+        if (candidate == tag)
+          return true;
+      }
+
+      return false;
     }
 
-    void WindowDelegateWrapper::onScriptAlert(::Berkelium::Window *win, WideString message, WideString defaultValue, URLString url, int flags, bool &success, WideString &value) {
+    static bool IsNotModified (ProtocolResponse ^ response, array<String ^> ^ requestHeaders) {
+      // If-Modified-Since is only consulted when there's no If-None-Match.
+      String ^ ifNoneMatch = FindHeader(requestHeaders, "If-None-Match");
+      if (ifNoneMatch != nullptr)
+        return (response->ETag != nullptr) && MatchesAnyETag(response->ETag, ifNoneMatch);
+
+      String ^ ifModifiedSince = FindHeader(requestHeaders, "If-Modified-Since");
+      DateTime since;
+      if ((ifModifiedSince == nullptr) || !response->LastModified.HasValue || !TryParseHttpDate(ifModifiedSince, since))
+        return false;
+
+      return TruncateToSeconds(response->LastModified.Value) <= since;
+    }
+
+    // If-Range needs a strong match: a weak tag or a stale date means the whole body is sent instead.
+    static bool MatchesIfRange (ProtocolResponse ^ response, String ^ ifRange) {
+      if (ifRange->StartsWith("\"", StringComparison::Ordinal))
+        return (response->ETag != nullptr) && !response->ETag->StartsWith("W/", StringComparison::Ordinal) && (ifRange == response->ETag);
+
+      DateTime date;
+      if (!response->LastModified.HasValue || !TryParseHttpDate(ifRange, date))
+        return false;
+
+      return TruncateToSeconds(response->LastModified.Value) == date;
+    }
+
+    enum class ByteRange {
+      Ignored,
+      Satisfiable,
+      Unsatisfiable
+    };
+
+    // Parses a single "bytes=first-last", "bytes=first-" or "bytes=-suffix" range.
+    //  Multiple ranges and anything malformed are ignored, and the whole body is sent.
+    static ByteRange ParseByteRange (String ^ value, Int64 length, Int64 % first, Int64 % last) {
+      if (!value->StartsWith("bytes=", StringComparison::OrdinalIgnoreCase))
+        return ByteRange::Ignored;
+
+      String ^ spec = value->Substring(6)->Trim();
+      int dash = spec->IndexOf('-');
+      if ((dash < 0) || (spec->IndexOf(',') >= 0))
+        return ByteRange::Ignored;
+
+      String ^ firstText = spec->Substring(0, dash)->Trim();
+      String ^ lastText = spec->Substring(dash + 1)->Trim();
+      System::Globalization::NumberStyles digits = System::Globalization::NumberStyles::None;
+      System::Globalization::CultureInfo ^ invariant = System::Globalization::CultureInfo::InvariantCulture;
+
+      if (firstText->Length == 0) {
+        Int64 suffix;
+        if (!Int64::TryParse(lastText, digits, invariant, suffix))
+          return ByteRange::Ignored;
+        if ((suffix == 0) || (length == 0))
+          return ByteRange::Unsatisfiable;
+
+        first = Math::Max((Int64)0, length - suffix);
+        last = length - 1;
+        return ByteRange::Satisfiable;
+      }
+
+      if (!Int64::TryParse(firstText, digits, invariant, first))
+        return ByteRange::Ignored;
+
+      if (lastText->Length == 0) {
+        last = length - 1;
+      } else {
+        if (!Int64::TryParse(lastText, digits, invariant, last) || (last < first))
+          return ByteRange::Ignored;
+        last = Math::Min(last, length - 1);
+      }
+
+      return (first < length) ? ByteRange::Satisfiable : ByteRange::Unsatisfiable;
+    }
+
+    // Runs OpenResponse for asynchronous protocol requests. Threads are started as requests queue up,
+    //  up to MaxThreads, and exit again once they have been idle for a while.
+    ref class ProtocolWorkerPool abstract sealed {
+    internal:
+      literal int IdleTimeoutMilliseconds = 30000;
+
+      static Object ^ Lock = gcnew Object();
+      static System::Collections::Generic::Queue<ProtocolRequest ^> ^ Pending = gcnew System::Collections::Generic::Queue<ProtocolRequest ^>();
+      static int MaxThreads = Math::Max(2, Environment::ProcessorCount);
+      static int ThreadCount, IdleCount;
+
+      static void Enqueue (ProtocolRequest ^ request) {
+        msclr::lock l(Lock);
+        Pending->Enqueue(request);
+
+        if ((Pending->Count > IdleCount) && (ThreadCount < MaxThreads)) {
+          ThreadCount += 1;
+          System::Threading::Thread ^ thread = gcnew System::Threading::Thread(gcnew System::Threading::ThreadStart(&ProtocolWorkerPool::Run));
+          thread->Name = "Berkelium protocol worker";
+          thread->IsBackground = true;
+          thread->Start();
+        } else {
+          System::Threading::Monitor::Pulse(Lock);
+        }
+      }
+
+      static void Run () {
+        NativeProfiler::nameThread("Berkelium protocol worker");
+
+        for (;;) {
+          ProtocolRequest ^ request;
+
+          {
+            msclr::lock l(Lock);
+            for (;;) {
+              // Threads beyond a lowered MaxThreads leave as soon as they finish their request.
+              if (ThreadCount > MaxThreads) {
+                ThreadCount -= 1;
+                return;
+              }
+
+              if (Pending->Count > 0)
+                break;
+
+              IdleCount += 1;
+              bool woken = System::Threading::Monitor::Wait(Lock, IdleTimeoutMilliseconds);
+              IdleCount -= 1;
+
+              if (!woken && (Pending->Count == 0)) {
+                ThreadCount -= 1;
+                return;
+              }
+            }
+
+            request = Pending->Dequeue();
+          }
+
+          request->Handler->ServeRequest(request);
+        }
+      }
+    };
+
+    ProtocolHandler::ProtocolHandler (
+      Managed::Context ^ context, 
+      String ^ scheme
+    )
+      : Scheme(scheme)
+      , Context(context)
+    {
+      Native = new NativeProtocolHandler(this);
+
+      IntPtr schemePtr = Marshal::StringToHGlobalAnsi(scheme);
+
+      // FIXME: registerProtocol not defined.
+      // context->Native->registerProtocol((const char *)schemePtr.ToPointer(), scheme->Length, Native);
+
+      Marshal::FreeHGlobal(schemePtr);
+    }
+
+    ProtocolHandler::~ProtocolHandler () {
+      if (Native) {
+        IntPtr schemePtr = Marshal::StringToHGlobalAnsi(Scheme);
+        // FIXME: unregisterProtocol not defined.
+        // Context->Native->unregisterProtocol((const char *)schemePtr.ToPointer(), Scheme->Length);
+        Marshal::FreeHGlobal(schemePtr);
+
+        delete Native;
+        Native = 0;
+        
+        Scheme = nullptr;
+        Context = nullptr;
+      }
+    }
+
+#pragma managed(push, off)
+    const AssetBundleEntry * NativeProtocolHandler::FindBundleEntry(const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength) {
+      if (!Bundle || IsConditionalRequest(requestHeaders, requestHeadersLength))
+        return 0;
+
+      return Bundle->findUrl(url, urlLength);
+    }
+
+    // Bundle entries and cache hits are answered here without ever entering managed code.
+    bool NativeProtocolHandler::HandleRequest(const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders) {
+      NativeLatencyScope latency (NativeLatencyHistogram::Protocol);
+      NativeStatCounters::Process.add(StatProtocolRequests, 1);
+
+      bool succeeded = AnswerRequest(url, urlLength, requestHeaders, requestHeadersLength, responseBody, responseHeaders);
+      if (succeeded && responseBody)
+        NativeStatCounters::Process.add(StatProtocolBytes, (long long)LocalSize(responseBody));
+
+      return succeeded;
+    }
+
+    bool NativeProtocolHandler::AnswerRequest(const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders) {
+      const AssetBundleEntry * entry = FindBundleEntry(url, urlLength, requestHeaders, requestHeadersLength);
+      if (entry) {
+        size_t headersLength;
+        responseBody = Bundle->copyBody(entry);
+        responseHeaders = Bundle->copyHeaders(entry, headersLength);
+        return true;
+      }
+
+      bool succeeded;
+      if (Cache && !IsConditionalRequest(requestHeaders, requestHeadersLength) && Cache->serve(url, urlLength, responseBody, responseHeaders, succeeded))
+        return succeeded;
+
+      return HandleUncachedRequest(url, urlLength, requestHeaders, requestHeadersLength, responseBody, responseHeaders);
+    }
+
+    // The body's bytes are counted as they're read.
+    NativeProtocolResponse * NativeProtocolHandler::OpenRequest(const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength) {
+      NativeLatencyScope latency (NativeLatencyHistogram::Protocol);
+      NativeStatCounters::Process.add(StatProtocolRequests, 1);
+
+      const AssetBundleEntry * entry = FindBundleEntry(url, urlLength, requestHeaders, requestHeadersLength);
+      if (entry) {
+        size_t headersLength;
+        return new NativeProtocolResponse(Bundle, entry, Bundle->copyHeaders(entry, headersLength));
+      }
+
+      NativeCachedResponse * cached = (Cache && !IsConditionalRequest(requestHeaders, requestHeadersLength)) ? Cache->lookup(url, urlLength) : 0;
+      if (cached)
+        return OpenCachedRequest(cached);
+
+      return OpenUncachedRequest(url, urlLength, requestHeaders, requestHeadersLength);
+    }
+
+    NativeProtocolRequest * NativeProtocolHandler::BeginRequest(const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, NativeProtocolRequestClient * client) {
+      NativeLatencyScope latency (NativeLatencyHistogram::Protocol);
+      NativeStatCounters::Process.add(StatProtocolRequests, 1);
+
+      // Reading out of the mapping never blocks for long, so there's no point handing these to a worker.
+      const AssetBundleEntry * entry = FindBundleEntry(url, urlLength, requestHeaders, requestHeadersLength);
+      if (entry) {
+        size_t headersLength;
+        client->onResponseReady(new NativeProtocolResponse(Bundle, entry, Bundle->copyHeaders(entry, headersLength)));
+        return 0;
+      }
+
+      NativeCachedResponse * cached = (Cache && !IsConditionalRequest(requestHeaders, requestHeadersLength)) ? Cache->lookup(url, urlLength) : 0;
+      if (cached) {
+        client->onResponseReady(OpenCachedRequest(cached));
+        return 0;
+      }
+
+      // ProtocolRequest measures these itself, up to when they complete.
+      latency.cancel();
+      return BeginUncachedRequest(url, urlLength, requestHeaders, requestHeadersLength, client);
+    }
+
+    size_t NativeProtocolResponse::Read (void * buffer, size_t capacity) {
+      if (Mapped) {
+        size_t readBytes = (capacity < MappedLength - Position) ? capacity : MappedLength - Position;
+        memcpy(buffer, Mapped + Position, readBytes);
+        Position += readBytes;
+        NativeStatCounters::Process.add(StatProtocolBytes, (long long)readBytes);
+        return readBytes;
+      }
+
+      if (Cached) {
+        size_t readBytes = Cached->readBody(Position, buffer, capacity);
+        Position += readBytes;
+        NativeStatCounters::Process.add(StatProtocolBytes, (long long)readBytes);
+        return readBytes;
+      }
+
+      size_t readBytes = ReadManaged(buffer, capacity);
+      NativeStatCounters::Process.add(StatProtocolBytes, (long long)readBytes);
+
+      if (Filling) {
+        if (readBytes > 0)
+          Filling->appendBody(buffer, readBytes);
+
+        if ((readBytes == 0) || (Filling->byteSize() > Cache->byteBudget())) {
+          // Bodies that outgrow the cache are simply not cached.
+          if (readBytes == 0)
+            Cache->insert(Filling);
+
+          Filling->release();
+          Filling = 0;
+        }
+      }
+
+      return readBytes;
+    }
+
+    long long NativeProtocolResponse::RemainingLength () {
+      if (Mapped)
+        return (long long)(MappedLength - Position);
+
+      if (Cached)
+        return (long long)(Cached->Body.size() - Position);
+
+      return RemainingLengthManaged();
+    }
+#pragma managed(pop)
+
+    bool NativeProtocolHandler::HandleUncachedRequest(const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders) {
+      return Owner->DoHandleRequest(url, urlLength, requestHeaders, requestHeadersLength, responseBody, responseHeaders);
+    }
+
+    NativeProtocolResponse * NativeProtocolHandler::OpenUncachedRequest(const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength) {
+      return Owner->DoOpenRequest(url, urlLength, requestHeaders, requestHeadersLength);
+    }
+
+    NativeProtocolRequest * NativeProtocolHandler::BeginUncachedRequest(const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, NativeProtocolRequestClient * client) {
+      return Owner->DoBeginRequest(url, urlLength, requestHeaders, requestHeadersLength, client);
+    }
+
+    NativeProtocolResponse * NativeProtocolHandler::OpenCachedRequest(NativeCachedResponse * cached) {
+      return new NativeProtocolResponse(cached);
+    }
+
+    void ProtocolHandler::CacheByteBudget::set (Int64 value) {
+      if (value < 0)
+        throw gcnew ArgumentOutOfRangeException("value");
+
+      if (!Native->Cache) {
+        if (value == 0)
+          return;
+
+        Native->Cache = new NativeResponseCache();
+      }
+
+      Native->Cache->setByteBudget((size_t)value);
+    }
+
+    bool ProtocolHandler::InvalidateCachedResponse (String ^ url) {
+      if (!Native || !Native->Cache)
+        return false;
+
+      pin_ptr<const wchar_t> urlPtr = PtrToStringChars(url);
+      return Native->Cache->invalidate(urlPtr, url->Length);
+    }
+
+    ProtocolResponse ^ ProtocolHandler::Respond(String ^ url, array<String ^> ^ requestHeaders) {
+      return ApplyRequestHeaders(this->OpenResponse(url, requestHeaders), requestHeaders);
+    }
+
+    ProtocolResponse ^ ProtocolHandler::ApplyRequestHeaders(ProtocolResponse ^ response, array<String ^> ^ requestHeaders) {
+      if ((response == nullptr) || !response->Succeeded)
+        return response;
+
+      ResponseHeaders ^ fields = response->HeaderFields;
+      if ((fields != nullptr) ? (fields->StatusCode != 200) : !IsStatus(response->Headers, "200"))
+        return response;
+
+      bool seekable = (response->Body != nullptr) && response->Body->CanSeek;
+
+      // Advertise what the page can make conditional or ranged requests with.
+      if (fields != nullptr) {
+        if (fields->ETag == nullptr)
+          fields->ETag = response->ETag;
+        if (!fields->LastModified.HasValue)
+          fields->LastModified = response->LastModified;
+        if (seekable)
+          fields->AcceptRanges = true;
+      } else {
+        String ^ etagHeader = (response->ETag != nullptr) ? "ETag: " + response->ETag : nullptr;
+        String ^ lastModifiedHeader = response->LastModified.HasValue ? "Last-Modified: " + FormatHttpDate(response->LastModified.Value) : nullptr;
+
+        response->Headers = RewriteHeaders(
+          response->Headers, response->Headers[0],
+          gcnew array<String ^> { "ETag", "Last-Modified", "Accept-Ranges" },
+          etagHeader, lastModifiedHeader, seekable ? gcnew String("Accept-Ranges: bytes") : nullptr
+        );
+      }
+
+      if ((requestHeaders == nullptr) || (requestHeaders->Length == 0))
+        return response;
+
+      if (IsNotModified(response, requestHeaders)) {
+        ProtocolResponse ^ result;
+        if (fields != nullptr) {
+          result = gcnew ProtocolResponse(fields->CopyForStatus(304), nullptr);
+        } else {
+          result = gcnew ProtocolResponse(true, RewriteHeaders(
+            response->Headers, "HTTP/1.1 304 Not Modified",
+            gcnew array<String ^> { "Content-Length", "Content-Type", "Accept-Ranges" }
+          ), nullptr);
+        }
+        result->Cacheable = false;
+        delete response;
+        return result;
+      }
+
+      String ^ range = FindHeader(requestHeaders, "Range");
+      if ((range == nullptr) || !seekable)
+        return response;
+
+      String ^ ifRange = FindHeader(requestHeaders, "If-Range");
+      if ((ifRange != nullptr) && !MatchesIfRange(response, ifRange))
+        return response;
+
+      Int64 length = response->GetRemainingLength(), first, last;
+      switch (ParseByteRange(range, length, first, last)) {
+        case ByteRange::Unsatisfiable: {
+          ProtocolResponse ^ result;
+          if (fields != nullptr) {
+            ResponseHeaders ^ headers = fields->CopyForStatus(416);
+            headers->RangeLength = length;
+            result = gcnew ProtocolResponse(headers, nullptr);
+          } else {
+            result = gcnew ProtocolResponse(false, RewriteHeaders(
+              response->Headers, "HTTP/1.1 416 Requested Range Not Satisfiable",
+              gcnew array<String ^> { "Content-Length", "Content-Range" },
+              String::Format("Content-Range: bytes */{0}", length)
+            ), nullptr);
+          }
+          result->Cacheable = false;
+          delete response;
+          return result;
+        }
+
+        case ByteRange::Satisfiable:
+          // Only the requested bytes are ever read from the body.
+          response->Body->Seek(first, SeekOrigin::Current);
+          response->Limit = last - first + 1;
+          response->Cacheable = false;
+
+          if (fields != nullptr) {
+            fields->StatusCode = 206;
+            fields->StatusText = nullptr;
+            fields->ContentLength = response->Limit;
+            fields->RangeFirst = first;
+            fields->RangeLast = last;
+            fields->RangeLength = length;
+          } else {
+            response->Headers = RewriteHeaders(
+              response->Headers, "HTTP/1.1 206 Partial Content",
+              gcnew array<String ^> { "Content-Length", "Content-Range" },
+              String::Format("Content-Range: bytes {0}-{1}/{2}", first, last, length),
+              String::Format("Content-Length: {0}", response->Limit)
+            );
+          }
+          return response;
+
+        default:
+          return response;
+      }
+    }
+
+    ProtocolResponse ^ ProtocolHandler::OpenResponse(String ^ url) {
+      array<unsigned char> ^ body = nullptr;
+      array<String ^> ^ headers = nullptr;
+
+      bool result = this->HandleRequest(
+        url, body, headers
+      );
+
+      // Wrap the body rather than copying it.
+      ProtocolResponse ^ response = gcnew ProtocolResponse(
+        result, headers, (body != nullptr) ? gcnew MemoryStream(body, false) : nullptr
+      );
+      response->BodyBuffer = body;
+
+      return response;
+    }
+
+    NativeProtocolResponse * ProtocolHandler::DoOpenRequest(const wchar_t * urlPtr, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength) {
+      NativeProfileScope span ("protocol", "ProtocolHandler::DoOpenRequest");
+
+      String ^ url = gcnew String(urlPtr, 0, urlLength);
+
+      ProtocolResponse ^ response = Respond(url, HeaderBlockToArray(requestHeaders, requestHeadersLength));
+      if (response == nullptr)
+        return 0;
+
+      return WrapResponse(response, urlPtr, urlLength);
+    }
+
+    NativeProtocolResponse * ProtocolHandler::WrapResponse(ProtocolResponse ^ response, const wchar_t * urlPtr, size_t urlLength) {
+      size_t headersLength;
+      NativeProtocolResponse * result = new NativeProtocolResponse(response, EncodeHeaders(response, headersLength));
+
+      // The body is copied into the cache as it's streamed, and only inserted once all of it has been read.
+      NativeResponseCache * cache = Native->Cache;
+      if (cache && (cache->byteBudget() > 0) && response->Succeeded && response->Cacheable) {
+        cache->addRef();
+        result->Cache = cache;
+        result->Filling = new NativeCachedResponse(urlPtr, urlLength, result->Headers, headersLength, true);
+      }
+
+      return result;
+    }
+
+    NativeProtocolRequest * ProtocolHandler::DoBeginRequest(const wchar_t * urlPtr, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, NativeProtocolRequestClient * client) {
+      ProtocolRequest ^ request = gcnew ProtocolRequest(
+        this, gcnew String(urlPtr, 0, urlLength), HeaderBlockToArray(requestHeaders, requestHeadersLength), client
+      );
+      NativeProtocolRequest * result = new NativeProtocolRequest(request);
+
+      try {
+        this->BeginResponse(request);
+      } catch (Exception ^) {
+        delete result;
+        throw;
+      }
+
+      // Handlers are free to complete the request before BeginResponse returns.
+      msclr::lock l(request);
+      if (request->Completed) {
+        delete result;
+        return 0;
+      }
+
+      return result;
+    }
+
+    void ProtocolHandler::BeginResponse(ProtocolRequest ^ request) {
+      ProtocolWorkerPool::Enqueue(request);
+    }
+
+    void ProtocolHandler::BeginRequest(String ^ url, array<String ^> ^ requestHeaders, System::Action<ProtocolResponse ^> ^ callback) {
+      if (url == nullptr)
+        throw gcnew ArgumentNullException("url");
+      if (callback == nullptr)
+        throw gcnew ArgumentNullException("callback");
+      if (!Native)
+        throw gcnew ObjectDisposedException("ProtocolHandler");
+
+      ProtocolRequest ^ request = gcnew ProtocolRequest(this, url, (requestHeaders != nullptr) ? requestHeaders : gcnew array<String ^>(0), 0);
+      request->Callback = callback;
+      this->BeginResponse(request);
+    }
+
+    void ProtocolHandler::ServeRequest(ProtocolRequest ^ request) {
+      NativeProfileScope span ("protocol", "ProtocolHandler::ServeRequest");
+
+      // Requests that were cancelled while they were queued never reach the handler.
+      if (request->IsCancelled || !Native) {
+        request->Complete(nullptr);
+        return;
+      }
+
+      ProtocolResponse ^ response;
+      try {
+        response = this->OpenResponse(request->Url, request->RequestHeaders);
+      } catch (Exception ^) {
+        // There is no caller on this thread to rethrow to, so the page gets the error instead.
+        response = gcnew ProtocolResponse(false, gcnew array<String ^> { "HTTP/1.1 500 Internal Server Error" }, nullptr);
+      }
+
+      request->Complete(response);
+    }
+
+    int ProtocolHandler::MaxWorkerThreads::get () {
+      return ProtocolWorkerPool::MaxThreads;
+    }
+
+    void ProtocolHandler::MaxWorkerThreads::set (int value) {
+      if (value < 1)
+        throw gcnew ArgumentOutOfRangeException("value");
+
+      msclr::lock l(ProtocolWorkerPool::Lock);
+      ProtocolWorkerPool::MaxThreads = value;
+    }
+
+    void ProtocolRequest::Complete (ProtocolResponse ^ response) {
+      // The client is called while the lock is held, so cancelling waits for a delivery that is already under way.
+      msclr::lock l(this);
+      if (Completed)
+        throw gcnew InvalidOperationException("The request has already been completed.");
+
+      Completed = true;
+      NativeProtocolRequestClient * client = Client;
+      Client = 0;
+
+      if (Callback != nullptr) {
+        Callback(ProtocolHandler::ApplyRequestHeaders(response, RequestHeaders));
+        return;
+      }
+
+      if (!client || Cancelled || !Handler->Native) {
+        if (response != nullptr)
+          delete response;
+        return;
+      }
+
+      NativeLatencyHistogram::Protocol.recordSince(Started);
+
+      response = ProtocolHandler::ApplyRequestHeaders(response, RequestHeaders);
+
+      NativeProtocolResponse * result = 0;
+      if (response != nullptr) {
+        pin_ptr<const wchar_t> urlPtr = PtrToStringChars(Url);
+        result = Handler->WrapResponse(response, urlPtr, Url->Length);
+      }
+
+      client->onResponseReady(result);
+    }
+
+    void ProtocolRequest::Cancel () {
+      msclr::lock l(this);
+      Cancelled = true;
+      Client = 0;
+    }
+
+    NativeProtocolRequest::~NativeProtocolRequest () {
+      ProtocolRequest ^ owner = Owner;
+      if (owner != nullptr)
+        owner->Cancel();
+    }
+
+    bool ProtocolHandler::DoHandleRequest(const wchar_t * urlPtr, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders) {
+      NativeProfileScope span ("protocol", "ProtocolHandler::DoHandleRequest");
+
+      String ^ url = gcnew String(urlPtr, 0, urlLength);
+
+      ProtocolResponse ^ response = Respond(url, HeaderBlockToArray(requestHeaders, requestHeadersLength));
+      if (response == nullptr) {
+        responseBody = 0;
+        responseHeaders = 0;
+        return false;
+      }
+
+      try {
+        size_t headersLength;
+        size_t bodyLength = CopyToGlobal(response, responseBody);
+        responseHeaders = EncodeHeaders(response, headersLength);
+
+        NativeResponseCache * cache = Native->Cache;
+        if (cache && (cache->byteBudget() > 0) && response->Succeeded && response->Cacheable) {
+          NativeCachedResponse * cached = new NativeCachedResponse(urlPtr, urlLength, responseHeaders, headersLength, true);
+          if (responseBody)
+            cached->appendBody(responseBody, bodyLength);
+          cache->insert(cached);
+          cached->release();
+        }
+
+        return response->Succeeded;
+      } finally {
+        delete response;
+      }
+    }
+
+    // Reads an entry straight out of a bundle's mapping, and keeps the bundle mapped until it is disposed.
+    ref class MappedAssetStream : public UnmanagedMemoryStream {
+      NativeAssetBundle * Bundle;
+
+    public:
+      MappedAssetStream (NativeAssetBundle * bundle, const AssetBundleEntry * entry)
+        : UnmanagedMemoryStream(const_cast<unsigned char *>(bundle->data(entry)), (Int64)entry->DataLength)
+        , Bundle(bundle) {
+        bundle->addRef();
+      }
+
+      ~MappedAssetStream () {
+        this->!MappedAssetStream();
+      }
+
+      !MappedAssetStream () {
+        if (Bundle)
+          Bundle->release();
+        Bundle = 0;
+      }
+    };
+
+    AssetBundleProtocolHandler::AssetBundleProtocolHandler (
+      Managed::Context ^ context,
+      String ^ scheme,
+      String ^ bundleFilename
+    )
+      : ProtocolHandler(context, scheme)
+    {
+      pin_ptr<const wchar_t> filenamePtr = PtrToStringChars(bundleFilename);
+      NativeAssetBundle * bundle = NativeAssetBundle::open(filenamePtr);
+      if (!bundle)
+        throw gcnew IOException(String::Format("'{0}' could not be opened as an asset bundle.", bundleFilename));
+
+      Native->Bundle = bundle;
+    }
+
+    ProtocolResponse ^ AssetBundleProtocolHandler::OpenResponse (String ^ url) {
+      NativeAssetBundle * bundle = Native ? Native->Bundle : 0;
+      pin_ptr<const wchar_t> urlPtr = PtrToStringChars(url);
+      const AssetBundleEntry * entry = bundle ? bundle->findUrl(urlPtr, url->Length) : 0;
+
+      if (!entry)
+        return gcnew ProtocolResponse(gcnew ResponseHeaders(404), nullptr);
+
+      ResponseHeaders ^ headers = gcnew ResponseHeaders(200);
+      headers->ContentType = gcnew String((signed char *)bundle->text(entry->MimeTypeOffset), 0, (int)entry->MimeTypeLength, Encoding::UTF8);
+      headers->ContentLength = (Int64)entry->DataLength;
+      headers->AcceptRanges = true;
+      if (entry->ETagLength > 0)
+        headers->ETag = gcnew String((signed char *)bundle->text(entry->ETagOffset), 0, (int)entry->ETagLength, Encoding::UTF8);
+      if (entry->Flags & AssetBundleGzip)
+        headers->ContentEncoding = "gzip";
+
+      ProtocolResponse ^ response = gcnew ProtocolResponse(headers, gcnew MappedAssetStream(bundle, entry));
+      // The bundle is already in memory; caching its entries would only copy them.
+      response->Cacheable = false;
+
+      return response;
+    }
+
+    NativeProtocolResponse::~NativeProtocolResponse () {
+      if (Headers)
+        Marshal::FreeHGlobal(IntPtr(Headers));
+      Headers = 0;
+
+      // A response that was cancelled part way through never makes it into the cache.
+      if (Filling)
+        Filling->release();
+      if (Cache)
+        Cache->release();
+      if (Cached)
+        Cached->release();
+      if (Bundle)
+        Bundle->release();
+      Filling = 0;
+      Cache = 0;
+      Cached = 0;
+      Bundle = 0;
+      Mapped = 0;
+
+      ProtocolResponse ^ owner = Owner;
+      if (owner != nullptr)
+        delete owner;
+    }
+
+    size_t NativeProtocolResponse::ReadManaged (void * buffer, size_t capacity) {
+      return Owner->Read((unsigned char *)buffer, capacity);
+    }
+
+    long long NativeProtocolResponse::RemainingLengthManaged () {
+      return Owner->GetRemainingLength();
+    }
+
+    size_t ProtocolResponse::Read (unsigned char * buffer, size_t capacity) {
+      if (Limit < 0)
+        return ReadBody(buffer, capacity);
+
+      if ((System::UInt64)capacity > (System::UInt64)Limit)
+        capacity = (size_t)Limit;
+
+      size_t readBytes = ReadBody(buffer, capacity);
+      Limit -= (Int64)readBytes;
+      return readBytes;
+    }
+
+    size_t ProtocolResponse::ReadBody (unsigned char * buffer, size_t capacity) {
+      if ((Body == nullptr) || (capacity == 0))
+        return 0;
+
+      // A body that is already in memory is copied straight out of its array.
+      if (BodyBuffer != nullptr) {
+        Int64 position = Body->Position;
+        Int64 remaining = Body->Length - position;
+        if (remaining <= 0)
+          return 0;
+
+        size_t count = (size_t)Math::Min((Int64)capacity, remaining);
+        pin_ptr<unsigned char> ptr = &BodyBuffer[0];
+        memcpy(buffer, ptr + position, count);
+        Body->Position = position + count;
+
+        return count;
+      }
+
+      // Only as much as the caller has room for is read, so a slow consumer never makes us buffer ahead.
+      int count = (int)Math::Min((System::UInt64)capacity, (System::UInt64)ChunkSize);
+      if ((Chunk == nullptr) || (Chunk->Length < count))
+        Chunk = gcnew array<unsigned char>(count);
+
+      int readBytes = Body->Read(Chunk, 0, count);
+      if (readBytes > 0) {
+        pin_ptr<unsigned char> ptr = &Chunk[0];
+        memcpy(buffer, ptr, readBytes);
+      }
+
+      return readBytes > 0 ? readBytes : 0;
+    }
+
+    Int64 ProtocolResponse::GetRemainingLength () {
+      if ((Body == nullptr) || !Body->CanSeek)
+        return (Body == nullptr) ? 0 : -1;
+
+      Int64 remaining = Body->Length - Body->Position;
+      return (Limit >= 0) ? Math::Min(Limit, remaining) : remaining;
+    }
+
+    Context ^ Context::GetContext(::Berkelium::Context * context, bool ownsHandle) {
+      if (!Table)
+        Table = new ContextTable();
+
+      Context ^ result = Table->find(context);
+
+      if (result)
+        return result;
+
+      result = gcnew Context(context, ownsHandle);
+      Table->insert(context, result);
+
+      return result;
+    }
+
+    bool Context::ContextDestroyed (::Berkelium::Context * context) {
+      return Table->erase(context);
+    }
+
+    void ErrorDelegateWrapper::onPureCall() {
+      BerkeliumSharp::OnPureCall();
+    }
+
+    void ErrorDelegateWrapper::onInvalidParameter(const wchar_t *expression, const wchar_t *function, const wchar_t *file, unsigned int line, uintptr_t reserved) {
+      BerkeliumSharp::OnInvalidParameter(
+        gcnew String(expression),
+        gcnew String(function),
+        gcnew String(file),
+        line
+        );
+    }
+
+    void ErrorDelegateWrapper::onOutOfMemory() {
+      BerkeliumSharp::OnOutOfMemory();
+    }
+
+    void ErrorDelegateWrapper::onAssertion(const char *assertMessage) {
+      BerkeliumSharp::OnAssertion(
+        gcnew String(assertMessage)
+        );
+    }
+
+    void Window::DetectLegacyPaintOverrides () {
+      // This only happens once per window, and lets us skip building the legacy
+      //  paint arguments for subclasses that have moved over to OnPaintFrame.
+      Type ^ type = GetType();
+      OverridesLegacyPaint = OverridesMethod(type, "OnPaint");
+      OverridesLegacyWidgetPaint = OverridesMethod(type, "OnWidgetPaint");
+    }
+
+    int HostMessage::GetId (String ^ name) {
+      if (name == nullptr)
+        throw gcnew ArgumentNullException("name");
+
+      pin_ptr<const wchar_t> chars = PtrToStringChars(name);
+      int id = NativeHostNameTable::instance().intern(chars, name->Length);
+      if (id == Plain)
+        throw gcnew InvalidOperationException("Too many host message names have been used.");
+
+      return id;
+    }
+
+    String ^ HostMessage::GetName (int id) {
+      msclr::lock l(HostMessageBatch::NamesLock);
+
+      System::Collections::Generic::List<String ^> ^ names = HostMessageBatch::Names;
+      if ((id < names->Count) && (names[id] != nullptr))
+        return names[id];
+
+      std::wstring name;
+      if (!NativeHostNameTable::instance().name(id, name))
+        return nullptr;
+
+      while (names->Count <= id)
+        names->Add(nullptr);
+
+      String ^ result = gcnew String((wchar_t *)name.data(), 0, (int)name.length());
+      names[id] = String::Intern(result);
+      return names[id];
+    }
+
+    const NativeHostMessage & HostMessage::GetNative () {
+      if (Batch == nullptr)
+        throw gcnew InvalidOperationException("This message is empty.");
+
+      return Batch->GetNative().message(Index);
+    }
+
+    const NativeHostArgument & HostMessage::GetArgument (int index, NativeHostArgumentType expectedType) {
+      const NativeHostMessage & message = GetNative();
+      if ((index < 0) || ((size_t)index >= message.ArgumentCount))
+        throw gcnew ArgumentOutOfRangeException("index");
+
+      const NativeHostArgument & argument = Batch->Native->argument(message, index);
+      if (argument.Type != expectedType)
+        throw gcnew InvalidCastException(String::Format("Argument {0} is a {1}.", index, (HostArgumentType)argument.Type));
+
+      return argument;
+    }
+
+    String ^ HostMessage::GetText (size_t offset, size_t length) {
+      if (length == 0)
+        return String::Empty;
+
+      return gcnew String((wchar_t *)Batch->Native->text(offset), 0, (int)length);
+    }
+
+    String ^ HostMessage::Name::get () {
+      const NativeHostMessage & message = GetNative();
+      if (message.Id != Plain)
+        return GetName(message.Id);
+
+      return GetText(message.NameOffset, message.NameLength);
+    }
+
+    HostArgumentType HostMessage::GetArgumentType (int index) {
+      const NativeHostMessage & message = GetNative();
+      if ((index < 0) || ((size_t)index >= message.ArgumentCount))
+        throw gcnew ArgumentOutOfRangeException("index");
+
+      return (HostArgumentType)Batch->Native->argument(message, index).Type;
+    }
+
+    String ^ HostMessage::GetString (int index) {
+      if (GetArgumentType(index) == HostArgumentType::Null)
+        return nullptr;
+
+      const NativeHostArgument & argument = GetArgument(index, HostArgumentString);
+      return GetText(argument.Offset, argument.Length);
+    }
+
+    int HostMessage::CopyBytes (int index, array<Byte> ^ buffer, int offset) {
+      if (buffer == nullptr)
+        throw gcnew ArgumentNullException("buffer");
+
+      const NativeHostArgument & argument = GetArgument(index, HostArgumentBytes);
+      if ((offset < 0) || (offset > buffer->Length) || ((size_t)(buffer->Length - offset) < argument.Length))
+        throw gcnew ArgumentOutOfRangeException("offset");
+
+      if (argument.Length > 0)
+        Marshal::Copy(IntPtr((void *)Batch->Native->bytes(argument.Offset)), buffer, offset, (int)argument.Length);
+
+      return (int)argument.Length;
+    }
+
+    HostMessage HostMessageBatch::default::get (int index) {
+      if ((index < 0) || (index >= Count))
+        throw gcnew ArgumentOutOfRangeException("index");
+
+      return HostMessage(this, index);
+    }
+
+    ScriptTemplate::ScriptTemplate (String ^ source) {
+      if (source == nullptr)
+        throw gcnew ArgumentNullException("source");
+
+      pin_ptr<const wchar_t> chars = PtrToStringChars(source);
+      Native = new NativeScriptTemplate(chars, source->Length);
+      SourceText = source;
+    }
+
+    bool ScriptTemplate::IsSupportedArgument (Object ^ value) {
+      if ((value == nullptr) || (dynamic_cast<String ^>(value) != nullptr) || (dynamic_cast<ScriptLiteral ^>(value) != nullptr))
+        return true;
+
+      switch (Type::GetTypeCode(value->GetType())) {
+        case TypeCode::Boolean:
+        case TypeCode::Char:
+        case TypeCode::SByte:
+        case TypeCode::Byte:
+        case TypeCode::Int16:
+        case TypeCode::UInt16:
+        case TypeCode::Int32:
+        case TypeCode::UInt32:
+        case TypeCode::Int64:
+        case TypeCode::UInt64:
+        case TypeCode::Single:
+        case TypeCode::Double:
+        case TypeCode::Decimal:
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    void ScriptTemplate::AppendArgument (std::vector<wchar_t> & script, Object ^ value) {
+      static const wchar_t nullLiteral[] = L"null", trueLiteral[] = L"true", falseLiteral[] = L"false";
+
+      if (value == nullptr) {
+        AppendScriptText(script, nullLiteral, 4);
+        return;
+      }
+
+      String ^ text = dynamic_cast<String ^>(value);
+      ScriptLiteral ^ literal = dynamic_cast<ScriptLiteral ^>(value);
+      if ((text != nullptr) || (literal != nullptr)) {
+        String ^ chars = (text != nullptr) ? text : literal->Text;
+        pin_ptr<const wchar_t> pinned = PtrToStringChars(chars);
+
+        if (text != nullptr)
+          AppendStringLiteral(script, pinned, chars->Length);
+        else
+          AppendScriptText(script, pinned, chars->Length);
+        return;
+      }
+
+      // Enums land here too, as their underlying type.
+      switch (Type::GetTypeCode(value->GetType())) {
+        case TypeCode::Boolean:
+          if (safe_cast<bool>(value))
+            AppendScriptText(script, trueLiteral, 4);
+          else
+            AppendScriptText(script, falseLiteral, 5);
+          break;
+        case TypeCode::Char: {
+          wchar_t ch = safe_cast<wchar_t>(value);
+          AppendStringLiteral(script, &ch, 1);
+          break;
+        }
+        case TypeCode::SByte:
+        case TypeCode::Byte:
+        case TypeCode::Int16:
+        case TypeCode::UInt16:
+        case TypeCode::Int32:
+        case TypeCode::UInt32:
+        case TypeCode::Int64:
+          AppendIntegerLiteral(script, Convert::ToInt64(value));
+          break;
+        case TypeCode::UInt64:
+        case TypeCode::Single:
+        case TypeCode::Double:
+        case TypeCode::Decimal:
+          AppendNumberLiteral(script, Convert::ToDouble(value));
+          break;
+        default:
+          throw gcnew ArgumentException(String::Format(
+            "Script arguments must be null, booleans, numbers, strings or ScriptLiterals, not {0}.", value->GetType()
+          ));
+      }
+    }
+
+    String ^ ScriptTemplate::Format (... array<Object ^> ^ arguments) {
+      std::vector<wchar_t> values, script;
+      std::vector<size_t> starts;
+
+      if (arguments != nullptr) {
+        for (int i = 0; i < arguments->Length; i++) {
+          starts.push_back(values.size());
+          AppendArgument(values, arguments[i]);
+        }
+      }
+
+      Native->fill(script, values, starts);
+
+      if (script.empty())
+        return String::Empty;
+
+      return gcnew String(&script[0], 0, (int)script.size());
+    }
+
+    void Window::QueueJavascript (String ^ javascript) {
+      if (javascript == nullptr)
+        throw gcnew ArgumentNullException("javascript");
+      if (!Native)
+        throw gcnew ObjectDisposedException("Window");
+
+      pin_ptr<const wchar_t> chars = PtrToStringChars(javascript);
+
+      msclr::lock queueLock (QueueLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        queueLock.acquire();
+
+      if (!Scripts)
+        Scripts = new NativeScriptQueue();
+
+      Scripts->append(chars, javascript->Length);
+      QueueForFlush();
+    }
+
+    void Window::QueueJavascript (ScriptTemplate ^ script, ... array<Object ^> ^ arguments) {
+      if (script == nullptr)
+        throw gcnew ArgumentNullException("script");
+      if (!Native)
+        throw gcnew ObjectDisposedException("Window");
+
+      msclr::lock queueLock (QueueLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        queueLock.acquire();
+
+      if (!Scripts)
+        Scripts = new NativeScriptQueue();
+
+      try {
+        if (arguments != nullptr) {
+          for (int i = 0; i < arguments->Length; i++) {
+            Scripts->beginArgument();
+            ScriptTemplate::AppendArgument(Scripts->arguments(), arguments[i]);
+          }
+        }
+      } catch (Exception ^) {
+        Scripts->clearArguments();
+        throw;
+      }
+
+      Scripts->appendTemplate(*script->Native);
+      QueueForFlush();
+    }
+
+    // Expects QueueLock to be held.
+    void Window::QueueForFlush () {
+      if (FlushQueued)
+        return;
+
+      FlushQueued = true;
+      BerkeliumSharp::QueueWindowFlush(this);
+    }
+
+    void Window::FlushJavascriptNative () {
+      const wchar_t * script;
+      size_t length;
+
+      {
+        msclr::lock queueLock (QueueLock, msclr::lock_later);
+        if (PumpThread::IsRunning)
+          queueLock.acquire();
+
+        if (!Scripts)
+          return;
+
+        FlushQueued = false;
+        script = Scripts->take(length);
+      }
+
+      // The script that take returned stays put until the next flush, which only ever happens on this thread.
+      if (script)
+        Native->executeJavascript(WideStringView(script, length));
+    }
+
+    namespace {
+      template <class T>
+      void SendInputEvent (T * target, const NativeInputEvent & evt, const wchar_t * text) {
+        switch (evt.Kind) {
+          case InputMouseMoved:
+            target->mouseMoved(evt.A, evt.B);
+            break;
+          case InputMouseWheel:
+            target->mouseWheel(evt.A, evt.B);
+            break;
+          case InputMouseButton:
+            target->mouseButton((unsigned)evt.A, evt.B != 0);
+            break;
+          case InputKey:
+            target->keyEvent(evt.A != 0, evt.B, evt.C, evt.D);
+            break;
+          case InputText:
+            target->textEvent(text, evt.TextLength);
+            break;
+          case InputFocus:
+            target->focus();
+            break;
+          case InputUnfocus:
+            target->unfocus();
+            break;
+        }
+      }
+    }
+
+    LatencyHistogram::LatencyHistogram (const NativeLatencyHistogram & native)
+      : Buckets(gcnew array<Int64>(NativeLatencyHistogram::BucketCount)) {
+      for (int i = 0; i < Buckets->Length; i++)
+        Buckets[i] = native.bucket(i);
+
+      // Samples recorded while the buckets were being copied can put these slightly ahead of them.
+      SampleCount = native.count();
+      TotalMicroseconds = native.total();
+      MaxMicroseconds = native.maximum();
+    }
+
+    TimeSpan LatencyHistogram::Percentile (double fraction) {
+      if (!(fraction >= 0) || (fraction > 1))
+        throw gcnew ArgumentOutOfRangeException("fraction");
+
+      Int64 total = 0;
+      for (int i = 0; i < Buckets->Length; i++)
+        total += Buckets[i];
+
+      if (total == 0)
+        return TimeSpan::Zero;
+
+      Int64 rank = Math::Max((Int64)1, (Int64)Math::Ceiling(fraction * total));
+      Int64 seen = 0;
+      int bucket = 0;
+      for (; bucket < Buckets->Length - 1; bucket++) {
+        seen += Buckets[bucket];
+        if (seen >= rank)
+          break;
+      }
+
+      return TimeSpan::FromTicks(Math::Min(NativeLatencyHistogram::bucketLimit(bucket), MaxMicroseconds) * 10);
+    }
+
+    WindowStats::WindowStats (const NativeStatCounters & counters, const NativeLatencyHistogram * inputLatency)
+      : Values(gcnew array<Int64>(StatCount)) {
+      for (int i = 0; i < StatCount; i++)
+        Values[i] = counters.read(i);
+
+      if (inputLatency)
+        Input = gcnew LatencyHistogram(*inputLatency);
+    }
+
+    ProcessStats::ProcessStats ()
+      : WindowStats(NativeStatCounters::Process, &NativeLatencyHistogram::Input)
+      , Latency(gcnew LatencyHistogram(NativeLatencyHistogram::Protocol)) {
+    }
+
+    WindowStats ^ Widget::Stats::get () {
+      msclr::lock paintLock ((Parent != nullptr) ? Parent->PaintLock : this, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      if (!Counters)
+        throw gcnew ObjectDisposedException("Widget");
+
+      return gcnew WindowStats(*Counters, 0);
+    }
+
+    bool Widget::QueueInputEvent (NativeInputKind kind, int a, int b, int c, int d, String ^ text) {
+      return (Parent != nullptr) && Parent->QueueInputEvent(this, kind, a, b, c, d, text);
+    }
+
+    // Returns false if input isn't being queued, in which case the caller sends the event itself.
+    bool Window::QueueInputEvent (Berkelium::Managed::Widget ^ target, NativeInputKind kind, int a, int b, int c, int d, String ^ text) {
+      if (!InputQueueEnabled || !Native)
+        return false;
+
+      msclr::lock queueLock (QueueLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        queueLock.acquire();
+
+      if (!Input) {
+        Input = new NativeInputQueue();
+        FlushingInput = new NativeInputQueue();
+        InputWidgets = gcnew System::Collections::Generic::List<Berkelium::Managed::Widget ^>();
+        FlushingInputWidgets = gcnew System::Collections::Generic::List<Berkelium::Managed::Widget ^>();
+      }
+
+      int targetIndex = 0;
+      if (target != nullptr) {
+        targetIndex = InputWidgets->IndexOf(target) + 1;
+        if (targetIndex == 0) {
+          InputWidgets->Add(target);
+          targetIndex = InputWidgets->Count;
+        }
+      }
+
+      bool merged;
+      if (kind == InputText) {
+        if (text == nullptr)
+          text = String::Empty;
+        pin_ptr<const wchar_t> chars = PtrToStringChars(text);
+        merged = Input->pushText(targetIndex, chars, text->Length);
+      } else {
+        merged = Input->push(kind, targetIndex, a, b, c, d);
+      }
+
+      InputEventCount += 1;
+      if (merged)
+        CoalescedInputEventCount += 1;
+
+      QueueForFlush();
+      return true;
+    }
+
+    void Window::QueueInput::set (bool value) {
+      if (value == InputQueueEnabled)
+        return;
+
+      InputQueueEnabled = value;
+      if (!value && Native)
+        FlushInput();
+    }
+
+    void Window::FlushInputNative () {
+      {
+        msclr::lock queueLock (QueueLock, msclr::lock_later);
+        if (PumpThread::IsRunning)
+          queueLock.acquire();
+
+        if (!Input || Input->empty())
+          return;
+
+        FlushQueued = false;
+        FlushingInput->swap(*Input);
+
+        System::Collections::Generic::List<Berkelium::Managed::Widget ^> ^ widgets = InputWidgets;
+        InputWidgets = FlushingInputWidgets;
+        FlushingInputWidgets = widgets;
+      }
+
+      // Only the thread that flushes touches the flushing buffers, so dispatching doesn't need the lock.
+      for (size_t i = 0, count = FlushingInput->count(); i < count; i++) {
+        const NativeInputEvent & evt = FlushingInput->event(i);
+        const wchar_t * text = FlushingInput->text(evt);
+
+        if (evt.Target == 0) {
+          SendInputEvent(Native, evt, text);
+        } else {
+          // Skip widgets that went away after their input was queued.
+          Berkelium::Managed::Widget ^ widget = FlushingInputWidgets[evt.Target - 1];
+          if (widget->Native)
+            SendInputEvent(widget->Native, evt, text);
+        }
+      }
+
+      FlushingInput->clear();
+      FlushingInputWidgets->Clear();
+    }
+
+    FrameCapture ^ Window::StartCapture (String ^ path, double framesPerSecond, CaptureFormat format) {
+      if (path == nullptr)
+        throw gcnew ArgumentNullException("path");
+      if (!(framesPerSecond >= 0))
+        throw gcnew ArgumentOutOfRangeException("framesPerSecond");
+
+      UseBackingStore = true;
+
+      FrameCapture ^ capture = gcnew FrameCapture(this, path, true, format, framesPerSecond);
+
+      msclr::lock paintLock (PaintLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      if (Capture != nullptr)
+        throw gcnew InvalidOperationException("The window is already being captured. Stop the active capture first.");
+
+      Capture = capture;
+      capture->Offer(Store->Native);
+      return capture;
+    }
+
+    FrameCapture ^ Window::CaptureFrame (String ^ filename, CaptureFormat format) {
+      if (filename == nullptr)
+        throw gcnew ArgumentNullException("filename");
+      if (Store == nullptr)
+        throw gcnew InvalidOperationException("CaptureFrame needs UseBackingStore to be enabled before the window paints.");
+
+      FrameCapture ^ capture = gcnew FrameCapture(this, filename, false, format, 0);
+
+      {
+        msclr::lock paintLock (PaintLock, msclr::lock_later);
+        if (PumpThread::IsRunning)
+          paintLock.acquire();
+
+        capture->Snapshot(Store->Native);
+      }
+
+      capture->Stop();
+      return capture;
+    }
+
+    EventRecorder ^ Window::StartRecording (String ^ path, TracePixels pixels) {
+      if (path == nullptr)
+        throw gcnew ArgumentNullException("path");
+      if (!Native)
+        throw gcnew ObjectDisposedException("Window");
+      if (Recorder != nullptr)
+        throw gcnew InvalidOperationException("The window is already being recorded. Stop the active recording first.");
+
+      pin_ptr<const wchar_t> pathPtr = PtrToStringChars(path);
+      NativeTraceWriter * writer = NativeTraceWriter::create(pathPtr, (NativeTracePixels)pixels);
+      if (!writer)
+        throw gcnew IOException(String::Format("The event trace '{0}' could not be created.", path));
+
+      // A replay starts by resizing its window to match.
+      NativeTraceRecord record (TraceWindowResized);
+      record.addInt(Width);
+      record.addInt(Height);
+      writer->write(record);
+
+      Recorder = gcnew EventRecorder(this, path, pixels, writer);
+      UpdateEventTrace();
+      return Recorder;
+    }
+
+    WindowStats ^ Window::Stats::get () {
+      if (!Counters)
+        throw gcnew ObjectDisposedException("Window");
+
+      return gcnew WindowStats(*Counters, &InputLatency->histogram());
+    }
+
+    void Window::UpdateEventTrace () {
+      if (PumpThread::MustMarshal)
+        PumpThread::Send(this, PumpCommandKind::UpdateEventTrace);
+      else
+        UpdateEventTraceNative();
+    }
+
+    void Window::UpdateEventTraceNative () {
+      if (Wrapper)
+        Wrapper->Trace = (Recorder != nullptr) ? Recorder->Writer : 0;
+    }
+
+    void Window::UseBackingStore::set (bool value) {
+      if (value == (Store != nullptr))
+        return;
+
+      // The pump thread always paints into the backing store.
+      if (!value && PumpThread::IsRunning)
+        return;
+
+      if (PumpThread::MustMarshal)
+        PumpThread::Send(this, PumpCommandKind::SetUseBackingStore, value, 0, 0);
+      else
+        SetUseBackingStoreNative(value);
+    }
+
+    void Window::SetUseBackingStoreNative (bool value) {
+      if (value == (Store != nullptr))
+        return;
+
+      // Coalesced paints point into the backing store, so they have to go first.
+      if (!value)
+        SetCoalescePaintsNative(false);
+
+      msclr::lock paintLock (PaintLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      if (value) {
+        // Sized for a queued resize straight away, since that's what the next paints will be.
+        ::Berkelium::Rect rect = Native->getWidget()->getRect();
+        int width = rect.width(), height = rect.height();
+        GetQueuedSize(width, height);
+        Store = gcnew Berkelium::Managed::BackingStore(width, height);
+      } else {
+        delete Store;
+        Store = nullptr;
+      }
+
+      Wrapper->SetWidgetBackingStores(value);
+    }
+
+    void Window::CoalescePaints::set (bool value) {
+      if (value == Coalesce)
+        return;
+
+      // The pump thread always coalesces paints.
+      if (!value && PumpThread::IsRunning)
+        return;
+
+      if (PumpThread::MustMarshal)
+        PumpThread::Send(this, PumpCommandKind::SetCoalescePaints, value, 0, 0);
+      else
+        SetCoalescePaintsNative(value);
+    }
+
+    void Window::SetCoalescePaintsNative (bool value) {
+      if (value == Coalesce)
+        return;
+
+      if (value) {
+        SetUseBackingStoreNative(true);
+
+        if (!PendingPaint)
+          PendingPaint = new NativePaintAccumulator();
+      }
+
+      Coalesce = value;
+
+      // Deliver anything that has already accumulated rather than dropping it.
+      if (!value && Wrapper)
+        Wrapper->FlushCoalescedPaints();
+    }
+
+    void Window::Resize (int width, int height) {
+      if (!Native)
+        throw gcnew ObjectDisposedException("Window");
+
+      msclr::lock queueLock (QueueLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        queueLock.acquire();
+
+      if (ResizeQueued)
+        Counters->add(StatResizesCoalesced, 1);
+
+      ResizeQueued = true;
+      QueuedWidth = width;
+      QueuedHeight = height;
+      QueueForFlush();
+    }
+
+    bool Window::GetQueuedSize (int & width, int & height) {
+      msclr::lock queueLock (QueueLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        queueLock.acquire();
+
+      if (!ResizeQueued)
+        return false;
+
+      width = QueuedWidth;
+      height = QueuedHeight;
+      return true;
+    }
+
+    void Window::FlushResizeNative () {
+      int width, height;
+
+      {
+        msclr::lock queueLock (QueueLock, msclr::lock_later);
+        if (PumpThread::IsRunning)
+          queueLock.acquire();
+
+        if (!ResizeQueued)
+          return;
+
+        FlushQueued = false;
+        ResizeQueued = false;
+        width = QueuedWidth;
+        height = QueuedHeight;
+      }
+
+      ResizeNative(width, height);
+    }
+
+    void Window::ResizeNative (int width, int height) {
+      Counters->add(StatResizes, 1);
+      Native->resize(width, height);
+
+      if (Wrapper && Wrapper->Trace) {
+        NativeTraceRecord record (TraceWindowResized);
+        record.addInt(width);
+        record.addInt(height);
+        Wrapper->Trace->write(record);
+      }
+
+      msclr::lock paintLock (PaintLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      if (Store)
+        Store->Native->resize(width, height);
+    }
+
+    WindowDelegateWrapper::WindowDelegateWrapper (Window ^ owner)
+      : Owner(owner)
+      , Trace(0)
+      , Counters(owner->Counters) {
+      Counters->addRef();
+    }
+
+    WindowDelegateWrapper::~WindowDelegateWrapper () {
+      Counters->release();
+    }
+
+    Widget ^ WindowDelegateWrapper::GetWidget (::Berkelium::Widget * widget, bool ownsHandle) {
+      Widget ^ result = WidgetTable.find(widget);
+
+      if (result)
+        return result;
+
+      result = gcnew Widget(Owner, widget, ownsHandle);
+      if (Owner->UseBackingStore) {
+        ::Berkelium::Rect rect = widget->getRect();
+        result->Store = gcnew BackingStore(rect.width(), rect.height());
+      }
+
+      WidgetTable.insert(widget, result);
+      return result;
+    }
+
+    void WindowDelegateWrapper::SetWidgetBackingStores (bool enabled) {
+      for (size_t i = 0; i < WidgetTable.capacity(); i++) {
+        if (!WidgetTable.keyAt(i))
+          continue;
+
+        Widget ^ widget = WidgetTable.valueAt(i);
+
+        if (enabled && !widget->Store) {
+          ::Berkelium::Rect rect = WidgetTable.keyAt(i)->getRect();
+          widget->Store = gcnew BackingStore(rect.width(), rect.height());
+        } else if (!enabled && widget->Store) {
+          delete widget->Store;
+          widget->Store = nullptr;
+        }
+      }
+    }
+
+    bool WindowDelegateWrapper::WidgetDestroyed (::Berkelium::Widget * widget) {
+      return WidgetTable.erase(widget);
+    }
+
+    void WindowDelegateWrapper::onCursorUpdated (::Berkelium::Window *win, const Berkelium::Cursor &newCursor) {
+      NativeCallbackScope stats (Counters, CallbackCursorUpdated);
+
+      if (PumpThread::IsPumpThread) {
+        PumpEvent evt;
+        evt.Kind = PumpEventKind::CursorChanged;
+        evt.Source = Owner;
+        evt.Handle = (IntPtr)newCursor.GetCursor();
+        PumpThread::Defer(evt);
+        return;
+      }
+
+      Owner->OnCursorChanged(
+        (IntPtr)newCursor.GetCursor()
+      );
+    }
+
+    void WindowDelegateWrapper::onAddressBarChanged (::Berkelium::Window *win, URLString newURL) {
+      NativeCallbackScope stats (Counters, CallbackAddressBarChanged);
+
+      if (Trace)
+        TraceUrl(Trace, TraceAddressBarChanged, newURL);
+
+      if (PumpThread::Defer(Owner, PumpEventKind::AddressBarChanged, URLToString(newURL)))
+        return;
+
+      Owner->OnAddressBarChanged(
+        URLToString(newURL)
+        );
+    }
+
+    void WindowDelegateWrapper::onStartLoading (::Berkelium::Window *win, URLString newURL) {
+      NativeCallbackScope stats (Counters, CallbackStartLoading);
+
+      if (Trace)
+        TraceUrl(Trace, TraceStartLoading, newURL);
+
+      if (PumpThread::Defer(Owner, PumpEventKind::StartLoading, URLToString(newURL)))
+        return;
+
+      Owner->OnStartLoading(
+        URLToString(newURL)
+        );
+    }
+
+    void WindowDelegateWrapper::onLoad (::Berkelium::Window *win) {
+      NativeCallbackScope stats (Counters, CallbackLoad);
+
+      if (Trace)
+        Trace->write(NativeTraceRecord(TraceLoad));
+
+      if (PumpThread::Defer(Owner, PumpEventKind::Load))
+        return;
+
+      Owner->OnLoad();
+    }
+
+    void WindowDelegateWrapper::onProvisionalLoadError(::Berkelium::Window *win, URLString url, int errorCode, bool isMainFrame) {
+      NativeCallbackScope stats (Counters, CallbackProvisionalLoadError);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceProvisionalLoadError);
+        record.addNarrow(url.data(), url.length());
+        record.addInt(errorCode);
+        record.addInt(isMainFrame);
+        Trace->write(record);
+      }
+
+      if (PumpThread::Defer(Owner, PumpEventKind::ProvisionalLoadError, URLToString(url), (String ^)nullptr, errorCode, isMainFrame))
+        return;
+
+      Owner->OnProvisionalLoadError(
+        URLToString(url), errorCode, isMainFrame
+        );
+    }
+
+    void WindowDelegateWrapper::onCrashed (::Berkelium::Window *win) {
+      NativeCallbackScope stats (Counters, CallbackCrashed);
+
+      if (Trace)
+        Trace->write(NativeTraceRecord(TraceCrashed));
+
+      if (PumpThread::Defer(Owner, PumpEventKind::Crashed))
+        return;
+
+      Owner->OnCrashed();
+    }
+
+    void WindowDelegateWrapper::onUnresponsive (::Berkelium::Window *win) {
+      NativeCallbackScope stats (Counters, CallbackUnresponsive);
+
+      if (Trace)
+        Trace->write(NativeTraceRecord(TraceUnresponsive));
+
+      if (PumpThread::Defer(Owner, PumpEventKind::Unresponsive))
+        return;
+
+      Owner->OnUnresponsive();
+    }
+
+    void WindowDelegateWrapper::onResponsive (::Berkelium::Window *win) {
+      NativeCallbackScope stats (Counters, CallbackResponsive);
+
+      if (Trace)
+        Trace->write(NativeTraceRecord(TraceResponsive));
+
+      if (PumpThread::Defer(Owner, PumpEventKind::Responsive))
+        return;
+
+      Owner->OnResponsive();
+    }
+
+    void WindowDelegateWrapper::onExternalHost (::Berkelium::Window *win, WideString message, URLString origin, URLString target) {
+      NativeCallbackScope stats (Counters, CallbackExternalHost);
+
+      Window ^ owner = Owner;
+
+      if (Trace) {
+        NativeTraceRecord record (TraceExternalHost);
+        record.addWide(message.data(), message.length());
+        record.addNarrow(origin.data(), origin.length());
+        record.addNarrow(target.data(), target.length());
+        Trace->write(record);
+      }
+
+      {
+        msclr::lock paintLock (owner->PaintLock, msclr::lock_later);
+        if (PumpThread::IsRunning)
+          paintLock.acquire();
+
+        if (!PendingMessages.add(message.data(), message.length(), origin.data(), origin.length(), target.data(), target.length()))
+          return;
+      }
+
+      // Like coalesced paints, the batch goes out once the update that received it is over.
+      owner->QueueCoalescedPaint();
+    }
+
+    void WindowDelegateWrapper::FlushHostMessages () {
+      Window ^ owner = Owner;
+
+      if (owner->MessageBatch == nullptr)
+        owner->MessageBatch = gcnew HostMessageBatch(owner);
+
+      HostMessageBatch ^ batch = owner->MessageBatch;
+      // A handler that pumps gets its new messages once it returns, in the next batch.
+      if (batch->Native)
+        return;
+
+      {
+        msclr::lock paintLock (owner->PaintLock, msclr::lock_later);
+        if (PumpThread::IsRunning)
+          paintLock.acquire();
+
+        if (PendingMessages.empty())
+          return;
+
+        FlushingMessages.swap(PendingMessages);
+      }
+
+      batch->Native = &FlushingMessages;
+      try {
+        owner->OnHostMessages(batch);
+      } finally {
+        batch->Native = 0;
+      }
+
+      // The handler may have destroyed the window, and this wrapper along with it.
+      if (owner->Wrapper != this)
+        return;
+
+      FlushingMessages.clear();
+
+      msclr::lock paintLock (owner->PaintLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      bool requeue = !PendingMessages.empty();
+      paintLock.release();
+
+      if (requeue)
+        owner->QueueCoalescedPaint();
+    }
+
+    void WindowDelegateWrapper::onCreatedWindow (::Berkelium::Window *win, ::Berkelium::Window *newWindow, const ::Berkelium::Rect &initialRect) {
+      NativeCallbackScope stats (Counters, CallbackCreatedWindow);
+
+      Window ^ managedWindow = gcnew Window(Owner->Context, newWindow, true);
+      Rect ^ managedRect = gcnew Rect(initialRect.left(), initialRect.top(), initialRect.width(), initialRect.height());
+
+      if (PumpThread::Defer(Owner, PumpEventKind::CreatedWindow, managedWindow, managedRect, 0, 0))
+        return;
+
+      Owner->OnCreatedWindow(
+        managedWindow,
+        managedRect,
+        gcnew String("", 0, 0) // FIXME: Chromium no longer sends us the URL.
+      );
+    }
+
+    void WindowDelegateWrapper::onPaint (::Berkelium::Window *win, const unsigned char *sourceBuffer, const ::Berkelium::Rect &rect, size_t numCopyRects, const ::Berkelium::Rect *copyRects, int dx, int dy, const ::Berkelium::Rect &scrollRect) {
+      NativeCallbackScope stats (Counters, CallbackPaint);
+
+      Counters->add(StatPaints, 1);
+      if (dx || dy)
+        Counters->add(StatScrollBlits, 1);
+
+      Window ^ owner = Owner;
+
+      if (Trace) {
+        NativeTraceRecord record (TracePaint);
+        record.setPaint(sourceBuffer, rect, numCopyRects, copyRects, dx, dy, scrollRect);
+        Trace->write(record);
+      }
+
+      // Paints can't be handed to the UI thread as they arrive, so they always go through the backing store.
+      if (PumpThread::IsPumpThread && !owner->Coalesce)
+        owner->SetCoalescePaintsNative(true);
+
+      msclr::lock paintLock (owner->PaintLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      if (owner->Store)
+        owner->Store->Native->applyPaint(sourceBuffer, rect, numCopyRects, copyRects, dx, dy, scrollRect);
+
+      if (owner->Coalesce) {
+        owner->PendingPaint->add(numCopyRects, copyRects, dx, dy, scrollRect);
+
+        // Queueing the flush can block until the UI thread drains events, and it needs the lock to do that.
+        paintLock.release();
+        owner->QueueCoalescedPaint();
+        return;
+      }
+
+      DispatchPaint(sourceBuffer, rect, (size_t)rect.width() * NativeBackingStore::BytesPerPixel, numCopyRects, copyRects, dx, dy, scrollRect, 1);
+    }
+
+    void WindowDelegateWrapper::DispatchPaint (const unsigned char *sourceBuffer, const ::Berkelium::Rect &rect, size_t stride, size_t numCopyRects, const ::Berkelium::Rect *copyRects, int dx, int dy, const ::Berkelium::Rect &scrollRect, int paintCount) {
+      Window ^ owner = Owner;
+
+      Counters->addDelivered(numCopyRects, copyRects);
+      owner->InputLatency->painted(Counters, numCopyRects, copyRects);
+
+      if ((owner->Capture != nullptr) && owner->Store)
+        owner->Capture->Offer(owner->Store->Native);
+
+      PaintFrame frame;
+      FillPaintFrame(frame, owner->PaintSequenceNumber++, sourceBuffer, rect, stride, numCopyRects, copyRects, dx, dy, scrollRect, paintCount);
+      owner->OnPaintFrame(frame);
+
+      if (!owner->WantsLegacyPaint)
+        return;
+
+      owner->OnPaint(
+        IntPtr((void *)PackLegacyPaint(LegacyPaintBuffer, sourceBuffer, rect, stride, numCopyRects, copyRects)),
+        ToManagedRect(rect),
+        CopyRectsToArray(numCopyRects, copyRects),
+        dx, dy,
+        ToManagedRect(scrollRect)
+      );
+    }
+
+    void WindowDelegateWrapper::FlushCoalescedPaints () {
+      Window ^ owner = Owner;
+
+      // Handlers read straight out of the backing stores, so the pump thread has to wait
+      //  for them to finish before it can paint into the stores again.
+      msclr::lock paintLock (owner->PaintLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      PumpThread::PaintDispatchDepth++;
+      try {
+        owner->QueuedForFlush = false;
+
+        if (owner->PendingPaint && owner->PendingPaint->isPending() && owner->Store) {
+          CoalescedPaint paint (owner->Store->Native, owner->PendingPaint);
+          DispatchPaint(
+            paint.SourceBuffer, paint.SourceRect, paint.Stride,
+            paint.CopyRectCount(), &paint.CopyRect,
+            paint.Dx, paint.Dy, paint.ScrollRect,
+            paint.PaintCount
+          );
+        }
+
+        if ((owner->PendingWidgets == nullptr) || (owner->PendingWidgets->Count == 0))
+          return;
+
+        // Same list swap as BerkeliumSharp::FlushCoalescedPaints. A paint handler might destroy
+        //  a widget, so each one is checked again right before its paint goes out.
+        System::Collections::Generic::List<Widget ^> ^ widgets = owner->PendingWidgets;
+        owner->PendingWidgets = owner->FlushingWidgets ? owner->FlushingWidgets : gcnew System::Collections::Generic::List<Widget ^>();
+        owner->FlushingWidgets = nullptr;
+
+        for (int i = 0; i < widgets->Count; i++) {
+          Widget ^ widget = widgets[i];
+          widget->QueuedForFlush = false;
+
+          if (!widget->Store || !widget->PendingPaint || !widget->PendingPaint->isPending())
+            continue;
+
+          CoalescedPaint paint (widget->Store->Native, widget->PendingPaint);
+          DispatchWidgetPaint(
+            widget,
+            paint.SourceBuffer, paint.SourceRect, paint.Stride,
+            paint.CopyRectCount(), &paint.CopyRect,
+            paint.Dx, paint.Dy, paint.ScrollRect,
+            paint.PaintCount
+          );
+        }
+
+        widgets->Clear();
+        owner->FlushingWidgets = widgets;
+      } finally {
+        PumpThread::PaintDispatchDepth--;
+      }
+    }
+
+    void WindowDelegateWrapper::onCrashedWorker(::Berkelium::Window *win) {
+      NativeCallbackScope stats (Counters, CallbackCrashedWorker);
+
+      if (Trace)
+        Trace->write(NativeTraceRecord(TraceCrashedWorker));
+
+      if (PumpThread::Defer(Owner, PumpEventKind::CrashedWorker))
+        return;
+
+      Owner->OnCrashedWorker();
+    }
+
+    void WindowDelegateWrapper::onCrashedPlugin(::Berkelium::Window *win, WideString pluginName) {
+      NativeCallbackScope stats (Counters, CallbackCrashedPlugin);
+
+      if (Trace)
+        TraceText(Trace, TraceCrashedPlugin, pluginName);
+
+      String ^ pluginNameStr = gcnew String(pluginName.data(), 0, pluginName.length());
+      if (PumpThread::Defer(Owner, PumpEventKind::CrashedPlugin, pluginNameStr))
+        return;
+
+      Owner->OnCrashedPlugin(
+        pluginNameStr
+        );
+    }
+
+    void WindowDelegateWrapper::onConsoleMessage(::Berkelium::Window *win, WideString sourceId, WideString message, int line_no) {
+      NativeCallbackScope stats (Counters, CallbackConsoleMessage);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceConsoleMessage);
+        record.addWide(sourceId.data(), sourceId.length());
+        record.addWide(message.data(), message.length());
+        record.addInt(line_no);
+        Trace->write(record);
+      }
+
+      String ^ sourceIdStr = gcnew String(sourceId.data(), 0, sourceId.length());
+      String ^ messageStr = gcnew String(message.data(), 0, message.length());
+      if (PumpThread::Defer(Owner, PumpEventKind::ConsoleMessage, sourceIdStr, messageStr, line_no, 0))
+        return;
+
+      Owner->OnConsoleMessage(
+        sourceIdStr,
+        messageStr,
+        line_no
+        );
+    }
+
+    void WindowDelegateWrapper::onScriptAlert(::Berkelium::Window *win, WideString message, WideString defaultValue, URLString url, int flags, bool &success, WideString &value) {
+      NativeCallbackScope stats (Counters, CallbackScriptAlert);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceScriptAlert);
+        record.addWide(message.data(), message.length());
+        record.addWide(defaultValue.data(), defaultValue.length());
+        record.addNarrow(url.data(), url.length());
+        record.addInt(flags);
+        Trace->write(record);
+      }
+
       String ^ valueStr = nullptr;
       Owner->OnScriptAlert(
         gcnew String(message.data(), 0, message.length()),
@@ -395,6 +2829,16 @@ namespace Berkelium {
     }
 
     void WindowDelegateWrapper::onNavigationRequested(::Berkelium::Window *win, URLString newUrl, URLString referrer, bool isNewWindow, bool &cancelDefaultAction) {
+      NativeCallbackScope stats (Counters, CallbackNavigationRequested);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceNavigationRequested);
+        record.addNarrow(newUrl.data(), newUrl.length());
+        record.addNarrow(referrer.data(), referrer.length());
+        record.addInt(isNewWindow);
+        Trace->write(record);
+      }
+
       Owner->OnNavigationRequested(
         URLToString(newUrl),
         URLToString(referrer),
@@ -406,8 +2850,25 @@ namespace Berkelium {
       if (newWidget->getId() == win->getId())
         return;
 
+      NativeCallbackScope stats (Counters, CallbackWidgetCreated);
+
+      if (Trace) {
+        ::Berkelium::Rect rect = newWidget->getRect();
+        NativeTraceRecord record (TraceWidgetCreated, Trace->widgetId(newWidget));
+        record.addInt(zIndex);
+        record.addInt(rect.left());
+        record.addInt(rect.top());
+        record.addInt(rect.width());
+        record.addInt(rect.height());
+        Trace->write(record);
+      }
+
+      Widget ^ managedWidget = GetWidget(newWidget, false);
+      if (PumpThread::Defer(Owner, PumpEventKind::WidgetCreated, managedWidget, nullptr, zIndex, 0))
+        return;
+
       Owner->OnWidgetCreated(
-        GetWidget(newWidget, false), zIndex
+        managedWidget, zIndex
       );
     }
 
@@ -415,18 +2876,67 @@ namespace Berkelium {
       if (widget->getId() == win->getId())
         return;
 
-      Owner->OnWidgetDestroyed(
-        GetWidget(widget, false)
-      );
+      NativeCallbackScope stats (Counters, CallbackWidgetDestroyed);
+
+      if (Trace)
+        Trace->write(NativeTraceRecord(TraceWidgetDestroyed, Trace->widgetId(widget, true)));
+
+      Widget ^ managedWidget = GetWidget(widget, false);
+      // The UI thread hears about it later, once the widget is already gone.
+      if (!PumpThread::Defer(Owner, PumpEventKind::WidgetDestroyed, managedWidget, nullptr, 0, 0))
+        Owner->OnWidgetDestroyed(
+          managedWidget
+        );
       WidgetDestroyed(widget);
+
+      msclr::lock paintLock (Owner->PaintLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      if (managedWidget->Store) {
+        delete managedWidget->Store;
+        managedWidget->Store = nullptr;
+      }
+
+      if (managedWidget->PendingPaint) {
+        delete managedWidget->PendingPaint;
+        managedWidget->PendingPaint = 0;
+      }
+
+      if (managedWidget->Counters) {
+        managedWidget->Counters->release();
+        managedWidget->Counters = 0;
+      }
     }
 
     void WindowDelegateWrapper::onWidgetResize (::Berkelium::Window *win, ::Berkelium::Widget *widget, int newWidth, int newHeight) {
       if (widget->getId() == win->getId())
         return;
 
+      NativeCallbackScope stats (Counters, CallbackWidgetResize);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceWidgetResized, Trace->widgetId(widget));
+        record.addInt(newWidth);
+        record.addInt(newHeight);
+        Trace->write(record);
+      }
+
+      Widget ^ managedWidget = GetWidget(widget, false);
+      {
+        msclr::lock paintLock (Owner->PaintLock, msclr::lock_later);
+        if (PumpThread::IsRunning)
+          paintLock.acquire();
+
+        if (managedWidget->Store)
+          managedWidget->Store->Native->resize(newWidth, newHeight);
+      }
+
+      if (PumpThread::Defer(Owner, PumpEventKind::WidgetResized, managedWidget, nullptr, newWidth, newHeight))
+        return;
+
       Owner->OnWidgetResized(
-        GetWidget(widget, false),
+        managedWidget,
         newWidth, newHeight
       );
     }
@@ -435,8 +2945,21 @@ namespace Berkelium {
       if (widget->getId() == win->getId())
         return;
 
+      NativeCallbackScope stats (Counters, CallbackWidgetMove);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceWidgetMoved, Trace->widgetId(widget));
+        record.addInt(newX);
+        record.addInt(newY);
+        Trace->write(record);
+      }
+
+      Widget ^ managedWidget = GetWidget(widget, false);
+      if (PumpThread::Defer(Owner, PumpEventKind::WidgetMoved, managedWidget, nullptr, newX, newY))
+        return;
+
       Owner->OnWidgetMoved(
-        GetWidget(widget, false),
+        managedWidget,
         newX, newY
       );
     }
@@ -445,35 +2968,143 @@ namespace Berkelium {
       if (widget->getId() == win->getId())
         return;
 
-      // FIXME: Same here
-      Owner->OnWidgetPaint(
-        GetWidget(widget, false),
-        IntPtr((void *)sourceBuffer),
-        gcnew Rect(rect.left(), rect.top(), rect.width(), rect.height()),
+      NativeCallbackScope stats (Counters, CallbackWidgetPaint);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceWidgetPaint, Trace->widgetId(widget));
+        record.setPaint(sourceBuffer, rect, numCopyRects, copyRects, dx, dy, scrollRect);
+        Trace->write(record);
+      }
+
+      Window ^ owner = Owner;
+      if (PumpThread::IsPumpThread && !owner->Coalesce)
+        owner->SetCoalescePaintsNative(true);
+
+      Widget ^ managedWidget = GetWidget(widget, false);
+
+      msclr::lock paintLock (owner->PaintLock, msclr::lock_later);
+      if (PumpThread::IsRunning)
+        paintLock.acquire();
+
+      if (managedWidget->Counters) {
+        managedWidget->Counters->add(StatPaints, 1);
+        if (dx || dy)
+          managedWidget->Counters->add(StatScrollBlits, 1);
+      }
+
+      if (managedWidget->Store)
+        managedWidget->Store->Native->applyPaint(sourceBuffer, rect, numCopyRects, copyRects, dx, dy, scrollRect);
+
+      if (owner->Coalesce && managedWidget->Store) {
+        if (!managedWidget->PendingPaint)
+          managedWidget->PendingPaint = new NativePaintAccumulator();
+
+        managedWidget->PendingPaint->add(numCopyRects, copyRects, dx, dy, scrollRect);
+
+        if (!managedWidget->QueuedForFlush) {
+          if (owner->PendingWidgets == nullptr)
+            owner->PendingWidgets = gcnew System::Collections::Generic::List<Widget ^>();
+
+          managedWidget->QueuedForFlush = true;
+          owner->PendingWidgets->Add(managedWidget);
+        }
+
+        paintLock.release();
+        owner->QueueCoalescedPaint();
+        return;
+      }
+
+      DispatchWidgetPaint(managedWidget, sourceBuffer, rect, (size_t)rect.width() * NativeBackingStore::BytesPerPixel, numCopyRects, copyRects, dx, dy, scrollRect, 1);
+    }
+
+    void WindowDelegateWrapper::DispatchWidgetPaint (Widget ^ widget, const unsigned char *sourceBuffer, const ::Berkelium::Rect &rect, size_t stride, size_t numCopyRects, const ::Berkelium::Rect *copyRects, int dx, int dy, const ::Berkelium::Rect &scrollRect, int paintCount) {
+      Window ^ owner = Owner;
+
+      if (widget->Counters)
+        widget->Counters->addDelivered(numCopyRects, copyRects);
+
+      PaintFrame frame;
+      FillPaintFrame(frame, owner->PaintSequenceNumber++, sourceBuffer, rect, stride, numCopyRects, copyRects, dx, dy, scrollRect, paintCount);
+      owner->OnWidgetPaintFrame(widget, frame);
+
+      if (!owner->WantsLegacyWidgetPaint(widget))
+        return;
+
+      owner->OnWidgetPaint(
+        widget,
+        IntPtr((void *)PackLegacyPaint(LegacyPaintBuffer, sourceBuffer, rect, stride, numCopyRects, copyRects)),
+        ToManagedRect(rect),
+        CopyRectsToArray(numCopyRects, copyRects),
         dx, dy,
-        gcnew Rect(scrollRect.left(), scrollRect.top(), scrollRect.width(), scrollRect.height())
+        ToManagedRect(scrollRect)
       );
     }
 
     void WindowDelegateWrapper::onLoadingStateChanged(::Berkelium::Window *win, bool isLoading) {
+      NativeCallbackScope stats (Counters, CallbackLoadingStateChanged);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceLoadingStateChanged);
+        record.addInt(isLoading);
+        Trace->write(record);
+      }
+
+      if (PumpThread::Defer(Owner, PumpEventKind::LoadingStateChanged, (String ^)nullptr, (String ^)nullptr, isLoading, 0))
+        return;
+
       Owner->OnLoadingStateChanged(
         isLoading
       );
     }
 
     void WindowDelegateWrapper::onTitleChanged(::Berkelium::Window *win, WideString title) {
+      NativeCallbackScope stats (Counters, CallbackTitleChanged);
+
+      if (Trace)
+        TraceText(Trace, TraceTitleChanged, title);
+
+      String ^ titleStr = gcnew String(title.data(), 0, title.length());
+      if (PumpThread::Defer(Owner, PumpEventKind::TitleChanged, titleStr))
+        return;
+
       Owner->OnTitleChanged(
-        gcnew String(title.data(), 0, title.length())
+        titleStr
       );
     }
 
     void WindowDelegateWrapper::onTooltipChanged(::Berkelium::Window *win, WideString tooltip) {
+      NativeCallbackScope stats (Counters, CallbackTooltipChanged);
+
+      if (Trace)
+        TraceText(Trace, TraceTooltipChanged, tooltip);
+
+      String ^ tooltipStr = gcnew String(tooltip.data(), 0, tooltip.length());
+      if (PumpThread::Defer(Owner, PumpEventKind::TooltipChanged, tooltipStr))
+        return;
+
       Owner->OnTooltipChanged(
-        gcnew String(tooltip.data(), 0, tooltip.length())
+        tooltipStr
       );
     }
 
     void WindowDelegateWrapper::onShowContextMenu(::Berkelium::Window *win, const ::Berkelium::ContextMenuEventArgs& cargs) {
+      NativeCallbackScope stats (Counters, CallbackShowContextMenu);
+
+      if (Trace) {
+        NativeTraceRecord record (TraceShowContextMenu);
+        record.addInt(cargs.mediaType);
+        record.addInt(cargs.mouseX);
+        record.addInt(cargs.mouseY);
+        record.addInt(cargs.isEditable);
+        record.addInt(cargs.editFlags);
+        record.addNarrow(cargs.linkUrl.data(), cargs.linkUrl.length());
+        record.addNarrow(cargs.srcUrl.data(), cargs.srcUrl.length());
+        record.addNarrow(cargs.pageUrl.data(), cargs.pageUrl.length());
+        record.addNarrow(cargs.frameUrl.data(), cargs.frameUrl.length());
+        record.addWide(cargs.selectedText.data(), cargs.selectedText.length());
+        Trace->write(record);
+      }
+
       ContextMenuEventArgs ^ args = gcnew ContextMenuEventArgs();
 
       args->MediaType = (MediaType)cargs.mediaType;
@@ -489,8 +3120,638 @@ namespace Berkelium {
       args->IsEditable = cargs.isEditable;
       args->EditFlags = (EditFlags)cargs.editFlags;
 
+      if (PumpThread::Defer(Owner, PumpEventKind::ShowContextMenu, nullptr, args, 0, 0))
+        return;
+
       Owner->OnShowContextMenu(
         args
       );
     }
+    // A reusable frame buffer, along with where its current contents are going.
+    ref class CaptureJob {
+    internal:
+      FrameCapture ^ Owner;
+      NativeCapturedFrame * Frame;
+      String ^ Filename;
+
+      CaptureJob (FrameCapture ^ owner)
+        : Owner(owner)
+        , Frame(new NativeCapturedFrame()) {
+      }
+
+      ~CaptureJob () {
+        if (Frame)
+          delete Frame;
+
+        Frame = 0;
+      }
+    };
+
+    // Shared by every capture, the same way ProtocolWorkerPool is shared by every protocol handler.
+    ref class FrameEncoderPool abstract sealed {
+    internal:
+      literal int IdleTimeoutMilliseconds = 30000;
+
+      static Object ^ Lock = gcnew Object();
+      static System::Collections::Generic::Queue<CaptureJob ^> ^ Pending = gcnew System::Collections::Generic::Queue<CaptureJob ^>();
+      // Leaves a core for the thread that is painting.
+      static int MaxThreads = Math::Max(1, Environment::ProcessorCount - 1);
+      static int ThreadCount, IdleCount;
+
+      static void Enqueue (CaptureJob ^ job) {
+        msclr::lock l(Lock);
+        Pending->Enqueue(job);
+
+        if ((Pending->Count > IdleCount) && (ThreadCount < MaxThreads)) {
+          ThreadCount += 1;
+          System::Threading::Thread ^ thread = gcnew System::Threading::Thread(gcnew System::Threading::ThreadStart(&FrameEncoderPool::Run));
+          thread->Name = "Berkelium frame encoder";
+          thread->IsBackground = true;
+          thread->Priority = System::Threading::ThreadPriority::BelowNormal;
+          thread->Start();
+        } else {
+          System::Threading::Monitor::Pulse(Lock);
+        }
+      }
+
+      static void Run () {
+        for (;;) {
+          CaptureJob ^ job;
+
+          {
+            msclr::lock l(Lock);
+            while (Pending->Count == 0) {
+              IdleCount += 1;
+              bool woken = System::Threading::Monitor::Wait(Lock, IdleTimeoutMilliseconds);
+              IdleCount -= 1;
+
+              if (!woken && (Pending->Count == 0)) {
+                ThreadCount -= 1;
+                return;
+              }
+            }
+
+            job = Pending->Dequeue();
+          }
+
+          job->Owner->Encode(job);
+        }
+      }
+    };
+
+    FrameCapture::FrameCapture (Berkelium::Managed::Window ^ owner, String ^ path, bool sequence, CaptureFormat format, double framesPerSecond)
+      : Owner(owner)
+      , OriginalPath(path)
+      , Pattern(path)
+      , Sequence(sequence)
+      , FileFormat(format)
+      , Rate(framesPerSecond)
+      , Capturing(true)
+      , Lock(gcnew Object())
+      , FreeJobs(gcnew System::Collections::Generic::Stack<CaptureJob ^>())
+      , MaxPending(3)
+    {
+      if (framesPerSecond > 0)
+        Interval = (Int64)(Stopwatch::Frequency / framesPerSecond);
+
+      if (sequence && (path->IndexOf("{0", StringComparison::Ordinal) < 0)) {
+        String ^ escaped = path->Replace("{", "{{")->Replace("}", "}}");
+        Pattern = IO::Path::Combine(
+          IO::Path::GetDirectoryName(escaped),
+          IO::Path::GetFileNameWithoutExtension(escaped) + "{0:D6}" + IO::Path::GetExtension(escaped)
+        );
+      }
+    }
+
+    FrameCapture::~FrameCapture () {
+      Stop();
+      WaitForPendingFrames(System::Threading::Timeout::Infinite);
+    }
+
+    CaptureFormat FrameCapture::FormatForFilename (String ^ filename) {
+      if ((filename != nullptr) && filename->EndsWith(".raw", StringComparison::OrdinalIgnoreCase))
+        return CaptureFormat::Raw;
+
+      return CaptureFormat::Png;
+    }
+
+    void FrameCapture::MaxPendingFrames::set (int value) {
+      if (value < 1)
+        throw gcnew ArgumentOutOfRangeException("value");
+
+      msclr::lock l(Lock);
+      MaxPending = value;
+    }
+
+    void FrameCapture::Offer (NativeBackingStore * store) {
+      if (Interval > 0) {
+        Int64 now = Stopwatch::GetTimestamp();
+        if (HasSnapshot && ((now - LastSnapshot) < Interval))
+          return;
+
+        LastSnapshot = now;
+        HasSnapshot = true;
+      }
+
+      Snapshot(store);
+    }
+
+    void FrameCapture::Snapshot (NativeBackingStore * store) {
+      if ((store->width() <= 0) || (store->height() <= 0))
+        return;
+
+      CaptureJob ^ job;
+
+      {
+        msclr::lock l(Lock);
+        if (!Capturing)
+          return;
+
+        Captured += 1;
+
+        if (Pending >= MaxPending) {
+          // The frame waiting for an encoder is out of date now, so it takes on the new contents instead.
+          // If every pending frame is already being written, the new one is lost.
+          Dropped += 1;
+          if (Newest != nullptr)
+            Newest->Frame->copyFrom(*store);
+          return;
+        }
+
+        job = (FreeJobs->Count > 0) ? FreeJobs->Pop() : gcnew CaptureJob(this);
+        if (!job->Frame->copyFrom(*store)) {
+          FreeJobs->Push(job);
+          Dropped += 1;
+          return;
+        }
+
+        job->Filename = Sequence ? String::Format(Pattern, NextNumber++) : Pattern;
+        Pending += 1;
+        Newest = job;
+      }
+
+      FrameEncoderPool::Enqueue(job);
+    }
+
+    void FrameCapture::Encode (CaptureJob ^ job) {
+      {
+        msclr::lock l(Lock);
+        if (Newest == job)
+          Newest = nullptr;
+      }
+
+      Exception ^ error = nullptr;
+      NativeCapturedFrame * frame = job->Frame;
+
+      try {
+        if (FileFormat == CaptureFormat::Raw) {
+          pin_ptr<const wchar_t> filename = PtrToStringChars(job->Filename);
+          if (!frame->writeRaw(filename))
+            throw gcnew IOException(String::Format("Could not write '{0}'.", job->Filename));
+        } else {
+          System::Drawing::Bitmap ^ bitmap = gcnew System::Drawing::Bitmap(
+            frame->width(), frame->height(), (int)frame->stride(),
+            System::Drawing::Imaging::PixelFormat::Format32bppRgb, IntPtr((void *)frame->data())
+          );
+
+          try {
+            bitmap->Save(job->Filename, System::Drawing::Imaging::ImageFormat::Png);
+          } finally {
+            delete bitmap;
+          }
+        }
+      } catch (Exception ^ exc) {
+        error = exc;
+      }
+
+      msclr::lock l(Lock);
+      Pending -= 1;
+      if (error != nullptr) {
+        Failed += 1;
+        Error = error;
+      } else {
+        Encoded += 1;
+      }
+
+      FreeJobs->Push(job);
+      ReleaseFrames();
+      System::Threading::Monitor::PulseAll(Lock);
+    }
+
+    // Frame buffers can be as big as the window, so they're freed as soon as nothing can use them again,
+    //  rather than when the capture happens to be disposed.
+    void FrameCapture::ReleaseFrames () {
+      if (Capturing || (Pending > 0))
+        return;
+
+      while (FreeJobs->Count > 0)
+        delete FreeJobs->Pop();
+    }
+
+    void FrameCapture::Stop () {
+      {
+        msclr::lock paintLock (Owner->PaintLock, msclr::lock_later);
+        if (PumpThread::IsRunning)
+          paintLock.acquire();
+
+        if (Owner->Capture == this)
+          Owner->Capture = nullptr;
+      }
+
+      msclr::lock l(Lock);
+      Capturing = false;
+      ReleaseFrames();
+    }
+
+    bool FrameCapture::WaitForPendingFrames (int millisecondsTimeout) {
+      Int64 deadline = Stopwatch::GetTimestamp() + ((Int64)millisecondsTimeout * Stopwatch::Frequency / 1000);
+
+      msclr::lock l(Lock);
+      while (Pending > 0) {
+        if (millisecondsTimeout == System::Threading::Timeout::Infinite) {
+          System::Threading::Monitor::Wait(Lock);
+          continue;
+        }
+
+        Int64 remaining = (deadline - Stopwatch::GetTimestamp()) * 1000 / Stopwatch::Frequency;
+        if (remaining <= 0)
+          return false;
+
+        System::Threading::Monitor::Wait(Lock, (int)remaining);
+      }
+
+      return true;
+    }
+
+    void EventRecorder::Stop () {
+      if (!Writer)
+        return;
+
+      // Once the window lets go of the writer, the pump thread is done with it.
+      if (Owner->Recorder == this) {
+        Owner->Recorder = nullptr;
+        Owner->UpdateEventTrace();
+      }
+
+      if (!Writer->flush())
+        Error = gcnew IOException(String::Format("The event trace '{0}' could not be written.", OriginalPath));
+
+      Records = Writer->recordCount();
+      Bytes = Writer->bytesWritten();
+      delete Writer;
+      Writer = 0;
+    }
+
+    EventTrace::EventTrace (String ^ path)
+      : OriginalPath(path) {
+      if (path == nullptr)
+        throw gcnew ArgumentNullException("path");
+
+      pin_ptr<const wchar_t> pathPtr = PtrToStringChars(path);
+      Native = NativeTraceReader::open(pathPtr);
+      if (!Native)
+        throw gcnew IOException(String::Format("'{0}' could not be opened as an event trace.", path));
+    }
+
+    namespace {
+      typedef std::map<int, NativeReplayWidget *> TReplayWidgets;
+
+      // Trace widgets get negative ids, so the wrapper never mistakes one for the window itself.
+      NativeReplayWidget * FindReplayWidget (TReplayWidgets & widgets, const NativeTraceRecord & record) {
+        TReplayWidgets::iterator iter = widgets.find(record.Widget);
+        if (iter != widgets.end())
+          return iter->second;
+
+        ::Berkelium::Rect rect;
+        rect.mLeft = rect.mTop = rect.mWidth = rect.mHeight = 0;
+        NativeReplayWidget * result = new NativeReplayWidget(-record.Widget, rect);
+        widgets[record.Widget] = result;
+        return result;
+      }
+
+      void ReplayRecord (::Berkelium::Window * win, WindowDelegateWrapper * wrapper, TReplayWidgets & widgets, const NativeTraceRecord & record) {
+        const int * ints = record.Ints;
+
+        switch (record.Kind) {
+          case TracePaint:
+            if (record.Pixels)
+              wrapper->onPaint(win, record.Pixels, record.SourceRect, record.CopyRectCount, record.CopyRects, record.Dx, record.Dy, record.ScrollRect);
+            break;
+          case TraceWidgetPaint:
+            if (record.Pixels)
+              wrapper->onWidgetPaint(win, FindReplayWidget(widgets, record), record.Pixels, record.SourceRect, record.CopyRectCount, record.CopyRects, record.Dx, record.Dy, record.ScrollRect);
+            break;
+          case TraceWidgetCreated: {
+            NativeReplayWidget * widget = FindReplayWidget(widgets, record);
+            widget->setPos(ints[1], ints[2]);
+            widget->setSize(ints[3], ints[4]);
+            wrapper->onWidgetCreated(win, widget, ints[0]);
+            break;
+          }
+          case TraceWidgetDestroyed: {
+            NativeReplayWidget * widget = FindReplayWidget(widgets, record);
+            wrapper->onWidgetDestroyed(win, widget);
+            widgets.erase(record.Widget);
+            delete widget;
+            break;
+          }
+          case TraceWidgetMoved: {
+            NativeReplayWidget * widget = FindReplayWidget(widgets, record);
+            widget->setPos(ints[0], ints[1]);
+            wrapper->onWidgetMove(win, widget, ints[0], ints[1]);
+            break;
+          }
+          case TraceWidgetResized: {
+            NativeReplayWidget * widget = FindReplayWidget(widgets, record);
+            widget->setSize(ints[0], ints[1]);
+            wrapper->onWidgetResize(win, widget, ints[0], ints[1]);
+            break;
+          }
+          case TraceAddressBarChanged:
+            wrapper->onAddressBarChanged(win, URLStringView(record.Narrow[0], record.NarrowLength[0]));
+            break;
+          case TraceStartLoading:
+            wrapper->onStartLoading(win, URLStringView(record.Narrow[0], record.NarrowLength[0]));
+            break;
+          case TraceLoad:
+            wrapper->onLoad(win);
+            break;
+          case TraceLoadingStateChanged:
+            wrapper->onLoadingStateChanged(win, ints[0] != 0);
+            break;
+          case TraceTitleChanged:
+            wrapper->onTitleChanged(win, WideStringView(record.Wide[0], record.WideLength[0]));
+            break;
+          case TraceTooltipChanged:
+            wrapper->onTooltipChanged(win, WideStringView(record.Wide[0], record.WideLength[0]));
+            break;
+          case TraceConsoleMessage:
+            wrapper->onConsoleMessage(win, WideStringView(record.Wide[0], record.WideLength[0]), WideStringView(record.Wide[1], record.WideLength[1]), ints[0]);
+            break;
+          case TraceScriptAlert: {
+            bool success = false;
+            WideStringView value (0, 0);
+            wrapper->onScriptAlert(
+              win, WideStringView(record.Wide[0], record.WideLength[0]), WideStringView(record.Wide[1], record.WideLength[1]),
+              URLStringView(record.Narrow[0], record.NarrowLength[0]), ints[0], success, value
+            );
+            if (value.data())
+              wrapper->freeLastScriptAlert(value);
+            break;
+          }
+          case TraceNavigationRequested: {
+            bool cancelDefaultAction = false;
+            wrapper->onNavigationRequested(
+              win, URLStringView(record.Narrow[0], record.NarrowLength[0]), URLStringView(record.Narrow[1], record.NarrowLength[1]),
+              ints[0] != 0, cancelDefaultAction
+            );
+            break;
+          }
+          case TraceProvisionalLoadError:
+            wrapper->onProvisionalLoadError(win, URLStringView(record.Narrow[0], record.NarrowLength[0]), ints[0], ints[1] != 0);
+            break;
+          case TraceExternalHost:
+            wrapper->onExternalHost(
+              win, WideStringView(record.Wide[0], record.WideLength[0]),
+              URLStringView(record.Narrow[0], record.NarrowLength[0]), URLStringView(record.Narrow[1], record.NarrowLength[1])
+            );
+            break;
+          case TraceShowContextMenu: {
+            ::Berkelium::ContextMenuEventArgs args;
+            args.mediaType = (::Berkelium::ContextMenuEventArgs::MediaType)ints[0];
+            args.mouseX = ints[1];
+            args.mouseY = ints[2];
+            args.isEditable = ints[3] != 0;
+            args.editFlags = ints[4];
+            args.linkUrl = URLStringView(record.Narrow[0], record.NarrowLength[0]);
+            args.srcUrl = URLStringView(record.Narrow[1], record.NarrowLength[1]);
+            args.pageUrl = URLStringView(record.Narrow[2], record.NarrowLength[2]);
+            args.frameUrl = URLStringView(record.Narrow[3], record.NarrowLength[3]);
+            args.selectedText = WideStringView(record.Wide[0], record.WideLength[0]);
+            wrapper->onShowContextMenu(win, args);
+            break;
+          }
+          case TraceCrashed:
+            wrapper->onCrashed(win);
+            break;
+          case TraceCrashedWorker:
+            wrapper->onCrashedWorker(win);
+            break;
+          case TraceCrashedPlugin:
+            wrapper->onCrashedPlugin(win, WideStringView(record.Wide[0], record.WideLength[0]));
+            break;
+          case TraceUnresponsive:
+            wrapper->onUnresponsive(win);
+            break;
+          case TraceResponsive:
+            wrapper->onResponsive(win);
+            break;
+        }
+      }
+
+      // A record that's missing fields its kind needs (from a damaged or newer trace) is skipped.
+      bool IsComplete (const NativeTraceRecord & record) {
+        int ints = 0, narrow = 0, wide = 0;
+
+        switch (record.Kind) {
+          case TraceWindowResized: case TraceWidgetMoved: case TraceWidgetResized: ints = 2; break;
+          case TraceWidgetCreated: ints = 5; break;
+          case TraceAddressBarChanged: case TraceStartLoading: narrow = 1; break;
+          case TraceLoadingStateChanged: ints = 1; break;
+          case TraceTitleChanged: case TraceTooltipChanged: case TraceCrashedPlugin: wide = 1; break;
+          case TraceConsoleMessage: ints = 1; wide = 2; break;
+          case TraceScriptAlert: ints = 1; narrow = 1; wide = 2; break;
+          case TraceNavigationRequested: ints = 1; narrow = 2; break;
+          case TraceProvisionalLoadError: ints = 2; narrow = 1; break;
+          case TraceExternalHost: narrow = 2; wide = 1; break;
+          case TraceShowContextMenu: ints = 5; narrow = 4; wide = 1; break;
+        }
+
+        return (record.IntCount >= ints) && (record.NarrowCount >= narrow) && (record.WideCount >= wide);
+      }
+    }
+
+    void EventTrace::Replay (Berkelium::Managed::Window ^ window, bool realTime) {
+      if (window == nullptr)
+        throw gcnew ArgumentNullException("window");
+      if (!Native)
+        throw gcnew ObjectDisposedException("EventTrace");
+      if (!window->Native || !window->Wrapper)
+        throw gcnew ObjectDisposedException("Window");
+      // The callbacks would race the pump thread's own.
+      if (PumpThread::IsRunning)
+        throw gcnew InvalidOperationException("A trace can't be replayed while BerkeliumSharp is using a pump thread.");
+
+      ::Berkelium::Window * win = window->Native;
+      WindowDelegateWrapper * wrapper = window->Wrapper;
+      TReplayWidgets widgets;
+      NativeTraceRecord record (0);
+      long long previousTime = 0;
+      Int64 start = Stopwatch::GetTimestamp();
+
+      Native->rewind();
+      try {
+        while (Native->next(record)) {
+          if (record.Time - previousTime >= 1000)
+            BerkeliumSharp::FlushCoalescedPaints();
+          previousTime = record.Time;
+
+          if (realTime) {
+            Int64 due = start + (record.Time * Stopwatch::Frequency / 1000000);
+            Int64 wait = (due - Stopwatch::GetTimestamp()) * 1000 / Stopwatch::Frequency;
+            if (wait > 0)
+              System::Threading::Thread::Sleep((int)wait);
+          }
+
+          if (!IsComplete(record))
+            continue;
+
+          // The recorded size is one that was applied, so it's applied again right away rather than queued.
+          if (record.Kind == TraceWindowResized) {
+            window->Resize(record.Ints[0], record.Ints[1]);
+            window->FlushResizeNative();
+          } else {
+            ReplayRecord(win, wrapper, widgets, record);
+          }
+
+          // A handler may have destroyed the window.
+          if (window->Wrapper != wrapper)
+            break;
+        }
+
+        BerkeliumSharp::FlushCoalescedPaints();
+      } finally {
+        for (TReplayWidgets::iterator iter = widgets.begin(); iter != widgets.end(); ++iter) {
+          if (window->Wrapper == wrapper)
+            wrapper->onWidgetDestroyed(win, iter->second);
+          delete iter->second;
+        }
+      }
+    }
+
+    int Profiler::BufferCapacity::get () {
+      return (int)Math::Min((size_t)Int32::MaxValue, NativeProfiler::capacity());
+    }
+
+    void Profiler::BufferCapacity::set (int value) {
+      if (value < 1)
+        throw gcnew ArgumentOutOfRangeException("value");
+
+      NativeProfiler::setCapacity((size_t)value);
+    }
+
+    void Profiler::WriteChromeTrace (String ^ path) {
+      if (path == nullptr)
+        throw gcnew ArgumentNullException("path");
+
+      pin_ptr<const wchar_t> pathPtr = PtrToStringChars(path);
+      if (!NativeProfiler::writeChromeTrace(pathPtr))
+        throw gcnew IOException(String::Format("The trace '{0}' could not be written.", path));
+    }
+
+    WindowPool::WindowPool (Berkelium::Managed::Context ^ context, int width, int height, int lowWatermark, int highWatermark) {
+      if (context == nullptr)
+        throw gcnew ArgumentNullException("context");
+      if ((width <= 0) || (height <= 0))
+        throw gcnew ArgumentOutOfRangeException((width <= 0) ? "width" : "height");
+      if ((lowWatermark < 0) || (highWatermark < lowWatermark))
+        throw gcnew ArgumentOutOfRangeException((lowWatermark < 0) ? "lowWatermark" : "highWatermark");
+
+      PoolContext = context;
+      PoolWidth = width;
+      PoolHeight = height;
+      Low = lowWatermark;
+      High = highWatermark;
+      Idle = gcnew System::Collections::Generic::Stack<Window ^>(highWatermark);
+
+      Replenish();
+    }
+
+    WindowPool::~WindowPool () {
+      if (Idle == nullptr)
+        return;
+
+      while (Idle->Count > 0)
+        delete Idle->Pop();
+      Idle = nullptr;
+    }
+
+    void WindowPool::LowWatermark::set (int value) {
+      if ((value < 0) || (value > High))
+        throw gcnew ArgumentOutOfRangeException("value");
+
+      Low = value;
+    }
+
+    void WindowPool::HighWatermark::set (int value) {
+      if (value < Low)
+        throw gcnew ArgumentOutOfRangeException("value");
+
+      High = value;
+      Trim();
+    }
+
+    Window ^ WindowPool::CreateIdleWindow () {
+      Window ^ window = gcnew Window(PoolContext);
+      window->Resize(PoolWidth, PoolHeight);
+      window->NavigateTo("about:blank");
+      return window;
+    }
+
+    void WindowPool::Trim () {
+      while (Idle->Count > High)
+        delete Idle->Pop();
+    }
+
+    void WindowPool::Replenish () {
+      if (Idle == nullptr)
+        throw gcnew ObjectDisposedException("WindowPool");
+
+      while (Idle->Count < Low)
+        Idle->Push(CreateIdleWindow());
+    }
+
+    Window ^ WindowPool::Acquire () {
+      if (Idle == nullptr)
+        throw gcnew ObjectDisposedException("WindowPool");
+
+      Window ^ result = (Idle->Count > 0) ? Idle->Pop() : CreateIdleWindow();
+
+      if (ReplenishOnAcquire)
+        Replenish();
+
+      return result;
+    }
+
+    void WindowPool::Release (Window ^ window) {
+      if (window == nullptr)
+        throw gcnew ArgumentNullException("window");
+      if (window->Context != PoolContext)
+        throw gcnew ArgumentException("The window belongs to a different context.", "window");
+      if (Idle == nullptr)
+        throw gcnew ObjectDisposedException("WindowPool");
+
+      // Already disposed by its user, so there's nothing left to recycle.
+      if (!window->Native)
+        return;
+
+      if (Idle->Count >= High) {
+        delete window;
+        return;
+      }
+
+      window->Stop();
+      window->Unfocus();
+      window->Transparent = false;
+      window->AdjustZoom(ZoomFunction::ResetZoom);
+      window->Resize(PoolWidth, PoolHeight);
+      // Resizes wait for the next update, and by then the native window belongs to the recycled Window.
+      window->FlushResize();
+      window->NavigateTo("about:blank");
+
+      Window ^ recycled = window->Rebind();
+      if (recycled != nullptr)
+        Idle->Push(recycled);
+    }
+
   }}
\ No newline at end of file
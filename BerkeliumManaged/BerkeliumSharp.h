@@ -4,6 +4,20 @@
 
 #using <mscorlib.dll>
 
+#include "NativeBackingStore.h"
+#include "NativeEventTrace.h"
+#include "NativeFrameCapture.h"
+#include "NativeHostMessages.h"
+#include "NativeInputQueue.h"
+#include "NativeProfiler.h"
+#include "NativeScriptQueue.h"
+#include "NativeStats.h"
+#include "NativeStrings.h"
+#include "HandleTable.h"
+#include "NativeResponseCache.h"
+#include "NativeAssetBundle.h"
+#include "PumpThread.h"
+
 using namespace System;
 using namespace System::IO;
 using namespace System::Runtime::InteropServices;
@@ -12,51 +26,109 @@ namespace Berkelium {
   namespace Managed {
 
     using ::Berkelium::URLString;
+    // Encodes a URL the way Chromium expects it: ASCII as is, an internationalized host name
+    //  in punycode and any other non-ASCII characters as percent-escaped UTF-8.
+    // URLs are almost always ASCII, and short ones are narrowed into inline storage.
     class URLStringHelper : public URLString {
+      static const size_t InlineCapacity = 256;
+      char mInline[InlineCapacity];
       std::string mString;
+
+      URLStringHelper (const URLStringHelper &);
+      URLStringHelper & operator= (const URLStringHelper &);
+
+      void EncodeNonAscii (System::String ^ sysString);
+
     public:
       URLStringHelper(System::String ^ sysString) {
-        pin_ptr<const wchar_t> pinnedData = PtrToStringChars(sysString);
         size_t length = sysString->Length;
-        mString.resize(length);
-        bool url_string_invalid = false;
-        for (size_t i = 0; i < length; ++i) {
-          if (pinnedData[i] <= 0 || pinnedData[i] >= 127) {
-            url_string_invalid = true;
-            mString[i] = '?';
-          } else {
-            mString[i] = static_cast<char>(pinnedData[i]);
-          }
+        char * output = mInline;
+        if (length > InlineCapacity) {
+          mString.resize(length);
+          output = &mString[0];
         }
-        if (url_string_invalid) {
-          // FIXME: Show an error?
+
+        pin_ptr<const wchar_t> pinnedData = PtrToStringChars(sysString);
+        if (NarrowAscii(pinnedData, length, output) == length) {
+          this->mData = output;
+          this->mLength = length;
+        } else {
+          EncodeNonAscii(sysString);
         }
-        this->mData = mString.data();
-        this->mLength = mString.length();
       }
     };
 
     using ::Berkelium::WideString;
+    // Hands a managed string's characters to Berkelium without copying them. Short strings are
+    //  copied into inline storage since that's cheaper than pinning; longer ones stay pinned
+    //  where they are for as long as the helper lives.
     class WideStringHelper : public WideString {
-      std::wstring mString;
+      static const size_t InlineCapacity = 64;
+      wchar_t mInline[InlineCapacity];
+      void * mPin;
+
+      WideStringHelper (const WideStringHelper &);
+      WideStringHelper & operator= (const WideStringHelper &);
+
     public:
-      WideStringHelper(System::String ^ sysString) {
-        pin_ptr<const wchar_t> pinnedData = PtrToStringChars(sysString);
+      WideStringHelper(System::String ^ sysString)
+        : mPin(0) {
         size_t length = sysString->Length;
-        mString = std::wstring(pinnedData, length);
-        this->mData = mString.data();
-        this->mLength = mString.length();
+
+        if (length <= InlineCapacity) {
+          pin_ptr<const wchar_t> pinnedData = PtrToStringChars(sysString);
+          memcpy(mInline, pinnedData, length * sizeof(wchar_t));
+          this->mData = mInline;
+        } else {
+          GCHandle pin = GCHandle::Alloc(sysString, GCHandleType::Pinned);
+          mPin = GCHandle::ToIntPtr(pin).ToPointer();
+          this->mData = (const wchar_t *)pin.AddrOfPinnedObject().ToPointer();
+        }
+
+        this->mLength = length;
+      }
+
+      ~WideStringHelper() {
+        if (mPin)
+          GCHandle::FromIntPtr(IntPtr(mPin)).Free();
+      }
+    };
+
+    // Points a WideString at text that is already in native memory.
+    class WideStringView : public WideString {
+    public:
+      WideStringView(const wchar_t * data, size_t length) {
+        this->mData = data;
+        this->mLength = length;
+      }
+    };
+
+    // Points a URLString at text that is already in native memory.
+    class URLStringView : public URLString {
+    public:
+      URLStringView(const char * data, size_t length) {
+        this->mData = data;
+        this->mLength = length;
       }
     };
 
     using ::Berkelium::Cursor;
 
     class WindowDelegateWrapper;
+    class NativeProtocolRequestClient;
 
     ref class ProtocolHandler;
+    ref class ProtocolRequest;
     ref class Context;
     ref class Widget;
     ref class Window;
+    ref class BackingStore;
+    ref class FrameCapture;
+    ref class EventRecorder;
+    ref class CaptureJob;
+    ref class HostMessageBatch;
+    ref class ScriptTemplate;
+    ref class ProcessStats;
     ref struct Data;
     ref struct Rect;
 
@@ -79,6 +151,17 @@ namespace Berkelium {
     internal:
       static bool IsInitialized;
       static ErrorDelegateWrapper * Wrapper;
+      static System::Collections::Generic::List<Window ^> ^ CoalescedWindows;
+      static System::Collections::Generic::List<Window ^> ^ FlushingWindows;
+
+      static System::Collections::Generic::List<Window ^> ^ QueuedWindows;
+
+      static void QueueCoalescedPaint (Window ^ window);
+      static void FlushCoalescedPaints ();
+      static void QueueWindowFlush (Window ^ window);
+      static void FlushQueuedWindows ();
+      // Runs Berkelium's message pump once, counting it toward the process's stats.
+      static void UpdateNative ();
 
     public:
       static event ErrorHandler ^ PureCall;
@@ -103,11 +186,47 @@ namespace Berkelium {
         InvalidParameter(expression, function, file, lineNumber);
       }
 
+      static void OnEventsAvailable () {
+        EventsAvailable(nullptr, EventArgs::Empty);
+      }
+
+      static void InitNative (System::String ^ homeDirectory);
+
+      static int ToTimeout (TimeSpan timeout);
+      static bool HasPendingWork ();
+      static bool WaitForWork (TimeSpan maxWait, System::Threading::WaitHandle ^ wakeHandle);
+
+      static void DestroyNative () {
+        ::Berkelium::setErrorHandler(0);
+        ::Berkelium::destroy();
+        if (Wrapper) {
+          delete Wrapper;
+          Wrapper = 0;
+        }
+      }
+
     public:
+      /// <summary>
+      /// Raised on the pump thread when events are queued for a UI thread that has drained all previous events.
+      /// Use this to schedule a call to DispatchEvents (for example with Control.BeginInvoke).
+      /// </summary>
+      static event EventHandler ^ EventsAvailable;
+
+      /// <summary>
+      /// Initializes the Berkelium library for the current process, specifying a home directory to use for browser cache, preferences, and data.
+      /// </summary>
+      static void Init (System::String ^ homeDirectory) {
+        Init(homeDirectory, false);
+      }
+
       /// <summary>
       /// Initializes the Berkelium library for the current process, specifying a home directory to use for browser cache, preferences, and data.
+      /// If usePumpThread is true, Berkelium is initialized on and pumped by a dedicated thread. All events are then queued for
+      ///  the calling thread, which receives them by calling DispatchEvents (or Update), and input and navigation calls are
+      ///  queued for the pump thread instead of being made synchronously. Paints are always coalesced in this mode.
+      /// ScriptAlert and NavigationRequested need an immediate answer, so they are raised on the pump thread.
       /// </summary>
-      static void Init (System::String ^ homeDirectory);
+      static void Init (System::String ^ homeDirectory, bool usePumpThread);
 
       /// <summary>
       /// Initializes the Berkelium library for the current process, using the default home directory for browser cache, preferences, and data.
@@ -123,23 +242,85 @@ namespace Berkelium {
         if (!IsInitialized)
           return;
 
-        ::Berkelium::setErrorHandler(0);
-        ::Berkelium::destroy();
-        if (Wrapper) {
-          delete Wrapper;
-          Wrapper = 0;
-        }
+        if (PumpThread::IsRunning)
+          PumpThread::Stop();
+        else
+          DestroyNative();
+
         IsInitialized = false;
       }
 
+      /// <summary>
+      /// A snapshot of the counters for the whole process. Safe to read from any thread.
+      /// </summary>
+      static property ProcessStats ^ Stats {
+        ProcessStats ^ get ();
+      }
+
+      /// <summary>
+      /// Indicates whether Berkelium is being pumped by a dedicated thread.
+      /// </summary>
+      static property bool UsesPumpThread {
+        bool get () {
+          return PumpThread::IsRunning;
+        }
+      }
+
       /// <summary>
       /// Runs the Berkelium message pump, processing any pending messages or tasks and dispatching events.
+      /// Windows that coalesce paints receive their merged paint after the pump returns.
+      /// If Berkelium is pumped by a dedicated thread, this dispatches all queued events instead.
       /// </summary>
       static void Update () {
         if (!IsInitialized)
           return;
 
-        ::Berkelium::update();
+        FlushQueuedWindows();
+
+        if (PumpThread::IsRunning) {
+          PumpThread::DispatchEvents(TimeSpan::MaxValue);
+          return;
+        }
+
+        NativeProfileScope span ("update", "BerkeliumSharp::Update");
+        UpdateNative();
+        FlushCoalescedPaints();
+      }
+
+      /// <summary>
+      /// Sleeps until Berkelium has work to do (a message from a renderer or a timer that is due) or maxWait elapses,
+      ///  then runs the message pump once. Unlike Update, this uses no CPU time while every browser is idle.
+      /// If Berkelium is pumped by a dedicated thread, this waits for queued events and then dispatches all of them.
+      /// </summary>
+      /// <returns>true if work is still pending, in which case the caller should update again soon.</returns>
+      static bool Update (TimeSpan maxWait) {
+        if (PumpThread::IsRunning)
+          return Update(maxWait, TimeSpan::MaxValue);
+
+        return Update(maxWait, TimeSpan::Zero);
+      }
+
+      /// <summary>
+      /// Sleeps until Berkelium has work to do or maxWait elapses, then keeps running the message pump for as long as
+      ///  work is pending and the time spent pumping is under budget. The pump always runs at least once.
+      /// If Berkelium is pumped by a dedicated thread, this waits for queued events and dispatches them within the budget.
+      /// </summary>
+      /// <param name="wallClockBudget">How long pumping may take, in elapsed (wall-clock) time counted from the end of
+      ///  the wait, not CPU time. Time the thread spends preempted or blocked counts against it, so leave some slack.</param>
+      /// <returns>true if work is still pending because the budget ran out.</returns>
+      static bool Update (TimeSpan maxWait, TimeSpan wallClockBudget);
+
+      /// <summary>
+      /// Dispatches events queued by the pump thread until the queue is empty or the budget has been used up.
+      /// At least one event is dispatched if any are queued. Must be called from the thread that called Init.
+      /// </summary>
+      /// <param name="wallClockBudget">How long dispatching may take, in elapsed (wall-clock) time, as for Update.</param>
+      /// <returns>true if events are still queued.</returns>
+      static bool DispatchEvents (TimeSpan wallClockBudget) {
+        if (!IsInitialized || !PumpThread::IsRunning)
+          return false;
+
+        return PumpThread::DispatchEvents(wallClockBudget);
       }
     };
 
@@ -168,6 +349,63 @@ namespace Berkelium {
       HasMessage = 0x8
     };
 
+    /// <summary>
+    /// The file format a FrameCapture writes frames in. Raw frames are the backing store's pixels exactly
+    ///  as they are (32bpp BGRX, top row first), without padding or a header.
+    /// </summary>
+    public enum class CaptureFormat : System::Int32 {
+      Png,
+      Raw
+    };
+
+    /// <summary>
+    /// How much of each paint an EventRecorder keeps. Without pixels, a replayed paint still covers the same rects
+    ///  but its contents are undefined. Compressed pixels are run-length encoded, which suits page content well.
+    /// </summary>
+    public enum class TracePixels : System::Int32 {
+      None,
+      Raw,
+      Compressed
+    };
+
+    /// <summary>
+    /// The Berkelium callbacks a window's statistics count, one counter each.
+    /// </summary>
+    public enum class CallbackType : System::Int32 {
+      AddressBarChanged,
+      StartLoading,
+      Load,
+      LoadingStateChanged,
+      TitleChanged,
+      TooltipChanged,
+      ProvisionalLoadError,
+      NavigationRequested,
+      ConsoleMessage,
+      ScriptAlert,
+      ExternalHost,
+      CreatedWindow,
+      Paint,
+      WidgetCreated,
+      WidgetDestroyed,
+      WidgetMove,
+      WidgetResize,
+      WidgetPaint,
+      CursorUpdated,
+      ShowContextMenu,
+      Crashed,
+      CrashedWorker,
+      CrashedPlugin,
+      Unresponsive,
+      Responsive
+    };
+
+    public enum class HostArgumentType : System::Int32 {
+      Null,
+      Number,
+      String,
+      Bytes
+    };
+
     public enum class MediaType : System::Int32  {
       None,
       Image,
@@ -193,6 +431,123 @@ namespace Berkelium {
       ZoomIn = 1
     };
 
+    public enum class BufferFormat : System::Int32 {
+      /// <summary>
+      /// 32 bits per pixel, stored as blue, green, red, alpha.
+      /// </summary>
+      Bgra32 = 0
+    };
+
+    /// <summary>
+    /// An allocation-free counterpart of Rect, used by PaintFrame.
+    /// </summary>
+    public value struct PaintRect {
+    public:
+      int Left, Top, Width, Height;
+
+      PaintRect (int left, int top, int width, int height) 
+        : Left(left)
+        , Top(top) 
+        , Width(width)
+        , Height(height) {
+      }
+
+      property int Right {
+        int get () {
+          return Left + Width;
+        }
+      }
+
+      property int Bottom {
+        int get () {
+          return Top + Height;
+        }
+      }
+
+      property bool IsEmpty {
+        bool get () {
+          return (Width <= 0) || (Height <= 0);
+        }
+      }
+
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "PaintRect({0},{1} {2}x{3})", 
+          Left, Top, Width, Height
+          );
+      }
+
+    internal:
+      static PaintRect FromNative (const ::Berkelium::Rect & rect) {
+        return PaintRect(rect.left(), rect.top(), rect.width(), rect.height());
+      }
+    };
+
+    /// <summary>
+    /// Describes a single paint event without allocating anything on the managed heap.
+    /// The buffer and copy rects are only valid for the duration of the event handler.
+    /// </summary>
+    public value struct PaintFrame {
+    internal:
+      const ::Berkelium::Rect * NativeCopyRects;
+
+    public:
+      /// <summary>
+      /// Increases by one for every paint dispatched by a window (including paints of its widgets).
+      /// </summary>
+      System::Int64 SequenceNumber;
+
+      /// <summary>
+      /// The region covered by Buffer, relative to the top-left corner of the window or widget.
+      /// </summary>
+      PaintRect SourceRect;
+      IntPtr Buffer;
+      /// <summary>
+      /// The distance between the start of each row of Buffer, in bytes. Only more than SourceRect.Width * 4 when Buffer
+      ///  is a backing store (see Window.CoalescePaints).
+      /// </summary>
+      int Stride;
+      int ByteLength;
+      BufferFormat Format;
+
+      int Dx, Dy;
+      PaintRect ScrollRect;
+
+      /// <summary>
+      /// The number of rects within SourceRect that actually changed.
+      /// </summary>
+      int CopyRectCount;
+
+      /// <summary>
+      /// The number of paints from Berkelium that this frame represents. Only greater than one when the window coalesces paints.
+      /// </summary>
+      int PaintCount;
+
+      PaintRect GetCopyRect (int index) {
+        if ((index < 0) || (index >= CopyRectCount))
+          throw gcnew ArgumentOutOfRangeException("index");
+
+        return PaintRect::FromNative(NativeCopyRects[index]);
+      }
+
+      /// <summary>
+      /// Returns a pointer to the top-left pixel of the specified rect within Buffer.
+      /// </summary>
+      IntPtr GetPixelPointer (PaintRect rect) {
+        return IntPtr(
+          (unsigned char *)Buffer.ToPointer() + 
+          ((rect.Top - SourceRect.Top) * Stride) + 
+          ((rect.Left - SourceRect.Left) * 4)
+        );
+      }
+
+      property bool IsScroll {
+        bool get () {
+          return (Dx != 0) || (Dy != 0);
+        }
+      }
+    };
+
     public ref struct ContextMenuEventArgs {
       MediaType MediaType;
 
@@ -212,8 +567,10 @@ namespace Berkelium {
     public delegate void LoadingStateChangedHandler (Window ^ window, bool isLoading);
     public delegate void ProvisionalLoadErrorHandler (Window ^ window, System::String ^ url, int errorCode, bool isMainFrame);
     public delegate void ChromeSendHandler (Window ^ window, System::String ^ message, array<System::String ^> ^ arguments);
+    public delegate void HostMessagesHandler (Window ^ window, HostMessageBatch ^ messages);
     public delegate void CreatedWindowHandler (Window ^ window, Window ^ newWindow, Rect ^ initialRect, System::String ^ creatorUrl);
-    public delegate void PaintHandler (Window ^ window, IntPtr sourceBuffer, Rect ^ rect, int dx, int dy, Rect ^ scrollRect);
+    public delegate void PaintHandler (Window ^ window, IntPtr sourceBuffer, Rect ^ rect, array<Rect ^> ^ copyRects, int dx, int dy, Rect ^ scrollRect);
+    public delegate void PaintFrameHandler (Window ^ window, PaintFrame % frame);
     public delegate void CrashedPluginHandler (Window ^ window, System::String ^ pluginName);
     public delegate void ConsoleMessageHandler (Window ^ window, System::String ^ sourceId, System::String ^ message, int lineNumber);
     public delegate void ScriptAlertHandler (Window ^ window, System::String ^ message, System::String ^ defaultPrompt, System::String ^ url, ScriptAlertFlags flags, bool % success, System::String ^% prompt);
@@ -221,122 +578,1514 @@ namespace Berkelium {
     public delegate void TitleChangedHandler (Window ^ window, System::String ^ newTitle);
     public delegate void TooltipChangedHandler (Window ^ window, System::String ^ newTooltip);
     public delegate void WidgetCreatedHandler (Window ^ window, Widget ^ newWidget, int zIndex);
-    public delegate void WidgetPaintHandler (Window ^ window, Widget ^ widget, IntPtr sourceBuffer, Rect ^ rect, int dx, int dy, Rect ^ scrollRect);
+    public delegate void WidgetPaintHandler (Window ^ window, Widget ^ widget, IntPtr sourceBuffer, Rect ^ rect, array<Rect ^> ^ copyRects, int dx, int dy, Rect ^ scrollRect);
+    public delegate void WidgetPaintFrameHandler (Window ^ window, Widget ^ widget, PaintFrame % frame);
     public delegate void WidgetMovedHandler (Window ^ window, Widget ^ widget, int newX, int newY);
     public delegate void WidgetResizedHandler (Window ^ window, Widget ^ widget, int newWidth, int newHeight);
     public delegate void WidgetDestroyedHandler (Window ^ window, Widget ^ widget);
     public delegate void ShowContextMenuHandler (Window ^ window, ContextMenuEventArgs ^ args);
     public delegate void CursorChangedHandler (Window ^ window, IntPtr cursorHandle);
 
-    class NativeProtocolHandler {
-    public:
-      gcroot<ProtocolHandler ^> Owner;
+    /// <summary>
+    /// A set of header lines encoded once, up front, so that responses can share them without formatting
+    ///  or marshalling them again. Immutable, and safe to share between threads.
+    /// </summary>
+    public ref class HeaderBlock sealed {
+    internal:
+      // Each line followed by a null, as they appear in the native header block.
+      array<unsigned char> ^ Bytes;
+
+    public:
+      /// <param name="lines">The header lines, such as "Cache-Control: max-age=3600". Characters outside Latin-1 are sent as '?'.</param>
+      HeaderBlock (... array<System::String ^> ^ lines);
+
+      /// <summary>
+      /// The number of bytes the block adds to a response's headers.
+      /// </summary>
+      property int Length {
+        int get () {
+          return Bytes->Length;
+        }
+      }
+    };
+
+    /// <summary>
+    /// Response headers as a status code and a set of well-known fields, encoded straight into the native header
+    ///  block in a single pass when the response is handed to Berkelium. Fields left null (or -1) are omitted.
+    /// </summary>
+    public ref class ResponseHeaders {
+    internal:
+      System::Collections::Generic::List<HeaderBlock ^> ^ Blocks;
+      System::Collections::Generic::List<System::String ^> ^ Lines;
+      // Emitted as Content-Range for 206 and 416 responses.
+      System::Int64 RangeFirst, RangeLast, RangeLength;
+
+      size_t GetMaximumLength ();
+      size_t EncodeTo (unsigned char * buffer);
+      HGLOBAL Encode (size_t & length);
+      ResponseHeaders ^ CopyForStatus (int statusCode);
+
+    public:
+      /// <param name="statusCode">The HTTP status code, such as 200 or 404.</param>
+      ResponseHeaders (int statusCode) {
+        StatusCode = statusCode;
+        ContentLength = -1;
+        RangeLength = -1;
+      }
+
+      property int StatusCode;
+      /// <summary>
+      /// The reason phrase sent after the status code. If null, the standard one for the status code is used.
+      /// </summary>
+      property System::String ^ StatusText;
+      property System::String ^ ContentType;
+      /// <summary>
+      /// Appended to the Content-Type as "; charset=...".
+      /// </summary>
+      property System::String ^ Charset;
+      property System::Int64 ContentLength;
+      property System::String ^ ContentEncoding;
+      property System::String ^ CacheControl;
+      property System::String ^ ETag;
+      property System::Nullable<System::DateTime> LastModified;
+      property bool AcceptRanges;
+
+      /// <summary>
+      /// Appends a header line that has no field of its own.
+      /// </summary>
+      void Add (System::String ^ line);
+      /// <summary>
+      /// Appends a preformatted block of header lines.
+      /// </summary>
+      void Add (HeaderBlock ^ block);
+
+      /// <summary>
+      /// The header lines these fields produce, one per string. Handlers don't need this; it's for inspecting responses.
+      /// </summary>
+      array<System::String ^> ^ ToArray ();
+    };
+
+    /// <summary>
+    /// A response to a custom protocol request. The body is not read up front: Berkelium pulls it from
+    ///  the stream one chunk at a time as the page consumes it, and the stream is disposed with the response.
+    /// </summary>
+    public ref class ProtocolResponse {
+    internal:
+      literal int ChunkSize = 65536;
+
+      array<unsigned char> ^ Chunk;
+      // Set when Body is a MemoryStream over this array (starting at index 0).
+      array<unsigned char> ^ BodyBuffer;
+      // The number of body bytes left to send when answering a range request, or -1 to send the rest of the body.
+      System::Int64 Limit;
+
+      size_t Read (unsigned char * buffer, size_t capacity);
+      size_t ReadBody (unsigned char * buffer, size_t capacity);
+      System::Int64 GetRemainingLength ();
+
+    public:
+      /// <param name="succeeded">true if the request was successful, false otherwise.</param>
+      /// <param name="headers">The response headers. Each header line should be an individual string within the array.</param>
+      /// <param name="body">The response body, or null if there is none.</param>
+      ProtocolResponse (bool succeeded, array<System::String ^> ^ headers, System::IO::Stream ^ body) {
+        Succeeded = succeeded;
+        Headers = headers;
+        Body = body;
+        Cacheable = true;
+        Limit = -1;
+      }
+
+      /// <summary>
+      /// Constructs a response with structured headers, which are encoded without formatting or marshalling each line.
+      /// The response succeeds if the status code is below 400, and takes its ETag and LastModified from the headers.
+      /// </summary>
+      /// <param name="headers">The response headers.</param>
+      /// <param name="body">The response body, or null if there is none.</param>
+      ProtocolResponse (ResponseHeaders ^ headers, System::IO::Stream ^ body) {
+        Succeeded = headers->StatusCode < 400;
+        HeaderFields = headers;
+        Body = body;
+        Cacheable = true;
+        Limit = -1;
+        ETag = headers->ETag;
+        LastModified = headers->LastModified;
+      }
+
+      ~ProtocolResponse () {
+        if (Body != nullptr) {
+          delete Body;
+          Body = nullptr;
+        }
+      }
+
+      property bool Succeeded;
+      /// <summary>
+      /// The response headers, one line per string. Null if the response was constructed with ResponseHeaders.
+      /// </summary>
+      property array<System::String ^> ^ Headers;
+      /// <summary>
+      /// The structured response headers, if the response was constructed with them. They take precedence over Headers.
+      /// </summary>
+      property ResponseHeaders ^ HeaderFields;
+      property System::IO::Stream ^ Body;
+      /// <summary>
+      /// If the handler's response cache is enabled, successful responses are kept in it unless this is set to false.
+      /// </summary>
+      property bool Cacheable;
+      /// <summary>
+      /// An entity tag identifying this version of the body, including its quotes. Requests with a matching
+      ///  If-None-Match header are answered with 304 Not Modified without reading the body.
+      /// </summary>
+      property System::String ^ ETag;
+      /// <summary>
+      /// When the body last changed, if known. Requests with an If-Modified-Since header that is no older
+      ///  are answered with 304 Not Modified.
+      /// </summary>
+      property System::Nullable<System::DateTime> LastModified;
+    };
+
+    /// <summary>
+    /// A custom protocol request that is being answered asynchronously. Complete it from any thread once
+    ///  the response is ready.
+    /// </summary>
+    public ref class ProtocolRequest {
+    internal:
+      ProtocolHandler ^ Handler;
+      NativeProtocolRequestClient * Client;
+      bool Completed;
+      volatile bool Cancelled;
+      // Set instead of Client for requests begun through ProtocolHandler.BeginRequest.
+      System::Action<ProtocolResponse ^> ^ Callback;
+      // When the request arrived, in NativeStatTicks.
+      Int64 Started;
+
+      ProtocolRequest (ProtocolHandler ^ handler, System::String ^ url, array<System::String ^> ^ requestHeaders, NativeProtocolRequestClient * client)
+        : Handler(handler)
+        , Client(client)
+        , Completed(false)
+        , Cancelled(false)
+        , Started(NativeStatTicks()) {
+        Url = url;
+        RequestHeaders = requestHeaders;
+      }
+
+      void Cancel ();
+
+    public:
+      property System::String ^ Url;
+      /// <summary>
+      /// The request headers, one "Name: value" line per string. Empty if there are none.
+      /// </summary>
+      property array<System::String ^> ^ RequestHeaders;
+
+      /// <summary>
+      /// True once the request has been abandoned, for example because the navigation was aborted.
+      /// Handlers doing long-running work should check this and stop early; completing a cancelled
+      ///  request simply disposes the response.
+      /// </summary>
+      property bool IsCancelled {
+        bool get () {
+          return Cancelled;
+        }
+      }
+
+      /// <summary>
+      /// Delivers the response for this request. May be called from any thread, but only once.
+      /// </summary>
+      /// <param name="response">The response, or null if the handler could not handle the request.</param>
+      void Complete (ProtocolResponse ^ response);
+    };
+
+    // The native side of a ProtocolResponse. Whoever opened it reads the body from it in chunks
+    //  and deletes it once the body has been consumed or the request has been cancelled.
+    class NativeProtocolResponse {
+    public:
+      gcroot<ProtocolResponse ^> Owner;
+      HGLOBAL Headers;
+      bool Succeeded;
+      // Set when the response is served from the handler's cache; the body is then read natively.
+      NativeCachedResponse * Cached;
+      size_t Position;
+      // Set while the body is being copied into the handler's cache as it is read.
+      NativeResponseCache * Cache;
+      NativeCachedResponse * Filling;
+      // Set when the response is served from an asset bundle; the body is then read straight out of its mapping.
+      NativeAssetBundle * Bundle;
+      const unsigned char * Mapped;
+      size_t MappedLength;
+
+      NativeProtocolResponse (ProtocolResponse ^ owner, HGLOBAL headers)
+        : Owner(owner)
+        , Headers(headers)
+        , Succeeded(owner->Succeeded)
+        , Cached(0)
+        , Position(0)
+        , Cache(0)
+        , Filling(0)
+        , Bundle(0)
+        , Mapped(0)
+        , MappedLength(0) {
+      }
+
+      NativeProtocolResponse (NativeCachedResponse * cached)
+        : Headers(cached->copyHeaders())
+        , Succeeded(cached->Succeeded)
+        , Cached(cached)
+        , Position(0)
+        , Cache(0)
+        , Filling(0)
+        , Bundle(0)
+        , Mapped(0)
+        , MappedLength(0) {
+      }
+
+      NativeProtocolResponse (NativeAssetBundle * bundle, const AssetBundleEntry * entry, HGLOBAL headers)
+        : Headers(headers)
+        , Succeeded(true)
+        , Cached(0)
+        , Position(0)
+        , Cache(0)
+        , Filling(0)
+        , Bundle(bundle)
+        , Mapped(bundle->data(entry))
+        , MappedLength((size_t)entry->DataLength) {
+        bundle->addRef();
+      }
+
+      ~NativeProtocolResponse ();
+
+      // Copies up to capacity bytes of the body into buffer. Returns 0 once the body has been read.
+      size_t Read (void * buffer, size_t capacity);
+      // The number of body bytes left to read, or -1 if the body's length isn't known.
+      long long RemainingLength ();
+
+    private:
+      size_t ReadManaged (void * buffer, size_t capacity);
+      long long RemainingLengthManaged ();
+    };
+
+    // Implemented by whoever issues asynchronous protocol requests.
+    class NativeProtocolRequestClient {
+    public:
+      // Called once per request, on any thread, unless the request is deleted first. The client takes
+      //  ownership of the response, which is 0 if the handler did not produce one.
+      virtual void onResponseReady (NativeProtocolResponse * response) = 0;
+    };
+
+    // A request that a handler is answering asynchronously. Whoever began it deletes it once its response
+    //  has been delivered, or earlier to cancel it (for example, when the navigation is aborted).
+    //  Once the destructor returns, the client will not be called.
+    class NativeProtocolRequest {
+    public:
+      gcroot<ProtocolRequest ^> Owner;
+
+      NativeProtocolRequest (ProtocolRequest ^ owner)
+        : Owner(owner) {
+      }
+
+      ~NativeProtocolRequest ();
+    };
+
+    class NativeProtocolHandler {
+    public:
+      gcroot<ProtocolHandler ^> Owner;
+      // Created the first time the handler's cache is given a budget.
+      NativeResponseCache * Cache;
+      // Set by AssetBundleProtocolHandler; requests for the bundle's entries never reach managed code.
+      NativeAssetBundle * Bundle;
+
+      NativeProtocolHandler (ProtocolHandler ^ owner) 
+        : Owner(owner)
+        , Cache(0)
+        , Bundle(0) {
+      }
+
+      ~NativeProtocolHandler () {
+        // Responses that are still being streamed into the cache (or read out of the bundle) hold their own references.
+        if (Cache)
+          Cache->release();
+        if (Bundle)
+          Bundle->release();
+      }
+
+      bool HandleRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders);
+      NativeProtocolResponse * OpenRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength);
+      // Starts answering a request without blocking the calling thread. Returns 0 if the response was
+      //  delivered to the client before returning (as it is for cache hits); otherwise the request is pending.
+      NativeProtocolRequest * BeginRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, NativeProtocolRequestClient * client);
+
+    private:
+      // HandleRequest, without the stats.
+      bool AnswerRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders);
+      bool HandleUncachedRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders);
+      NativeProtocolResponse * OpenUncachedRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength);
+      NativeProtocolRequest * BeginUncachedRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, NativeProtocolRequestClient * client);
+      NativeProtocolResponse * OpenCachedRequest (NativeCachedResponse * cached);
+      const AssetBundleEntry * FindBundleEntry (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength);
+    };
+
+    public ref class ProtocolHandler abstract {
+    internal:
+      NativeProtocolHandler * Native;
+      System::String ^ Scheme;
+      Managed::Context ^ Context;
+
+      bool DoHandleRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders);
+      NativeProtocolResponse * DoOpenRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength);
+      NativeProtocolRequest * DoBeginRequest (const wchar_t * url, size_t urlLength, const char * requestHeaders, size_t requestHeadersLength, NativeProtocolRequestClient * client);
+      NativeProtocolResponse * WrapResponse (ProtocolResponse ^ response, const wchar_t * url, size_t urlLength);
+      void ServeRequest (ProtocolRequest ^ request);
+      ProtocolResponse ^ Respond (System::String ^ url, array<System::String ^> ^ requestHeaders);
+      static ProtocolResponse ^ ApplyRequestHeaders (ProtocolResponse ^ response, array<System::String ^> ^ requestHeaders);
+    protected:
+      /// <summary>
+      /// Handles an incoming request for a custom protocol by producing the whole response body at once.
+      /// Handlers that serve large bodies should override OpenResponse instead.
+      /// </summary>
+      /// <param name="url">Specifies the URL being requested.</param>
+      /// <param name="responseBody">On a successful request, return the response body via this parameter.</param>
+      /// <param name="responseHeaders">Return the response headers via this parameter. Each header line should be an individual string within the array.</param>
+      /// <returns>true if the request was successful, false otherwise.</returns>
+      virtual bool HandleRequest (System::String ^ url, array<unsigned char> ^% responseBody, array<System::String ^> ^% responseHeaders) {
+        return false;
+      }
+
+      /// <summary>
+      /// Handles an incoming request for a custom protocol. The response body is streamed to the page as it is read,
+      ///  so the page receives the first bytes before the last ones have been read.
+      /// The default implementation calls HandleRequest.
+      /// </summary>
+      /// <param name="url">Specifies the URL being requested.</param>
+      virtual ProtocolResponse ^ OpenResponse (System::String ^ url);
+
+      /// <summary>
+      /// Handles an incoming request for a custom protocol, given its request headers. Conditional and range
+      ///  requests are answered from the returned response's ETag, LastModified and body, so handlers rarely need to look at them.
+      /// The default implementation calls OpenResponse(url).
+      /// </summary>
+      /// <param name="url">Specifies the URL being requested.</param>
+      /// <param name="requestHeaders">The request headers, one "Name: value" line per string.</param>
+      virtual ProtocolResponse ^ OpenResponse (System::String ^ url, array<System::String ^> ^ requestHeaders) {
+        return OpenResponse(url);
+      }
+
+      /// <summary>
+      /// Starts answering a request that Berkelium does not wait for, so slow handlers don't stall the message pump.
+      /// The default implementation calls OpenResponse on one of the protocol worker threads, so handlers
+      ///  that are used this way must be safe to call from several threads at once.
+      /// Override this to answer requests with your own asynchronous I/O, then call request.Complete.
+      /// </summary>
+      /// <param name="request">The pending request.</param>
+      virtual void BeginResponse (ProtocolRequest ^ request);
+    public:
+      /// <summary>
+      /// Answers a request without going through Berkelium, the way requests that Berkelium does not wait for are answered:
+      ///  BeginResponse is called, so by default the handler runs on a protocol worker and this returns right away.
+      /// </summary>
+      /// <param name="url">Specifies the URL being requested.</param>
+      /// <param name="requestHeaders">The request headers, one "Name: value" line per string.</param>
+      /// <param name="callback">Called with the response (or null) on whichever thread completes the request. It owns the response.</param>
+      void BeginRequest (System::String ^ url, array<System::String ^> ^ requestHeaders, System::Action<ProtocolResponse ^> ^ callback);
+
+      /// <summary>
+      /// Constructs and registers a custom protocol handler for the specified context and URL scheme.
+      /// </summary>
+      /// <param name="context">Specifies the context to register the handler for.</param>
+      /// <param name="scheme">Specifies the URL scheme to register (omit the trailing colon.)</param>
+      ProtocolHandler (Managed::Context ^ context, System::String ^ scheme);
+      ~ProtocolHandler ();
+
+      /// <summary>
+      /// The most threads that will run OpenResponse for asynchronous requests at once, shared by all handlers.
+      /// Requests beyond this are queued. Defaults to the number of processors, with a minimum of two.
+      /// </summary>
+      static property int MaxWorkerThreads {
+        int get ();
+        void set (int value);
+      }
+
+      /// <summary>
+      /// The number of bytes of responses to keep in this handler's cache. Repeat requests for a cached URL
+      ///  are answered natively, without calling the handler. The default of zero disables the cache.
+      /// </summary>
+      property System::Int64 CacheByteBudget {
+        System::Int64 get () {
+          return (Native && Native->Cache) ? (System::Int64)Native->Cache->byteBudget() : 0;
+        }
+        void set (System::Int64 value);
+      }
+
+      /// <summary>
+      /// The number of bytes currently held by this handler's cache.
+      /// </summary>
+      property System::Int64 CachedBytes {
+        System::Int64 get () {
+          return (Native && Native->Cache) ? (System::Int64)Native->Cache->byteCount() : 0;
+        }
+      }
+
+      /// <summary>
+      /// The number of requests that were answered from this handler's cache.
+      /// </summary>
+      property System::Int64 CacheHits {
+        System::Int64 get () {
+          return (Native && Native->Cache) ? Native->Cache->hits() : 0;
+        }
+      }
+
+      /// <summary>
+      /// The number of requests that this handler's cache could not answer while it was enabled.
+      /// </summary>
+      property System::Int64 CacheMisses {
+        System::Int64 get () {
+          return (Native && Native->Cache) ? Native->Cache->misses() : 0;
+        }
+      }
+
+      /// <summary>
+      /// Removes the cached response for the specified URL, if there is one.
+      /// </summary>
+      /// <returns>true if a response was removed.</returns>
+      bool InvalidateCachedResponse (System::String ^ url);
+
+      /// <summary>
+      /// Removes every response from this handler's cache.
+      /// </summary>
+      void ClearCache () {
+        if (Native && Native->Cache)
+          Native->Cache->clear();
+      }
+    };
+
+    /// <summary>
+    /// Serves a custom protocol from a single asset bundle file, which is memory-mapped once and kept open
+    ///  for the lifetime of the handler. Requests are answered straight out of the mapping without opening
+    ///  any files or entering managed code, and precompressed entries are sent with Content-Encoding: gzip.
+    /// Bundles are written with AssetBundleWriter.
+    /// </summary>
+    public ref class AssetBundleProtocolHandler : public ProtocolHandler {
+    protected:
+      /// <summary>
+      /// Only requests for missing entries, and conditional or range requests, reach this. It answers them
+      ///  from the same mapping, leaving 304 and 206 responses to ProtocolHandler.
+      /// </summary>
+      virtual ProtocolResponse ^ OpenResponse (System::String ^ url) override;
+    public:
+      /// <summary>
+      /// Constructs and registers a handler that serves the entries of the specified bundle file.
+      /// </summary>
+      /// <param name="context">Specifies the context to register the handler for.</param>
+      /// <param name="scheme">Specifies the URL scheme to register (omit the trailing colon.)</param>
+      /// <param name="bundleFilename">The bundle file to map.</param>
+      /// <exception cref="System.IO.IOException">The file could not be opened or is not a valid bundle.</exception>
+      AssetBundleProtocolHandler (Managed::Context ^ context, System::String ^ scheme, System::String ^ bundleFilename);
+
+      /// <summary>
+      /// The number of entries in the bundle.
+      /// </summary>
+      property int EntryCount {
+        int get () {
+          return (Native && Native->Bundle) ? (int)Native->Bundle->count() : 0;
+        }
+      }
+    };
+
+    typedef HandleTable<::Berkelium::Context, Context> ContextTable;
+
+    public ref class Context {
+    internal:
+      static ContextTable * Table = 0;
+
+      bool OwnsHandle;
+      ::Berkelium::Context * Native;
+
+      Context (::Berkelium::Context * native, bool ownsHandle)
+        : Native(native)
+        , OwnsHandle(ownsHandle) {
+      }
+
+      static Context ^ GetContext (::Berkelium::Context * pointer, bool ownsHandle);
+      static bool ContextDestroyed (::Berkelium::Context * pointer);
+
+      static Context ^ CreateNative () {
+        return GetContext(::Berkelium::Context::create(), true);
+      }
+
+      Context ^ CloneNative () {
+        return GetContext(Native->clone(), true);
+      }
+
+      void DestroyNative () {
+        if (Native && OwnsHandle) {
+            ContextDestroyed(Native);
+            delete Native;
+        }
+
+        Native = 0;
+      }
+
+    public:
+      static Context ^ Create () {
+        if (PumpThread::MustMarshal)
+          return safe_cast<Context ^>(PumpThread::Send(nullptr, PumpCommandKind::CreateContext));
+
+        return CreateNative();
+      }
+
+      Context ^ Clone () {
+        if (PumpThread::MustMarshal)
+          return safe_cast<Context ^>(PumpThread::Send(this, PumpCommandKind::CloneContext));
+
+        return CloneNative();
+      }
+
+      ~Context () {
+        if (PumpThread::MustMarshal)
+          PumpThread::Send(this, PumpCommandKind::DestroyContext);
+        else
+          DestroyNative();
+      }
+
+      virtual String^ ToString () override {
+        return String::Format(
+          "Context({0})", IntPtr((void*)Native).ToString()
+        );
+      }
+
+    };
+
+    public ref struct Rect {
+    public:
+      int Left, Top, Width, Height;
+
+      Rect (int left, int top, int width, int height) 
+        : Left(left)
+        , Top(top) 
+        , Width(width)
+        , Height(height) {
+      }
+
+      property int Right {
+        int get () {
+          return Left + Width;
+        }
+      }
+
+      property int Bottom {
+        int get () {
+          return Top + Height;
+        }
+      }
+
+      /// <summary>
+      /// Returns the offset (in bytes) of this rect's top-left pixel within a 32bpp source buffer covering bufferRect.
+      /// Rows of the source buffer are bufferRect.Width * 4 bytes apart.
+      /// </summary>
+      int GetBufferOffset (Rect ^ bufferRect) {
+        return (((Top - bufferRect->Top) * bufferRect->Width) + (Left - bufferRect->Left)) * 4;
+      }
+
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "Rect({0},{1} {2}x{3})", 
+          Left, Top, Width, Height
+          );
+      }
+    };
+
+    /// <summary>
+    /// A persistent 32bpp copy of the contents of a window or widget, maintained natively.
+    /// Paint events (including scrolls) are applied to the store before they are dispatched, so consumers only need to copy out the dirty region.
+    /// </summary>
+    public ref class BackingStore {
+    internal:
+      NativeBackingStore * Native;
+
+      BackingStore (int width, int height)
+        : Native(new NativeBackingStore()) {
+        if (!Native->resize(width, height)) {
+          delete Native;
+          Native = 0;
+          throw gcnew OutOfMemoryException("Could not allocate the backing store's buffer.");
+        }
+      }
+
+    public:
+      ~BackingStore () {
+        if (Native)
+          delete Native;
+
+        Native = 0;
+      }
+
+      /// <summary>
+      /// A pointer to the first pixel of the store. The pointer remains valid until the store grows beyond the largest
+      ///  width or height it has had so far; shrinking it, and growing it back, leave the pointer where it was.
+      /// </summary>
+      property IntPtr Buffer {
+        IntPtr get () {
+          return IntPtr(Native->data());
+        }
+      }
+
+      property int Width {
+        int get () {
+          return Native->width();
+        }
+      }
+
+      property int Height {
+        int get () {
+          return Native->height();
+        }
+      }
+
+      /// <summary>
+      /// The distance between the start of each row of the store, in bytes. This is based on the widest the store has
+      ///  been, not its current Width, so always step through rows with it.
+      /// </summary>
+      property int Stride {
+        int get () {
+          return (int)Native->stride();
+        }
+      }
+
+      /// <summary>
+      /// Indicates whether any pixels have changed since the last call to ClearDirty.
+      /// </summary>
+      property bool IsDirty {
+        bool get () {
+          return Native->isDirty();
+        }
+      }
+
+      /// <summary>
+      /// The bounding rectangle of all pixels that have changed since the last call to ClearDirty.
+      /// </summary>
+      property Rect ^ DirtyRect {
+        Rect ^ get () {
+          const ::Berkelium::Rect & dirty = Native->dirtyRect();
+          return gcnew Rect(dirty.mLeft, dirty.mTop, dirty.mWidth, dirty.mHeight);
+        }
+      }
+
+      /// <summary>
+      /// The changed pixels as a few non-overlapping rectangles, so that paints far apart from each other
+      ///  can be copied out separately instead of as one bounding rectangle. Together they cover DirtyRect's changes.
+      /// </summary>
+      property array<Rect ^> ^ DirtyRects {
+        array<Rect ^> ^ get () {
+          array<Rect ^> ^ result = gcnew array<Rect ^>((int)Native->dirtyRectCount());
+          for (int i = 0; i < result->Length; i++) {
+            const ::Berkelium::Rect & dirty = Native->dirtyRect(i);
+            result[i] = gcnew Rect(dirty.mLeft, dirty.mTop, dirty.mWidth, dirty.mHeight);
+          }
+          return result;
+        }
+      }
+
+      /// <summary>
+      /// Marks the entire store as clean. Call this once you have copied out the dirty region.
+      /// </summary>
+      void ClearDirty () {
+        Native->clearDirty();
+      }
+
+      /// <summary>
+      /// Marks the entire store as dirty, for when whatever its contents were copied to has to be refilled.
+      /// </summary>
+      void MarkDirty () {
+        Native->markDirty(MakeRect(0, 0, Native->width(), Native->height()));
+      }
+
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "BackingStore({0}x{1})", 
+          Width, Height
+        );
+      }
+    };
+
+    /// <summary>
+    /// Writes snapshots of a window's backing store to disk. Snapshots are copied natively while the window paints,
+    ///  and encoded on background threads, so capturing never waits for an encoder.
+    /// When the encoders fall behind, the newest frame still waiting for one is replaced by the latest snapshot
+    ///  instead of queueing another; the frames lost that way are counted in FramesDropped.
+    /// </summary>
+    public ref class FrameCapture {
+    internal:
+      Berkelium::Managed::Window ^ Owner;
+      String ^ OriginalPath, ^ Pattern;
+      bool Sequence;
+      CaptureFormat FileFormat;
+      double Rate;
+      Int64 Interval, LastSnapshot;
+      bool Capturing, HasSnapshot;
+      Object ^ Lock;
+      System::Collections::Generic::Stack<CaptureJob ^> ^ FreeJobs;
+      // The most recent frame that no encoder has picked up yet.
+      CaptureJob ^ Newest;
+      int Pending, MaxPending, NextNumber;
+      int Captured, Encoded, Dropped, Failed;
+      Exception ^ Error;
+
+      FrameCapture (Berkelium::Managed::Window ^ owner, String ^ path, bool sequence, CaptureFormat format, double framesPerSecond);
+
+      static CaptureFormat FormatForFilename (String ^ filename);
+
+      // Both are called with the owner's paint lock held.
+      void Offer (NativeBackingStore * store);
+      void Snapshot (NativeBackingStore * store);
+
+      void Encode (CaptureJob ^ job);
+      void ReleaseFrames ();
+
+    public:
+      ~FrameCapture ();
+
+      property Berkelium::Managed::Window ^ Window {
+        Berkelium::Managed::Window ^ get () {
+          return Owner;
+        }
+      }
+
+      property String ^ Path {
+        String ^ get () {
+          return OriginalPath;
+        }
+      }
+
+      property CaptureFormat Format {
+        CaptureFormat get () {
+          return FileFormat;
+        }
+      }
+
+      /// <summary>
+      /// The most frames captured per second, or 0 if every paint is captured.
+      /// </summary>
+      property double FramesPerSecond {
+        double get () {
+          return Rate;
+        }
+      }
+
+      property bool IsCapturing {
+        bool get () {
+          return Capturing;
+        }
+      }
+
+      /// <summary>
+      /// The most frames that may be waiting for (or being written by) an encoder at once. Defaults to 3.
+      /// </summary>
+      property int MaxPendingFrames {
+        int get () {
+          return MaxPending;
+        }
+        void set (int value);
+      }
+
+      /// <summary>
+      /// The number of snapshots taken, including the ones that were later dropped.
+      /// </summary>
+      property int FramesCaptured {
+        int get () {
+          return Captured;
+        }
+      }
+
+      property int FramesEncoded {
+        int get () {
+          return Encoded;
+        }
+      }
+
+      /// <summary>
+      /// The number of snapshots that were never written because the encoders fell behind.
+      /// </summary>
+      property int FramesDropped {
+        int get () {
+          return Dropped;
+        }
+      }
+
+      /// <summary>
+      /// The number of frames that could not be written. LastError holds the most recent reason.
+      /// </summary>
+      property int FramesFailed {
+        int get () {
+          return Failed;
+        }
+      }
+
+      property int PendingFrames {
+        int get () {
+          return Pending;
+        }
+      }
+
+      property Exception ^ LastError {
+        Exception ^ get () {
+          return Error;
+        }
+      }
+
+      /// <summary>
+      /// Stops taking snapshots. Frames that were already captured are still written.
+      /// </summary>
+      void Stop ();
+
+      /// <summary>
+      /// Waits until every captured frame has been written (or dropped). Returns false if the timeout elapsed first.
+      /// </summary>
+      bool WaitForPendingFrames (int millisecondsTimeout);
+
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "FrameCapture({0}, {1} captured, {2} encoded, {3} dropped)", 
+          OriginalPath, Captured, Encoded, Dropped
+        );
+      }
+    };
+
+    /// <summary>
+    /// Writes the callbacks a window receives to a trace file, through a buffer, as they arrive.
+    /// </summary>
+    public ref class EventRecorder {
+    internal:
+      Berkelium::Managed::Window ^ Owner;
+      String ^ OriginalPath;
+      TracePixels PixelMode;
+      NativeTraceWriter * Writer;
+      Int64 Records, Bytes;
+      Exception ^ Error;
+
+      EventRecorder (Berkelium::Managed::Window ^ owner, String ^ path, TracePixels pixels, NativeTraceWriter * writer)
+        : Owner(owner)
+        , OriginalPath(path)
+        , PixelMode(pixels)
+        , Writer(writer) {
+      }
+
+    public:
+      ~EventRecorder () {
+        Stop();
+      }
+
+      property Berkelium::Managed::Window ^ Window {
+        Berkelium::Managed::Window ^ get () {
+          return Owner;
+        }
+      }
+
+      property String ^ Path {
+        String ^ get () {
+          return OriginalPath;
+        }
+      }
+
+      property TracePixels Pixels {
+        TracePixels get () {
+          return PixelMode;
+        }
+      }
+
+      property bool IsRecording {
+        bool get () {
+          return Writer != 0;
+        }
+      }
+
+      property Int64 RecordCount {
+        Int64 get () {
+          return Writer ? Writer->recordCount() : Records;
+        }
+      }
+
+      /// <summary>
+      /// The size of the trace so far, including records that are still buffered.
+      /// </summary>
+      property Int64 BytesWritten {
+        Int64 get () {
+          return Writer ? Writer->bytesWritten() : Bytes;
+        }
+      }
+
+      /// <summary>
+      /// Why the trace could not be written, or null if nothing has gone wrong. Only known once the recording stops.
+      /// </summary>
+      property Exception ^ LastError {
+        Exception ^ get () {
+          return Error;
+        }
+      }
+
+      /// <summary>
+      /// Stops recording and closes the file.
+      /// </summary>
+      void Stop ();
+
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "EventRecorder({0}, {1} records)", 
+          OriginalPath, RecordCount
+        );
+      }
+    };
+
+    /// <summary>
+    /// A trace written by an EventRecorder. Replaying it hands the recorded callbacks to a window exactly as
+    ///  Berkelium would have, so that handlers and paint paths can be measured repeatably without a live page.
+    /// </summary>
+    public ref class EventTrace {
+    internal:
+      NativeTraceReader * Native;
+      String ^ OriginalPath;
+
+    public:
+      /// <summary>
+      /// Opens and checks a trace.
+      /// </summary>
+      /// <exception cref="System.IO.IOException">The file could not be opened or is not a valid trace.</exception>
+      EventTrace (String ^ path);
+
+      ~EventTrace () {
+        if (Native)
+          delete Native;
+
+        Native = 0;
+      }
+
+      property String ^ Path {
+        String ^ get () {
+          return OriginalPath;
+        }
+      }
+
+      property Int64 RecordCount {
+        Int64 get () {
+          return Native ? Native->recordCount() : 0;
+        }
+      }
+
+      /// <summary>
+      /// The time from the first record to the last, as recorded.
+      /// </summary>
+      property TimeSpan Duration {
+        TimeSpan get () {
+          return TimeSpan::FromTicks(Native ? Native->duration() * 10 : 0);
+        }
+      }
+
+      /// <summary>
+      /// Replays the trace into a window as fast as possible.
+      /// </summary>
+      void Replay (Berkelium::Managed::Window ^ window) {
+        Replay(window, false);
+      }
+
+      /// <summary>
+      /// Replays the trace into a window. The window is resized to the recorded size, and widgets are created
+      ///  for the ones the trace saw. Coalesced paints are flushed wherever the recording had a gap of a millisecond
+      ///  or more, standing in for the updates that separated them. Answers to script alerts and navigation
+      ///  requests are ignored. Not available while BerkeliumSharp runs its own pump thread.
+      /// </summary>
+      /// <param name="realTime">If true, records are delivered at the pace they were recorded at.</param>
+      void Replay (Berkelium::Managed::Window ^ window, bool realTime);
+    };
+
+    /// <summary>
+    /// Records how long updates, callbacks, custom protocol requests and startup take, as spans kept in a ring buffer
+    ///  for each thread, and writes them out as a Chrome trace that about:tracing or Perfetto can open.
+    /// While disabled, each place that would record a span only reads a flag.
+    /// </summary>
+    public ref class Profiler abstract sealed {
+    public:
+      /// <summary>
+      /// Determines whether spans are recorded. Enable it before BerkeliumSharp.Init to include startup.
+      /// </summary>
+      static property bool Enabled {
+        bool get () {
+          return NativeProfiler::Enabled != 0;
+        }
+        void set (bool value) {
+          NativeProfiler::enable(value);
+        }
+      }
+
+      /// <summary>
+      /// The number of spans each thread keeps before the oldest are overwritten. Changing it only affects threads
+      ///  that haven't recorded a span yet. Defaults to 16384.
+      /// </summary>
+      static property int BufferCapacity {
+        int get ();
+        void set (int value);
+      }
+
+      /// <summary>
+      /// Discards every span recorded so far.
+      /// </summary>
+      static void Clear () {
+        NativeProfiler::clear();
+      }
+
+      /// <summary>
+      /// Writes the spans every thread has recorded to a Chrome trace_event JSON file. Recording carries on meanwhile.
+      /// </summary>
+      /// <param name="path">The file to write. An existing file is replaced.</param>
+      /// <exception cref="System.IO.IOException">The file could not be written.</exception>
+      static void WriteChromeTrace (String ^ path);
+    };
+
+    /// <summary>
+    /// A message the page posted with window.externalHost.postMessage.
+    /// Messages sent with the berkeliumHost.send function that BridgeScript defines carry a name and typed arguments,
+    ///  which are parsed natively; any other message has an Id of Plain and a single string argument, the message itself.
+    /// A message can only be read during the HostMessages event that delivered it.
+    /// </summary>
+    public value struct HostMessage {
+    internal:
+      HostMessageBatch ^ Batch;
+      int Index;
+
+      HostMessage (HostMessageBatch ^ batch, int index)
+        : Batch(batch)
+        , Index(index) {
+      }
+
+      const NativeHostMessage & GetNative ();
+      const NativeHostArgument & GetArgument (int index, NativeHostArgumentType expectedType);
+      String ^ GetText (size_t offset, size_t length);
+
+    public:
+      /// <summary>
+      /// The Id of messages that don't use the bridge format.
+      /// </summary>
+      literal int Plain = 0;
+
+      /// <summary>
+      /// Defines berkeliumHost.send(name, ...) in the page. Arguments can be numbers, booleans (sent as numbers),
+      ///  strings, null or undefined, and ArrayBuffers or typed arrays (sent as bytes). Run it with ExecuteJavascript or include it in the page.
+      /// </summary>
+      literal String ^ BridgeScript =
+        "(function () {"
+        "  function field (tag, text) { return tag + text.length + ':' + text; }"
+        "  window.berkeliumHost = {"
+        "    send: function (name) {"
+        "      var message = '\\x1f' + field('', String(name));"
+        "      for (var i = 1; i < arguments.length; i++) {"
+        "        var value = arguments[i];"
+        "        if ((value === null) || (value === undefined)) {"
+        "          message += 'u0:';"
+        "        } else if ((typeof value == 'number') || (typeof value == 'boolean')) {"
+        "          message += field('n', String(+value));"
+        "        } else if ((typeof ArrayBuffer != 'undefined') && ((value instanceof ArrayBuffer) || (value.buffer instanceof ArrayBuffer))) {"
+        "          var bytes = (value instanceof ArrayBuffer) ? new Uint8Array(value) : new Uint8Array(value.buffer, value.byteOffset, value.byteLength);"
+        "          var text = '';"
+        "          for (var j = 0; j < bytes.length; j += 8192)"
+        "            text += String.fromCharCode.apply(null, bytes.subarray(j, j + 8192));"
+        "          message += field('b', text);"
+        "        } else {"
+        "          message += field('s', String(value));"
+        "        }"
+        "      }"
+        "      window.externalHost.postMessage(message, '*');"
+        "    }"
+        "  };"
+        "})();";
+
+      /// <summary>
+      /// Returns the Id that messages with this name arrive with, so that handlers can switch on Ids instead of comparing names.
+      /// Ids are assigned the first time a name is seen, and never change.
+      /// </summary>
+      static int GetId (String ^ name);
+
+      /// <summary>
+      /// Returns the name of an Id, or null if there is no such Id.
+      /// </summary>
+      static String ^ GetName (int id);
+
+      property int Id {
+        int get () {
+          return GetNative().Id;
+        }
+      }
+
+      /// <summary>
+      /// The message's name. Names that have an Id are cached, so reading this doesn't allocate.
+      /// </summary>
+      property String ^ Name {
+        String ^ get ();
+      }
+
+      property String ^ Origin {
+        String ^ get () {
+          const NativeHostMessage & message = GetNative();
+          return GetText(message.OriginOffset, message.OriginLength);
+        }
+      }
+
+      property String ^ Target {
+        String ^ get () {
+          const NativeHostMessage & message = GetNative();
+          return GetText(message.TargetOffset, message.TargetLength);
+        }
+      }
+
+      property int ArgumentCount {
+        int get () {
+          return (int)GetNative().ArgumentCount;
+        }
+      }
+
+      HostArgumentType GetArgumentType (int index);
+
+      double GetNumber (int index) {
+        return GetArgument(index, HostArgumentNumber).Number;
+      }
+
+      int GetInt32 (int index) {
+        return (int)GetArgument(index, HostArgumentNumber).Number;
+      }
+
+      /// <summary>
+      /// Returns a string argument, or null if the argument was null or undefined.
+      /// </summary>
+      String ^ GetString (int index);
+
+      int GetByteLength (int index) {
+        return (int)GetArgument(index, HostArgumentBytes).Length;
+      }
+
+      /// <summary>
+      /// Copies a binary argument into a buffer, returning the number of bytes copied.
+      /// </summary>
+      int CopyBytes (int index, array<Byte> ^ buffer, int offset);
+
+      array<Byte> ^ GetBytes (int index) {
+        array<Byte> ^ result = gcnew array<Byte>(GetByteLength(index));
+        CopyBytes(index, result, 0);
+        return result;
+      }
+
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "HostMessage({0}, {1} argument(s))", 
+          Name, ArgumentCount
+        );
+      }
+    };
+
+    /// <summary>
+    /// Every message a window received during one update, delivered together by Window.HostMessages.
+    /// The batch (and the messages in it) can only be read during that event; the object is reused for the next batch.
+    /// </summary>
+    public ref class HostMessageBatch {
+    internal:
+      Berkelium::Managed::Window ^ Owner;
+      NativeHostMessageBatch * Native;
+
+      static Object ^ NamesLock = gcnew Object();
+      static System::Collections::Generic::List<String ^> ^ Names = gcnew System::Collections::Generic::List<String ^>();
+
+      HostMessageBatch (Berkelium::Managed::Window ^ owner)
+        : Owner(owner)
+        , Native(0) {
+      }
+
+      NativeHostMessageBatch & GetNative () {
+        if (!Native)
+          throw gcnew InvalidOperationException("Host messages can only be read during the HostMessages event that delivered them.");
+
+        return *Native;
+      }
+
+    public:
+      property Berkelium::Managed::Window ^ Window {
+        Berkelium::Managed::Window ^ get () {
+          return Owner;
+        }
+      }
+
+      property int Count {
+        int get () {
+          return (int)GetNative().count();
+        }
+      }
+
+      property HostMessage default[int] {
+        HostMessage get (int index);
+      }
+    };
+
+    /// <summary>
+    /// A snapshot of a latency distribution. Latencies are kept in buckets four to a doubling,
+    ///  so percentiles are accurate to within a fifth or so.
+    /// </summary>
+    public ref class LatencyHistogram {
+    internal:
+      array<Int64> ^ Buckets;
+      Int64 SampleCount, TotalMicroseconds, MaxMicroseconds;
+
+      LatencyHistogram (const NativeLatencyHistogram & native);
+
+    public:
+      property Int64 Count {
+        Int64 get () {
+          return SampleCount;
+        }
+      }
+
+      property TimeSpan Total {
+        TimeSpan get () {
+          return TimeSpan::FromTicks(TotalMicroseconds * 10);
+        }
+      }
+
+      property TimeSpan Mean {
+        TimeSpan get () {
+          return TimeSpan::FromTicks(SampleCount ? (TotalMicroseconds * 10) / SampleCount : 0);
+        }
+      }
+
+      property TimeSpan Max {
+        TimeSpan get () {
+          return TimeSpan::FromTicks(MaxMicroseconds * 10);
+        }
+      }
+
+      /// <summary>
+      /// The latency that the given fraction of samples came in under, rounded up to the end of its bucket.
+      /// </summary>
+      /// <param name="fraction">Between 0 and 1; 0.99 gives the 99th percentile.</param>
+      TimeSpan Percentile (double fraction);
+
+      property TimeSpan P50 {
+        TimeSpan get () {
+          return Percentile(0.50);
+        }
+      }
+
+      property TimeSpan P95 {
+        TimeSpan get () {
+          return Percentile(0.95);
+        }
+      }
 
-      NativeProtocolHandler (ProtocolHandler ^ owner) 
-        : Owner(owner) {
+      property TimeSpan P99 {
+        TimeSpan get () {
+          return Percentile(0.99);
+        }
       }
 
-      bool HandleRequest (const wchar_t * url, size_t urlLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders);
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "LatencyHistogram({0} samples, p50 {1}, p99 {2}, max {3})", 
+          Count, P50, P99, Max
+        );
+      }
     };
 
-    public ref class ProtocolHandler abstract {
+    /// <summary>
+    /// A snapshot of a window's or a widget's performance counters. The counters keep running; take another
+    ///  snapshot and subtract to measure an interval. Each counter is read atomically, but not all of them at once.
+    /// </summary>
+    public ref class WindowStats {
     internal:
-      NativeProtocolHandler * Native;
-      System::String ^ Scheme;
-      Managed::Context ^ Context;
+      array<Int64> ^ Values;
+      LatencyHistogram ^ Input;
 
-      bool DoHandleRequest (const wchar_t * url, size_t urlLength, HGLOBAL &responseBody, HGLOBAL &responseHeaders);
-    protected:
+      WindowStats (const NativeStatCounters & counters, const NativeLatencyHistogram * inputLatency);
+
+      static TimeSpan TicksToTime (Int64 ticks) {
+        return TimeSpan::FromTicks((Int64)(ticks * ((double)TimeSpan::TicksPerSecond / System::Diagnostics::Stopwatch::Frequency)));
+      }
+
+    public:
       /// <summary>
-      /// Handles an incoming request for a custom protocol.
+      /// How many paints Berkelium delivered, including the ones that were then coalesced.
       /// </summary>
-      /// <param name="url">Specifies the URL being requested.</param>
-      /// <param name="responseBody">On a successful request, return the response body via this parameter.</param>
-      /// <param name="responseHeaders">Return the response headers via this parameter. Each header line should be an individual string within the array.</param>
-      /// <returns>true if the request was successful, false otherwise.</returns>
-      virtual bool HandleRequest (System::String ^ url, array<unsigned char> ^% responseBody, array<System::String ^> ^% responseHeaders) = 0;
-    public:
+      property Int64 PaintCallbacks {
+        Int64 get () {
+          return Values[StatPaints];
+        }
+      }
+
       /// <summary>
-      /// Constructs and registers a custom protocol handler for the specified context and URL scheme.
+      /// How many paints were handed to handlers, after coalescing.
       /// </summary>
-      /// <param name="context">Specifies the context to register the handler for.</param>
-      /// <param name="scheme">Specifies the URL scheme to register (omit the trailing colon.)</param>
-      ProtocolHandler (Managed::Context ^ context, System::String ^ scheme);
-      ~ProtocolHandler ();
-    };
+      property Int64 PaintsDelivered {
+        Int64 get () {
+          return Values[StatPaintsDelivered];
+        }
+      }
 
-    class ContextTable : public std::map<::Berkelium::Context *, gcroot<Context ^>> {
-    };
+      /// <summary>
+      /// The area of the copy rects in the paints handed to handlers.
+      /// </summary>
+      property Int64 PixelsDelivered {
+        Int64 get () {
+          return Values[StatPixelsDelivered];
+        }
+      }
 
-    public ref class Context {
-    internal:
-      static ContextTable * Table = 0;
+      property Int64 BytesDelivered {
+        Int64 get () {
+          return Values[StatPixelsDelivered] * 4;
+        }
+      }
 
-      bool OwnsHandle;
-      ::Berkelium::Context * Native;
+      /// <summary>
+      /// How many of the paints Berkelium delivered asked for part of the view to be scrolled.
+      /// </summary>
+      property Int64 ScrollBlits {
+        Int64 get () {
+          return Values[StatScrollBlits];
+        }
+      }
 
-      Context (::Berkelium::Context * native, bool ownsHandle)
-        : Native(native)
-        , OwnsHandle(ownsHandle) {
+      /// <summary>
+      /// The time spent in callbacks and the handlers they raised. A widget's callbacks are counted toward its window.
+      /// </summary>
+      property TimeSpan CallbackTime {
+        TimeSpan get () {
+          return TicksToTime(Values[StatCallbackTicks]);
+        }
       }
 
-      static Context ^ GetContext (::Berkelium::Context * pointer, bool ownsHandle);
-      static bool ContextDestroyed (::Berkelium::Context * pointer);
+      /// <summary>
+      /// How many mouse, keyboard and text events were sent to the window, through KeyEvent, TextEvent, MouseButton
+      ///  and MouseMoved. Always 0 for a widget.
+      /// </summary>
+      property Int64 InputEvents {
+        Int64 get () {
+          return Values[StatInputEvents];
+        }
+      }
 
-    public:
-      static Context ^ Create () {
-        return GetContext(::Berkelium::Context::create(), true);
+      /// <summary>
+      /// How many input events no paint showed within a second, and so were left out of InputLatency.
+      /// </summary>
+      property Int64 InputsUnpainted {
+        Int64 get () {
+          return Values[StatInputsUnpainted];
+        }
       }
 
-      Context ^ Clone () {
-        return GetContext(Native->clone(), true);
+      /// <summary>
+      /// How many times the window was actually resized. Always 0 for a widget.
+      /// </summary>
+      property Int64 Resizes {
+        Int64 get () {
+          return Values[StatResizes];
+        }
       }
 
-      ~Context () {
-        if (Native && OwnsHandle) {
-            ContextDestroyed(Native);
-            delete Native;
+      /// <summary>
+      /// How many calls to Resize were replaced by a later one before they were applied. Always 0 for a widget.
+      /// </summary>
+      property Int64 ResizesCoalesced {
+        Int64 get () {
+          return Values[StatResizesCoalesced];
         }
+      }
 
-        Native = 0;
+      /// <summary>
+      /// How long input took to be shown, from the call that sent it to the first paint handed to handlers afterwards
+      ///  whose copy rects cover the mouse position (or any paint, for keyboard and text input). Null for a widget.
+      /// </summary>
+      property LatencyHistogram ^ InputLatency {
+        LatencyHistogram ^ get () {
+          return Input;
+        }
       }
 
-      virtual String^ ToString () override {
-        return String::Format(
-          "Context({0})", IntPtr((void*)Native).ToString()
-        );
+      /// <summary>
+      /// How many times Berkelium made a callback. A widget's callbacks are counted toward its window.
+      /// </summary>
+      Int64 GetCallbackCount (CallbackType type) {
+        if (((int)type < 0) || ((int)type >= CallbackCount))
+          throw gcnew ArgumentOutOfRangeException("type");
+
+        return Values[StatCallbacks + (int)type];
       }
 
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "{0}({1} paints, {2} delivered, {3} pixels, {4} in callbacks)", 
+          GetType()->Name, PaintCallbacks, PaintsDelivered, PixelsDelivered, CallbackTime
+        );
+      }
     };
 
-    public ref struct Rect {
+    /// <summary>
+    /// A snapshot of the counters for every window in the process, along with the time spent pumping Berkelium,
+    ///  custom protocol traffic and native allocations.
+    /// </summary>
+    public ref class ProcessStats : public WindowStats {
+    internal:
+      LatencyHistogram ^ Latency;
+
+      ProcessStats ();
+
     public:
-      int Left, Top, Width, Height;
+      /// <summary>
+      /// How many times Berkelium's message pump ran, on this thread or the pump thread.
+      /// </summary>
+      property Int64 Updates {
+        Int64 get () {
+          return Values[StatUpdates];
+        }
+      }
 
-      Rect (int left, int top, int width, int height) 
-        : Left(left)
-        , Top(top) 
-        , Width(width)
-        , Height(height) {
+      /// <summary>
+      /// The time spent inside Berkelium's message pump. Callbacks made from inside the pump count toward it as well
+      ///  as toward CallbackTime, unless a pump thread is running and defers them.
+      /// </summary>
+      property TimeSpan UpdateTime {
+        TimeSpan get () {
+          return TicksToTime(Values[StatUpdateTicks]);
+        }
       }
 
-      property int Right {
-        int get () {
-          return Left + Width;
+      property Int64 ProtocolRequests {
+        Int64 get () {
+          return Values[StatProtocolRequests];
         }
       }
 
-      property int Bottom {
-        int get () {
-          return Top + Height;
+      /// <summary>
+      /// The size of the response bodies custom protocol handlers served.
+      /// </summary>
+      property Int64 ProtocolBytes {
+        Int64 get () {
+          return Values[StatProtocolBytes];
         }
       }
 
-      virtual String^ ToString() override {
-        return System::String::Format(
-          "Rect({0},{1} {2}x{3})", 
-          Left, Top, Width, Height
-          );
+      /// <summary>
+      /// How long custom protocol requests took, from the request to the response being ready.
+      /// </summary>
+      property LatencyHistogram ^ ProtocolLatency {
+        LatencyHistogram ^ get () {
+          return Latency;
+        }
+      }
+
+      /// <summary>
+      /// Native allocations made by BerkeliumSharp itself. Berkelium and Chromium allocate separately and aren't counted.
+      /// </summary>
+      property Int64 NativeAllocations {
+        Int64 get () {
+          return Values[StatNativeAllocations];
+        }
+      }
+
+      property Int64 NativeBytesAllocated {
+        Int64 get () {
+          return Values[StatNativeBytesAllocated];
+        }
       }
     };
 
@@ -345,28 +2094,72 @@ namespace Berkelium {
       bool OwnsHandle;
       Window ^ Parent;
       ::Berkelium::Widget * Native;
+      Berkelium::Managed::BackingStore ^ Store;
+      NativePaintAccumulator * PendingPaint;
+      // Released along with PendingPaint, under the window's PaintLock.
+      NativeStatCounters * Counters;
+      bool QueuedForFlush;
+      WidgetPaintHandler ^ PaintHandlers;
+
+      bool QueueInputEvent (NativeInputKind kind, int a, int b, int c, int d, System::String ^ text);
 
       Widget (Window ^ parent, ::Berkelium::Widget * native, bool ownsHandle) 
         : Parent(parent)
         , Native(native)
-        , OwnsHandle(ownsHandle) {
+        , OwnsHandle(ownsHandle)
+        , Counters(new NativeStatCounters()) {
+      }
+
+      void DestroyNative () {
+        if (Native && OwnsHandle)
+          delete Native;
+        if (Store)
+          delete Store;
+        if (PendingPaint)
+          delete PendingPaint;
+        if (Counters)
+          Counters->release();
+
+        Native = 0;
+        Store = nullptr;
+        PendingPaint = 0;
+        Counters = 0;
       }
 
     public:
-      event WidgetPaintHandler ^ Paint;
+      /// <summary>
+      /// Raised for every paint of the widget. Prefer FramePainted, which does not allocate.
+      /// </summary>
+      event WidgetPaintHandler ^ Paint {
+        void add (WidgetPaintHandler ^ handler) {
+          PaintHandlers = safe_cast<WidgetPaintHandler ^>(Delegate::Combine(PaintHandlers, handler));
+        }
+        void remove (WidgetPaintHandler ^ handler) {
+          PaintHandlers = safe_cast<WidgetPaintHandler ^>(Delegate::Remove(PaintHandlers, handler));
+        }
+        void raise (Window ^ window, Widget ^ widget, IntPtr sourceBuffer, Berkelium::Managed::Rect ^ rect, array<Berkelium::Managed::Rect ^> ^ copyRects, int dx, int dy, Berkelium::Managed::Rect ^ scrollRect) {
+          WidgetPaintHandler ^ handlers = PaintHandlers;
+          if (handlers != nullptr)
+            handlers->Invoke(window, widget, sourceBuffer, rect, copyRects, dx, dy, scrollRect);
+        }
+      }
+      event WidgetPaintFrameHandler ^ FramePainted;
       event WidgetMovedHandler ^ Moved;
       event WidgetResizedHandler ^ Resized;
       event WidgetDestroyedHandler ^ Destroyed;
 
       ~Widget () {
-        if (Native && OwnsHandle)
-          delete Native;
-
-        Native = 0;
+        if (PumpThread::MustMarshal)
+          PumpThread::Send(this, PumpCommandKind::DestroyWidget);
+        else
+          DestroyNative();
       }
 
       property int Id {
         int get() {
+          if (PumpThread::MustMarshal)
+            return safe_cast<int>(PumpThread::Send(this, PumpCommandKind::GetId));
+
           return Native->getId();
         }
       }
@@ -377,11 +2170,30 @@ namespace Berkelium {
         }
       }
 
+      /// <summary>
+      /// A snapshot of the widget's paint counters. Its callbacks are counted toward the parent window.
+      /// </summary>
+      property WindowStats ^ Stats {
+        WindowStats ^ get ();
+      }
+
+      /// <summary>
+      /// The native backing store that the widget's paint events are applied to, or null if the parent window does not use backing stores.
+      /// </summary>
+      property Berkelium::Managed::BackingStore ^ BackingStore {
+        Berkelium::Managed::BackingStore ^ get () {
+          return Store;
+        }
+      }
+
       /// <summary>
       /// Returns the virtual boundaries of the widget (relative to the parent window).
       /// </summary>
       property Berkelium::Managed::Rect ^ Rect {
         Berkelium::Managed::Rect ^ get() {
+          if (PumpThread::MustMarshal)
+            return safe_cast<Berkelium::Managed::Rect ^>(PumpThread::Send(this, PumpCommandKind::GetRect));
+
           ::Berkelium::Rect rect = Native->getRect();
           return gcnew Berkelium::Managed::Rect(rect.mLeft, rect.mTop, rect.mWidth, rect.mHeight);
         }
@@ -395,6 +2207,11 @@ namespace Berkelium {
       /// <param name="vk_code">Specifies the virtual key code of the key event.</param>
       /// <param name="scancode">Specifies the keyboard scan code of the key event.</param>
       void KeyEvent (bool pressed, KeyModifier modifiers, int vk_code, int scancode) {
+        if (QueueInputEvent(InputKey, pressed, (int)modifiers, vk_code, scancode, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::KeyEvent, pressed, (int)modifiers, vk_code, scancode))
+          return;
+
         Native->keyEvent(pressed, (int)modifiers, vk_code, scancode);
       }
 
@@ -403,6 +2220,11 @@ namespace Berkelium {
       /// </summary>
       /// <param name="text">Specifies the unicode character(s) generated by the keystrokes that produced the event.</param>
       void TextEvent (System::String ^ text) {
+        if (QueueInputEvent(InputText, 0, 0, 0, 0, text))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::TextEvent, text, nullptr))
+          return;
+
         WideStringHelper textPtr (text);
 
         Native->textEvent(textPtr.mData, textPtr.mLength);
@@ -414,6 +2236,11 @@ namespace Berkelium {
       /// <param name="buttonId">Specifies the mouse button that generated the event.</param>
       /// <param name="pressed">Specifies whether the event is a mouse down event or a mouse up event.</param>
       void MouseButton (MouseButton buttonId, bool pressed) {
+        if (QueueInputEvent(InputMouseButton, (int)buttonId, pressed, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::MouseButton, (int)buttonId, pressed))
+          return;
+
         Native->mouseButton((unsigned)buttonId, pressed);
       }
 
@@ -423,6 +2250,11 @@ namespace Berkelium {
       /// <param name="x">Specifies the new X coordinate of the mouse cursor (relative to the top-left corner of the widget).</param>
       /// <param name="y">Specifies the new Y coordinate of the mouse cursor (relative to the top-left corner of the widget).</param>
       void MouseMoved (int x, int y) {
+        if (QueueInputEvent(InputMouseMoved, x, y, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::MouseMoved, x, y))
+          return;
+
         Native->mouseMoved(x, y);
       }
 
@@ -430,6 +2262,11 @@ namespace Berkelium {
       /// Generates a virtual mouse wheel event within the widget.
       /// </summary>
       void MouseWheel (int xScroll, int yScroll) {
+        if (QueueInputEvent(InputMouseWheel, xScroll, yScroll, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::MouseWheel, xScroll, yScroll))
+          return;
+
         Native->mouseWheel(xScroll, yScroll);
       }
 
@@ -437,6 +2274,11 @@ namespace Berkelium {
       /// Generates a virtual focus gained event within the widget.
       /// </summary>
       void Focus () {
+        if (QueueInputEvent(InputFocus, 0, 0, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::Focus))
+          return;
+
         Native->focus();
       }
 
@@ -444,6 +2286,11 @@ namespace Berkelium {
       /// Generates a virtual focus lost event within the widget.
       /// </summary>
       void Unfocus () {
+        if (QueueInputEvent(InputUnfocus, 0, 0, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::Unfocus))
+          return;
+
         Native->unfocus();
       }
 
@@ -451,13 +2298,16 @@ namespace Berkelium {
       /// Changes the window's position relative to the parent window. Slightly useless!
       /// </summary>
       void Move (int newX, int newY) {
+        if (PumpThread::Post(this, PumpCommandKind::Move, newX, newY))
+          return;
+
         Native->setPos(newX, newY);
       }
 
       virtual String^ ToString() override {
         return System::String::Format(
           "Widget({0})", 
-          Native->getId()
+          Id
         );
       }
 
@@ -466,8 +2316,12 @@ namespace Berkelium {
         Destroyed(Parent, this);
       }
 
-      void OnPaint (IntPtr sourceBuffer, Berkelium::Managed::Rect ^ rect, int dx, int dy, Berkelium::Managed::Rect ^ scrollRect) {
-        Paint(Parent, this, sourceBuffer, rect, dx, dy, scrollRect);
+      void OnPaint (IntPtr sourceBuffer, Berkelium::Managed::Rect ^ rect, array<Berkelium::Managed::Rect ^> ^ copyRects, int dx, int dy, Berkelium::Managed::Rect ^ scrollRect) {
+        Paint(Parent, this, sourceBuffer, rect, copyRects, dx, dy, scrollRect);
+      }
+
+      void OnPaintFrame (PaintFrame % frame) {
+        FramePainted(Parent, this, frame);
       }
 
       void OnMoved (int newX, int newY) {
@@ -480,20 +2334,35 @@ namespace Berkelium {
 
     };
 
-    typedef std::map<::Berkelium::Widget *, gcroot<Widget ^>> TWidgetTable;
+    typedef HandleTable<::Berkelium::Widget, Widget> TWidgetTable;
 
     class WindowDelegateWrapper : public ::Berkelium::WindowDelegate {
     private:
       TWidgetTable WidgetTable;
+      // Messages are received into the first batch while the second is being dispatched.
+      NativeHostMessageBatch PendingMessages, FlushingMessages;
+      // Coalesced paints repacked for the legacy paint events; see PackLegacyPaint. Only ever grows.
+      std::vector<unsigned char> LegacyPaintBuffer;
     public:
       gcroot<Window ^> Owner;
+      // Set by the window's active EventRecorder; only ever changed on the thread that pumps Berkelium.
+      NativeTraceWriter * Trace;
+      // The window's counters, shared so that they outlive whichever of the two goes first.
+      NativeStatCounters * Counters;
 
-      WindowDelegateWrapper (Window ^ owner)
-        : Owner(owner) {
-      }
+      WindowDelegateWrapper (Window ^ owner);
+      ~WindowDelegateWrapper ();
 
       Widget ^ GetWidget (::Berkelium::Widget * widget, bool ownsHandle);
       bool WidgetDestroyed (::Berkelium::Widget * widget);
+      void SetWidgetBackingStores (bool enabled);
+
+      void DispatchPaint (const unsigned char *sourceBuffer, const ::Berkelium::Rect &sourceBufferRect, size_t stride,
+          size_t numCopyRects, const ::Berkelium::Rect *copyRects, int dx, int dy, const ::Berkelium::Rect &scrollRect, int paintCount);
+      void DispatchWidgetPaint (Widget ^ widget, const unsigned char *sourceBuffer, const ::Berkelium::Rect &sourceBufferRect, size_t stride,
+          size_t numCopyRects, const ::Berkelium::Rect *copyRects, int dx, int dy, const ::Berkelium::Rect &scrollRect, int paintCount);
+      void FlushCoalescedPaints ();
+      void FlushHostMessages ();
 
       virtual void onAddressBarChanged(::Berkelium::Window *win, URLString newURL);
       virtual void onStartLoading(::Berkelium::Window *win, URLString newURL);
@@ -531,11 +2400,44 @@ namespace Berkelium {
       ::Berkelium::Window * Native;
       Context ^ ManagedContext;
       WindowDelegateWrapper * Wrapper;
+      Berkelium::Managed::BackingStore ^ Store;
+      NativePaintAccumulator * PendingPaint;
+      NativeStatCounters * Counters;
+      NativeInputLatency * InputLatency;
+      bool Coalesce, QueuedForFlush;
+      // Guards the backing stores and pending paints when they are shared with the pump thread.
+      Object ^ PaintLock;
+      System::Collections::Generic::List<Berkelium::Managed::Widget ^> ^ PendingWidgets, ^ FlushingWidgets;
+      System::Int64 PaintSequenceNumber;
+      FrameCapture ^ Capture;
+      EventRecorder ^ Recorder;
+      HostMessageBatch ^ MessageBatch;
+      NativeScriptQueue * Scripts;
+      NativeInputQueue * Input, * FlushingInput;
+      // Widgets with queued input; an input event's Target is one more than the widget's index here.
+      System::Collections::Generic::List<Berkelium::Managed::Widget ^> ^ InputWidgets, ^ FlushingInputWidgets;
+      bool InputQueueEnabled;
+      System::Int64 InputEventCount, CoalescedInputEventCount;
+      // The size most recently passed to Resize, until it's applied.
+      bool ResizeQueued;
+      int QueuedWidth, QueuedHeight;
+      // Guards Scripts, Input and the queued resize when they are shared with the pump thread.
+      Object ^ QueueLock;
+      bool FlushQueued;
+      PaintHandler ^ PaintHandlers;
+      WidgetPaintHandler ^ WidgetPaintHandlers;
+      bool OverridesLegacyPaint, OverridesLegacyWidgetPaint;
 
       Window (Berkelium::Managed::Context ^ context, ::Berkelium::Window * native, bool ownsHandle)
         : Native(native)
         , OwnsHandle(ownsHandle)
-        , ManagedContext(context) {
+        , ManagedContext(context)
+        , Counters(new NativeStatCounters())
+        , InputLatency(new NativeInputLatency())
+        , PaintLock(gcnew Object())
+        , QueueLock(gcnew Object()) {
+
+          DetectLegacyPaintOverrides();
 
           if (ownsHandle) {
             Wrapper = new WindowDelegateWrapper(this);
@@ -543,6 +2445,110 @@ namespace Berkelium {
           }
       }
 
+      void DetectLegacyPaintOverrides ();
+
+      // The legacy paint events allocate a Rect for every rect, so we only raise
+      //  them if someone is actually listening.
+      property bool WantsLegacyPaint {
+        bool get () {
+          return OverridesLegacyPaint || (PaintHandlers != nullptr);
+        }
+      }
+
+      bool WantsLegacyWidgetPaint (Berkelium::Managed::Widget ^ widget) {
+        return OverridesLegacyWidgetPaint || (WidgetPaintHandlers != nullptr) || (widget->PaintHandlers != nullptr);
+      }
+
+      void QueueCoalescedPaint () {
+        if (QueuedForFlush)
+          return;
+
+        QueuedForFlush = true;
+        if (!PumpThread::Defer(this, PumpEventKind::FlushPaints))
+          BerkeliumSharp::QueueCoalescedPaint(this);
+      }
+
+      // Host messages received during the update go out along with its paints, after them.
+      void FlushCoalescedPaints () {
+        if (!Native || !Wrapper)
+          return;
+
+        NativeProfileScope span ("callback", "Window::FlushCoalescedPaints");
+        NativeTimeScope handlerTime (Counters, StatCallbackTicks);
+        Wrapper->FlushCoalescedPaints();
+        if (Native && Wrapper)
+          Wrapper->FlushHostMessages();
+      }
+
+      void CreateNative () {
+        Native = ::Berkelium::Window::create(ManagedContext->Native);
+        Wrapper = new WindowDelegateWrapper(this);
+        Native->setDelegate(Wrapper);
+      }
+
+      void DestroyNative () {
+        if (Capture != nullptr)
+          Capture->Stop();
+        if (Recorder != nullptr)
+          Recorder->Stop();
+        if (Native && OwnsHandle && BerkeliumSharp::IsInitialized)
+          delete Native;
+        if (Wrapper)
+          delete Wrapper;
+        if (Store)
+          delete Store;
+        if (PendingPaint)
+          delete PendingPaint;
+        if (Scripts)
+          delete Scripts;
+        if (Input)
+          delete Input;
+        if (FlushingInput)
+          delete FlushingInput;
+        if (Counters)
+          Counters->release();
+        if (InputLatency)
+          delete InputLatency;
+
+        Native = 0;
+        Wrapper = 0;
+        Store = nullptr;
+        PendingPaint = 0;
+        Scripts = 0;
+        Input = 0;
+        FlushingInput = 0;
+        Counters = 0;
+        InputLatency = 0;
+      }
+
+      // Hands the native window over to a new Window with a fresh delegate, and detaches this one, so that
+      //  nothing registered on this object (handlers, widgets or backing stores) follows the native window.
+      Window ^ RebindNative () {
+        Window ^ result = gcnew Window(ManagedContext, Native, true);
+        Native = 0;
+        DestroyNative();
+        return result;
+      }
+
+      Window ^ Rebind () {
+        if (PumpThread::MustMarshal)
+          return safe_cast<Window ^>(PumpThread::Send(this, PumpCommandKind::RebindWindow));
+
+        return RebindNative();
+      }
+
+      void ResizeNative (int width, int height);
+      void FlushResizeNative ();
+      bool GetQueuedSize (int & width, int & height);
+      void UpdateEventTrace ();
+      void UpdateEventTraceNative ();
+      void QueueForFlush ();
+      void FlushJavascriptNative ();
+      bool QueueInputEvent (Berkelium::Managed::Widget ^ target, NativeInputKind kind, int a, int b, int c, int d, System::String ^ text);
+      void FlushInputNative ();
+      void SetUseBackingStoreNative (bool value);
+      void SetCoalescePaintsNative (bool value);
+
     public:
       event AddressBarChangedHandler ^ AddressBarChanged;
       event StartLoadingHandler ^ StartLoading;
@@ -552,15 +2558,52 @@ namespace Berkelium {
       event BasicHandler ^ Unresponsive;
       event BasicHandler ^ Responsive;
       event ChromeSendHandler ^ ChromeSend;
+      /// <summary>
+      /// Raised once per update with every message the page posted with window.externalHost.postMessage during it.
+      /// Messages that claim to use the bridge format but are malformed are dropped.
+      /// </summary>
+      event HostMessagesHandler ^ HostMessages;
       event CreatedWindowHandler ^ CreatedWindow;
-      event PaintHandler ^ Paint;
+      /// <summary>
+      /// Raised for every paint of the window. Prefer FramePainted, which does not allocate.
+      /// </summary>
+      event PaintHandler ^ Paint {
+        void add (PaintHandler ^ handler) {
+          PaintHandlers = safe_cast<PaintHandler ^>(Delegate::Combine(PaintHandlers, handler));
+        }
+        void remove (PaintHandler ^ handler) {
+          PaintHandlers = safe_cast<PaintHandler ^>(Delegate::Remove(PaintHandlers, handler));
+        }
+        void raise (Window ^ window, IntPtr sourceBuffer, Rect ^ rect, array<Rect ^> ^ copyRects, int dx, int dy, Rect ^ scrollRect) {
+          PaintHandler ^ handlers = PaintHandlers;
+          if (handlers != nullptr)
+            handlers->Invoke(window, sourceBuffer, rect, copyRects, dx, dy, scrollRect);
+        }
+      }
+      event PaintFrameHandler ^ FramePainted;
       event BasicHandler ^ CrashedWorker;
       event CrashedPluginHandler ^ CrashedPlugin;
       event ConsoleMessageHandler ^ ConsoleMessage;
       event ScriptAlertHandler ^ ScriptAlert;
       event NavigationRequestedHandler ^ NavigationRequested;
       event WidgetCreatedHandler ^ WidgetCreated;
-      event WidgetPaintHandler ^ WidgetPaint;
+      /// <summary>
+      /// Raised for every paint of any of the window's widgets. Prefer WidgetFramePainted, which does not allocate.
+      /// </summary>
+      event WidgetPaintHandler ^ WidgetPaint {
+        void add (WidgetPaintHandler ^ handler) {
+          WidgetPaintHandlers = safe_cast<WidgetPaintHandler ^>(Delegate::Combine(WidgetPaintHandlers, handler));
+        }
+        void remove (WidgetPaintHandler ^ handler) {
+          WidgetPaintHandlers = safe_cast<WidgetPaintHandler ^>(Delegate::Remove(WidgetPaintHandlers, handler));
+        }
+        void raise (Window ^ window, Berkelium::Managed::Widget ^ widget, IntPtr sourceBuffer, Rect ^ rect, array<Rect ^> ^ copyRects, int dx, int dy, Rect ^ scrollRect) {
+          WidgetPaintHandler ^ handlers = WidgetPaintHandlers;
+          if (handlers != nullptr)
+            handlers->Invoke(window, widget, sourceBuffer, rect, copyRects, dx, dy, scrollRect);
+        }
+      }
+      event WidgetPaintFrameHandler ^ WidgetFramePainted;
       event WidgetMovedHandler ^ WidgetMoved;
       event WidgetResizedHandler ^ WidgetResized;
       event WidgetDestroyedHandler ^ WidgetDestroyed;
@@ -571,39 +2614,63 @@ namespace Berkelium {
       event CursorChangedHandler ^ CursorChanged;
 
       Window (Berkelium::Managed::Context ^ context)
-        : Native(::Berkelium::Window::create(context->Native))
-        , OwnsHandle(true)
-        , ManagedContext(context) {
-
-        Wrapper = new WindowDelegateWrapper(this);
-        Native->setDelegate(Wrapper);
-      }
+        : OwnsHandle(true)
+        , ManagedContext(context)
+        , Counters(new NativeStatCounters())
+        , InputLatency(new NativeInputLatency())
+        , PaintLock(gcnew Object())
+        , QueueLock(gcnew Object()) {
 
-      ~Window () {
-        if (Native && OwnsHandle && BerkeliumSharp::IsInitialized)
-          delete Native;
-        if (Wrapper)
-          delete Wrapper;
+        DetectLegacyPaintOverrides();
 
-        Native = 0;
-        Wrapper = 0;
+        if (PumpThread::MustMarshal)
+          PumpThread::Send(this, PumpCommandKind::CreateWindow);
+        else
+          CreateNative();
+      }
+
+      ~Window () {
+        if (PumpThread::MustMarshal)
+          PumpThread::Send(this, PumpCommandKind::DestroyWindow);
+        else
+          DestroyNative();
       }
 
       virtual String^ ToString() override {
         return System::String::Format(
           "Window({0})", 
-          Native->getId()
+          Id
         );
       }
 
+      /// <summary>
+      /// The width of the window, including a resize that hasn't been applied yet.
+      /// </summary>
       property int Width {
         int get() {
+          int width, height;
+          if (GetQueuedSize(width, height))
+            return width;
+
+          if (PumpThread::MustMarshal)
+            return safe_cast<Rect ^>(PumpThread::Send(this, PumpCommandKind::GetRect))->Width;
+
           return Native->getWidget()->getRect().width();
         }
       }
 
+      /// <summary>
+      /// The height of the window, including a resize that hasn't been applied yet.
+      /// </summary>
       property int Height {
         int get() {
+          int width, height;
+          if (GetQueuedSize(width, height))
+            return height;
+
+          if (PumpThread::MustMarshal)
+            return safe_cast<Rect ^>(PumpThread::Send(this, PumpCommandKind::GetRect))->Height;
+
           return Native->getWidget()->getRect().height();
         }
       }
@@ -612,6 +2679,9 @@ namespace Berkelium {
 
       property int Id {
         int get() {
+          if (PumpThread::MustMarshal)
+            return safe_cast<int>(PumpThread::Send(this, PumpCommandKind::GetId));
+
           return Native->getId();
         }
       }
@@ -627,15 +2697,120 @@ namespace Berkelium {
       /// </summary>
       property Widget ^ Widget {
         Berkelium::Managed::Widget ^ get () {
+          if (PumpThread::MustMarshal)
+            return safe_cast<Berkelium::Managed::Widget ^>(PumpThread::Send(this, PumpCommandKind::GetWidget));
+
           return Wrapper->GetWidget(Native->getWidget(), false);
         }
       }
 
+      /// <summary>
+      /// Determines whether paint events are applied to a native backing store before they are dispatched.
+      /// Enabling this also gives each of the window's widgets a backing store of its own.
+      /// </summary>
+      property bool UseBackingStore {
+        bool get () {
+          return Store != nullptr;
+        }
+        void set (bool value);
+      }
+
+      /// <summary>
+      /// The native backing store that the window's paint events are applied to, or null if UseBackingStore is false.
+      /// </summary>
+      property Berkelium::Managed::BackingStore ^ BackingStore {
+        Berkelium::Managed::BackingStore ^ get () {
+          return Store;
+        }
+      }
+
+      /// <summary>
+      /// Starts writing the window's frames to disk, at up to framesPerSecond (0 captures every paint).
+      /// A snapshot is taken right away and then whenever the window paints, so a page that doesn't change doesn't produce frames.
+      /// Enables UseBackingStore. The format is PNG unless the path ends in ".raw".
+      /// </summary>
+      /// <param name="path">The filename for each frame, as a String.Format pattern given the frame number (for example "capture\\{0:D6}.png").
+      ///  If it has no placeholder, the frame number is inserted before the extension.</param>
+      FrameCapture ^ StartCapture (String ^ path, double framesPerSecond) {
+        return StartCapture(path, framesPerSecond, FrameCapture::FormatForFilename(path));
+      }
+
+      FrameCapture ^ StartCapture (String ^ path, double framesPerSecond, CaptureFormat format);
+
+      /// <summary>
+      /// Writes the current contents of the window's backing store to a file, in the background.
+      /// Call WaitForPendingFrames on the result to find out when the file is complete. Requires UseBackingStore.
+      /// The format is PNG unless the filename ends in ".raw".
+      /// </summary>
+      FrameCapture ^ CaptureFrame (String ^ filename) {
+        return CaptureFrame(filename, FrameCapture::FormatForFilename(filename));
+      }
+
+      FrameCapture ^ CaptureFrame (String ^ filename, CaptureFormat format);
+
+      /// <summary>
+      /// The capture started by StartCapture, or null if it has been stopped.
+      /// </summary>
+      property FrameCapture ^ ActiveCapture {
+        FrameCapture ^ get () {
+          return Capture;
+        }
+      }
+
+      /// <summary>
+      /// Starts recording the window's callbacks (paints, widget changes, navigation, console messages and so on)
+      ///  into a binary trace, which EventTrace can replay without Chromium. Created windows and cursor changes
+      ///  are not recorded.
+      /// </summary>
+      /// <param name="path">The file to write the trace to. An existing file is replaced.</param>
+      /// <exception cref="System.IO.IOException">The file could not be created.</exception>
+      EventRecorder ^ StartRecording (String ^ path) {
+        return StartRecording(path, TracePixels::Compressed);
+      }
+
+      EventRecorder ^ StartRecording (String ^ path, TracePixels pixels);
+
+      /// <summary>
+      /// The recording started by StartRecording, or null if it has been stopped.
+      /// </summary>
+      property EventRecorder ^ ActiveRecording {
+        EventRecorder ^ get () {
+          return Recorder;
+        }
+      }
+
+      /// <summary>
+      /// A snapshot of the window's performance counters: paints received and delivered, callbacks and the time spent in them,
+      ///  and how long input takes to be painted.
+      /// </summary>
+      /// <exception cref="System.ObjectDisposedException">The window has been destroyed.</exception>
+      property WindowStats ^ Stats {
+        WindowStats ^ get ();
+      }
+
+      /// <summary>
+      /// Determines whether paints are merged instead of being dispatched as they arrive.
+      /// While enabled, every paint received during BerkeliumSharp.Update is applied to the backing store,
+      ///  and the window (and each of its widgets) receives at most one paint once the pump returns.
+      /// The merged paint's buffer is the backing store itself, so its rows are the store's Stride apart rather than
+      ///  packed; handlers of the Paint events, which aren't told the stride, should use FramePainted instead.
+      /// Enabling this also enables UseBackingStore.
+      /// </summary>
+      property bool CoalescePaints {
+        bool get () {
+          return Coalesce;
+        }
+        void set (bool value);
+      }
+
       /// <summary>
       /// Determines whether the window background is opaque. If true, the window will have a usable alpha channel for overlay purposes.
       /// </summary>
       property bool Transparent {
         void set (bool isTransparent) {
+          if (PumpThread::Post(this, PumpCommandKind::SetTransparent, isTransparent, 0))
+            return;
+
           Native->setTransparent(isTransparent);
         }
       }
@@ -645,6 +2820,9 @@ namespace Berkelium {
       /// </summary>
       property bool CanGoBack {
         bool get () {
+          if (PumpThread::MustMarshal)
+            return safe_cast<bool>(PumpThread::Send(this, PumpCommandKind::CanGoBack));
+
           return Native->canGoBack();
         }
       }
@@ -654,6 +2832,9 @@ namespace Berkelium {
       /// </summary>
       property bool CanGoForward {
         bool get () {
+          if (PumpThread::MustMarshal)
+            return safe_cast<bool>(PumpThread::Send(this, PumpCommandKind::CanGoForward));
+
           return Native->canGoForward();
         }
       }
@@ -669,6 +2850,9 @@ namespace Berkelium {
       /// Returns the topmost widget located at the specified position, if any.
       /// </summary>
       Berkelium::Managed::Widget ^ GetWidgetAtPoint (int x, int y, bool returnRootIfOutside) {
+        if (PumpThread::MustMarshal)
+          return safe_cast<Berkelium::Managed::Widget ^>(PumpThread::Send(this, PumpCommandKind::GetWidgetAtPoint, x, y, returnRootIfOutside));
+
         ::Berkelium::Widget * ptr = Native->getWidgetAtPoint(x, y, returnRootIfOutside);
         if (ptr)
           return Wrapper->GetWidget(ptr, false);
@@ -684,6 +2868,13 @@ namespace Berkelium {
       /// <param name="vk_code">Specifies the virtual key code of the key event.</param>
       /// <param name="scancode">Specifies the keyboard scan code of the key event.</param>
       void KeyEvent (bool pressed, KeyModifier modifiers, int vk_code, int scancode) {
+        if (InputLatency)
+          InputLatency->keyboard(Counters);
+        if (QueueInputEvent(InputKey, pressed, (int)modifiers, vk_code, scancode, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::KeyEvent, pressed, (int)modifiers, vk_code, scancode))
+          return;
+
         Native->keyEvent(pressed, (int)modifiers, vk_code, scancode);
       }
 
@@ -692,6 +2883,13 @@ namespace Berkelium {
       /// </summary>
       /// <param name="text">Specifies the unicode character(s) generated by the keystrokes that produced the event.</param>
       void TextEvent (System::String ^ text) {
+        if (InputLatency)
+          InputLatency->keyboard(Counters);
+        if (QueueInputEvent(InputText, 0, 0, 0, 0, text))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::TextEvent, text, nullptr))
+          return;
+
         WideStringHelper textPtr (text);
 
         Native->textEvent(textPtr.mData, textPtr.mLength);
@@ -703,6 +2901,13 @@ namespace Berkelium {
       /// <param name="buttonId">Specifies the mouse button that generated the event.</param>
       /// <param name="pressed">Specifies whether the event is a mouse down event or a mouse up event.</param>
       void MouseButton (MouseButton buttonId, bool pressed) {
+        if (InputLatency)
+          InputLatency->mouseButton(Counters);
+        if (QueueInputEvent(InputMouseButton, (int)buttonId, pressed, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::MouseButton, (int)buttonId, pressed))
+          return;
+
         Native->mouseButton((unsigned)buttonId, pressed);
       }
 
@@ -712,6 +2917,13 @@ namespace Berkelium {
       /// <param name="x">Specifies the new X coordinate of the mouse cursor (relative to the top-left corner of the window).</param>
       /// <param name="y">Specifies the new Y coordinate of the mouse cursor (relative to the top-left corner of the window).</param>
       void MouseMoved (int x, int y) {
+        if (InputLatency)
+          InputLatency->mouseMoved(Counters, x, y);
+        if (QueueInputEvent(InputMouseMoved, x, y, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::MouseMoved, x, y))
+          return;
+
         Native->mouseMoved(x, y);
       }
 
@@ -719,6 +2931,11 @@ namespace Berkelium {
       /// Generates a virtual mouse wheel event within the window.
       /// </summary>
       void MouseWheel (int xScroll, int yScroll) {
+        if (QueueInputEvent(InputMouseWheel, xScroll, yScroll, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::MouseWheel, xScroll, yScroll))
+          return;
+
         Native->mouseWheel(xScroll, yScroll);
       }
 
@@ -726,8 +2943,11 @@ namespace Berkelium {
       /// Asks the window to navigate to the specified URL.
       /// </summary>
       /// <param name="url">The URL to navigate to. Must be a fully formed URL including scheme.</param>
-      /// <returns>true if the navigation was started successfully.</returns>
+      /// <returns>true if the navigation was started successfully (or was queued for the pump thread).</returns>
       virtual bool NavigateTo (System::String ^ url) {
+        if (PumpThread::Post(this, PumpCommandKind::NavigateTo, url, nullptr))
+          return true;
+
         URLStringHelper urlPtr (url);
         return Native->navigateTo(urlPtr);
       }
@@ -736,6 +2956,9 @@ namespace Berkelium {
       /// Attempts to navigate backward in the window's history.
       /// </summary>
       void GoBack () {
+        if (PumpThread::Post(this, PumpCommandKind::GoBack))
+          return;
+
         Native->goBack();
       }
 
@@ -743,6 +2966,9 @@ namespace Berkelium {
       /// Attempts to navigate forward in the window's history.
       /// </summary>
       void GoForward () {
+        if (PumpThread::Post(this, PumpCommandKind::GoForward))
+          return;
+
         Native->goForward();
       }
 
@@ -751,25 +2977,102 @@ namespace Berkelium {
       /// </summary>
       /// <param name="mode">Specifies how to adjust the zoom.</param>
       void AdjustZoom (ZoomFunction mode) {
+        if (PumpThread::Post(this, PumpCommandKind::AdjustZoom, (int)mode, 0))
+          return;
+
         Native->adjustZoom((int)mode);
       }
 
       /// <summary>
       /// Executes a javascript snippet within the context of the window's currently loaded page (if any).
+      /// Scripts queued with QueueJavascript are sent first, so scripts run in the order they were issued. With the pump
+      ///  thread running, that holds for scripts queued before this call; ones queued while it's on its way may go first.
       /// </summary>
       /// <param name="javascript">The javascript to execute.</param>
       void ExecuteJavascript (System::String ^ javascript) {
+        if (PumpThread::Post(this, PumpCommandKind::ExecuteJavascript, javascript, nullptr))
+          return;
+
+        FlushJavascriptNative();
+
         WideStringHelper scriptPtr (javascript);
 
         Native->executeJavascript(scriptPtr);
       }
 
+      /// <summary>
+      /// Queues a javascript snippet to run at the start of the next BerkeliumSharp.Update. Every snippet queued for the window
+      ///  by then is sent to the page in a single call, in order, after anything else the window was asked to do in the meantime.
+      /// A snippet that throws doesn't stop the ones after it, but one that doesn't parse stops the whole batch.
+      /// </summary>
+      void QueueJavascript (System::String ^ javascript);
+
+      /// <summary>
+      /// Queues a script template with its parameters filled in, the same way as QueueJavascript.
+      /// </summary>
+      void QueueJavascript (ScriptTemplate ^ script, ... array<Object ^> ^ arguments);
+
+      /// <summary>
+      /// Sends the scripts queued with QueueJavascript to the page now, instead of at the start of the next update.
+      /// </summary>
+      void FlushJavascript () {
+        if (PumpThread::Post(this, PumpCommandKind::FlushJavascript))
+          return;
+
+        FlushJavascriptNative();
+      }
+
+      /// <summary>
+      /// Determines whether input events for the window and its widgets are queued and sent at the start of the next update,
+      ///  instead of one at a time as they are generated. Queued events keep their order, except that consecutive mouse moves
+      ///  are merged into the last one, consecutive wheel events are added together and consecutive text events are joined.
+      /// Other calls (navigation, resizing, scripts) are not ordered with respect to queued input.
+      /// Turning this off sends anything still queued.
+      /// </summary>
+      property bool QueueInput {
+        bool get () {
+          return InputQueueEnabled;
+        }
+        void set (bool value);
+      }
+
+      /// <summary>
+      /// The number of input events that have been queued for the window and its widgets, including the ones merged into others.
+      /// </summary>
+      property System::Int64 InputEventsQueued {
+        System::Int64 get () {
+          return InputEventCount;
+        }
+      }
+
+      /// <summary>
+      /// The number of queued input events that were merged into the event before them instead of being sent separately.
+      /// </summary>
+      property System::Int64 InputEventsCoalesced {
+        System::Int64 get () {
+          return CoalescedInputEventCount;
+        }
+      }
+
+      /// <summary>
+      /// Sends the queued input events now, instead of at the start of the next update.
+      /// </summary>
+      void FlushInput () {
+        if (PumpThread::Post(this, PumpCommandKind::FlushInput))
+          return;
+
+        FlushInputNative();
+      }
+
       /// <summary>
       /// Inserts a new CSS stylesheet within the context of the window's currently loaded page, optionally specifying an element to contain the CSS.
       /// </summary>
       /// <param name="css">The contents of the CSS stylesheet.</param>
       /// <param name="id">The ID of the element to contain the CSS, or null for none.</param>
       void InsertCSS (System::String ^ css, System::String ^ id) {
+        if (PumpThread::Post(this, PumpCommandKind::InsertCSS, css, id))
+          return;
+
         WideStringHelper cssPtr (css);
         
         if (id == nullptr)
@@ -784,6 +3087,9 @@ namespace Berkelium {
       /// Reloads the currently loaded page.
       /// </summary>
       void Refresh () {
+        if (PumpThread::Post(this, PumpCommandKind::Refresh))
+          return;
+
         Native->refresh();
       }
 
@@ -791,44 +3097,78 @@ namespace Berkelium {
       /// Cancels an active navigation.
       /// </summary>
       void Stop () {
+        if (PumpThread::Post(this, PumpCommandKind::Stop))
+          return;
+
         Native->stop();
       }
 
       void Cut () {
+        if (PumpThread::Post(this, PumpCommandKind::Cut))
+          return;
+
         Native->cut();
       }
 
       void Copy () {
+        if (PumpThread::Post(this, PumpCommandKind::Copy))
+          return;
+
         Native->copy();
       }
 
       void Paste () {
+        if (PumpThread::Post(this, PumpCommandKind::Paste))
+          return;
+
         Native->paste();
       }
 
       void Undo () {
+        if (PumpThread::Post(this, PumpCommandKind::Undo))
+          return;
+
         Native->undo();
       }
 
       void Redo () {
+        if (PumpThread::Post(this, PumpCommandKind::Redo))
+          return;
+
         Native->redo();
       }
 
       void DeleteSelection () {
+        if (PumpThread::Post(this, PumpCommandKind::DeleteSelection))
+          return;
+
         Native->del();
       }
 
       void SelectAll () {
+        if (PumpThread::Post(this, PumpCommandKind::SelectAll))
+          return;
+
         Native->selectAll();
       }
 
       /// <summary>
-      /// Changes the virtual size of the window.
+      /// Changes the virtual size of the window. The new size is applied at the start of the next update (or by FlushResize),
+      ///  and replaces any size passed earlier that hasn't been applied yet, so a window that is resized many times between
+      ///  updates (while being dragged, say) only goes through one resize. Width and Height report the new size right away.
       /// </summary>
       /// <param name="width">Specifies the new width of the window, in pixels (must be greater than 0).</param>
       /// <param name="height">Specifies the new height of the window, in pixels (must be greater than 0).</param>
-      virtual void Resize (int width, int height) {
-        Native->resize(width, height);
+      virtual void Resize (int width, int height);
+
+      /// <summary>
+      /// Applies the size passed to Resize now, instead of at the start of the next update.
+      /// </summary>
+      void FlushResize () {
+        if (PumpThread::Post(this, PumpCommandKind::FlushResize))
+          return;
+
+        FlushResizeNative();
       }
 
       /// <summary>
@@ -836,6 +3176,12 @@ namespace Berkelium {
       /// </summary>
       void Focus () {
         Focused = true;
+
+        if (QueueInputEvent(InputFocus, 0, 0, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::Focus))
+          return;
+
         Native->focus();
       }
 
@@ -844,6 +3190,12 @@ namespace Berkelium {
       /// </summary>
       void Unfocus () {
         Focused = false;
+
+        if (QueueInputEvent(InputUnfocus, 0, 0, 0, 0, nullptr))
+          return;
+        if (PumpThread::Post(this, PumpCommandKind::Unfocus))
+          return;
+
         Native->unfocus();
       }
 
@@ -880,8 +3232,12 @@ namespace Berkelium {
         CursorChanged(this, cursorHandle);
       }
 
-      virtual void OnPaint (IntPtr sourceBuffer, Rect ^ rect, int dx, int dy, Rect ^ scrollRect) {
-        Paint(this, sourceBuffer, rect, dx, dy, scrollRect);
+      virtual void OnPaint (IntPtr sourceBuffer, Rect ^ rect, array<Rect ^> ^ copyRects, int dx, int dy, Rect ^ scrollRect) {
+        Paint(this, sourceBuffer, rect, copyRects, dx, dy, scrollRect);
+      }
+
+      virtual void OnPaintFrame (PaintFrame % frame) {
+        FramePainted(this, frame);
       }
 
       virtual void OnCreatedWindow (Window ^ newWindow, Rect ^ initialRect, System::String ^ creatorUrl) {
@@ -892,6 +3248,10 @@ namespace Berkelium {
         ChromeSend(this, message, arguments);
       }
 
+      virtual void OnHostMessages (HostMessageBatch ^ messages) {
+        HostMessages(this, messages);
+      }
+
       virtual void OnCrashedWorker () {
         CrashedWorker(this);
       }
@@ -921,9 +3281,14 @@ namespace Berkelium {
         widget->OnDestroyed();
       }
 
-      virtual void OnWidgetPaint (Berkelium::Managed::Widget ^ widget, IntPtr sourceBuffer, Rect ^ rect, int dx, int dy, Rect ^ scrollRect) {
-        WidgetPaint(this, widget, sourceBuffer, rect, dx, dy, scrollRect);
-        widget->OnPaint(sourceBuffer, rect, dx, dy, scrollRect);
+      virtual void OnWidgetPaint (Berkelium::Managed::Widget ^ widget, IntPtr sourceBuffer, Rect ^ rect, array<Rect ^> ^ copyRects, int dx, int dy, Rect ^ scrollRect) {
+        WidgetPaint(this, widget, sourceBuffer, rect, copyRects, dx, dy, scrollRect);
+        widget->OnPaint(sourceBuffer, rect, copyRects, dx, dy, scrollRect);
+      }
+
+      virtual void OnWidgetPaintFrame (Berkelium::Managed::Widget ^ widget, PaintFrame % frame) {
+        WidgetFramePainted(this, widget, frame);
+        widget->OnPaintFrame(frame);
       }
 
       virtual void OnWidgetMoved (Berkelium::Managed::Widget ^ widget, int newX, int newY) {
@@ -953,4 +3318,182 @@ namespace Berkelium {
       }
     };
 
+    /// <summary>
+    /// JavaScript to pass to a ScriptTemplate as it is, for values that aren't null, a boolean, a number or a string.
+    /// </summary>
+    public ref class ScriptLiteral sealed {
+    internal:
+      String ^ Text;
+
+    public:
+      ScriptLiteral (String ^ javascript) {
+        if (javascript == nullptr)
+          throw gcnew ArgumentNullException("javascript");
+
+        Text = javascript;
+      }
+
+      property String ^ Javascript {
+        String ^ get () {
+          return Text;
+        }
+      }
+
+      virtual String^ ToString() override {
+        return Text;
+      }
+    };
+
+    /// <summary>
+    /// A script with numbered parameters ($0, $1, ...), parsed once so that queueing it only costs as much as its arguments.
+    /// Arguments can be null, booleans, numbers, characters and strings, which are turned into JavaScript literals natively,
+    ///  or ScriptLiterals. Parameters without an argument are undefined. A '$' that isn't followed by a digit is left alone.
+    /// </summary>
+    public ref class ScriptTemplate {
+    internal:
+      NativeScriptTemplate * Native;
+      String ^ SourceText;
+
+      static void AppendArgument (std::vector<wchar_t> & script, Object ^ value);
+
+    public:
+      ScriptTemplate (String ^ source);
+
+      ~ScriptTemplate () {
+        if (Native)
+          delete Native;
+
+        Native = 0;
+      }
+
+      property String ^ Source {
+        String ^ get () {
+          return SourceText;
+        }
+      }
+
+      property int ParameterCount {
+        int get () {
+          return Native->parameterCount();
+        }
+      }
+
+      /// <summary>
+      /// Determines whether a value can be passed to a template as it is, rather than as a ScriptLiteral.
+      /// </summary>
+      static bool IsSupportedArgument (Object ^ value);
+
+      /// <summary>
+      /// Fills in the template, for use with ExecuteJavascript.
+      /// </summary>
+      String ^ Format (... array<Object ^> ^ arguments);
+
+      virtual String^ ToString() override {
+        return System::String::Format(
+          "ScriptTemplate({0} parameter(s))", 
+          ParameterCount
+        );
+      }
+    };
+
+    /// <summary>
+    /// Keeps windows created ahead of time for one context, so that short-lived views don't pay for starting up
+    ///  a renderer each time. Idle windows sit on about:blank at the pool's size.
+    /// Give windows back with Release rather than disposing them. A released window is reset and its native window
+    ///  is handed to a new Window object, so the handlers and state of the old one never carry over; don't use it again.
+    /// The pool should only be used from the thread that called BerkeliumSharp.Init.
+    /// </summary>
+    public ref class WindowPool {
+      Berkelium::Managed::Context ^ PoolContext;
+      System::Collections::Generic::Stack<Window ^> ^ Idle;
+      int PoolWidth, PoolHeight;
+      int Low, High;
+
+      Window ^ CreateIdleWindow ();
+      void Trim ();
+
+    public:
+      /// <summary>
+      /// Constructs a pool and creates its first LowWatermark windows.
+      /// </summary>
+      /// <param name="context">The context the pool's windows are created in.</param>
+      /// <param name="width">The size idle windows are reset to, in pixels.</param>
+      /// <param name="height">The size idle windows are reset to, in pixels.</param>
+      /// <param name="lowWatermark">The number of idle windows the pool tops itself up to.</param>
+      /// <param name="highWatermark">The most idle windows the pool keeps; windows released beyond this are destroyed.</param>
+      WindowPool (Berkelium::Managed::Context ^ context, int width, int height, int lowWatermark, int highWatermark);
+      ~WindowPool ();
+
+      property Berkelium::Managed::Context ^ Context {
+        Berkelium::Managed::Context ^ get () {
+          return PoolContext;
+        }
+      }
+
+      property int Width {
+        int get () {
+          return PoolWidth;
+        }
+      }
+
+      property int Height {
+        int get () {
+          return PoolHeight;
+        }
+      }
+
+      /// <summary>
+      /// The number of windows that are waiting to be handed out.
+      /// </summary>
+      property int IdleCount {
+        int get () {
+          return Idle->Count;
+        }
+      }
+
+      /// <summary>
+      /// The number of idle windows that Replenish tops the pool up to.
+      /// </summary>
+      property int LowWatermark {
+        int get () {
+          return Low;
+        }
+        void set (int value);
+      }
+
+      /// <summary>
+      /// The most idle windows the pool keeps. Lowering it destroys the excess.
+      /// </summary>
+      property int HighWatermark {
+        int get () {
+          return High;
+        }
+        void set (int value);
+      }
+
+      /// <summary>
+      /// If true, Acquire replenishes the pool once it drops below LowWatermark, so the next Acquire is warm, but the
+      ///  caller pays for creating the replacement. False by default: call Replenish from idle time instead.
+      /// </summary>
+      property bool ReplenishOnAcquire;
+
+      /// <summary>
+      /// Hands out an idle window, or creates one if there are none. Unless ReplenishOnAcquire is set, this never
+      ///  creates a window while an idle one is left.
+      /// </summary>
+      Window ^ Acquire ();
+
+      /// <summary>
+      /// Gives a window back to the pool. It is reset (navigation stopped, blank page, pool size, default zoom,
+      ///  opaque background) and kept for reuse, unless the pool already holds HighWatermark idle windows.
+      /// </summary>
+      void Release (Window ^ window);
+
+      /// <summary>
+      /// Creates windows until LowWatermark are idle. Each one takes a while to create, so call this when the
+      ///  application is idle (between frames, or after a level has loaded), not right before Acquire.
+      /// </summary>
+      void Replenish ();
+    };
+
   }}
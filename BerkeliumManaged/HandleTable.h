@@ -0,0 +1,169 @@
+// HandleTable.h : maps native Berkelium objects to the managed objects that wrap them
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // A flat, open-addressed map from a native pointer to its managed wrapper. Every entry caches
+    //  the GCHandle of its wrapper, so a lookup is a hash and (almost always) a single probe into
+    //  one contiguous array, instead of a tree walk over separately allocated nodes.
+    // Erasing shifts the following entries back, so the table never fills up with tombstones.
+    template <typename TKey, typename TValue>
+    class HandleTable {
+      struct Slot {
+        TKey * Key;
+        void * Handle;
+      };
+
+      static const size_t InitialCapacity = 8;
+
+      Slot * mSlots;
+      size_t mMask, mCount;
+
+      HandleTable (const HandleTable &);
+      HandleTable & operator= (const HandleTable &);
+
+      static size_t hash (const TKey * key) {
+        // Heap pointers are aligned and clustered, so mix the high bits into the low ones.
+        size_t value = (size_t)key;
+        value ^= value >> 16;
+        value *= 0x45D9F3B;
+        value ^= value >> 16;
+        return value;
+      }
+
+      static void * allocHandle (TValue ^ value) {
+        return System::Runtime::InteropServices::GCHandle::ToIntPtr(
+          System::Runtime::InteropServices::GCHandle::Alloc(value)
+        ).ToPointer();
+      }
+
+      static void freeHandle (void * handle) {
+        System::Runtime::InteropServices::GCHandle::FromIntPtr(System::IntPtr(handle)).Free();
+      }
+
+      size_t indexOf (const TKey * key) const {
+        if (!mSlots)
+          return capacity();
+
+        for (size_t i = hash(key) & mMask; mSlots[i].Key; i = (i + 1) & mMask) {
+          if (mSlots[i].Key == key)
+            return i;
+        }
+
+        return capacity();
+      }
+
+      void place (TKey * key, void * handle) {
+        size_t i = hash(key) & mMask;
+        while (mSlots[i].Key)
+          i = (i + 1) & mMask;
+
+        mSlots[i].Key = key;
+        mSlots[i].Handle = handle;
+      }
+
+      void grow () {
+        Slot * oldSlots = mSlots;
+        size_t oldCapacity = capacity();
+        size_t newCapacity = oldSlots ? oldCapacity * 2 : InitialCapacity;
+
+        Slot * newSlots = (Slot *)calloc(newCapacity, sizeof(Slot));
+        // The table is left as it was, so the caller can still use it.
+        if (!newSlots)
+          throw gcnew System::OutOfMemoryException("Could not grow the handle table.");
+
+        mSlots = newSlots;
+        mMask = newCapacity - 1;
+
+        for (size_t i = 0; i < oldCapacity; i++) {
+          if (oldSlots[i].Key)
+            place(oldSlots[i].Key, oldSlots[i].Handle);
+        }
+
+        free(oldSlots);
+      }
+
+    public:
+      HandleTable ()
+        : mSlots(0)
+        , mMask(0)
+        , mCount(0) {
+      }
+
+      ~HandleTable () {
+        clear();
+        free(mSlots);
+      }
+
+      size_t count () const { return mCount; }
+      size_t capacity () const { return mSlots ? mMask + 1 : 0; }
+
+      // For walking the table: slots without an entry have a null key.
+      TKey * keyAt (size_t index) const { return mSlots[index].Key; }
+      TValue ^ valueAt (size_t index) const {
+        return static_cast<TValue ^>(
+          System::Runtime::InteropServices::GCHandle::FromIntPtr(System::IntPtr(mSlots[index].Handle)).Target
+        );
+      }
+
+      // Returns nullptr if the key isn't in the table.
+      TValue ^ find (const TKey * key) const {
+        size_t i = indexOf(key);
+        if (i == capacity())
+          return nullptr;
+
+        return valueAt(i);
+      }
+
+      // The key must not already be in the table.
+      void insert (TKey * key, TValue ^ value) {
+        // Keep the load factor at or under one half so probe sequences stay short.
+        if ((mCount + 1) * 2 > capacity())
+          grow();
+
+        place(key, allocHandle(value));
+        mCount += 1;
+      }
+
+      bool erase (const TKey * key) {
+        size_t i = indexOf(key);
+        if (i == capacity())
+          return false;
+
+        freeHandle(mSlots[i].Handle);
+
+        for (size_t j = (i + 1) & mMask; mSlots[j].Key; j = (j + 1) & mMask) {
+          // An entry can fill the hole only if its home slot isn't cyclically within (i, j].
+          size_t home = hash(mSlots[j].Key) & mMask;
+          bool staysPut = (i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j));
+          if (staysPut)
+            continue;
+
+          mSlots[i] = mSlots[j];
+          i = j;
+        }
+
+        mSlots[i].Key = 0;
+        mSlots[i].Handle = 0;
+        mCount -= 1;
+        return true;
+      }
+
+      void clear () {
+        for (size_t i = 0; i < capacity(); i++) {
+          if (mSlots[i].Key)
+            freeHandle(mSlots[i].Handle);
+        }
+
+        if (mSlots)
+          memset(mSlots, 0, capacity() * sizeof(Slot));
+        mCount = 0;
+      }
+    };
+
+  }}
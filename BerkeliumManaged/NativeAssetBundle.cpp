@@ -0,0 +1,261 @@
+// NativeAssetBundle.cpp : compiled as native code; see NativeAssetBundle.h
+
+#include "NativeAssetBundle.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    namespace {
+      // Longer paths are never found, so lookups don't have to allocate.
+      const size_t MaxPathLength = 1024;
+
+      int ComparePaths (const char * a, size_t aLength, const char * b, size_t bLength) {
+        int result = memcmp(a, b, (aLength < bLength) ? aLength : bLength);
+        if (result != 0)
+          return result;
+
+        return (aLength < bLength) ? -1 : ((aLength > bLength) ? 1 : 0);
+      }
+
+      int HexDigitValue (wchar_t ch) {
+        if ((ch >= '0') && (ch <= '9'))
+          return ch - '0';
+        if ((ch >= 'a') && (ch <= 'f'))
+          return ch - 'a' + 10;
+        if ((ch >= 'A') && (ch <= 'F'))
+          return ch - 'A' + 10;
+        return -1;
+      }
+
+      // Unescapes a URL path into UTF-8. Returns false if it doesn't fit.
+      bool DecodePath (const wchar_t * path, size_t length, char * output, size_t & outputLength) {
+        size_t o = 0;
+
+        for (size_t i = 0; i < length; i++) {
+          wchar_t ch = path[i];
+          int high, low;
+
+          if ((ch == '%') && (i + 2 < length) && ((high = HexDigitValue(path[i + 1])) >= 0) && ((low = HexDigitValue(path[i + 2])) >= 0)) {
+            if (o + 1 > MaxPathLength)
+              return false;
+            output[o++] = (char)((high << 4) | low);
+            i += 2;
+          } else if (ch < 0x80) {
+            if (o + 1 > MaxPathLength)
+              return false;
+            output[o++] = (char)ch;
+          } else if (ch < 0x800) {
+            if (o + 2 > MaxPathLength)
+              return false;
+            output[o++] = (char)(0xC0 | (ch >> 6));
+            output[o++] = (char)(0x80 | (ch & 0x3F));
+          } else {
+            // Chromium hands us escaped URLs, so this is only for hand-written ones; surrogates aren't paired up.
+            if (o + 3 > MaxPathLength)
+              return false;
+            output[o++] = (char)(0xE0 | ((ch >> 12) & 0x0F));
+            output[o++] = (char)(0x80 | ((ch >> 6) & 0x3F));
+            output[o++] = (char)(0x80 | (ch & 0x3F));
+          }
+        }
+
+        outputLength = o;
+        return true;
+      }
+
+      void AppendHeader (char * buffer, size_t & position, const char * name, const char * value, size_t valueLength) {
+        size_t nameLength = strlen(name);
+        memcpy(buffer + position, name, nameLength);
+        position += nameLength;
+        memcpy(buffer + position, value, valueLength);
+        position += valueLength;
+        buffer[position++] = 0;
+      }
+    }
+
+    const char NativeAssetBundle::Magic[8] = { 'B', 'K', 'B', 'N', 'D', 'L', '0', '1' };
+
+    NativeAssetBundle::NativeAssetBundle ()
+      : mRefCount(1)
+      , mFile(INVALID_HANDLE_VALUE)
+      , mMapping(0)
+      , mView(0)
+      , mSize(0)
+      , mEntries(0)
+      , mCount(0) {
+    }
+
+    NativeAssetBundle::~NativeAssetBundle () {
+      if (mView)
+        UnmapViewOfFile(mView);
+      if (mMapping)
+        CloseHandle(mMapping);
+      if (mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+    }
+
+    NativeAssetBundle * NativeAssetBundle::open (const wchar_t * filename) {
+      NativeAssetBundle * result = new NativeAssetBundle();
+
+      result->mFile = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, 0);
+      LARGE_INTEGER size;
+      if ((result->mFile == INVALID_HANDLE_VALUE) || !GetFileSizeEx(result->mFile, &size) || (size.QuadPart < (LONGLONG)sizeof(AssetBundleHeader))) {
+        result->release();
+        return 0;
+      }
+
+      result->mSize = (unsigned long long)size.QuadPart;
+      result->mMapping = CreateFileMappingW(result->mFile, 0, PAGE_READONLY, 0, 0, 0);
+      if (result->mMapping)
+        result->mView = (const unsigned char *)MapViewOfFile(result->mMapping, FILE_MAP_READ, 0, 0, 0);
+
+      if (!result->mView || !result->validate()) {
+        result->release();
+        return 0;
+      }
+
+      return result;
+    }
+
+    // Everything a lookup touches is bounds-checked here, once, so that lookups can trust the file.
+    bool NativeAssetBundle::validate () {
+      const AssetBundleHeader * header = (const AssetBundleHeader *)mView;
+      if (memcmp(header->Magic, Magic, sizeof(Magic)) != 0)
+        return false;
+
+      unsigned long long entriesEnd = sizeof(AssetBundleHeader) + ((unsigned long long)header->EntryCount * sizeof(AssetBundleEntry));
+      if (entriesEnd > mSize)
+        return false;
+
+      mEntries = (const AssetBundleEntry *)(mView + sizeof(AssetBundleHeader));
+      mCount = header->EntryCount;
+
+      for (unsigned int i = 0; i < mCount; i++) {
+        const AssetBundleEntry & entry = mEntries[i];
+        if (((unsigned long long)entry.PathOffset + entry.PathLength > mSize) ||
+            ((unsigned long long)entry.MimeTypeOffset + entry.MimeTypeLength > mSize) ||
+            ((unsigned long long)entry.ETagOffset + entry.ETagLength > mSize) ||
+            (entry.DataOffset > mSize) || (entry.DataLength > mSize - entry.DataOffset) ||
+            (entry.MimeTypeLength > MaxPathLength) || (entry.ETagLength > MaxPathLength))
+          return false;
+
+        if ((i > 0) && (ComparePaths(text(mEntries[i - 1].PathOffset), mEntries[i - 1].PathLength, text(entry.PathOffset), entry.PathLength) >= 0))
+          return false;
+      }
+
+      return true;
+    }
+
+    void NativeAssetBundle::addRef () {
+      InterlockedIncrement(&mRefCount);
+    }
+
+    void NativeAssetBundle::release () {
+      if (InterlockedDecrement(&mRefCount) == 0)
+        delete this;
+    }
+
+    unsigned int NativeAssetBundle::count () const {
+      return mCount;
+    }
+
+    const AssetBundleEntry * NativeAssetBundle::entryAt (unsigned int index) const {
+      return (index < mCount) ? &mEntries[index] : 0;
+    }
+
+    const AssetBundleEntry * NativeAssetBundle::find (const char * path, size_t pathLength) const {
+      unsigned int low = 0, high = mCount;
+
+      while (low < high) {
+        unsigned int middle = low + ((high - low) / 2);
+        const AssetBundleEntry * entry = &mEntries[middle];
+
+        int comparison = ComparePaths(text(entry->PathOffset), entry->PathLength, path, pathLength);
+        if (comparison == 0)
+          return entry;
+        else if (comparison < 0)
+          low = middle + 1;
+        else
+          high = middle;
+      }
+
+      return 0;
+    }
+
+    const AssetBundleEntry * NativeAssetBundle::findUrl (const wchar_t * url, size_t urlLength) const {
+      size_t start = 0;
+      for (size_t i = 0; i + 2 < urlLength; i++) {
+        if ((url[i] == ':') && (url[i + 1] == '/') && (url[i + 2] == '/')) {
+          start = i + 3;
+          break;
+        }
+      }
+
+      if (start == 0)
+        return 0;
+
+      size_t end = start;
+      while ((end < urlLength) && (url[end] != '?') && (url[end] != '#'))
+        end++;
+      if ((end > start) && (url[end - 1] == '/'))
+        end--;
+
+      char path[MaxPathLength];
+      size_t pathLength;
+      if (!DecodePath(url + start, end - start, path, pathLength))
+        return 0;
+
+      return find(path, pathLength);
+    }
+
+    HGLOBAL NativeAssetBundle::copyHeaders (const AssetBundleEntry * entry, size_t & length) const {
+      static const char statusLine[] = "HTTP/1.1 200 OK";
+      static const char acceptRanges[] = "bytes";
+      static const char gzip[] = "gzip";
+
+      char contentLength[24];
+      int contentLengthLength = sprintf_s(contentLength, sizeof(contentLength), "%llu", entry->DataLength);
+
+      // Each line is null-terminated, and the block ends with an extra null.
+      size_t capacity = sizeof(statusLine) +
+        sizeof("Content-Type: ") + entry->MimeTypeLength +
+        sizeof("Content-Length: ") + contentLengthLength +
+        sizeof("Accept-Ranges: ") + sizeof(acceptRanges) +
+        sizeof("ETag: ") + entry->ETagLength +
+        sizeof("Content-Encoding: ") + sizeof(gzip) + 1;
+
+      char * result = (char *)LocalAlloc(LMEM_FIXED, capacity);
+      if (!result) {
+        length = 0;
+        return 0;
+      }
+
+      size_t position = 0;
+      AppendHeader(result, position, "", statusLine, sizeof(statusLine) - 1);
+      AppendHeader(result, position, "Content-Type: ", text(entry->MimeTypeOffset), entry->MimeTypeLength);
+      AppendHeader(result, position, "Content-Length: ", contentLength, contentLengthLength);
+      AppendHeader(result, position, "Accept-Ranges: ", acceptRanges, sizeof(acceptRanges) - 1);
+      if (entry->ETagLength > 0)
+        AppendHeader(result, position, "ETag: ", text(entry->ETagOffset), entry->ETagLength);
+      if (entry->Flags & AssetBundleGzip)
+        AppendHeader(result, position, "Content-Encoding: ", gzip, sizeof(gzip) - 1);
+      result[position++] = 0;
+
+      length = position;
+      return (HGLOBAL)result;
+    }
+
+    HGLOBAL NativeAssetBundle::copyBody (const AssetBundleEntry * entry) const {
+      if (entry->DataLength == 0)
+        return 0;
+
+      HGLOBAL result = (HGLOBAL)LocalAlloc(LMEM_FIXED, (SIZE_T)entry->DataLength);
+      if (result)
+        memcpy(result, data(entry), (size_t)entry->DataLength);
+      return result;
+    }
+
+  }}
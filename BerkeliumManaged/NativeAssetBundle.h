@@ -0,0 +1,87 @@
+// NativeAssetBundle.h : serves custom protocol requests straight out of a memory-mapped bundle file
+
+#pragma once
+
+#include <windows.h>
+#include <stddef.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // A bundle is a single read-only file laid out as follows (all integers little-endian):
+    //
+    //   AssetBundleHeader
+    //   AssetBundleEntry[EntryCount], sorted by path (compared bytewise)
+    //   the UTF-8 paths, MIME types and ETags, and the payloads, at the offsets the entries give
+    //
+    // Paths are relative to the scheme, without a leading slash ("host/dir/file.html"), and are stored unescaped.
+    struct AssetBundleHeader {
+      char Magic[8];
+      unsigned int EntryCount;
+      unsigned int Reserved;
+    };
+
+    enum AssetBundleEntryFlags {
+      // The payload is gzip-compressed and is served with Content-Encoding: gzip.
+      AssetBundleGzip = 1
+    };
+
+    struct AssetBundleEntry {
+      // Offsets are from the start of the file.
+      unsigned int PathOffset, PathLength;
+      unsigned int MimeTypeOffset, MimeTypeLength;
+      unsigned int ETagOffset, ETagLength;
+      unsigned int Flags, Reserved;
+      unsigned long long DataOffset, DataLength;
+    };
+
+    // A bundle file mapped into memory once for its whole lifetime. Lookups never allocate or lock,
+    //  so it's safe to use from any thread. It is reference counted so that responses still being read
+    //  out of the mapping can outlive the protocol handler that opened it.
+    class NativeAssetBundle {
+      volatile LONG mRefCount;
+      HANDLE mFile, mMapping;
+      const unsigned char * mView;
+      unsigned long long mSize;
+      const AssetBundleEntry * mEntries;
+      unsigned int mCount;
+
+      NativeAssetBundle ();
+      NativeAssetBundle (const NativeAssetBundle &);
+      NativeAssetBundle & operator= (const NativeAssetBundle &);
+      ~NativeAssetBundle ();
+
+      bool validate ();
+
+    public:
+      static const char Magic[8];
+
+      // Maps the named file. Returns 0 if it can't be opened or isn't a well-formed bundle.
+      //  The bundle starts out with a single reference, owned by the caller.
+      static NativeAssetBundle * open (const wchar_t * filename);
+
+      void addRef ();
+      void release ();
+
+      unsigned int count () const;
+      const AssetBundleEntry * entryAt (unsigned int index) const;
+
+      // Finds the entry for an unescaped UTF-8 path, or returns 0.
+      const AssetBundleEntry * find (const char * path, size_t pathLength) const;
+      // Finds the entry a scheme://path URL refers to, ignoring any query or fragment and a trailing slash.
+      const AssetBundleEntry * findUrl (const wchar_t * url, size_t urlLength) const;
+
+      const unsigned char * data (const AssetBundleEntry * entry) const {
+        return mView + entry->DataOffset;
+      }
+
+      const char * text (unsigned int offset) const {
+        return (const char *)(mView + offset);
+      }
+
+      // Allocates the serialized header block for an entry the way ProtocolHandler hands out responses.
+      HGLOBAL copyHeaders (const AssetBundleEntry * entry, size_t & length) const;
+      HGLOBAL copyBody (const AssetBundleEntry * entry) const;
+    };
+
+  }}
@@ -0,0 +1,283 @@
+// NativeBackingStore.cpp : compiled as native code; see NativeBackingStore.h
+
+#include "NativeBackingStore.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    ::Berkelium::Rect MakeRect (int left, int top, int width, int height) {
+      ::Berkelium::Rect result;
+      result.mLeft = left;
+      result.mTop = top;
+      result.mWidth = width;
+      result.mHeight = height;
+      return result;
+    }
+
+    ::Berkelium::Rect IntersectRects (const ::Berkelium::Rect & a, const ::Berkelium::Rect & b) {
+      int left = a.mLeft > b.mLeft ? a.mLeft : b.mLeft;
+      int top = a.mTop > b.mTop ? a.mTop : b.mTop;
+      int right = (a.mLeft + a.mWidth) < (b.mLeft + b.mWidth) ? (a.mLeft + a.mWidth) : (b.mLeft + b.mWidth);
+      int bottom = (a.mTop + a.mHeight) < (b.mTop + b.mHeight) ? (a.mTop + a.mHeight) : (b.mTop + b.mHeight);
+
+      if ((right <= left) || (bottom <= top))
+        return MakeRect(0, 0, 0, 0);
+
+      return MakeRect(left, top, right - left, bottom - top);
+    }
+
+    ::Berkelium::Rect UnionRects (const ::Berkelium::Rect & a, const ::Berkelium::Rect & b) {
+      if ((a.mWidth <= 0) || (a.mHeight <= 0))
+        return b;
+      if ((b.mWidth <= 0) || (b.mHeight <= 0))
+        return a;
+
+      int left = a.mLeft < b.mLeft ? a.mLeft : b.mLeft;
+      int top = a.mTop < b.mTop ? a.mTop : b.mTop;
+      int right = (a.mLeft + a.mWidth) > (b.mLeft + b.mWidth) ? (a.mLeft + a.mWidth) : (b.mLeft + b.mWidth);
+      int bottom = (a.mTop + a.mHeight) > (b.mTop + b.mHeight) ? (a.mTop + a.mHeight) : (b.mTop + b.mHeight);
+
+      return MakeRect(left, top, right - left, bottom - top);
+    }
+
+    NativeBackingStore::NativeBackingStore ()
+      : mBuffer(0)
+      , mWidth(0)
+      , mHeight(0)
+      , mStride(0)
+      , mCapacityHeight(0)
+      , mDirty(MakeRect(0, 0, 0, 0))
+      , mDirtyRectCount(0) {
+    }
+
+    NativeBackingStore::~NativeBackingStore () {
+      if (mBuffer)
+        free(mBuffer);
+
+      mBuffer = 0;
+    }
+
+    namespace {
+      inline long long Area (const ::Berkelium::Rect & rect) {
+        return (long long)rect.mWidth * rect.mHeight;
+      }
+    }
+
+    void NativeBackingStore::clearDirty () {
+      mDirty = MakeRect(0, 0, 0, 0);
+      mDirtyRectCount = 0;
+    }
+
+    void NativeBackingStore::markDirty (const ::Berkelium::Rect & rect) {
+      if ((rect.mWidth <= 0) || (rect.mHeight <= 0))
+        return;
+
+      mDirty = UnionRects(mDirty, rect);
+
+      // Overlapping rects are merged, so that no pixel is uploaded twice. Each pass takes one rect
+      //  out of the list, so this always ends.
+      ::Berkelium::Rect merged = rect;
+      for (;;) {
+        size_t found = mDirtyRectCount;
+        for (size_t i = 0; i < mDirtyRectCount; i++) {
+          if (Area(IntersectRects(mDirtyRects[i], merged)) > 0) {
+            found = i;
+            break;
+          }
+        }
+
+        // With no overlap and no room left, the cheapest merge is the one that adds the fewest clean pixels.
+        if ((found == mDirtyRectCount) && (mDirtyRectCount == MaxDirtyRects)) {
+          long long cheapest = 0;
+          for (size_t i = 0; i < mDirtyRectCount; i++) {
+            long long cost = Area(UnionRects(mDirtyRects[i], merged)) - Area(mDirtyRects[i]);
+            if ((i == 0) || (cost < cheapest)) {
+              cheapest = cost;
+              found = i;
+            }
+          }
+        }
+
+        if (found == mDirtyRectCount)
+          break;
+
+        merged = UnionRects(merged, mDirtyRects[found]);
+        mDirtyRects[found] = mDirtyRects[--mDirtyRectCount];
+      }
+
+      mDirtyRects[mDirtyRectCount++] = merged;
+    }
+
+    bool NativeBackingStore::resize (int width, int height) {
+      if (width < 0)
+        width = 0;
+      if (height < 0)
+        height = 0;
+
+      if ((width == mWidth) && (height == mHeight))
+        return true;
+
+      size_t rowBytes = (size_t)width * BytesPerPixel;
+      int keptHeight = height < mHeight ? height : mHeight;
+      size_t keptBytes = (size_t)(width < mWidth ? width : mWidth) * BytesPerPixel;
+
+      if ((width > 0) && (height > 0) && ((rowBytes > mStride) || (height > mCapacityHeight))) {
+        // Never give up capacity in either direction, or a drag that alternates between wider and
+        //  taller would reallocate every time.
+        size_t newStride = rowBytes > mStride ? rowBytes : mStride;
+        int newCapacityHeight = height > mCapacityHeight ? height : mCapacityHeight;
+        unsigned char * newBuffer = (unsigned char *)calloc((size_t)newCapacityHeight, newStride);
+        if (!newBuffer)
+          return false;
+
+        if (mBuffer) {
+          for (int y = 0; y < keptHeight; y++)
+            memcpy(newBuffer + (y * newStride), mBuffer + (y * mStride), keptBytes);
+
+          free(mBuffer);
+        }
+
+        mBuffer = newBuffer;
+        mStride = newStride;
+        mCapacityHeight = newCapacityHeight;
+      } else if (mBuffer) {
+        // The buffer still holds whatever was there before the store last shrank.
+        if (rowBytes > keptBytes) {
+          for (int y = 0; y < keptHeight; y++)
+            memset(mBuffer + (y * mStride) + keptBytes, 0, rowBytes - keptBytes);
+        }
+
+        for (int y = keptHeight; y < height; y++)
+          memset(mBuffer + (y * mStride), 0, rowBytes);
+      }
+
+      mWidth = width;
+      mHeight = height;
+
+      ::Berkelium::Rect bounds = MakeRect(0, 0, mWidth, mHeight);
+      mDirty = IntersectRects(mDirty, bounds);
+
+      size_t kept = 0;
+      for (size_t i = 0; i < mDirtyRectCount; i++) {
+        ::Berkelium::Rect clipped = IntersectRects(mDirtyRects[i], bounds);
+        if (Area(clipped) > 0)
+          mDirtyRects[kept++] = clipped;
+      }
+      mDirtyRectCount = kept;
+
+      return true;
+    }
+
+    void NativeBackingStore::applyPaint (
+      const unsigned char * sourceBuffer, const ::Berkelium::Rect & sourceBufferRect,
+      size_t numCopyRects, const ::Berkelium::Rect * copyRects,
+      int dx, int dy, const ::Berkelium::Rect & scrollRect
+    ) {
+      if (dx || dy)
+        scroll(dx, dy, scrollRect);
+
+      for (size_t i = 0; i < numCopyRects; i++)
+        copyFrom(sourceBuffer, sourceBufferRect, copyRects[i]);
+    }
+
+    void NativeBackingStore::scroll (int dx, int dy, const ::Berkelium::Rect & scrollRect) {
+      if (!mBuffer)
+        return;
+
+      // Only the part of the scroll rect that is still inside the scroll rect after
+      //  moving is copied; the rest is exposed and will arrive as a copy rect.
+      ::Berkelium::Rect clipped = IntersectRects(scrollRect, MakeRect(0, 0, mWidth, mHeight));
+      ::Berkelium::Rect source = IntersectRects(clipped, MakeRect(clipped.mLeft - dx, clipped.mTop - dy, clipped.mWidth, clipped.mHeight));
+
+      if ((source.mWidth <= 0) || (source.mHeight <= 0))
+        return;
+
+      size_t rowBytes = (size_t)source.mWidth * BytesPerPixel;
+      unsigned char * src = mBuffer + (source.mTop * mStride) + (source.mLeft * BytesPerPixel);
+      unsigned char * dest = mBuffer + ((source.mTop + dy) * mStride) + ((source.mLeft + dx) * BytesPerPixel);
+
+      // Walk the rows in the opposite direction of the scroll so that we never
+      //  overwrite a row before it has been moved. memmove handles horizontal overlap.
+      if (dy > 0) {
+        for (int y = source.mHeight - 1; y >= 0; y--)
+          memmove(dest + (y * mStride), src + (y * mStride), rowBytes);
+      } else {
+        for (int y = 0; y < source.mHeight; y++)
+          memmove(dest + (y * mStride), src + (y * mStride), rowBytes);
+      }
+
+      markDirty(MakeRect(source.mLeft + dx, source.mTop + dy, source.mWidth, source.mHeight));
+    }
+
+    void NativeBackingStore::copyFrom (const unsigned char * sourceBuffer, const ::Berkelium::Rect & sourceBufferRect, const ::Berkelium::Rect & copyRect) {
+      if (!mBuffer || !sourceBuffer)
+        return;
+
+      // If we get a paint event after a resize, the rect can be larger than the buffer.
+      ::Berkelium::Rect rect = IntersectRects(
+        IntersectRects(copyRect, sourceBufferRect),
+        MakeRect(0, 0, mWidth, mHeight)
+      );
+
+      if ((rect.mWidth <= 0) || (rect.mHeight <= 0))
+        return;
+
+      size_t sourceStride = (size_t)sourceBufferRect.mWidth * BytesPerPixel;
+      size_t rowBytes = (size_t)rect.mWidth * BytesPerPixel;
+      const unsigned char * src = sourceBuffer +
+        ((rect.mTop - sourceBufferRect.mTop) * sourceStride) +
+        ((rect.mLeft - sourceBufferRect.mLeft) * BytesPerPixel);
+      unsigned char * dest = mBuffer + (rect.mTop * mStride) + (rect.mLeft * BytesPerPixel);
+
+      if ((rowBytes == mStride) && (rowBytes == sourceStride)) {
+        memcpy(dest, src, rowBytes * rect.mHeight);
+      } else {
+        for (int y = 0; y < rect.mHeight; y++, src += sourceStride, dest += mStride)
+          memcpy(dest, src, rowBytes);
+      }
+
+      markDirty(rect);
+    }
+
+    NativePaintAccumulator::NativePaintAccumulator ()
+      : mDirty(MakeRect(0, 0, 0, 0))
+      , mScrollRect(MakeRect(0, 0, 0, 0))
+      , mDx(0)
+      , mDy(0)
+      , mPaintCount(0) {
+    }
+
+    void NativePaintAccumulator::add (
+      size_t numCopyRects, const ::Berkelium::Rect * copyRects,
+      int dx, int dy, const ::Berkelium::Rect & scrollRect
+    ) {
+      if (dx || dy) {
+        mDx += dx;
+        mDy += dy;
+        mScrollRect = UnionRects(mScrollRect, scrollRect);
+        mDirty = UnionRects(mDirty, scrollRect);
+      }
+
+      for (size_t i = 0; i < numCopyRects; i++)
+        mDirty = UnionRects(mDirty, copyRects[i]);
+
+      mPaintCount += 1;
+    }
+
+    void NativePaintAccumulator::clip (int width, int height) {
+      ::Berkelium::Rect bounds = MakeRect(0, 0, width, height);
+      mDirty = IntersectRects(mDirty, bounds);
+      mScrollRect = IntersectRects(mScrollRect, bounds);
+    }
+
+    void NativePaintAccumulator::reset () {
+      mDirty = MakeRect(0, 0, 0, 0);
+      mScrollRect = MakeRect(0, 0, 0, 0);
+      mDx = mDy = 0;
+      mPaintCount = 0;
+    }
+
+  }}
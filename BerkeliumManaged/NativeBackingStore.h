@@ -0,0 +1,116 @@
+// NativeBackingStore.h : pixel store that paint events are applied to natively
+
+#pragma once
+
+#include "berkelium/Platform.hpp"
+#include "berkelium/Rect.hpp"
+
+#include <stddef.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // Holds a persistent 32bpp copy of a window or widget's contents.
+    // Paint events are applied straight from Berkelium's source buffer,
+    //  and scrolls are performed in place, so consumers only ever need
+    //  to upload the dirty region from a single stable buffer.
+    // The buffer only ever grows: its rows are as wide as the widest size the store has had, and
+    //  there are as many as the tallest, so shrinking and growing back again doesn't reallocate.
+    class NativeBackingStore {
+    public:
+      static const int BytesPerPixel = 4;
+      static const size_t MaxDirtyRects = 8;
+
+    private:
+      unsigned char * mBuffer;
+      int mWidth, mHeight;
+      size_t mStride;
+      int mCapacityHeight;
+      // The bounds of everything that changed, and the changes themselves as a few disjoint rects, so that two small
+      //  paints far apart don't turn into one upload of everything between them.
+      ::Berkelium::Rect mDirty;
+      ::Berkelium::Rect mDirtyRects[MaxDirtyRects];
+      size_t mDirtyRectCount;
+
+      NativeBackingStore (const NativeBackingStore &);
+      NativeBackingStore & operator= (const NativeBackingStore &);
+
+    public:
+      NativeBackingStore ();
+      ~NativeBackingStore ();
+
+      unsigned char * data () const { return mBuffer; }
+      int width () const { return mWidth; }
+      int height () const { return mHeight; }
+      // Can be more than width() * BytesPerPixel; see above.
+      size_t stride () const { return mStride; }
+      size_t byteLength () const { return mStride * mHeight; }
+      size_t capacity () const { return mStride * mCapacityHeight; }
+
+      const ::Berkelium::Rect & dirtyRect () const { return mDirty; }
+      // Non-overlapping rects that together cover every changed pixel. Once there are MaxDirtyRects of them,
+      //  a new one is merged into whichever rect that grows the least.
+      size_t dirtyRectCount () const { return mDirtyRectCount; }
+      const ::Berkelium::Rect & dirtyRect (size_t index) const { return mDirtyRects[index]; }
+      bool isDirty () const { return (mDirty.mWidth > 0) && (mDirty.mHeight > 0); }
+      void clearDirty ();
+
+      // Resizes the store, preserving the overlapping region of the old contents. Whatever the new size uncovers
+      //  is cleared. Only reallocates (and so moves data()) when the new size doesn't fit the current buffer.
+      // Returns false if that allocation fails, in which case the store keeps its old buffer and size.
+      bool resize (int width, int height);
+
+      // Applies a paint event exactly as Berkelium delivers it: first the scroll (if any),
+      //  then each copy rect from the source buffer.
+      void applyPaint (
+        const unsigned char * sourceBuffer, const ::Berkelium::Rect & sourceBufferRect,
+        size_t numCopyRects, const ::Berkelium::Rect * copyRects,
+        int dx, int dy, const ::Berkelium::Rect & scrollRect
+      );
+
+      // Moves the pixels of scrollRect by (dx, dy), clipped to scrollRect. Safe for overlapping source and destination.
+      void scroll (int dx, int dy, const ::Berkelium::Rect & scrollRect);
+
+      // Copies copyRect out of a tightly packed source buffer that covers sourceBufferRect.
+      void copyFrom (const unsigned char * sourceBuffer, const ::Berkelium::Rect & sourceBufferRect, const ::Berkelium::Rect & copyRect);
+
+      void markDirty (const ::Berkelium::Rect & rect);
+    };
+
+    // Accumulates the paint events a window or widget receives during a single update,
+    //  so that they can be dispatched as one merged paint once the pump returns.
+    // The pixels themselves live in a NativeBackingStore; this only tracks what changed.
+    class NativePaintAccumulator {
+      ::Berkelium::Rect mDirty;
+      ::Berkelium::Rect mScrollRect;
+      int mDx, mDy;
+      int mPaintCount;
+
+    public:
+      NativePaintAccumulator ();
+
+      bool isPending () const { return mPaintCount > 0; }
+      int paintCount () const { return mPaintCount; }
+      int dx () const { return mDx; }
+      int dy () const { return mDy; }
+      const ::Berkelium::Rect & scrollRect () const { return mScrollRect; }
+      const ::Berkelium::Rect & dirtyRect () const { return mDirty; }
+
+      // Records a paint event. The entire scroll rect is treated as dirty, so the
+      //  merged paint is correct whether or not the consumer re-applies the scroll.
+      void add (
+        size_t numCopyRects, const ::Berkelium::Rect * copyRects,
+        int dx, int dy, const ::Berkelium::Rect & scrollRect
+      );
+
+      // Clips the accumulated region to the specified size (the store may have been resized since).
+      void clip (int width, int height);
+
+      void reset ();
+    };
+
+    ::Berkelium::Rect MakeRect (int left, int top, int width, int height);
+    ::Berkelium::Rect IntersectRects (const ::Berkelium::Rect & a, const ::Berkelium::Rect & b);
+    ::Berkelium::Rect UnionRects (const ::Berkelium::Rect & a, const ::Berkelium::Rect & b);
+
+  }}
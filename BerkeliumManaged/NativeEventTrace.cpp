@@ -0,0 +1,652 @@
+// NativeEventTrace.cpp : compiled as native code; see NativeEventTrace.h
+
+#include "NativeEventTrace.h"
+
+#include <string.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    namespace {
+      // Buffered records go out once there's this much of them.
+      const size_t FlushThreshold = 1024 * 1024;
+      // Keeps a corrupt trace from asking for an absurd pixel buffer: nothing paints more than an 8K display.
+      const unsigned long long MaxPaintPixels = 7680ULL * 4320ULL;
+
+      class TraceLock {
+        CRITICAL_SECTION & mLock;
+
+        TraceLock (const TraceLock &);
+        TraceLock & operator= (const TraceLock &);
+
+      public:
+        TraceLock (CRITICAL_SECTION & lock)
+          : mLock(lock) {
+          EnterCriticalSection(&mLock);
+        }
+
+        ~TraceLock () {
+          LeaveCriticalSection(&mLock);
+        }
+      };
+
+      bool IsPaint (int kind) {
+        return (kind == TracePaint) || (kind == TraceWidgetPaint);
+      }
+
+      void AppendVarint (std::vector<unsigned char> & output, unsigned long long value) {
+        while (value >= 0x80) {
+          output.push_back((unsigned char)(value | 0x80));
+          value >>= 7;
+        }
+        output.push_back((unsigned char)value);
+      }
+
+      void AppendSigned (std::vector<unsigned char> & output, long long value) {
+        AppendVarint(output, ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+      }
+
+      void AppendRect (std::vector<unsigned char> & output, const ::Berkelium::Rect & rect) {
+        AppendSigned(output, rect.mLeft);
+        AppendSigned(output, rect.mTop);
+        AppendSigned(output, rect.mWidth);
+        AppendSigned(output, rect.mHeight);
+      }
+
+      void AppendPixels (std::vector<unsigned char> & output, const unsigned int * pixels, size_t count) {
+        size_t position = output.size();
+        output.resize(position + (count * 4));
+        memcpy(&output[position], pixels, count * 4);
+      }
+
+      // A run is worth a packet of its own once it's three pixels long.
+      void AppendCompressedPixels (std::vector<unsigned char> & output, const unsigned int * pixels, size_t count) {
+        size_t i = 0;
+
+        while (i < count) {
+          size_t run = 1;
+          while ((i + run < count) && (pixels[i + run] == pixels[i]))
+            run++;
+
+          if (run >= 3) {
+            AppendVarint(output, ((unsigned long long)(run - 1) << 1) | 1);
+            AppendPixels(output, pixels + i, 1);
+            i += run;
+            continue;
+          }
+
+          size_t start = i;
+          while ((i < count) && !((i + 2 < count) && (pixels[i] == pixels[i + 1]) && (pixels[i] == pixels[i + 2])))
+            i++;
+
+          AppendVarint(output, (unsigned long long)(i - start - 1) << 1);
+          AppendPixels(output, pixels + start, i - start);
+        }
+      }
+
+      bool ReadVarint (const unsigned char * data, size_t end, size_t & position, unsigned long long & result) {
+        result = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+          if (position >= end)
+            return false;
+
+          unsigned char byte = data[position++];
+          result |= (unsigned long long)(byte & 0x7F) << shift;
+          if (!(byte & 0x80))
+            return true;
+        }
+
+        return false;
+      }
+
+      bool ReadSigned (const unsigned char * data, size_t end, size_t & position, int & result) {
+        unsigned long long value;
+        if (!ReadVarint(data, end, position, value))
+          return false;
+
+        long long decoded = (long long)(value >> 1) ^ -(long long)(value & 1);
+        if ((decoded < INT_MIN) || (decoded > INT_MAX))
+          return false;
+
+        result = (int)decoded;
+        return true;
+      }
+
+      bool ReadRect (const unsigned char * data, size_t end, size_t & position, ::Berkelium::Rect & rect) {
+        return ReadSigned(data, end, position, rect.mLeft) &&
+          ReadSigned(data, end, position, rect.mTop) &&
+          ReadSigned(data, end, position, rect.mWidth) &&
+          ReadSigned(data, end, position, rect.mHeight);
+      }
+
+      bool ReadCount (const unsigned char * data, size_t end, size_t & position, int maximum, int & result) {
+        if (position >= end)
+          return false;
+
+        result = data[position++];
+        return result <= maximum;
+      }
+
+      bool Contains (const ::Berkelium::Rect & outer, const ::Berkelium::Rect & inner) {
+        return (inner.mWidth >= 0) && (inner.mHeight >= 0) &&
+          (inner.mLeft >= outer.mLeft) && (inner.mTop >= outer.mTop) &&
+          ((long long)inner.mLeft + inner.mWidth <= (long long)outer.mLeft + outer.mWidth) &&
+          ((long long)inner.mTop + inner.mHeight <= (long long)outer.mTop + outer.mHeight);
+      }
+    }
+
+    NativeTraceRecord::NativeTraceRecord (int kind, int widget)
+      : Kind(kind)
+      , Time(0)
+      , Widget(widget)
+      , IntCount(0)
+      , NarrowCount(0)
+      , WideCount(0)
+      , Pixels(0)
+      , Dx(0)
+      , Dy(0)
+      , CopyRectCount(0)
+      , CopyRects(0) {
+      SourceRect.mLeft = SourceRect.mTop = SourceRect.mWidth = SourceRect.mHeight = 0;
+      ScrollRect = SourceRect;
+    }
+
+    void NativeTraceRecord::addInt (int value) {
+      if (IntCount < MaxInts)
+        Ints[IntCount++] = value;
+    }
+
+    void NativeTraceRecord::addNarrow (const char * text, size_t length) {
+      if (NarrowCount < MaxStrings) {
+        Narrow[NarrowCount] = text;
+        NarrowLength[NarrowCount++] = text ? length : 0;
+      }
+    }
+
+    void NativeTraceRecord::addWide (const wchar_t * text, size_t length) {
+      if (WideCount < MaxStrings) {
+        Wide[WideCount] = text;
+        WideLength[WideCount++] = text ? length : 0;
+      }
+    }
+
+    void NativeTraceRecord::setPaint (const unsigned char * pixels, const ::Berkelium::Rect & sourceRect, size_t copyRectCount, const ::Berkelium::Rect * copyRects, int dx, int dy, const ::Berkelium::Rect & scrollRect) {
+      Pixels = pixels;
+      SourceRect = sourceRect;
+      CopyRectCount = copyRectCount;
+      CopyRects = copyRects;
+      Dx = dx;
+      Dy = dy;
+      ScrollRect = scrollRect;
+    }
+
+    const char NativeTraceWriter::Magic[8] = { 'B', 'K', 'T', 'R', 'A', 'C', 'E', '1' };
+
+    NativeTraceWriter::NativeTraceWriter ()
+      : mFile(INVALID_HANDLE_VALUE)
+      , mPixels(TracePixelsNone)
+      , mNextWidget(1)
+      , mRecordCount(0)
+      , mBytesWritten(0)
+      , mFailed(false) {
+      InitializeCriticalSection(&mLock);
+      QueryPerformanceFrequency(&mFrequency);
+      QueryPerformanceCounter(&mLastTime);
+    }
+
+    NativeTraceWriter::~NativeTraceWriter () {
+      flush();
+
+      if (mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+
+      DeleteCriticalSection(&mLock);
+    }
+
+    NativeTraceWriter * NativeTraceWriter::create (const wchar_t * filename, NativeTracePixels pixels) {
+      HANDLE file = CreateFileW(filename, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+      if (file == INVALID_HANDLE_VALUE)
+        return 0;
+
+      NativeTraceWriter * result = new NativeTraceWriter();
+      result->mFile = file;
+      result->mPixels = pixels;
+      result->mBuffer.reserve(FlushThreshold + (FlushThreshold / 4));
+
+      result->mBuffer.insert(result->mBuffer.end(), Magic, Magic + sizeof(Magic));
+      unsigned int header[2] = { Version, 0 };
+      result->mBuffer.insert(result->mBuffer.end(), (const unsigned char *)header, (const unsigned char *)(header + 2));
+
+      return result;
+    }
+
+    int NativeTraceWriter::widgetId (const void * widget, bool forget) {
+      TraceLock lock (mLock);
+
+      std::map<const void *, int>::iterator iter = mWidgets.find(widget);
+      int result;
+
+      if (iter != mWidgets.end()) {
+        result = iter->second;
+        if (forget)
+          mWidgets.erase(iter);
+      } else {
+        result = mNextWidget++;
+        if (!forget)
+          mWidgets[widget] = result;
+      }
+
+      return result;
+    }
+
+    void NativeTraceWriter::encodePixels (const NativeTraceRecord & record) {
+      if (!record.Pixels || (mPixels == TracePixelsNone) || (record.SourceRect.mWidth <= 0) || (record.SourceRect.mHeight <= 0)) {
+        mPayload.push_back((unsigned char)TracePixelsNone);
+        return;
+      }
+
+      mPayload.push_back((unsigned char)mPixels);
+
+      const unsigned int * source = (const unsigned int *)record.Pixels;
+      const ::Berkelium::Rect & sourceRect = record.SourceRect;
+      std::vector<unsigned int> & rectPixels = mRectPixels;
+
+      for (size_t i = 0; i < record.CopyRectCount; i++) {
+        const ::Berkelium::Rect & rect = record.CopyRects[i];
+
+        // The reader insists on this, so the rect was clipped when it was recorded.
+        if (!Contains(sourceRect, rect))
+          continue;
+
+        rectPixels.resize((size_t)rect.mWidth * rect.mHeight);
+        for (int y = 0; y < rect.mHeight; y++) {
+          const unsigned int * row = source + ((size_t)(rect.mTop - sourceRect.mTop + y) * sourceRect.mWidth) + (rect.mLeft - sourceRect.mLeft);
+          if (rect.mWidth > 0)
+            memcpy(&rectPixels[(size_t)y * rect.mWidth], row, (size_t)rect.mWidth * 4);
+        }
+
+        if (rectPixels.empty())
+          continue;
+
+        if (mPixels == TracePixelsRaw)
+          AppendPixels(mPayload, &rectPixels[0], rectPixels.size());
+        else
+          AppendCompressedPixels(mPayload, &rectPixels[0], rectPixels.size());
+      }
+    }
+
+    void NativeTraceWriter::write (const NativeTraceRecord & record) {
+      TraceLock lock (mLock);
+
+      if (mFile == INVALID_HANDLE_VALUE)
+        return;
+
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      unsigned long long delta = (mRecordCount == 0) ? 0 : (unsigned long long)((double)(now.QuadPart - mLastTime.QuadPart) * 1000000.0 / (double)mFrequency.QuadPart);
+      mLastTime = now;
+
+      mPayload.clear();
+      AppendVarint(mPayload, (unsigned long long)record.Widget);
+
+      mPayload.push_back((unsigned char)record.IntCount);
+      for (int i = 0; i < record.IntCount; i++)
+        AppendSigned(mPayload, record.Ints[i]);
+
+      mPayload.push_back((unsigned char)record.NarrowCount);
+      for (int i = 0; i < record.NarrowCount; i++) {
+        AppendVarint(mPayload, record.NarrowLength[i]);
+        if (record.NarrowLength[i] > 0)
+          mPayload.insert(mPayload.end(), record.Narrow[i], record.Narrow[i] + record.NarrowLength[i]);
+      }
+
+      mPayload.push_back((unsigned char)record.WideCount);
+      for (int i = 0; i < record.WideCount; i++) {
+        AppendVarint(mPayload, record.WideLength[i]);
+        for (size_t j = 0; j < record.WideLength[i]; j++) {
+          unsigned short unit = (unsigned short)record.Wide[i][j];
+          mPayload.push_back((unsigned char)unit);
+          mPayload.push_back((unsigned char)(unit >> 8));
+        }
+      }
+
+      if (IsPaint(record.Kind)) {
+        AppendRect(mPayload, record.SourceRect);
+        AppendSigned(mPayload, record.Dx);
+        AppendSigned(mPayload, record.Dy);
+        AppendRect(mPayload, record.ScrollRect);
+
+        size_t copyRectCount = 0;
+        for (size_t i = 0; i < record.CopyRectCount; i++) {
+          if (Contains(record.SourceRect, record.CopyRects[i]))
+            copyRectCount++;
+        }
+
+        AppendVarint(mPayload, copyRectCount);
+        for (size_t i = 0; i < record.CopyRectCount; i++) {
+          if (Contains(record.SourceRect, record.CopyRects[i]))
+            AppendRect(mPayload, record.CopyRects[i]);
+        }
+
+        encodePixels(record);
+      }
+
+      mBuffer.push_back((unsigned char)record.Kind);
+      AppendVarint(mBuffer, delta);
+      AppendVarint(mBuffer, mPayload.size());
+      mBuffer.insert(mBuffer.end(), mPayload.begin(), mPayload.end());
+      mRecordCount += 1;
+
+      if (mBuffer.size() >= FlushThreshold)
+        flushBuffer();
+    }
+
+    bool NativeTraceWriter::flushBuffer () {
+      size_t position = 0;
+
+      while (!mFailed && (position < mBuffer.size())) {
+        DWORD written = 0;
+        DWORD chunk = (DWORD)(((mBuffer.size() - position) > 0x10000000) ? 0x10000000 : (mBuffer.size() - position));
+
+        if (!WriteFile(mFile, &mBuffer[position], chunk, &written, 0) || (written == 0))
+          mFailed = true;
+
+        position += written;
+        mBytesWritten += written;
+      }
+
+      mBuffer.clear();
+      return !mFailed;
+    }
+
+    bool NativeTraceWriter::flush () {
+      TraceLock lock (mLock);
+
+      if (mFile == INVALID_HANDLE_VALUE)
+        return false;
+
+      return flushBuffer();
+    }
+
+    long long NativeTraceWriter::recordCount () {
+      TraceLock lock (mLock);
+      return mRecordCount;
+    }
+
+    long long NativeTraceWriter::bytesWritten () {
+      TraceLock lock (mLock);
+      return mBytesWritten + (long long)mBuffer.size();
+    }
+
+    NativeTraceReader::NativeTraceReader ()
+      : mFile(INVALID_HANDLE_VALUE)
+      , mMapping(0)
+      , mView(0)
+      , mSize(0)
+      , mPosition(0)
+      , mRecordCount(0)
+      , mDuration(0)
+      , mTime(0) {
+    }
+
+    NativeTraceReader::~NativeTraceReader () {
+      if (mView)
+        UnmapViewOfFile(mView);
+      if (mMapping)
+        CloseHandle(mMapping);
+      if (mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+    }
+
+    NativeTraceReader * NativeTraceReader::open (const wchar_t * filename) {
+      NativeTraceReader * result = new NativeTraceReader();
+
+      result->mFile = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+      LARGE_INTEGER size;
+      if ((result->mFile == INVALID_HANDLE_VALUE) || !GetFileSizeEx(result->mFile, &size) || (size.QuadPart < 16) || ((unsigned long long)size.QuadPart > (size_t)-1)) {
+        delete result;
+        return 0;
+      }
+
+      result->mSize = (size_t)size.QuadPart;
+      result->mMapping = CreateFileMappingW(result->mFile, 0, PAGE_READONLY, 0, 0, 0);
+      if (result->mMapping)
+        result->mView = (const unsigned char *)MapViewOfFile(result->mMapping, FILE_MAP_READ, 0, 0, 0);
+
+      if (!result->mView || !result->validate()) {
+        delete result;
+        return 0;
+      }
+
+      return result;
+    }
+
+    bool NativeTraceReader::validate () {
+      if (memcmp(mView, NativeTraceWriter::Magic, sizeof(NativeTraceWriter::Magic)) != 0)
+        return false;
+
+      unsigned int version;
+      memcpy(&version, mView + 8, sizeof(version));
+      if (version != NativeTraceWriter::Version)
+        return false;
+
+      size_t position = 16;
+      mTime = 0;
+      mRecordCount = 0;
+
+      while (position < mSize) {
+        if (!decode(position, 0))
+          return false;
+        mRecordCount += 1;
+      }
+
+      mDuration = mTime;
+      rewind();
+      return true;
+    }
+
+    void NativeTraceReader::rewind () {
+      mPosition = 16;
+      mTime = 0;
+    }
+
+    bool NativeTraceReader::next (NativeTraceRecord & record) {
+      if (mPosition >= mSize)
+        return false;
+
+      return decode(mPosition, &record);
+    }
+
+    // Decodes the record at position, moving past it. With no record to fill in, it only checks it.
+    bool NativeTraceReader::decode (size_t & position, NativeTraceRecord * record) {
+      const unsigned char * data = mView;
+      size_t p = position;
+
+      if (p >= mSize)
+        return false;
+
+      int kind = data[p++];
+      unsigned long long delta, length, widget;
+      if (!ReadVarint(data, mSize, p, delta) || !ReadVarint(data, mSize, p, length) || (length > mSize - p))
+        return false;
+
+      size_t end = p + (size_t)length;
+      NativeTraceRecord scratch (kind);
+      NativeTraceRecord & result = record ? *record : scratch;
+      result = NativeTraceRecord(kind);
+
+      if (!ReadVarint(data, end, p, widget) || (widget > INT_MAX))
+        return false;
+      result.Widget = (int)widget;
+
+      if (!ReadCount(data, end, p, NativeTraceRecord::MaxInts, result.IntCount))
+        return false;
+      for (int i = 0; i < result.IntCount; i++) {
+        if (!ReadSigned(data, end, p, result.Ints[i]))
+          return false;
+      }
+
+      if (!ReadCount(data, end, p, NativeTraceRecord::MaxStrings, result.NarrowCount))
+        return false;
+      for (int i = 0; i < result.NarrowCount; i++) {
+        unsigned long long textLength;
+        if (!ReadVarint(data, end, p, textLength) || (textLength > end - p))
+          return false;
+
+        result.Narrow[i] = (const char *)(data + p);
+        result.NarrowLength[i] = (size_t)textLength;
+        p += (size_t)textLength;
+      }
+
+      if (!ReadCount(data, end, p, NativeTraceRecord::MaxStrings, result.WideCount))
+        return false;
+      for (int i = 0; i < result.WideCount; i++) {
+        unsigned long long textLength;
+        if (!ReadVarint(data, end, p, textLength) || (textLength > (end - p) / 2))
+          return false;
+
+        // The mapping makes no promises about alignment, so strings are copied out.
+        std::vector<wchar_t> & text = mWide[i];
+        text.resize((size_t)textLength + 1);
+        for (size_t j = 0; j < textLength; j++)
+          text[j] = (wchar_t)(data[p + (j * 2)] | (data[p + (j * 2) + 1] << 8));
+        text[(size_t)textLength] = 0;
+
+        result.Wide[i] = &text[0];
+        result.WideLength[i] = (size_t)textLength;
+        p += (size_t)textLength * 2;
+      }
+
+      if (IsPaint(kind)) {
+        unsigned long long copyRectCount;
+        if (!ReadRect(data, end, p, result.SourceRect) ||
+            !ReadSigned(data, end, p, result.Dx) || !ReadSigned(data, end, p, result.Dy) ||
+            !ReadRect(data, end, p, result.ScrollRect) ||
+            !ReadVarint(data, end, p, copyRectCount) || (copyRectCount > (end - p) / 4))
+          return false;
+
+        mCopyRects.resize((size_t)copyRectCount);
+        for (size_t i = 0; i < mCopyRects.size(); i++) {
+          if (!ReadRect(data, end, p, mCopyRects[i]) || !Contains(result.SourceRect, mCopyRects[i]))
+            return false;
+        }
+
+        result.CopyRectCount = mCopyRects.size();
+        result.CopyRects = mCopyRects.empty() ? 0 : &mCopyRects[0];
+
+        if (p >= end)
+          return false;
+        int pixels = data[p++];
+
+        if ((pixels != TracePixelsNone) && (pixels != TracePixelsRaw) && (pixels != TracePixelsCompressed))
+          return false;
+
+        const ::Berkelium::Rect & sourceRect = result.SourceRect;
+        unsigned long long pixelCount = (unsigned long long)sourceRect.mWidth * (unsigned long long)sourceRect.mHeight;
+        bool empty = (sourceRect.mWidth <= 0) || (sourceRect.mHeight <= 0);
+        if (empty ? (pixels != TracePixelsNone) : (pixelCount > MaxPaintPixels))
+          return false;
+
+        // Raw pixels are stored as they are, so those a record claims have to be in the file. Runs can cover
+        //  any number of pixels in a few bytes, which is what MaxPaintPixels is for.
+        if (pixels == TracePixelsRaw) {
+          unsigned long long copyPixels = 0;
+          for (size_t i = 0; i < mCopyRects.size(); i++)
+            copyPixels += (unsigned long long)mCopyRects[i].mWidth * mCopyRects[i].mHeight;
+          if (copyPixels > (end - p) / 4)
+            return false;
+        }
+
+        if (!empty) {
+          // What's outside the copy rects was never recorded, and consumers never read it.
+          mPixels.resize((size_t)pixelCount * 4);
+          unsigned int * target = (unsigned int *)&mPixels[0];
+
+          for (size_t i = 0; (pixels != TracePixelsNone) && (i < mCopyRects.size()); i++) {
+            const ::Berkelium::Rect & rect = mCopyRects[i];
+            size_t count = (size_t)rect.mWidth * rect.mHeight;
+            size_t filled = 0;
+
+            while (filled < count) {
+              unsigned long long header = ((unsigned long long)(count - filled) - 1) << 1;
+              if ((pixels == TracePixelsCompressed) && !ReadVarint(data, end, p, header))
+                return false;
+
+              unsigned long long packet = (header >> 1) + 1;
+              bool run = (header & 1) != 0;
+              if ((packet > count - filled) || ((run ? 4 : packet * 4) > end - p))
+                return false;
+
+              for (size_t j = 0; j < packet; j++, filled++) {
+                size_t x = rect.mLeft - sourceRect.mLeft + (filled % rect.mWidth);
+                size_t y = rect.mTop - sourceRect.mTop + (filled / rect.mWidth);
+                memcpy(&target[(y * sourceRect.mWidth) + x], data + p + (run ? 0 : j * 4), 4);
+              }
+
+              p += run ? 4 : (size_t)packet * 4;
+            }
+          }
+
+          result.Pixels = &mPixels[0];
+        }
+      }
+
+      mTime += (long long)delta;
+      result.Time = mTime;
+      position = end;
+      return true;
+    }
+
+    NativeReplayWidget::NativeReplayWidget (int id, const ::Berkelium::Rect & rect)
+      : mId(id)
+      , mRect(rect)
+      , mFocused(false) {
+    }
+
+    void NativeReplayWidget::setSize (int width, int height) {
+      mRect.mWidth = width;
+      mRect.mHeight = height;
+    }
+
+    int NativeReplayWidget::getId () const {
+      return mId;
+    }
+
+    void NativeReplayWidget::focus () {
+      mFocused = true;
+    }
+
+    void NativeReplayWidget::unfocus () {
+      mFocused = false;
+    }
+
+    bool NativeReplayWidget::hasFocus () const {
+      return mFocused;
+    }
+
+    void NativeReplayWidget::mouseMoved (int xPos, int yPos) {
+    }
+
+    void NativeReplayWidget::mouseButton (unsigned int buttonID, bool down) {
+    }
+
+    void NativeReplayWidget::mouseWheel (int xScroll, int yScroll) {
+    }
+
+    void NativeReplayWidget::textEvent (const wchar_t * evt, size_t evtLength) {
+    }
+
+    void NativeReplayWidget::keyEvent (bool pressed, int mods, int vk_code, int scancode) {
+    }
+
+    ::Berkelium::Rect NativeReplayWidget::getRect () const {
+      return mRect;
+    }
+
+    void NativeReplayWidget::setPos (int x, int y) {
+      mRect.mLeft = x;
+      mRect.mTop = y;
+    }
+
+  }}
@@ -0,0 +1,194 @@
+// NativeEventTrace.h : records WindowDelegate callbacks into a compact binary trace, and reads them back
+
+#pragma once
+
+#include <windows.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include "berkelium/Rect.hpp"
+#include "berkelium/Widget.hpp"
+
+#include <map>
+#include <vector>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // A trace is an 8-byte magic, a 4-byte version and a 4-byte reserved field, followed by records:
+    //
+    //   kind (1 byte), microseconds since the previous record (varint), payload length (varint), payload
+    //
+    // Every payload has the same layout, so a reader can skip kinds it doesn't know:
+    //
+    //   widget (varint; 0 for the window itself), then a count byte and that many
+    //   zigzag varints, UTF-8 strings (varint length + bytes) and UTF-16 strings (varint length + code units),
+    //   then, for paints only, the source rect, dx, dy, the scroll rect, the copy rects and the pixels.
+    //
+    // Widgets are numbered in the order the trace first sees them. Pixels are stored for the copy rects
+    //  only, row by row: raw, or as packets whose varint header is ((count - 1) << 1) | isRun, followed
+    //  by one pixel for a run or count pixels for a literal.
+    enum NativeTraceKind {
+      TraceWindowResized = 1,
+      TracePaint,
+      TraceWidgetPaint,
+      TraceWidgetCreated,
+      TraceWidgetDestroyed,
+      TraceWidgetMoved,
+      TraceWidgetResized,
+      TraceAddressBarChanged,
+      TraceStartLoading,
+      TraceLoad,
+      TraceLoadingStateChanged,
+      TraceTitleChanged,
+      TraceTooltipChanged,
+      TraceConsoleMessage,
+      TraceScriptAlert,
+      TraceNavigationRequested,
+      TraceProvisionalLoadError,
+      TraceExternalHost,
+      TraceShowContextMenu,
+      TraceCrashed,
+      TraceCrashedWorker,
+      TraceCrashedPlugin,
+      TraceUnresponsive,
+      TraceResponsive
+    };
+
+    enum NativeTracePixels {
+      TracePixelsNone,
+      TracePixelsRaw,
+      TracePixelsCompressed
+    };
+
+    // One record's worth of fields. Which ones a kind uses is up to the code that writes and replays it.
+    struct NativeTraceRecord {
+      static const int MaxInts = 6;
+      static const int MaxStrings = 4;
+
+      int Kind;
+      long long Time;
+      int Widget;
+
+      int IntCount;
+      int Ints[MaxInts];
+      int NarrowCount;
+      const char * Narrow[MaxStrings];
+      size_t NarrowLength[MaxStrings];
+      int WideCount;
+      const wchar_t * Wide[MaxStrings];
+      size_t WideLength[MaxStrings];
+
+      // Paints only. When reading, Pixels covers SourceRect, tightly packed, unless SourceRect is empty. Pixels
+      //  the trace doesn't have (outside the copy rects, or all of them) are left over from earlier paints.
+      const unsigned char * Pixels;
+      ::Berkelium::Rect SourceRect, ScrollRect;
+      int Dx, Dy;
+      size_t CopyRectCount;
+      const ::Berkelium::Rect * CopyRects;
+
+      explicit NativeTraceRecord (int kind, int widget = 0);
+
+      void addInt (int value);
+      void addNarrow (const char * text, size_t length);
+      void addWide (const wchar_t * text, size_t length);
+      void setPaint (const unsigned char * pixels, const ::Berkelium::Rect & sourceRect, size_t copyRectCount, const ::Berkelium::Rect * copyRects, int dx, int dy, const ::Berkelium::Rect & scrollRect);
+    };
+
+    // Appends records to a file through a buffer. Safe to use from any thread.
+    class NativeTraceWriter {
+      CRITICAL_SECTION mLock;
+      HANDLE mFile;
+      NativeTracePixels mPixels;
+      std::vector<unsigned char> mBuffer, mPayload;
+      std::vector<unsigned int> mRectPixels;
+      std::map<const void *, int> mWidgets;
+      int mNextWidget;
+      LARGE_INTEGER mFrequency, mLastTime;
+      long long mRecordCount, mBytesWritten;
+      bool mFailed;
+
+      NativeTraceWriter ();
+      NativeTraceWriter (const NativeTraceWriter &);
+      NativeTraceWriter & operator= (const NativeTraceWriter &);
+
+      // Both of these expect mLock to be held.
+      void encodePixels (const NativeTraceRecord & record);
+      bool flushBuffer ();
+
+    public:
+      static const char Magic[8];
+      static const unsigned int Version = 1;
+
+      // Creates (or replaces) the file. Returns 0 if it can't be created.
+      static NativeTraceWriter * create (const wchar_t * filename, NativeTracePixels pixels);
+      ~NativeTraceWriter ();
+
+      // Returns the number the trace uses for a widget, assigning one if it's new. Forgetting a
+      //  widget (once it's destroyed) means a new widget at the same address gets a new number.
+      int widgetId (const void * widget, bool forget = false);
+
+      void write (const NativeTraceRecord & record);
+      // Writes out anything buffered. Returns false if the file couldn't be written, now or earlier.
+      bool flush ();
+
+      long long recordCount ();
+      long long bytesWritten ();
+    };
+
+    // A trace mapped into memory. It is checked once when it's opened, so reading it never goes out of bounds.
+    class NativeTraceReader {
+      HANDLE mFile, mMapping;
+      const unsigned char * mView;
+      size_t mSize, mPosition;
+      long long mRecordCount, mDuration, mTime;
+      std::vector< ::Berkelium::Rect> mCopyRects;
+      std::vector<unsigned char> mPixels;
+      std::vector<wchar_t> mWide[NativeTraceRecord::MaxStrings];
+
+      NativeTraceReader ();
+      NativeTraceReader (const NativeTraceReader &);
+      NativeTraceReader & operator= (const NativeTraceReader &);
+
+      bool validate ();
+      bool decode (size_t & position, NativeTraceRecord * record);
+
+    public:
+      static NativeTraceReader * open (const wchar_t * filename);
+      ~NativeTraceReader ();
+
+      long long recordCount () const { return mRecordCount; }
+      // Microseconds from the first record to the last.
+      long long duration () const { return mDuration; }
+
+      void rewind ();
+      // Reads the next record. Its strings, rects and pixels stay valid until the next call.
+      bool next (NativeTraceRecord & record);
+    };
+
+    // Stands in for the native widgets of a trace being replayed, so that WindowDelegateWrapper
+    //  can treat them like real ones. Input sent to them goes nowhere.
+    class NativeReplayWidget : public ::Berkelium::Widget {
+      int mId;
+      ::Berkelium::Rect mRect;
+      bool mFocused;
+
+    public:
+      NativeReplayWidget (int id, const ::Berkelium::Rect & rect);
+
+      void setSize (int width, int height);
+
+      virtual int getId () const;
+      virtual void focus ();
+      virtual void unfocus ();
+      virtual bool hasFocus () const;
+      virtual void mouseMoved (int xPos, int yPos);
+      virtual void mouseButton (unsigned int buttonID, bool down);
+      virtual void mouseWheel (int xScroll, int yScroll);
+      virtual void textEvent (const wchar_t * evt, size_t evtLength);
+      virtual void keyEvent (bool pressed, int mods, int vk_code, int scancode);
+      virtual ::Berkelium::Rect getRect () const;
+      virtual void setPos (int x, int y);
+    };
+
+  }}
@@ -0,0 +1,78 @@
+// NativeFrameCapture.cpp : compiled as native code; see NativeFrameCapture.h
+
+#include "NativeFrameCapture.h"
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    NativeCapturedFrame::NativeCapturedFrame ()
+      : mBuffer(0)
+      , mCapacity(0)
+      , mWidth(0)
+      , mHeight(0) {
+    }
+
+    NativeCapturedFrame::~NativeCapturedFrame () {
+      if (mBuffer)
+        free(mBuffer);
+
+      mBuffer = 0;
+    }
+
+    bool NativeCapturedFrame::copyFrom (const NativeBackingStore & store) {
+      size_t rowLength = (size_t)store.width() * NativeBackingStore::BytesPerPixel;
+      size_t length = rowLength * store.height();
+
+      if (length > mCapacity) {
+        unsigned char * newBuffer = (unsigned char *)realloc(mBuffer, length);
+        if (!newBuffer) {
+          mWidth = mHeight = 0;
+          return false;
+        }
+
+        mBuffer = newBuffer;
+        mCapacity = length;
+      }
+
+      mWidth = store.width();
+      mHeight = store.height();
+
+      if (length == 0)
+        return true;
+
+      if (store.stride() == rowLength) {
+        memcpy(mBuffer, store.data(), length);
+      } else {
+        for (int y = 0; y < mHeight; y++)
+          memcpy(mBuffer + (rowLength * y), store.data() + (store.stride() * y), rowLength);
+      }
+
+      return true;
+    }
+
+    bool NativeCapturedFrame::writeRaw (const wchar_t * filename) const {
+      HANDLE file = CreateFileW(filename, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+      if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+      bool result = true;
+      const unsigned char * position = mBuffer;
+      size_t remaining = byteLength();
+
+      while (result && (remaining > 0)) {
+        DWORD chunk = (remaining > 0x40000000) ? 0x40000000 : (DWORD)remaining;
+        DWORD written = 0;
+        result = WriteFile(file, position, chunk, &written, 0) && (written == chunk);
+        position += written;
+        remaining -= written;
+      }
+
+      CloseHandle(file);
+      return result;
+    }
+
+  }}
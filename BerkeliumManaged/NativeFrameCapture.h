@@ -0,0 +1,39 @@
+// NativeFrameCapture.h : frames snapshotted out of a backing store, waiting to be encoded
+
+#pragma once
+
+#include "NativeBackingStore.h"
+
+#include <stddef.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // A tightly packed 32bpp copy of a backing store. The buffer only ever grows, so a frame
+    //  that is reused for every snapshot of a window stops allocating once it has seen its largest size.
+    class NativeCapturedFrame {
+      unsigned char * mBuffer;
+      size_t mCapacity;
+      int mWidth, mHeight;
+
+      NativeCapturedFrame (const NativeCapturedFrame &);
+      NativeCapturedFrame & operator= (const NativeCapturedFrame &);
+
+    public:
+      NativeCapturedFrame ();
+      ~NativeCapturedFrame ();
+
+      const unsigned char * data () const { return mBuffer; }
+      int width () const { return mWidth; }
+      int height () const { return mHeight; }
+      size_t stride () const { return (size_t)mWidth * NativeBackingStore::BytesPerPixel; }
+      size_t byteLength () const { return stride() * mHeight; }
+
+      // Copies the whole store. Returns false (leaving the frame empty) if the buffer can't be grown.
+      bool copyFrom (const NativeBackingStore & store);
+
+      // Writes the pixels, top row first, with no header. Returns false if the file can't be written.
+      bool writeRaw (const wchar_t * filename) const;
+    };
+
+  }}
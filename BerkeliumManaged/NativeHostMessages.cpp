@@ -0,0 +1,296 @@
+// NativeHostMessages.cpp : compiled as native code; see NativeHostMessages.h
+
+#include "NativeHostMessages.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+
+namespace Berkelium {
+  namespace Managed {
+
+    namespace {
+      const wchar_t BridgeMarker = 0x1F;
+      // Longer than any number JavaScript prints.
+      const size_t MaxNumberLength = 64;
+
+      NativeHostNameTable Names;
+
+      unsigned int HashName (const wchar_t * name, size_t length) {
+        unsigned int hash = 2166136261u;
+        for (size_t i = 0; i < length; i++) {
+          hash ^= (unsigned int)name[i];
+          hash *= 16777619u;
+        }
+
+        return hash;
+      }
+
+      // Reads the "<length>:" that precedes a name or argument, checking that the content fits in what's left.
+      bool ReadLength (const wchar_t * message, size_t length, size_t & position, size_t & result) {
+        size_t start = position;
+        result = 0;
+
+        while ((position < length) && (message[position] >= '0') && (message[position] <= '9')) {
+          result = (result * 10) + (message[position++] - '0');
+          if (result > length)
+            return false;
+        }
+
+        if ((position == start) || (position >= length) || (message[position] != ':'))
+          return false;
+
+        position += 1;
+        return result <= length - position;
+      }
+
+      bool Matches (const char * text, size_t length, const char * expected) {
+        return (strlen(expected) == length) && (memcmp(text, expected, length) == 0);
+      }
+
+      bool ParseNumber (const wchar_t * text, size_t length, double & result) {
+        char buffer[MaxNumberLength + 1];
+        if ((length == 0) || (length > MaxNumberLength))
+          return false;
+
+        for (size_t i = 0; i < length; i++) {
+          if (text[i] > 0x7F)
+            return false;
+          buffer[i] = (char)text[i];
+        }
+        buffer[length] = 0;
+
+        // The C runtime doesn't know JavaScript's names for these.
+        if (Matches(buffer, length, "NaN")) {
+          result = std::numeric_limits<double>::quiet_NaN();
+          return true;
+        } else if (Matches(buffer, length, "Infinity")) {
+          result = std::numeric_limits<double>::infinity();
+          return true;
+        } else if (Matches(buffer, length, "-Infinity")) {
+          result = -std::numeric_limits<double>::infinity();
+          return true;
+        }
+
+        char * end;
+        result = strtod(buffer, &end);
+        return end == buffer + length;
+      }
+    }
+
+    NativeHostNameTable::NativeHostNameTable () {
+      InitializeCriticalSection(&mLock);
+    }
+
+    NativeHostNameTable::~NativeHostNameTable () {
+      DeleteCriticalSection(&mLock);
+    }
+
+    NativeHostNameTable & NativeHostNameTable::instance () {
+      return Names;
+    }
+
+    int NativeHostNameTable::find (const wchar_t * name, size_t length, unsigned int hash) const {
+      if (mSlots.empty())
+        return 0;
+
+      size_t mask = mSlots.size() - 1;
+      for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const Slot & slot = mSlots[i];
+        if (slot.Id == 0)
+          return 0;
+
+        const std::wstring & candidate = mNames[slot.Id - 1];
+        if ((slot.Hash == hash) && (candidate.size() == length) && (wmemcmp(candidate.data(), name, length) == 0))
+          return slot.Id;
+      }
+    }
+
+    void NativeHostNameTable::grow () {
+      size_t size = mSlots.empty() ? 64 : mSlots.size() * 2;
+      Slot empty = { 0, 0 };
+      mSlots.assign(size, empty);
+
+      for (size_t id = 1; id <= mNames.size(); id++) {
+        unsigned int hash = HashName(mNames[id - 1].data(), mNames[id - 1].size());
+        size_t i = hash & (size - 1);
+        while (mSlots[i].Id != 0)
+          i = (i + 1) & (size - 1);
+
+        mSlots[i].Hash = hash;
+        mSlots[i].Id = (int)id;
+      }
+    }
+
+    int NativeHostNameTable::intern (const wchar_t * name, size_t length) {
+      unsigned int hash = HashName(name, length);
+
+      EnterCriticalSection(&mLock);
+
+      int result = find(name, length, hash);
+      if ((result == 0) && (mNames.size() < (size_t)MaxNames)) {
+        mNames.push_back(std::wstring(name, length));
+        result = (int)mNames.size();
+
+        // Rebuilding inserts the new name along with the rest.
+        if (mNames.size() * 2 > mSlots.size()) {
+          grow();
+        } else {
+          size_t mask = mSlots.size() - 1;
+          size_t i = hash & mask;
+          while (mSlots[i].Id != 0)
+            i = (i + 1) & mask;
+
+          mSlots[i].Hash = hash;
+          mSlots[i].Id = result;
+        }
+      }
+
+      LeaveCriticalSection(&mLock);
+      return result;
+    }
+
+    int NativeHostNameTable::lookup (const wchar_t * name, size_t length) {
+      unsigned int hash = HashName(name, length);
+
+      EnterCriticalSection(&mLock);
+      int result = find(name, length, hash);
+      LeaveCriticalSection(&mLock);
+
+      return result;
+    }
+
+    bool NativeHostNameTable::name (int id, std::wstring & result) {
+      EnterCriticalSection(&mLock);
+
+      bool found = (id > 0) && ((size_t)id <= mNames.size());
+      if (found)
+        result = mNames[id - 1];
+
+      LeaveCriticalSection(&mLock);
+      return found;
+    }
+
+    int NativeHostNameTable::count () {
+      EnterCriticalSection(&mLock);
+      int result = (int)mNames.size();
+      LeaveCriticalSection(&mLock);
+
+      return result;
+    }
+
+    size_t NativeHostMessageBatch::appendText (const wchar_t * text, size_t length) {
+      size_t offset = mText.size();
+      mText.insert(mText.end(), text, text + length);
+      return offset;
+    }
+
+    // Origins and targets are URLs, which Chromium has already escaped down to ASCII.
+    size_t NativeHostMessageBatch::appendText (const char * text, size_t length) {
+      size_t offset = mText.size();
+      mText.resize(offset + length);
+      for (size_t i = 0; i < length; i++)
+        mText[offset + i] = (wchar_t)(unsigned char)text[i];
+      return offset;
+    }
+
+    bool NativeHostMessageBatch::parse (const wchar_t * message, size_t length, NativeHostMessage & result) {
+      size_t position = 1, nameLength;
+      if (!ReadLength(message, length, position, nameLength))
+        return false;
+
+      const wchar_t * name = message + position;
+      result.NameOffset = appendText(name, nameLength);
+      result.NameLength = nameLength;
+      position += nameLength;
+
+      while (position < length) {
+        wchar_t tag = message[position++];
+        size_t argumentLength;
+        if (!ReadLength(message, length, position, argumentLength))
+          return false;
+
+        const wchar_t * content = message + position;
+        NativeHostArgument argument = { HostArgumentNull, 0, 0, argumentLength };
+
+        switch (tag) {
+          case 'u':
+            if (argumentLength != 0)
+              return false;
+            break;
+          case 'n':
+            argument.Type = HostArgumentNumber;
+            if (!ParseNumber(content, argumentLength, argument.Number))
+              return false;
+            break;
+          case 's':
+            argument.Type = HostArgumentString;
+            argument.Offset = appendText(content, argumentLength);
+            break;
+          case 'b':
+            argument.Type = HostArgumentBytes;
+            argument.Offset = mBytes.size();
+            mBytes.resize(argument.Offset + argumentLength);
+            for (size_t i = 0; i < argumentLength; i++) {
+              if (content[i] > 0xFF)
+                return false;
+              mBytes[argument.Offset + i] = (unsigned char)content[i];
+            }
+            break;
+          default:
+            return false;
+        }
+
+        mArguments.push_back(argument);
+        position += argumentLength;
+      }
+
+      // Only names of messages that parse take up an Id, so malformed ones can't use up the table.
+      result.Id = NativeHostNameTable::instance().intern(name, nameLength);
+      return true;
+    }
+
+    bool NativeHostMessageBatch::add (const wchar_t * message, size_t length, const char * origin, size_t originLength, const char * target, size_t targetLength) {
+      size_t argumentCount = mArguments.size(), textLength = mText.size(), byteLength = mBytes.size();
+
+      NativeHostMessage result;
+      memset(&result, 0, sizeof(result));
+      result.FirstArgument = argumentCount;
+
+      if ((length > 0) && (message[0] == BridgeMarker)) {
+        if (!parse(message, length, result)) {
+          mArguments.resize(argumentCount);
+          mText.resize(textLength);
+          mBytes.resize(byteLength);
+          return false;
+        }
+      } else {
+        NativeHostArgument argument = { HostArgumentString, 0, appendText(message, length), length };
+        mArguments.push_back(argument);
+      }
+
+      result.ArgumentCount = mArguments.size() - result.FirstArgument;
+      result.OriginOffset = appendText(origin, originLength);
+      result.OriginLength = originLength;
+      result.TargetOffset = appendText(target, targetLength);
+      result.TargetLength = targetLength;
+
+      mMessages.push_back(result);
+      return true;
+    }
+
+    void NativeHostMessageBatch::clear () {
+      mMessages.clear();
+      mArguments.clear();
+      mText.clear();
+      mBytes.clear();
+    }
+
+    void NativeHostMessageBatch::swap (NativeHostMessageBatch & other) {
+      mMessages.swap(other.mMessages);
+      mArguments.swap(other.mArguments);
+      mText.swap(other.mText);
+      mBytes.swap(other.mBytes);
+    }
+
+  }}
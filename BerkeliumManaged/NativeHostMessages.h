@@ -0,0 +1,113 @@
+// NativeHostMessages.h : parses messages pages post with window.externalHost.postMessage
+
+#pragma once
+
+#include <windows.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // A message in the host bridge format starts with a unit separator (U+001F) and the length-prefixed name,
+    //  followed by any number of arguments. Each argument is a type tag, its length in UTF-16 code units, a colon
+    //  and its content:
+    //
+    //   \x1F 4:ping n3:1.5 s5:hello b2:\x01\xFF u0:
+    //
+    // (without the spaces). 'n' is a number in JavaScript's own notation, 's' is a string, 'b' is binary data with
+    //  one byte per code unit, and 'u' is null or undefined. Any other message is treated as a plain message: it has
+    //  no name and a single string argument, the message itself.
+    enum NativeHostArgumentType {
+      HostArgumentNull,
+      HostArgumentNumber,
+      HostArgumentString,
+      HostArgumentBytes
+    };
+
+    struct NativeHostArgument {
+      int Type;
+      double Number;
+      // Strings are in the batch's text, and binary arguments in its bytes.
+      size_t Offset, Length;
+    };
+
+    struct NativeHostMessage {
+      int Id;
+      // The name, origin and target are all in the batch's text.
+      size_t NameOffset, NameLength;
+      size_t OriginOffset, OriginLength;
+      size_t TargetOffset, TargetLength;
+      size_t FirstArgument, ArgumentCount;
+    };
+
+    // Hands out a small integer for each message name, so that handlers can switch on names instead of
+    //  comparing strings. IDs start at 1 and never change; 0 is for plain messages. It's safe to use from any thread.
+    class NativeHostNameTable {
+      struct Slot {
+        unsigned int Hash;
+        int Id;
+      };
+
+      CRITICAL_SECTION mLock;
+      std::vector<std::wstring> mNames;
+      // Open addressing, kept at most half full. A slot with an ID of 0 is empty.
+      std::vector<Slot> mSlots;
+
+      NativeHostNameTable (const NativeHostNameTable &);
+      NativeHostNameTable & operator= (const NativeHostNameTable &);
+
+      // Both of these expect mLock to be held.
+      int find (const wchar_t * name, size_t length, unsigned int hash) const;
+      void grow ();
+
+    public:
+      // Names beyond this many are still delivered, but as ID 0, so that a page can't grow the table without bound.
+      static const int MaxNames = 4096;
+
+      NativeHostNameTable ();
+      ~NativeHostNameTable ();
+
+      // Returns the ID of a name, assigning one if it's new (and the table isn't full).
+      int intern (const wchar_t * name, size_t length);
+      // Returns the ID of a name, or 0 if it has none.
+      int lookup (const wchar_t * name, size_t length);
+      // Copies out the name of an ID. Returns false if there is no such ID.
+      bool name (int id, std::wstring & result);
+      int count ();
+
+      static NativeHostNameTable & instance ();
+    };
+
+    // The messages a window received during one update. Clearing it keeps its storage, so once a window's
+    //  traffic has peaked, receiving messages doesn't allocate.
+    class NativeHostMessageBatch {
+      std::vector<NativeHostMessage> mMessages;
+      std::vector<NativeHostArgument> mArguments;
+      std::vector<wchar_t> mText;
+      std::vector<unsigned char> mBytes;
+
+      bool parse (const wchar_t * message, size_t length, NativeHostMessage & result);
+      size_t appendText (const wchar_t * text, size_t length);
+      size_t appendText (const char * text, size_t length);
+
+    public:
+      // Appends a message, returning false (and leaving the batch unchanged) if it claims to be in the bridge format but isn't.
+      bool add (const wchar_t * message, size_t length, const char * origin, size_t originLength, const char * target, size_t targetLength);
+
+      void clear ();
+      void swap (NativeHostMessageBatch & other);
+
+      size_t count () const { return mMessages.size(); }
+      bool empty () const { return mMessages.empty(); }
+
+      const NativeHostMessage & message (size_t index) const { return mMessages[index]; }
+      const NativeHostArgument & argument (const NativeHostMessage & message, size_t index) const { return mArguments[message.FirstArgument + index]; }
+
+      const wchar_t * text (size_t offset) const { return mText.empty() ? 0 : &mText[0] + offset; }
+      const unsigned char * bytes (size_t offset) const { return mBytes.empty() ? 0 : &mBytes[0] + offset; }
+    };
+
+  }}
@@ -0,0 +1,55 @@
+// NativeInputQueue.cpp : compiled as native code; see NativeInputQueue.h
+
+#include "NativeInputQueue.h"
+
+namespace Berkelium {
+  namespace Managed {
+
+    bool NativeInputQueue::push (int kind, int target, int a, int b, int c, int d) {
+      if (!mEvents.empty()) {
+        NativeInputEvent & last = mEvents.back();
+
+        if ((last.Kind == kind) && (last.Target == target)) {
+          if (kind == InputMouseMoved) {
+            last.A = a;
+            last.B = b;
+            return true;
+          } else if (kind == InputMouseWheel) {
+            last.A += a;
+            last.B += b;
+            return true;
+          }
+        }
+      }
+
+      NativeInputEvent evt = { kind, target, a, b, c, d, 0, 0 };
+      mEvents.push_back(evt);
+      return false;
+    }
+
+    bool NativeInputQueue::pushText (int target, const wchar_t * text, size_t length) {
+      // The last text event's text is always at the end of the buffer, so joining is an append.
+      bool merged = !mEvents.empty() && (mEvents.back().Kind == InputText) && (mEvents.back().Target == target);
+
+      if (merged) {
+        mEvents.back().TextLength += length;
+      } else {
+        NativeInputEvent evt = { InputText, target, 0, 0, 0, 0, mText.size(), length };
+        mEvents.push_back(evt);
+      }
+
+      mText.insert(mText.end(), text, text + length);
+      return merged;
+    }
+
+    void NativeInputQueue::clear () {
+      mEvents.clear();
+      mText.clear();
+    }
+
+    void NativeInputQueue::swap (NativeInputQueue & other) {
+      mEvents.swap(other.mEvents);
+      mText.swap(other.mText);
+    }
+
+  }}
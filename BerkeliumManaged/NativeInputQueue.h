@@ -0,0 +1,57 @@
+// NativeInputQueue.h : input events waiting to be sent to a window, merged where that doesn't change their meaning
+
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+namespace Berkelium {
+  namespace Managed {
+
+    enum NativeInputKind {
+      InputMouseMoved,
+      InputMouseWheel,
+      InputMouseButton,
+      InputKey,
+      InputText,
+      InputFocus,
+      InputUnfocus
+    };
+
+    struct NativeInputEvent {
+      int Kind;
+      // 0 for the window itself; otherwise one more than the index of a widget the owner keeps track of.
+      int Target;
+      int A, B, C, D;
+      // Text events keep their text in the queue's text buffer.
+      size_t TextOffset, TextLength;
+    };
+
+    // Events keep their order. An event is only merged into the one queued right before it, if both are for the same target:
+    //  mouse moves keep the latest position, wheel deltas are summed and text is joined.
+    class NativeInputQueue {
+      std::vector<NativeInputEvent> mEvents;
+      std::vector<wchar_t> mText;
+
+      NativeInputQueue (const NativeInputQueue &);
+      NativeInputQueue & operator= (const NativeInputQueue &);
+
+    public:
+      NativeInputQueue () {
+      }
+
+      // Returns true if the event was merged into the previous one.
+      bool push (int kind, int target, int a, int b, int c, int d);
+      bool pushText (int target, const wchar_t * text, size_t length);
+
+      bool empty () const { return mEvents.empty(); }
+      size_t count () const { return mEvents.size(); }
+      const NativeInputEvent & event (size_t index) const { return mEvents[index]; }
+      const wchar_t * text (const NativeInputEvent & evt) const { return (evt.TextLength > 0) ? &mText[evt.TextOffset] : L""; }
+
+      void clear ();
+      void swap (NativeInputQueue & other);
+    };
+
+  }}
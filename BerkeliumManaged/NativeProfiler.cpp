@@ -0,0 +1,277 @@
+// NativeProfiler.cpp : compiled as native code; see NativeProfiler.h
+
+#include "NativeProfiler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Berkelium {
+  namespace Managed {
+
+    namespace {
+      struct ProfileSpan {
+        const char * Category;
+        const char * Name;
+        long long Start, End;
+      };
+
+      // One thread's spans. Only that thread records into it, but it can be written out from any thread,
+      //  so both take the lock; it's never contended for long.
+      struct ProfileBuffer {
+        CRITICAL_SECTION Lock;
+        HANDLE Thread;
+        DWORD ThreadId;
+        std::vector<ProfileSpan> Spans;
+        size_t Next;
+        bool Wrapped;
+
+        ProfileBuffer (size_t capacity)
+          : Thread(OpenThread(SYNCHRONIZE, FALSE, GetCurrentThreadId()))
+          , ThreadId(GetCurrentThreadId())
+          , Spans(capacity)
+          , Next(0)
+          , Wrapped(false) {
+          InitializeCriticalSection(&Lock);
+        }
+
+        ~ProfileBuffer () {
+          if (Thread)
+            CloseHandle(Thread);
+          DeleteCriticalSection(&Lock);
+        }
+
+        bool hasExited () const {
+          return Thread && (WaitForSingleObject(Thread, 0) == WAIT_OBJECT_0);
+        }
+      };
+
+      class ProfileLock {
+        CRITICAL_SECTION & mLock;
+
+        ProfileLock (const ProfileLock &);
+        ProfileLock & operator= (const ProfileLock &);
+
+      public:
+        ProfileLock (CRITICAL_SECTION & lock)
+          : mLock(lock) {
+          EnterCriticalSection(&mLock);
+        }
+
+        ~ProfileLock () {
+          LeaveCriticalSection(&mLock);
+        }
+      };
+
+      // Every buffer ever handed to a thread, so that they can be written out together. Threads are named
+      //  here rather than in their buffers, so naming one doesn't allocate a buffer it might never use.
+      struct ProfileRegistry {
+        CRITICAL_SECTION Lock;
+        DWORD TlsIndex;
+        size_t Capacity;
+        std::vector<ProfileBuffer *> Buffers;
+        std::map<DWORD, std::string> ThreadNames;
+
+        ProfileRegistry ()
+          : TlsIndex(TlsAlloc())
+          , Capacity(NativeProfiler::DefaultCapacity) {
+          InitializeCriticalSection(&Lock);
+        }
+      };
+
+      ProfileRegistry Registry;
+
+      ProfileBuffer * CurrentBuffer () {
+        if (Registry.TlsIndex == TLS_OUT_OF_INDEXES)
+          return 0;
+
+        ProfileBuffer * buffer = (ProfileBuffer *)TlsGetValue(Registry.TlsIndex);
+        if (buffer)
+          return buffer;
+
+        ProfileLock lock (Registry.Lock);
+        buffer = new ProfileBuffer(Registry.Capacity);
+        Registry.Buffers.push_back(buffer);
+        TlsSetValue(Registry.TlsIndex, buffer);
+        return buffer;
+      }
+
+      void AppendEscaped (std::string & output, const char * text) {
+        for (; *text; text++) {
+          unsigned char ch = (unsigned char)*text;
+          if ((ch == '"') || (ch == '\\')) {
+            output += '\\';
+            output += (char)ch;
+          } else if (ch < 0x20) {
+            char escaped[8];
+            sprintf_s(escaped, sizeof(escaped), "\\u%04x", ch);
+            output += escaped;
+          } else {
+            output += (char)ch;
+          }
+        }
+      }
+
+      void AppendMicroseconds (std::string & output, long long ticks, double microsecondsPerTick) {
+        char number[32];
+        sprintf_s(number, sizeof(number), "%.3f", ticks * microsecondsPerTick);
+        output += number;
+      }
+
+      bool WriteAll (HANDLE file, const std::string & text) {
+        size_t position = 0;
+
+        while (position < text.size()) {
+          DWORD chunk = (text.size() - position > 0x100000) ? 0x100000 : (DWORD)(text.size() - position);
+          DWORD written = 0;
+          if (!WriteFile(file, text.data() + position, chunk, &written, 0) || (written == 0))
+            return false;
+
+          position += written;
+        }
+
+        return true;
+      }
+    }
+
+    volatile LONG NativeProfiler::Enabled = 0;
+
+    void NativeProfiler::enable (bool enabled) {
+      InterlockedExchange(&Enabled, enabled ? 1 : 0);
+    }
+
+    void NativeProfiler::setCapacity (size_t capacity) {
+      ProfileLock lock (Registry.Lock);
+      Registry.Capacity = capacity ? capacity : 1;
+    }
+
+    size_t NativeProfiler::capacity () {
+      ProfileLock lock (Registry.Lock);
+      return Registry.Capacity;
+    }
+
+    void NativeProfiler::record (const char * category, const char * name, long long startTicks, long long endTicks) {
+      ProfileBuffer * buffer = CurrentBuffer();
+      if (!buffer)
+        return;
+
+      ProfileLock lock (buffer->Lock);
+      ProfileSpan & span = buffer->Spans[buffer->Next];
+      span.Category = category;
+      span.Name = name;
+      span.Start = startTicks;
+      span.End = endTicks;
+
+      if (++buffer->Next == buffer->Spans.size()) {
+        buffer->Next = 0;
+        buffer->Wrapped = true;
+      }
+    }
+
+    void NativeProfiler::nameThread (const char * name) {
+      ProfileLock lock (Registry.Lock);
+      Registry.ThreadNames[GetCurrentThreadId()] = name ? name : "";
+    }
+
+    void NativeProfiler::clear () {
+      ProfileLock lock (Registry.Lock);
+
+      for (size_t i = 0; i < Registry.Buffers.size(); ) {
+        ProfileBuffer * buffer = Registry.Buffers[i];
+
+        // A thread that has exited can't be holding on to its buffer any more.
+        if (buffer->hasExited()) {
+          Registry.ThreadNames.erase(buffer->ThreadId);
+          delete buffer;
+          Registry.Buffers.erase(Registry.Buffers.begin() + i);
+          continue;
+        }
+
+        {
+          ProfileLock bufferLock (buffer->Lock);
+          buffer->Next = 0;
+          buffer->Wrapped = false;
+        }
+        i++;
+      }
+    }
+
+    bool NativeProfiler::writeChromeTrace (const wchar_t * filename) {
+      LARGE_INTEGER frequency;
+      QueryPerformanceFrequency(&frequency);
+      double microsecondsPerTick = 1000000.0 / (double)frequency.QuadPart;
+
+      DWORD processId = GetCurrentProcessId();
+      std::string output ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+      bool first = true;
+      std::vector<ProfileSpan> spans;
+
+      {
+        ProfileLock lock (Registry.Lock);
+
+        for (size_t i = 0; i < Registry.Buffers.size(); i++) {
+          ProfileBuffer * buffer = Registry.Buffers[i];
+          std::map<DWORD, std::string>::const_iterator threadName = Registry.ThreadNames.find(buffer->ThreadId);
+
+          // Copy the spans out, oldest first, so the thread isn't held up while they're formatted.
+          {
+            ProfileLock bufferLock (buffer->Lock);
+            spans.clear();
+            if (buffer->Wrapped)
+              spans.insert(spans.end(), buffer->Spans.begin() + buffer->Next, buffer->Spans.end());
+            spans.insert(spans.end(), buffer->Spans.begin(), buffer->Spans.begin() + buffer->Next);
+          }
+
+          char ids[64];
+          sprintf_s(ids, sizeof(ids), ",\"pid\":%lu,\"tid\":%lu", processId, buffer->ThreadId);
+
+          if ((threadName != Registry.ThreadNames.end()) && !threadName->second.empty()) {
+            if (!first)
+              output += ',';
+            first = false;
+
+            output += "{\"name\":\"thread_name\",\"ph\":\"M\"";
+            output += ids;
+            output += ",\"args\":{\"name\":\"";
+            AppendEscaped(output, threadName->second.c_str());
+            output += "\"}}";
+          }
+
+          for (size_t j = 0; j < spans.size(); j++) {
+            const ProfileSpan & span = spans[j];
+
+            if (!first)
+              output += ',';
+            first = false;
+
+            output += "{\"name\":\"";
+            AppendEscaped(output, span.Name);
+            output += "\",\"cat\":\"";
+            AppendEscaped(output, span.Category);
+            output += "\",\"ph\":\"X\",\"ts\":";
+            AppendMicroseconds(output, span.Start, microsecondsPerTick);
+            output += ",\"dur\":";
+            AppendMicroseconds(output, span.End - span.Start, microsecondsPerTick);
+            output += ids;
+            output += '}';
+          }
+        }
+      }
+
+      output += "]}\n";
+
+      HANDLE file = CreateFileW(filename, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+      if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+      bool succeeded = WriteAll(file, output);
+      if (!CloseHandle(file))
+        succeeded = false;
+
+      return succeeded;
+    }
+
+  }}
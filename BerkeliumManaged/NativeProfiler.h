@@ -0,0 +1,61 @@
+// NativeProfiler.h : timed spans, kept per thread in a ring buffer and written out as Chrome trace events
+
+#pragma once
+
+#include <windows.h>
+#include <stddef.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    long long NativeStatTicks ();
+
+    class NativeProfiler {
+    public:
+      // Checked once by every span, without a barrier: a span that starts while this changes may or may not be kept.
+      static volatile LONG Enabled;
+      static const size_t DefaultCapacity = 16384;
+
+      static void enable (bool enabled);
+      // The number of spans each thread keeps. Takes effect for threads that haven't recorded a span yet.
+      static void setCapacity (size_t capacity);
+      static size_t capacity ();
+
+      // Category and name must be string literals (or otherwise live forever); only the pointers are kept.
+      static void record (const char * category, const char * name, long long startTicks, long long endTicks);
+      // Names the calling thread in the trace. The name is copied.
+      static void nameThread (const char * name);
+
+      // Discards every span recorded so far, and the buffers of threads that have exited.
+      static void clear ();
+      // Writes the spans as a Chrome trace_event JSON file, which about:tracing and Perfetto can open. Returns false
+      //  if the file couldn't be written.
+      static bool writeChromeTrace (const wchar_t * filename);
+    };
+
+    // Records the enclosing block as a span, if the profiler is enabled when it starts.
+    class NativeProfileScope {
+      const char * mCategory;
+      const char * mName;
+      long long mStart;
+
+      NativeProfileScope (const NativeProfileScope &);
+      NativeProfileScope & operator= (const NativeProfileScope &);
+
+    public:
+      NativeProfileScope (const char * category, const char * name)
+        : mName(0) {
+        if (NativeProfiler::Enabled) {
+          mCategory = category;
+          mName = name;
+          mStart = NativeStatTicks();
+        }
+      }
+
+      ~NativeProfileScope () {
+        if (mName)
+          NativeProfiler::record(mCategory, mName, mStart, NativeStatTicks());
+      }
+    };
+
+  }}
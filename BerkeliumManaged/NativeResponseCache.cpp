@@ -0,0 +1,225 @@
+// NativeResponseCache.cpp : compiled as native code; see NativeResponseCache.h
+
+#include "NativeResponseCache.h"
+
+#include <string.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    namespace {
+      HGLOBAL CopyToLocal (const std::vector<unsigned char> & source) {
+        if (source.empty())
+          return 0;
+
+        HGLOBAL result = (HGLOBAL)LocalAlloc(LMEM_FIXED, source.size());
+        if (result)
+          memcpy(result, &source[0], source.size());
+        return result;
+      }
+
+      // Takes mLock for the lifetime of the guard.
+      class CacheLock {
+        CRITICAL_SECTION & mLock;
+
+        CacheLock (const CacheLock &);
+        CacheLock & operator= (const CacheLock &);
+
+      public:
+        CacheLock (CRITICAL_SECTION & lock)
+          : mLock(lock) {
+          EnterCriticalSection(&mLock);
+        }
+
+        ~CacheLock () {
+          LeaveCriticalSection(&mLock);
+        }
+      };
+    }
+
+    NativeCachedResponse::NativeCachedResponse (const wchar_t * url, size_t urlLength, const void * headers, size_t headersLength, bool succeeded)
+      : mRefCount(1)
+      , Url(url, urlLength)
+      , Headers((const unsigned char *)headers, (const unsigned char *)headers + headersLength)
+      , Succeeded(succeeded) {
+    }
+
+    NativeCachedResponse::~NativeCachedResponse () {
+    }
+
+    void NativeCachedResponse::addRef () {
+      InterlockedIncrement(&mRefCount);
+    }
+
+    void NativeCachedResponse::release () {
+      if (InterlockedDecrement(&mRefCount) == 0)
+        delete this;
+    }
+
+    size_t NativeCachedResponse::byteSize () const {
+      return (Url.length() * sizeof(wchar_t)) + Headers.size() + Body.size();
+    }
+
+    void NativeCachedResponse::appendBody (const void * data, size_t length) {
+      Body.insert(Body.end(), (const unsigned char *)data, (const unsigned char *)data + length);
+    }
+
+    size_t NativeCachedResponse::readBody (size_t position, void * buffer, size_t capacity) const {
+      if (position >= Body.size())
+        return 0;
+
+      size_t count = Body.size() - position;
+      if (count > capacity)
+        count = capacity;
+
+      memcpy(buffer, &Body[position], count);
+      return count;
+    }
+
+    HGLOBAL NativeCachedResponse::copyHeaders () const {
+      return CopyToLocal(Headers);
+    }
+
+    HGLOBAL NativeCachedResponse::copyBody () const {
+      return CopyToLocal(Body);
+    }
+
+    NativeResponseCache::NativeResponseCache ()
+      : mRefCount(1)
+      , mByteBudget(0)
+      , mByteCount(0)
+      , mHits(0)
+      , mMisses(0) {
+      InitializeCriticalSection(&mLock);
+    }
+
+    NativeResponseCache::~NativeResponseCache () {
+      evict(0);
+      DeleteCriticalSection(&mLock);
+    }
+
+    void NativeResponseCache::addRef () {
+      InterlockedIncrement(&mRefCount);
+    }
+
+    void NativeResponseCache::release () {
+      if (InterlockedDecrement(&mRefCount) == 0)
+        delete this;
+    }
+
+    size_t NativeResponseCache::byteBudget () {
+      CacheLock lock (mLock);
+      return mByteBudget;
+    }
+
+    void NativeResponseCache::setByteBudget (size_t byteBudget) {
+      CacheLock lock (mLock);
+      mByteBudget = byteBudget;
+      evict(byteBudget);
+    }
+
+    size_t NativeResponseCache::byteCount () {
+      CacheLock lock (mLock);
+      return mByteCount;
+    }
+
+    size_t NativeResponseCache::count () {
+      CacheLock lock (mLock);
+      return mIndex.size();
+    }
+
+    long long NativeResponseCache::hits () {
+      CacheLock lock (mLock);
+      return mHits;
+    }
+
+    long long NativeResponseCache::misses () {
+      CacheLock lock (mLock);
+      return mMisses;
+    }
+
+    void NativeResponseCache::erase (TIndex::iterator iter) {
+      NativeCachedResponse * response = *(iter->second);
+
+      mByteCount -= response->byteSize();
+      mLru.erase(iter->second);
+      mIndex.erase(iter);
+
+      response->release();
+    }
+
+    void NativeResponseCache::evict (size_t byteBudget) {
+      while ((mByteCount > byteBudget) && !mLru.empty())
+        erase(mIndex.find(mLru.back()->Url));
+    }
+
+    NativeCachedResponse * NativeResponseCache::lookup (const wchar_t * url, size_t urlLength) {
+      CacheLock lock (mLock);
+
+      // A disabled cache doesn't count anything.
+      if (mByteBudget == 0)
+        return 0;
+
+      TIndex::iterator iter = mIndex.find(std::wstring(url, urlLength));
+      if (iter == mIndex.end()) {
+        mMisses += 1;
+        return 0;
+      }
+
+      mHits += 1;
+      mLru.splice(mLru.begin(), mLru, iter->second);
+
+      NativeCachedResponse * response = *(iter->second);
+      response->addRef();
+      return response;
+    }
+
+    void NativeResponseCache::insert (NativeCachedResponse * response) {
+      CacheLock lock (mLock);
+
+      size_t size = response->byteSize();
+      if (size > mByteBudget)
+        return;
+
+      TIndex::iterator iter = mIndex.find(response->Url);
+      if (iter != mIndex.end())
+        erase(iter);
+
+      evict(mByteBudget - size);
+
+      response->addRef();
+      mLru.push_front(response);
+      mIndex[response->Url] = mLru.begin();
+      mByteCount += size;
+    }
+
+    bool NativeResponseCache::invalidate (const wchar_t * url, size_t urlLength) {
+      CacheLock lock (mLock);
+
+      TIndex::iterator iter = mIndex.find(std::wstring(url, urlLength));
+      if (iter == mIndex.end())
+        return false;
+
+      erase(iter);
+      return true;
+    }
+
+    void NativeResponseCache::clear () {
+      CacheLock lock (mLock);
+      evict(0);
+    }
+
+    bool NativeResponseCache::serve (const wchar_t * url, size_t urlLength, HGLOBAL & responseBody, HGLOBAL & responseHeaders, bool & succeeded) {
+      NativeCachedResponse * response = lookup(url, urlLength);
+      if (!response)
+        return false;
+
+      responseBody = response->copyBody();
+      responseHeaders = response->copyHeaders();
+      succeeded = response->Succeeded;
+
+      response->release();
+      return true;
+    }
+
+  }}
@@ -0,0 +1,97 @@
+// NativeResponseCache.h : caches custom protocol responses so repeat requests never reach managed code
+
+#pragma once
+
+#include <windows.h>
+#include <stddef.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // A complete response to a custom protocol request: its serialized header block
+    //  and its body. Shared between the cache and the requests it is serving, so it is
+    //  reference counted. It must not be modified once it has been inserted into a cache.
+    class NativeCachedResponse {
+      volatile LONG mRefCount;
+
+      NativeCachedResponse (const NativeCachedResponse &);
+      NativeCachedResponse & operator= (const NativeCachedResponse &);
+      ~NativeCachedResponse ();
+
+    public:
+      std::wstring Url;
+      std::vector<unsigned char> Headers;
+      std::vector<unsigned char> Body;
+      bool Succeeded;
+
+      // Starts out with a single reference, owned by the caller.
+      NativeCachedResponse (const wchar_t * url, size_t urlLength, const void * headers, size_t headersLength, bool succeeded);
+
+      void addRef ();
+      void release ();
+
+      size_t byteSize () const;
+      void appendBody (const void * data, size_t length);
+
+      // Copies up to capacity bytes of the body, starting at position. Returns the number of bytes copied.
+      size_t readBody (size_t position, void * buffer, size_t capacity) const;
+
+      // Allocates copies the way ProtocolHandler hands out responses (0 if there's nothing to copy).
+      HGLOBAL copyHeaders () const;
+      HGLOBAL copyBody () const;
+    };
+
+    // A least-recently-used cache of complete responses, keyed by URL and bounded by a byte budget.
+    // It's safe to use from any thread, and is reference counted so that responses still being
+    //  streamed into it can outlive the protocol handler that owns it.
+    class NativeResponseCache {
+      typedef std::list<NativeCachedResponse *> TLruList;
+      typedef std::map<std::wstring, TLruList::iterator> TIndex;
+
+      volatile LONG mRefCount;
+      CRITICAL_SECTION mLock;
+      // The most recently used response comes first.
+      TLruList mLru;
+      TIndex mIndex;
+      size_t mByteBudget, mByteCount;
+      long long mHits, mMisses;
+
+      NativeResponseCache (const NativeResponseCache &);
+      NativeResponseCache & operator= (const NativeResponseCache &);
+      ~NativeResponseCache ();
+
+      // Both of these expect mLock to be held.
+      void erase (TIndex::iterator iter);
+      void evict (size_t byteBudget);
+
+    public:
+      // Starts out with a single reference, owned by the caller, and a budget of zero (disabled).
+      NativeResponseCache ();
+
+      void addRef ();
+      void release ();
+
+      size_t byteBudget ();
+      void setByteBudget (size_t byteBudget);
+      size_t byteCount ();
+      size_t count ();
+      long long hits ();
+      long long misses ();
+
+      // Returns the cached response with a reference added for the caller, or 0 on a miss.
+      NativeCachedResponse * lookup (const wchar_t * url, size_t urlLength);
+      // Adds (or replaces) a response. The cache takes its own reference.
+      void insert (NativeCachedResponse * response);
+      bool invalidate (const wchar_t * url, size_t urlLength);
+      void clear ();
+
+      // Serves a hit the way NativeProtocolHandler::HandleRequest returns a response.
+      bool serve (const wchar_t * url, size_t urlLength, HGLOBAL & responseBody, HGLOBAL & responseHeaders, bool & succeeded);
+    };
+
+  }}
@@ -0,0 +1,201 @@
+// NativeScriptQueue.cpp : compiled as native code; see NativeScriptQueue.h
+
+#include "NativeScriptQueue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    namespace {
+      // Each script is wrapped so that one that throws doesn't stop the rest of the batch.
+      //  The error is rethrown on its own so that it still shows up on the console.
+      const wchar_t ScriptPrologue[] = L"try {\n";
+      const wchar_t ScriptEpilogue[] = L"\n} catch (e) { window.setTimeout(function () { throw e; }, 0); }\n";
+
+      void AppendAscii (std::vector<wchar_t> & script, const char * text, size_t length) {
+        for (size_t i = 0; i < length; i++)
+          script.push_back((wchar_t)text[i]);
+      }
+
+      bool IsDigit (wchar_t ch) {
+        return (ch >= '0') && (ch <= '9');
+      }
+    }
+
+    void AppendScriptText (std::vector<wchar_t> & script, const wchar_t * text, size_t length) {
+      script.insert(script.end(), text, text + length);
+    }
+
+    void AppendStringLiteral (std::vector<wchar_t> & script, const wchar_t * text, size_t length) {
+      static const char hexDigits[] = "0123456789ABCDEF";
+
+      script.reserve(script.size() + length + 2);
+      script.push_back('"');
+
+      for (size_t i = 0; i < length; i++) {
+        wchar_t ch = text[i];
+
+        switch (ch) {
+          case '"':
+          case '\\':
+            script.push_back('\\');
+            script.push_back(ch);
+            break;
+          case '\n':
+            AppendAscii(script, "\\n", 2);
+            break;
+          case '\r':
+            AppendAscii(script, "\\r", 2);
+            break;
+          case '\t':
+            AppendAscii(script, "\\t", 2);
+            break;
+          default:
+            // Control characters, and the two line terminators JavaScript doesn't allow in string literals.
+            if ((ch < 0x20) || (ch == 0x2028) || (ch == 0x2029)) {
+              AppendAscii(script, "\\u", 2);
+              script.push_back(hexDigits[(ch >> 12) & 0xF]);
+              script.push_back(hexDigits[(ch >> 8) & 0xF]);
+              script.push_back(hexDigits[(ch >> 4) & 0xF]);
+              script.push_back(hexDigits[ch & 0xF]);
+            } else {
+              script.push_back(ch);
+            }
+            break;
+        }
+      }
+
+      script.push_back('"');
+    }
+
+    void AppendNumberLiteral (std::vector<wchar_t> & script, double value) {
+      if (value != value) {
+        AppendAscii(script, "NaN", 3);
+        return;
+      } else if ((value - value) != 0) {
+        if (value > 0)
+          AppendAscii(script, "Infinity", 8);
+        else
+          AppendAscii(script, "-Infinity", 9);
+        return;
+      }
+
+      // Enough digits to read back the same double.
+      char buffer[32];
+      int length = _snprintf_s(buffer, sizeof(buffer), _TRUNCATE, "%.17g", value);
+      AppendAscii(script, buffer, (length > 0) ? length : 0);
+    }
+
+    void AppendIntegerLiteral (std::vector<wchar_t> & script, long long value) {
+      char buffer[24];
+      int length = _snprintf_s(buffer, sizeof(buffer), _TRUNCATE, "%lld", value);
+      AppendAscii(script, buffer, (length > 0) ? length : 0);
+    }
+
+    NativeScriptTemplate::NativeScriptTemplate (const wchar_t * source, size_t length)
+      : mParameterCount(0) {
+      mText.reserve(length);
+
+      Segment segment = { 0, 0, -1 };
+
+      for (size_t i = 0; i < length; i++) {
+        if ((source[i] != '$') || (i + 1 >= length) || !IsDigit(source[i + 1])) {
+          mText.push_back(source[i]);
+          continue;
+        }
+
+        int parameter = 0;
+        while ((i + 1 < length) && IsDigit(source[i + 1]) && (parameter < 100000))
+          parameter = (parameter * 10) + (source[++i] - '0');
+
+        segment.Length = mText.size() - segment.Offset;
+        segment.Parameter = parameter;
+        mSegments.push_back(segment);
+
+        if (parameter >= mParameterCount)
+          mParameterCount = parameter + 1;
+
+        segment.Offset = mText.size();
+        segment.Parameter = -1;
+      }
+
+      segment.Length = mText.size() - segment.Offset;
+      mSegments.push_back(segment);
+    }
+
+    void NativeScriptTemplate::fill (std::vector<wchar_t> & script, const std::vector<wchar_t> & arguments, const std::vector<size_t> & argumentStarts) const {
+      for (size_t i = 0; i < mSegments.size(); i++) {
+        const Segment & segment = mSegments[i];
+        if (segment.Length > 0)
+          AppendScriptText(script, &mText[segment.Offset], segment.Length);
+
+        if (segment.Parameter < 0)
+          continue;
+
+        size_t parameter = (size_t)segment.Parameter;
+        if (parameter >= argumentStarts.size()) {
+          AppendAscii(script, "undefined", 9);
+          continue;
+        }
+
+        size_t start = argumentStarts[parameter];
+        size_t end = (parameter + 1 < argumentStarts.size()) ? argumentStarts[parameter + 1] : arguments.size();
+        if (end > start)
+          AppendScriptText(script, &arguments[start], end - start);
+      }
+    }
+
+    NativeScriptQueue::NativeScriptQueue ()
+      : mCount(0) {
+    }
+
+    void NativeScriptQueue::beginScript () {
+      AppendScriptText(mPending, ScriptPrologue, (sizeof(ScriptPrologue) / sizeof(wchar_t)) - 1);
+    }
+
+    void NativeScriptQueue::endScript () {
+      AppendScriptText(mPending, ScriptEpilogue, (sizeof(ScriptEpilogue) / sizeof(wchar_t)) - 1);
+      mCount += 1;
+    }
+
+    void NativeScriptQueue::append (const wchar_t * script, size_t length) {
+      beginScript();
+      AppendScriptText(mPending, script, length);
+      endScript();
+    }
+
+    void NativeScriptQueue::beginArgument () {
+      mArgumentStarts.push_back(mArguments.size());
+    }
+
+    void NativeScriptQueue::clearArguments () {
+      mArguments.clear();
+      mArgumentStarts.clear();
+    }
+
+    void NativeScriptQueue::appendTemplate (const NativeScriptTemplate & script) {
+      beginScript();
+      script.fill(mPending, mArguments, mArgumentStarts);
+      endScript();
+
+      clearArguments();
+    }
+
+    const wchar_t * NativeScriptQueue::take (size_t & length) {
+      if (mCount == 0) {
+        length = 0;
+        return 0;
+      }
+
+      mFlushing.swap(mPending);
+      mPending.clear();
+      mCount = 0;
+
+      length = mFlushing.size();
+      return &mFlushing[0];
+    }
+
+  }}
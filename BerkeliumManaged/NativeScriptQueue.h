@@ -0,0 +1,77 @@
+// NativeScriptQueue.h : merges the scripts queued for a window into one executeJavascript call
+
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // Each of these appends a JavaScript literal to a script under construction.
+    void AppendScriptText (std::vector<wchar_t> & script, const wchar_t * text, size_t length);
+    void AppendStringLiteral (std::vector<wchar_t> & script, const wchar_t * text, size_t length);
+    void AppendNumberLiteral (std::vector<wchar_t> & script, double value);
+    void AppendIntegerLiteral (std::vector<wchar_t> & script, long long value);
+
+    // A script with numbered parameters ($0, $1, ...), split up once so that filling it in is a series of copies.
+    // A '$' that isn't followed by a digit is left alone. It never changes once parsed, so it's safe to share between threads.
+    class NativeScriptTemplate {
+      struct Segment {
+        // A run of the script's own text, followed by a parameter (or -1 at the end).
+        size_t Offset, Length;
+        int Parameter;
+      };
+
+      std::vector<wchar_t> mText;
+      std::vector<Segment> mSegments;
+      int mParameterCount;
+
+      NativeScriptTemplate (const NativeScriptTemplate &);
+      NativeScriptTemplate & operator= (const NativeScriptTemplate &);
+
+    public:
+      NativeScriptTemplate (const wchar_t * source, size_t length);
+
+      int parameterCount () const { return mParameterCount; }
+
+      // Appends the script, with argument i (already JavaScript) in place of each $i.
+      //  Parameters that weren't given an argument become undefined.
+      void fill (std::vector<wchar_t> & script, const std::vector<wchar_t> & arguments, const std::vector<size_t> & argumentStarts) const;
+    };
+
+    // The scripts queued for a window since it was last flushed. Only appending and taking need to be
+    //  synchronized; the script take returns stays valid (and untouched) until the next take.
+    class NativeScriptQueue {
+      std::vector<wchar_t> mPending, mFlushing;
+      size_t mCount;
+      // The arguments of the template that is being queued, one after another.
+      std::vector<wchar_t> mArguments;
+      std::vector<size_t> mArgumentStarts;
+
+      NativeScriptQueue (const NativeScriptQueue &);
+      NativeScriptQueue & operator= (const NativeScriptQueue &);
+
+      void beginScript ();
+      void endScript ();
+
+    public:
+      NativeScriptQueue ();
+
+      bool empty () const { return mCount == 0; }
+      size_t count () const { return mCount; }
+
+      void append (const wchar_t * script, size_t length);
+
+      // Arguments for appendTemplate are written into arguments(), each one after a call to beginArgument.
+      std::vector<wchar_t> & arguments () { return mArguments; }
+      void beginArgument ();
+      void clearArguments ();
+      void appendTemplate (const NativeScriptTemplate & script);
+
+      // Hands out every queued script as one, and empties the queue. Returns 0 if nothing was queued.
+      const wchar_t * take (size_t & length);
+    };
+
+  }}
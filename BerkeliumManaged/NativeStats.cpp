@@ -0,0 +1,288 @@
+// NativeStats.cpp : compiled as native code; see NativeStats.h
+
+#include "NativeStats.h"
+
+#include <new>
+#include <new.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    namespace {
+      long long TicksPerSecond () {
+        static long long frequency = 0;
+        if (!frequency) {
+          LARGE_INTEGER value;
+          QueryPerformanceFrequency(&value);
+          frequency = value.QuadPart;
+        }
+        return frequency;
+      }
+
+      void InterlockedMax (volatile LONGLONG * target, long long value) {
+        LONGLONG current = *target;
+        while (value > current) {
+          LONGLONG previous = InterlockedCompareExchange64(target, value, current);
+          if (previous == current)
+            return;
+          current = previous;
+        }
+      }
+    }
+
+    const char * const NativeCallbackNames[CallbackCount] = {
+      "onAddressBarChanged",
+      "onStartLoading",
+      "onLoad",
+      "onLoadingStateChanged",
+      "onTitleChanged",
+      "onTooltipChanged",
+      "onProvisionalLoadError",
+      "onNavigationRequested",
+      "onConsoleMessage",
+      "onScriptAlert",
+      "onExternalHost",
+      "onCreatedWindow",
+      "onPaint",
+      "onWidgetCreated",
+      "onWidgetDestroyed",
+      "onWidgetMove",
+      "onWidgetResize",
+      "onWidgetPaint",
+      "onCursorUpdated",
+      "onShowContextMenu",
+      "onCrashed",
+      "onCrashedWorker",
+      "onCrashedPlugin",
+      "onUnresponsive",
+      "onResponsive"
+    };
+
+    NativeStatCounters NativeStatCounters::Process;
+    NativeLatencyHistogram NativeLatencyHistogram::Protocol;
+    NativeLatencyHistogram NativeLatencyHistogram::Input;
+
+    NativeStatCounters::NativeStatCounters ()
+      : mRefCount(1) {
+      for (int i = 0; i < StatCount; i++)
+        mValues[i] = 0;
+    }
+
+    void NativeStatCounters::addRef () {
+      InterlockedIncrement(&mRefCount);
+    }
+
+    void NativeStatCounters::release () {
+      if (InterlockedDecrement(&mRefCount) == 0)
+        delete this;
+    }
+
+    void NativeStatCounters::addDelivered (size_t copyRectCount, const ::Berkelium::Rect * copyRects) {
+      long long pixels = 0;
+      for (size_t i = 0; i < copyRectCount; i++)
+        pixels += (long long)copyRects[i].mWidth * copyRects[i].mHeight;
+
+      add(StatPaintsDelivered, 1);
+      add(StatPixelsDelivered, pixels);
+    }
+
+    NativeLatencyHistogram::NativeLatencyHistogram ()
+      : mCount(0)
+      , mTotal(0)
+      , mMax(0) {
+      for (int i = 0; i < BucketCount; i++)
+        mBuckets[i] = 0;
+    }
+
+    int NativeLatencyHistogram::bucketFor (long long microseconds) {
+      if (microseconds < 4)
+        return (microseconds < 0) ? 0 : (int)microseconds;
+
+      int highBit = 2;
+      while ((highBit < 62) && ((microseconds >> (highBit + 1)) != 0))
+        highBit++;
+
+      int result = (4 * (highBit - 1)) + (int)((microseconds >> (highBit - 2)) & 3);
+      return (result < BucketCount) ? result : BucketCount - 1;
+    }
+
+    long long NativeLatencyHistogram::bucketLimit (int bucket) {
+      if (bucket < 4)
+        return bucket + 1;
+
+      int highBit = (bucket / 4) + 1;
+      return (long long)(5 + (bucket % 4)) << (highBit - 2);
+    }
+
+    void NativeLatencyHistogram::record (long long microseconds) {
+      if (microseconds < 0)
+        microseconds = 0;
+
+      InterlockedIncrement64(&mBuckets[bucketFor(microseconds)]);
+      InterlockedIncrement64(&mCount);
+      InterlockedExchangeAdd64(&mTotal, microseconds);
+      InterlockedMax(&mMax, microseconds);
+    }
+
+    void NativeLatencyHistogram::recordSince (long long startTicks) {
+      record(NativeTicksToMicroseconds(NativeStatTicks() - startTicks));
+    }
+
+    long long NativeLatencyHistogram::bucket (int index) const {
+      return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(&mBuckets[index]), 0, 0);
+    }
+
+    long long NativeLatencyHistogram::count () const {
+      return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(&mCount), 0, 0);
+    }
+
+    long long NativeLatencyHistogram::total () const {
+      return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(&mTotal), 0, 0);
+    }
+
+    long long NativeLatencyHistogram::maximum () const {
+      return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(&mMax), 0, 0);
+    }
+
+    NativeInputLatency::NativeInputLatency ()
+      : mPendingCount(0)
+      , mNextSequence(1)
+      , mMouseX(0)
+      , mMouseY(0)
+      , mMouseKnown(false) {
+      InitializeCriticalSection(&mLock);
+    }
+
+    NativeInputLatency::~NativeInputLatency () {
+      DeleteCriticalSection(&mLock);
+    }
+
+    void NativeInputLatency::expire (NativeStatCounters * counters, long long now) {
+      long long timeout = (TicksPerSecond() * TimeoutMilliseconds) / 1000;
+
+      int kept = 0;
+      for (int i = 0; i < mPendingCount; i++) {
+        if (now - mPending[i].Ticks >= timeout)
+          counters->add(StatInputsUnpainted, 1);
+        else
+          mPending[kept++] = mPending[i];
+      }
+      mPendingCount = kept;
+    }
+
+    long long NativeInputLatency::add (NativeStatCounters * counters, bool positional, int x, int y) {
+      long long now = NativeStatTicks();
+      expire(counters, now);
+
+      // With the queue full, the oldest input is the least likely to be painted yet.
+      if (mPendingCount == MaxPending) {
+        counters->add(StatInputsUnpainted, 1);
+        memmove(&mPending[0], &mPending[1], sizeof(PendingInput) * (MaxPending - 1));
+        mPendingCount--;
+      }
+
+      PendingInput & input = mPending[mPendingCount++];
+      input.Sequence = mNextSequence++;
+      input.Ticks = now;
+      input.X = x;
+      input.Y = y;
+      input.Positional = positional;
+
+      counters->add(StatInputEvents, 1);
+      return input.Sequence;
+    }
+
+    long long NativeInputLatency::mouseMoved (NativeStatCounters * counters, int x, int y) {
+      EnterCriticalSection(&mLock);
+      mMouseX = x;
+      mMouseY = y;
+      mMouseKnown = true;
+      long long result = add(counters, true, x, y);
+      LeaveCriticalSection(&mLock);
+      return result;
+    }
+
+    long long NativeInputLatency::mouseButton (NativeStatCounters * counters) {
+      EnterCriticalSection(&mLock);
+      long long result = add(counters, mMouseKnown, mMouseX, mMouseY);
+      LeaveCriticalSection(&mLock);
+      return result;
+    }
+
+    long long NativeInputLatency::keyboard (NativeStatCounters * counters) {
+      EnterCriticalSection(&mLock);
+      long long result = add(counters, false, 0, 0);
+      LeaveCriticalSection(&mLock);
+      return result;
+    }
+
+    void NativeInputLatency::painted (NativeStatCounters * counters, size_t copyRectCount, const ::Berkelium::Rect * copyRects) {
+      EnterCriticalSection(&mLock);
+      if (mPendingCount == 0) {
+        LeaveCriticalSection(&mLock);
+        return;
+      }
+
+      long long now = NativeStatTicks();
+      expire(counters, now);
+
+      int kept = 0;
+      for (int i = 0; i < mPendingCount; i++) {
+        const PendingInput & input = mPending[i];
+
+        bool shown = !input.Positional;
+        for (size_t j = 0; !shown && (j < copyRectCount); j++) {
+          const ::Berkelium::Rect & rect = copyRects[j];
+          shown = (input.X >= rect.mLeft) && (input.X < rect.mLeft + rect.mWidth) &&
+            (input.Y >= rect.mTop) && (input.Y < rect.mTop + rect.mHeight);
+        }
+
+        if (shown) {
+          long long microseconds = NativeTicksToMicroseconds(now - input.Ticks);
+          mHistogram.record(microseconds);
+          NativeLatencyHistogram::Input.record(microseconds);
+        } else {
+          mPending[kept++] = input;
+        }
+      }
+      mPendingCount = kept;
+
+      LeaveCriticalSection(&mLock);
+    }
+
+    long long NativeStatTicks () {
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      return now.QuadPart;
+    }
+
+    long long NativeTicksToMicroseconds (long long ticks) {
+      long long frequency = TicksPerSecond();
+      return ((ticks / frequency) * 1000000) + (((ticks % frequency) * 1000000) / frequency);
+    }
+
+  }}
+
+// Replaces operator new for this module only, so that every native allocation the wrapper makes is counted.
+//  Berkelium and Chromium allocate from their own modules and aren't included.
+void * operator new (size_t size) {
+  using namespace Berkelium::Managed;
+
+  NativeStatCounters::Process.add(StatNativeAllocations, 1);
+  NativeStatCounters::Process.add(StatNativeBytesAllocated, (long long)size);
+
+  for (;;) {
+    void * result = malloc(size ? size : 1);
+    if (result)
+      return result;
+
+    if (!_callnewh(size))
+      throw std::bad_alloc();
+  }
+}
+
+void operator delete (void * pointer) {
+  free(pointer);
+}
@@ -0,0 +1,247 @@
+// NativeStats.h : counters for what the wrapper costs, cheap enough to leave on
+
+#pragma once
+
+#include <windows.h>
+#include <stddef.h>
+
+#include "berkelium/Rect.hpp"
+
+#include "NativeProfiler.h"
+
+namespace Berkelium {
+  namespace Managed {
+
+    // The WindowDelegate callbacks, in the order CallbackType lists them.
+    enum NativeCallback {
+      CallbackAddressBarChanged,
+      CallbackStartLoading,
+      CallbackLoad,
+      CallbackLoadingStateChanged,
+      CallbackTitleChanged,
+      CallbackTooltipChanged,
+      CallbackProvisionalLoadError,
+      CallbackNavigationRequested,
+      CallbackConsoleMessage,
+      CallbackScriptAlert,
+      CallbackExternalHost,
+      CallbackCreatedWindow,
+      CallbackPaint,
+      CallbackWidgetCreated,
+      CallbackWidgetDestroyed,
+      CallbackWidgetMove,
+      CallbackWidgetResize,
+      CallbackWidgetPaint,
+      CallbackCursorUpdated,
+      CallbackShowContextMenu,
+      CallbackCrashed,
+      CallbackCrashedWorker,
+      CallbackCrashedPlugin,
+      CallbackUnresponsive,
+      CallbackResponsive,
+      CallbackCount
+    };
+
+    // The callbacks' names, as profiler spans show them.
+    extern const char * const NativeCallbackNames[CallbackCount];
+
+    enum NativeStat {
+      // Kept per window (and per widget, for paints), and totalled for the process.
+      StatPaints,
+      StatPaintsDelivered,
+      StatPixelsDelivered,
+      StatScrollBlits,
+      StatCallbackTicks,
+      // Windows only, and totalled for the process.
+      StatInputEvents,
+      StatInputsUnpainted,
+      StatResizes,
+      StatResizesCoalesced,
+      // Process only.
+      StatUpdates,
+      StatUpdateTicks,
+      StatProtocolRequests,
+      StatProtocolBytes,
+      StatNativeAllocations,
+      StatNativeBytesAllocated,
+      // One per NativeCallback.
+      StatCallbacks,
+      StatCount = StatCallbacks + CallbackCount
+    };
+
+    // Every update is a single interlocked add, so any thread can count without taking a lock. A snapshot
+    //  reads the counters one at a time, so it can see one counter updated and the next one not yet.
+    class NativeStatCounters {
+      volatile LONGLONG mValues[StatCount];
+      volatile LONG mRefCount;
+
+      NativeStatCounters (const NativeStatCounters &);
+      NativeStatCounters & operator= (const NativeStatCounters &);
+
+    public:
+      // The totals for the process. Every other set of counters adds to these as well.
+      static NativeStatCounters Process;
+
+      NativeStatCounters ();
+
+      void addRef ();
+      void release ();
+
+      void add (int stat, long long value) {
+        InterlockedExchangeAdd64(&mValues[stat], value);
+        if (this != &Process)
+          InterlockedExchangeAdd64(&Process.mValues[stat], value);
+      }
+
+      long long read (int stat) const {
+        return InterlockedCompareExchange64(const_cast<volatile LONGLONG *>(&mValues[stat]), 0, 0);
+      }
+
+      // Counts a paint as it's delivered to handlers.
+      void addDelivered (size_t copyRectCount, const ::Berkelium::Rect * copyRects);
+    };
+
+    // A latency distribution with four buckets per doubling, from a microsecond to about two hours.
+    //  Recording is lock-free like NativeStatCounters.
+    class NativeLatencyHistogram {
+    public:
+      static const int BucketCount = 128;
+
+    private:
+      volatile LONGLONG mBuckets[BucketCount];
+      volatile LONGLONG mCount, mTotal, mMax;
+
+      NativeLatencyHistogram (const NativeLatencyHistogram &);
+      NativeLatencyHistogram & operator= (const NativeLatencyHistogram &);
+
+    public:
+      // How long custom protocol requests took to answer, for the whole process.
+      static NativeLatencyHistogram Protocol;
+      // How long input took to show up in a paint, for every window.
+      static NativeLatencyHistogram Input;
+
+      NativeLatencyHistogram ();
+
+      static int bucketFor (long long microseconds);
+      // The smallest latency, in microseconds, that falls after the bucket.
+      static long long bucketLimit (int bucket);
+
+      void record (long long microseconds);
+      void recordSince (long long startTicks);
+
+      long long bucket (int index) const;
+      long long count () const;
+      long long total () const;
+      long long maximum () const;
+    };
+
+    // A window's input, waiting to be shown by a paint: mouse input by a paint whose copy rects cover where the mouse
+    //  was, and keyboard input by any paint. Input that nothing paints within the timeout is given up on.
+    class NativeInputLatency {
+    public:
+      static const int MaxPending = 64;
+      static const int TimeoutMilliseconds = 1000;
+
+    private:
+      struct PendingInput {
+        long long Sequence, Ticks;
+        int X, Y;
+        bool Positional;
+      };
+
+      CRITICAL_SECTION mLock;
+      PendingInput mPending[MaxPending];
+      int mPendingCount;
+      long long mNextSequence;
+      int mMouseX, mMouseY;
+      bool mMouseKnown;
+      NativeLatencyHistogram mHistogram;
+
+      NativeInputLatency (const NativeInputLatency &);
+      NativeInputLatency & operator= (const NativeInputLatency &);
+
+      // These expect mLock to be held.
+      void expire (NativeStatCounters * counters, long long now);
+      long long add (NativeStatCounters * counters, bool positional, int x, int y);
+
+    public:
+      NativeInputLatency ();
+      ~NativeInputLatency ();
+
+      // Each returns the input's sequence number. A button lands wherever the mouse last moved to.
+      long long mouseMoved (NativeStatCounters * counters, int x, int y);
+      long long mouseButton (NativeStatCounters * counters);
+      long long keyboard (NativeStatCounters * counters);
+
+      // Called as a paint is delivered to handlers.
+      void painted (NativeStatCounters * counters, size_t copyRectCount, const ::Berkelium::Rect * copyRects);
+
+      const NativeLatencyHistogram & histogram () const { return mHistogram; }
+    };
+
+    // QueryPerformanceCounter ticks, the same ones System.Diagnostics.Stopwatch counts.
+    long long NativeStatTicks ();
+    long long NativeTicksToMicroseconds (long long ticks);
+
+    // Adds the time spent in the enclosing block to a counter. The counters are kept alive until
+    //  it's done, in case something in the block (a handler, usually) destroys their window.
+    class NativeTimeScope {
+      NativeStatCounters * mCounters;
+      int mStat;
+      long long mStart;
+
+      NativeTimeScope (const NativeTimeScope &);
+      NativeTimeScope & operator= (const NativeTimeScope &);
+
+    public:
+      NativeTimeScope (NativeStatCounters * counters, int stat)
+        : mCounters(counters)
+        , mStat(stat)
+        , mStart(NativeStatTicks()) {
+        counters->addRef();
+      }
+
+      ~NativeTimeScope () {
+        mCounters->add(mStat, NativeStatTicks() - mStart);
+        mCounters->release();
+      }
+    };
+
+    // Counts a callback, and the time spent in it (handlers included), toward a window's counters,
+    //  and records it as a profiler span.
+    class NativeCallbackScope : NativeTimeScope {
+      NativeProfileScope mSpan;
+
+    public:
+      NativeCallbackScope (NativeStatCounters * counters, NativeCallback callback)
+        : NativeTimeScope(counters, StatCallbackTicks)
+        , mSpan("callback", NativeCallbackNames[callback]) {
+        counters->add(StatCallbacks + callback, 1);
+      }
+    };
+
+    // Records how long the enclosing block took into a histogram, unless it's cancelled first.
+    class NativeLatencyScope {
+      NativeLatencyHistogram * mHistogram;
+      long long mStart;
+
+      NativeLatencyScope (const NativeLatencyScope &);
+      NativeLatencyScope & operator= (const NativeLatencyScope &);
+
+    public:
+      NativeLatencyScope (NativeLatencyHistogram & histogram)
+        : mHistogram(&histogram)
+        , mStart(NativeStatTicks()) {
+      }
+
+      ~NativeLatencyScope () {
+        if (mHistogram)
+          mHistogram->recordSince(mStart);
+      }
+
+      void cancel () {
+        mHistogram = 0;
+      }
+    };
+
+  }}
@@ -0,0 +1,125 @@
+// NativeStrings.cpp : compiled as native code; see NativeStrings.h
+
+#include "NativeStrings.h"
+
+#include <emmintrin.h>
+#include <string.h>
+#include <wchar.h>
+
+namespace Berkelium {
+  namespace Managed {
+
+    size_t NarrowAscii (const wchar_t * text, size_t length, char * output) {
+      size_t i = 0;
+
+      // The vector loop expects UTF-16 code units; wider wchar_t (as on Linux, for the benchmarks) takes the plain loop.
+#if WCHAR_MAX <= 0xFFFF
+      const __m128i nonAsciiBits = _mm_set1_epi16((short)0xFF80);
+      const __m128i zero = _mm_setzero_si128();
+
+      for (; i + 16 <= length; i += 16) {
+        __m128i low = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i high = _mm_loadu_si128((const __m128i *)(text + i + 8));
+        __m128i nonAscii = _mm_and_si128(_mm_or_si128(low, high), nonAsciiBits);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(nonAscii, zero)) != 0xFFFF)
+          break;
+
+        _mm_storeu_si128((__m128i *)(output + i), _mm_packus_epi16(low, high));
+      }
+#endif
+
+      for (; i < length; i++) {
+        if (text[i] >= 0x80)
+          break;
+
+        output[i] = (char)text[i];
+      }
+
+      return i;
+    }
+
+    namespace {
+      const char HexDigits[] = "0123456789ABCDEF";
+
+      inline void AppendEscapedByte (std::string & output, unsigned char value) {
+        char escaped[3] = { '%', HexDigits[value >> 4], HexDigits[value & 0xF] };
+        output.append(escaped, 3);
+      }
+    }
+
+    void AppendPercentEncodedUtf8 (const wchar_t * text, size_t length, std::string & output) {
+      output.reserve(output.length() + length);
+
+      for (size_t i = 0; i < length; i++) {
+        unsigned int codepoint = text[i];
+
+        if (codepoint < 0x80) {
+          output.push_back((char)codepoint);
+          continue;
+        }
+
+        if ((codepoint >= 0xD800) && (codepoint <= 0xDBFF) && (i + 1 < length) &&
+            (text[i + 1] >= 0xDC00) && (text[i + 1] <= 0xDFFF)) {
+          codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (text[i + 1] - 0xDC00);
+          i += 1;
+        } else if ((codepoint >= 0xD800) && (codepoint <= 0xDFFF)) {
+          codepoint = 0xFFFD;
+        }
+
+        if (codepoint < 0x800) {
+          AppendEscapedByte(output, (unsigned char)(0xC0 | (codepoint >> 6)));
+          AppendEscapedByte(output, (unsigned char)(0x80 | (codepoint & 0x3F)));
+        } else if (codepoint < 0x10000) {
+          AppendEscapedByte(output, (unsigned char)(0xE0 | (codepoint >> 12)));
+          AppendEscapedByte(output, (unsigned char)(0x80 | ((codepoint >> 6) & 0x3F)));
+          AppendEscapedByte(output, (unsigned char)(0x80 | (codepoint & 0x3F)));
+        } else {
+          AppendEscapedByte(output, (unsigned char)(0xF0 | (codepoint >> 18)));
+          AppendEscapedByte(output, (unsigned char)(0x80 | ((codepoint >> 12) & 0x3F)));
+          AppendEscapedByte(output, (unsigned char)(0x80 | ((codepoint >> 6) & 0x3F)));
+          AppendEscapedByte(output, (unsigned char)(0x80 | (codepoint & 0x3F)));
+        }
+      }
+    }
+
+    bool HasHeader (const char * headers, size_t length, const char * name) {
+      size_t nameLength = strlen(name);
+      size_t lineStart = 0;
+
+      while (lineStart < length) {
+        size_t lineEnd = lineStart;
+        while ((lineEnd < length) && (headers[lineEnd] != 0))
+          lineEnd++;
+
+        if ((lineEnd - lineStart > nameLength) && (headers[lineStart + nameLength] == ':')) {
+          size_t i = 0;
+          for (; i < nameLength; i++) {
+            char a = headers[lineStart + i], b = name[i];
+            if ((a >= 'A') && (a <= 'Z'))
+              a += 'a' - 'A';
+            if ((b >= 'A') && (b <= 'Z'))
+              b += 'a' - 'A';
+            if (a != b)
+              break;
+          }
+
+          if (i == nameLength)
+            return true;
+        }
+
+        lineStart = lineEnd + 1;
+      }
+
+      return false;
+    }
+
+    bool IsConditionalRequest (const char * requestHeaders, size_t requestHeadersLength) {
+      return requestHeaders && (
+        HasHeader(requestHeaders, requestHeadersLength, "Range") ||
+        HasHeader(requestHeaders, requestHeadersLength, "If-None-Match") ||
+        HasHeader(requestHeaders, requestHeadersLength, "If-Modified-Since")
+      );
+    }
+
+  }}
@@ -0,0 +1,27 @@
+// NativeStrings.h : string conversions that are compiled as native code
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+namespace Berkelium {
+  namespace Managed {
+
+    // Copies UTF-16 text into an 8-bit buffer for as long as it stays ASCII, sixteen characters at a time.
+    // Returns the number of characters copied, so text[result] is the first non-ASCII character (if any).
+    size_t NarrowAscii (const wchar_t * text, size_t length, char * output);
+
+    // Appends text to output as UTF-8, percent-escaping every byte that isn't ASCII.
+    // Unpaired surrogates are encoded as U+FFFD.
+    void AppendPercentEncodedUtf8 (const wchar_t * text, size_t length, std::string & output);
+
+    // Returns true if a block of null-separated "Name: value" header lines contains the named header.
+    // Names are compared without regard to ASCII case.
+    bool HasHeader (const char * headers, size_t length, const char * name);
+
+    // Returns true if the request asks for a range or revalidates a copy it already holds. The response
+    //  cache only holds whole, unconditional responses, so these are always left to ProtocolHandler.
+    bool IsConditionalRequest (const char * requestHeaders, size_t requestHeadersLength);
+
+  }}
@@ -0,0 +1,506 @@
+// PumpThread.cpp : see PumpThread.h
+
+#include "stdafx.h"
+
+#include "BerkeliumSharp.h"
+
+using namespace System::Threading;
+using namespace System::Diagnostics;
+
+namespace Berkelium {
+  namespace Managed {
+
+    void PumpThread::Start (String ^ homeDirectory) {
+      if (Running)
+        return;
+
+      HomeDirectory = homeDirectory;
+      Commands = gcnew SpscQueue<PumpCommand>(CommandCapacity);
+      Events = gcnew SpscQueue<PumpEvent>(EventCapacity);
+      CommandsPosted = gcnew AutoResetEvent(false);
+      EventsQueued = gcnew AutoResetEvent(false);
+      Startup = gcnew PumpCall();
+
+      Worker = gcnew System::Threading::Thread(gcnew ThreadStart(&PumpThread::Run));
+      Worker->Name = "Berkelium Pump";
+      Worker->IsBackground = true;
+
+      UiThreadId = System::Threading::Thread::CurrentThread->ManagedThreadId;
+      PumpThreadId = Worker->ManagedThreadId;
+      Running = true;
+
+      Worker->Start();
+
+      // Berkelium has to be initialized on the thread that pumps it, so wait for that to finish
+      //  (or fail) before letting the caller create any windows.
+      Wait(Startup);
+
+      if (Startup->Error != nullptr) {
+        Running = false;
+        Worker->Join();
+        Worker = nullptr;
+        throw gcnew InvalidOperationException("Berkelium failed to initialize on the pump thread.", Startup->Error);
+      }
+    }
+
+    void PumpThread::Stop () {
+      if (!Running)
+        return;
+
+      Send(nullptr, PumpCommandKind::Shutdown);
+      Worker->Join();
+      Worker = nullptr;
+
+      // Anything still queued refers to windows that no longer exist.
+      PumpEvent evt;
+      while (Events->TryDequeue(evt))
+        ;
+    }
+
+    void PumpThread::Run () {
+      NativeProfiler::nameThread("Berkelium Pump");
+
+      try {
+        BerkeliumSharp::InitNative(HomeDirectory);
+      } catch (Exception ^ error) {
+        Complete(Startup, nullptr, error);
+        return;
+      }
+
+      Complete(Startup, nullptr, nullptr);
+
+      while (Running) {
+        PumpCommand command;
+        while (Running && Commands->TryDequeue(command))
+          Execute(command);
+
+        if (!Running)
+          break;
+
+        BerkeliumSharp::UpdateNative();
+
+        if (Commands->Count == 0)
+          BerkeliumSharp::WaitForWork(TimeSpan::FromMilliseconds(IdleTimeoutMilliseconds), CommandsPosted);
+      }
+    }
+
+    void PumpThread::CheckUiThread () {
+      if (Thread::CurrentThread->ManagedThreadId != UiThreadId)
+        throw gcnew InvalidOperationException(
+          "While the pump thread is running, Berkelium may only be used from the thread that called BerkeliumSharp.Init."
+        );
+    }
+
+    bool PumpThread::Post (PumpCommand % command) {
+      CheckUiThread();
+
+      // The queue only fills up if the pump thread is stuck inside a single update,
+      //  in which case there is nothing better to do than wait for it.
+      while (!Commands->TryEnqueue(command))
+        Thread::Sleep(0);
+
+      if (Commands->Count == 1)
+        CommandsPosted->Set();
+
+      return true;
+    }
+
+    Object ^ PumpThread::Send (PumpCommand % command) {
+      if (!MustMarshal) {
+        // Already on the right thread (or there is no pump thread), so just do it.
+        command.Call = gcnew PumpCall();
+        Execute(command);
+      } else {
+        if (PaintDispatchDepth > 0)
+          throw gcnew InvalidOperationException(
+            "Paint handlers hold the window's paint lock, so they cannot wait on the pump thread. Only input and navigation calls are allowed while handling a paint."
+          );
+
+        command.Call = gcnew PumpCall();
+        Post(command);
+        Wait(command.Call);
+      }
+
+      if (command.Call->Error != nullptr)
+        throw gcnew InvalidOperationException("A call on the Berkelium pump thread failed.", command.Call->Error);
+
+      return command.Call->Result;
+    }
+
+    void PumpThread::Complete (PumpCall ^ call, Object ^ result, Exception ^ error) {
+      Monitor::Enter(call);
+      try {
+        call->Result = result;
+        call->Error = error;
+        call->Done = true;
+        Monitor::PulseAll(call);
+      } finally {
+        Monitor::Exit(call);
+      }
+    }
+
+    void PumpThread::Wait (PumpCall ^ call) {
+      Monitor::Enter(call);
+      try {
+        while (!call->Done) {
+          // If the event queue is full the pump thread is blocked on us, so make room
+          //  for it instead of waiting forever.
+          if (Events->IsFull && (Thread::CurrentThread->ManagedThreadId == UiThreadId)) {
+            Monitor::Exit(call);
+            try {
+              PumpEvent evt;
+              if (Events->TryDequeue(evt))
+                Dispatch(evt);
+            } finally {
+              Monitor::Enter(call);
+            }
+            continue;
+          }
+
+          Monitor::Wait(call, IntervalMilliseconds);
+        }
+      } finally {
+        Monitor::Exit(call);
+      }
+    }
+
+    void PumpThread::Execute (PumpCommand % command) {
+      Object ^ result = nullptr;
+      Exception ^ error = nullptr;
+
+      try {
+        Window ^ window = dynamic_cast<Window ^>(command.Target);
+        Widget ^ widget = dynamic_cast<Widget ^>(command.Target);
+        Context ^ context = dynamic_cast<Context ^>(command.Target);
+
+        // The target may have been disposed after the command was posted.
+        bool disposed = (window && !window->Native && (command.Kind != PumpCommandKind::CreateWindow)) ||
+          (widget && !widget->Native) || (context && !context->Native);
+
+        if (disposed) {
+          if (command.Call)
+            Complete(command.Call, nullptr, nullptr);
+          return;
+        }
+
+        switch (command.Kind) {
+          case PumpCommandKind::KeyEvent:
+            if (widget)
+              widget->Native->keyEvent(command.A != 0, command.B, command.C, command.D);
+            else
+              window->Native->keyEvent(command.A != 0, command.B, command.C, command.D);
+            break;
+          case PumpCommandKind::TextEvent: {
+            WideStringHelper textPtr (command.Text);
+            if (widget)
+              widget->Native->textEvent(textPtr.mData, textPtr.mLength);
+            else
+              window->Native->textEvent(textPtr.mData, textPtr.mLength);
+            break;
+          }
+          case PumpCommandKind::MouseButton:
+            if (widget)
+              widget->Native->mouseButton((unsigned)command.A, command.B != 0);
+            else
+              window->Native->mouseButton((unsigned)command.A, command.B != 0);
+            break;
+          case PumpCommandKind::MouseMoved:
+            if (widget)
+              widget->Native->mouseMoved(command.A, command.B);
+            else
+              window->Native->mouseMoved(command.A, command.B);
+            break;
+          case PumpCommandKind::MouseWheel:
+            if (widget)
+              widget->Native->mouseWheel(command.A, command.B);
+            else
+              window->Native->mouseWheel(command.A, command.B);
+            break;
+          case PumpCommandKind::Focus:
+            if (widget)
+              widget->Native->focus();
+            else
+              window->Native->focus();
+            break;
+          case PumpCommandKind::Unfocus:
+            if (widget)
+              widget->Native->unfocus();
+            else
+              window->Native->unfocus();
+            break;
+          case PumpCommandKind::Move:
+            widget->Native->setPos(command.A, command.B);
+            break;
+          case PumpCommandKind::NavigateTo: {
+            URLStringHelper urlPtr (command.Text);
+            window->Native->navigateTo(urlPtr);
+            break;
+          }
+          case PumpCommandKind::GoBack:
+            window->Native->goBack();
+            break;
+          case PumpCommandKind::GoForward:
+            window->Native->goForward();
+            break;
+          case PumpCommandKind::AdjustZoom:
+            window->Native->adjustZoom(command.A);
+            break;
+          case PumpCommandKind::ExecuteJavascript: {
+            window->FlushJavascriptNative();
+            WideStringHelper scriptPtr (command.Text);
+            window->Native->executeJavascript(scriptPtr);
+            break;
+          }
+          case PumpCommandKind::FlushJavascript:
+            window->FlushJavascriptNative();
+            break;
+          case PumpCommandKind::FlushInput:
+            window->FlushInputNative();
+            break;
+          case PumpCommandKind::InsertCSS: {
+            WideStringHelper cssPtr (command.Text);
+            if (command.Text2 == nullptr)
+              window->Native->insertCSS(cssPtr, WideString::empty());
+            else {
+              WideStringHelper idPtr (command.Text2);
+              window->Native->insertCSS(cssPtr, idPtr);
+            }
+            break;
+          }
+          case PumpCommandKind::Refresh:
+            window->Native->refresh();
+            break;
+          case PumpCommandKind::Stop:
+            window->Native->stop();
+            break;
+          case PumpCommandKind::Cut:
+            window->Native->cut();
+            break;
+          case PumpCommandKind::Copy:
+            window->Native->copy();
+            break;
+          case PumpCommandKind::Paste:
+            window->Native->paste();
+            break;
+          case PumpCommandKind::Undo:
+            window->Native->undo();
+            break;
+          case PumpCommandKind::Redo:
+            window->Native->redo();
+            break;
+          case PumpCommandKind::DeleteSelection:
+            window->Native->del();
+            break;
+          case PumpCommandKind::SelectAll:
+            window->Native->selectAll();
+            break;
+          case PumpCommandKind::FlushResize:
+            window->FlushResizeNative();
+            break;
+          case PumpCommandKind::SetTransparent:
+            window->Native->setTransparent(command.A != 0);
+            break;
+
+          case PumpCommandKind::GetId:
+            result = widget ? widget->Native->getId() : window->Native->getId();
+            break;
+          case PumpCommandKind::GetRect: {
+            ::Berkelium::Rect rect = widget ? widget->Native->getRect() : window->Native->getWidget()->getRect();
+            result = gcnew Rect(rect.mLeft, rect.mTop, rect.mWidth, rect.mHeight);
+            break;
+          }
+          case PumpCommandKind::CanGoBack:
+            result = window->Native->canGoBack();
+            break;
+          case PumpCommandKind::CanGoForward:
+            result = window->Native->canGoForward();
+            break;
+          case PumpCommandKind::GetWidget:
+            result = window->Wrapper->GetWidget(window->Native->getWidget(), false);
+            break;
+          case PumpCommandKind::GetWidgetAtPoint: {
+            ::Berkelium::Widget * ptr = window->Native->getWidgetAtPoint(command.A, command.B, command.C != 0);
+            if (ptr)
+              result = window->Wrapper->GetWidget(ptr, false);
+            break;
+          }
+          case PumpCommandKind::CreateContext:
+            result = Context::CreateNative();
+            break;
+          case PumpCommandKind::CloneContext:
+            result = context->CloneNative();
+            break;
+          case PumpCommandKind::DestroyContext:
+            context->DestroyNative();
+            break;
+          case PumpCommandKind::CreateWindow:
+            window->CreateNative();
+            break;
+          case PumpCommandKind::DestroyWindow:
+            window->DestroyNative();
+            break;
+          case PumpCommandKind::RebindWindow:
+            result = window->RebindNative();
+            break;
+          case PumpCommandKind::DestroyWidget:
+            widget->DestroyNative();
+            break;
+          case PumpCommandKind::SetUseBackingStore:
+            window->SetUseBackingStoreNative(command.A != 0);
+            break;
+          case PumpCommandKind::SetCoalescePaints:
+            window->SetCoalescePaintsNative(command.A != 0);
+            break;
+          case PumpCommandKind::UpdateEventTrace:
+            window->UpdateEventTraceNative();
+            break;
+          case PumpCommandKind::Shutdown:
+            BerkeliumSharp::DestroyNative();
+            Running = false;
+            break;
+        }
+      } catch (Exception ^ e) {
+        error = e;
+      }
+
+      if (command.Call) {
+        Complete(command.Call, result, error);
+      } else if (error) {
+        // Nobody is waiting for a posted command, so hand the failure to the UI thread.
+        PumpEvent evt;
+        evt.Kind = PumpEventKind::Error;
+        evt.Payload = error;
+        Defer(evt);
+      }
+    }
+
+    bool PumpThread::Defer (PumpEvent % evt) {
+      if (!IsPumpThread)
+        return false;
+
+      // Back-pressure: if the UI thread stops draining events, the pump stops pumping.
+      while (!Events->TryEnqueue(evt)) {
+        if (!Running)
+          return true;
+
+        Thread::Sleep(1);
+      }
+
+      if (Events->Count == 1) {
+        EventsQueued->Set();
+        BerkeliumSharp::OnEventsAvailable();
+      }
+
+      return true;
+    }
+
+    bool PumpThread::DispatchEvents (TimeSpan budget) {
+      CheckUiThread();
+
+      Int64 deadline = Int64::MaxValue;
+      if (budget < TimeSpan::MaxValue)
+        deadline = Stopwatch::GetTimestamp() + (Int64)(budget.TotalSeconds * Stopwatch::Frequency);
+
+      PumpEvent evt;
+      while (Events->TryDequeue(evt)) {
+        Dispatch(evt);
+
+        if (Stopwatch::GetTimestamp() >= deadline)
+          break;
+      }
+
+      return Events->Count > 0;
+    }
+
+    bool PumpThread::Update (TimeSpan maxWait, TimeSpan budget) {
+      CheckUiThread();
+
+      if (Events->Count == 0)
+        EventsQueued->WaitOne(BerkeliumSharp::ToTimeout(maxWait), false);
+
+      return DispatchEvents(budget);
+    }
+
+    void PumpThread::Dispatch (PumpEvent % evt) {
+      Window ^ window = evt.Source;
+
+      if (evt.Kind == PumpEventKind::Error)
+        throw gcnew InvalidOperationException("A call on the Berkelium pump thread failed.", safe_cast<Exception ^>(evt.Payload));
+
+      if (!window || !window->Native)
+        return;
+
+      // Coalesced paints count their own handler time.
+      if (evt.Kind == PumpEventKind::FlushPaints) {
+        window->FlushCoalescedPaints();
+        return;
+      }
+
+      NativeProfileScope span ("callback", "PumpThread::Dispatch");
+      NativeTimeScope handlerTime (window->Counters, StatCallbackTicks);
+
+      switch (evt.Kind) {
+        case PumpEventKind::AddressBarChanged:
+          window->OnAddressBarChanged(evt.Text);
+          break;
+        case PumpEventKind::StartLoading:
+          window->OnStartLoading(evt.Text);
+          break;
+        case PumpEventKind::Load:
+          window->OnLoad();
+          break;
+        case PumpEventKind::ProvisionalLoadError:
+          window->OnProvisionalLoadError(evt.Text, evt.A, evt.B != 0);
+          break;
+        case PumpEventKind::Crashed:
+          window->OnCrashed();
+          break;
+        case PumpEventKind::Unresponsive:
+          window->OnUnresponsive();
+          break;
+        case PumpEventKind::Responsive:
+          window->OnResponsive();
+          break;
+        case PumpEventKind::CrashedWorker:
+          window->OnCrashedWorker();
+          break;
+        case PumpEventKind::CrashedPlugin:
+          window->OnCrashedPlugin(evt.Text);
+          break;
+        case PumpEventKind::ConsoleMessage:
+          window->OnConsoleMessage(evt.Text, evt.Text2, evt.A);
+          break;
+        case PumpEventKind::CreatedWindow:
+          window->OnCreatedWindow(safe_cast<Window ^>(evt.Target), safe_cast<Rect ^>(evt.Payload), gcnew String("", 0, 0));
+          break;
+        case PumpEventKind::CursorChanged:
+          window->OnCursorChanged(evt.Handle);
+          break;
+        case PumpEventKind::WidgetCreated:
+          window->OnWidgetCreated(safe_cast<Widget ^>(evt.Target), evt.A);
+          break;
+        case PumpEventKind::WidgetDestroyed:
+          window->OnWidgetDestroyed(safe_cast<Widget ^>(evt.Target));
+          break;
+        case PumpEventKind::WidgetResized:
+          window->OnWidgetResized(safe_cast<Widget ^>(evt.Target), evt.A, evt.B);
+          break;
+        case PumpEventKind::WidgetMoved:
+          window->OnWidgetMoved(safe_cast<Widget ^>(evt.Target), evt.A, evt.B);
+          break;
+        case PumpEventKind::LoadingStateChanged:
+          window->OnLoadingStateChanged(evt.A != 0);
+          break;
+        case PumpEventKind::TitleChanged:
+          window->OnTitleChanged(evt.Text);
+          break;
+        case PumpEventKind::TooltipChanged:
+          window->OnTooltipChanged(evt.Text);
+          break;
+        case PumpEventKind::ShowContextMenu:
+          window->OnShowContextMenu(safe_cast<ContextMenuEventArgs ^>(evt.Payload));
+          break;
+      }
+    }
+
+  }}
@@ -0,0 +1,309 @@
+// PumpThread.h : runs the Berkelium message pump on a dedicated thread
+
+#pragma once
+
+namespace Berkelium {
+  namespace Managed {
+
+    ref class Window;
+
+    // A bounded single-producer, single-consumer ring buffer. Neither side ever takes a lock:
+    //  the producer publishes an item by advancing Tail, and the consumer frees its slot by advancing Head.
+    template <typename T>
+    ref class SpscQueue {
+      array<T> ^ Items;
+      int Mask;
+      int Head, Tail;
+
+    public:
+      // The capacity must be a power of two.
+      SpscQueue (int capacity)
+        : Items(gcnew array<T>(capacity))
+        , Mask(capacity - 1) {
+      }
+
+      property int Count {
+        int get () {
+          return System::Threading::Thread::VolatileRead(Tail) - System::Threading::Thread::VolatileRead(Head);
+        }
+      }
+
+      property bool IsFull {
+        bool get () {
+          return Count >= Items->Length;
+        }
+      }
+
+      // Producer only.
+      bool TryEnqueue (T % item) {
+        int tail = Tail;
+        if ((tail - System::Threading::Thread::VolatileRead(Head)) >= Items->Length)
+          return false;
+
+        Items[tail & Mask] = item;
+        System::Threading::Thread::VolatileWrite(Tail, tail + 1);
+        return true;
+      }
+
+      // Consumer only.
+      bool TryDequeue (T % item) {
+        int head = Head;
+        if (head == System::Threading::Thread::VolatileRead(Tail))
+          return false;
+
+        item = Items[head & Mask];
+        // Don't keep the item's strings and objects alive until the slot is reused.
+        Items[head & Mask] = T();
+        System::Threading::Thread::VolatileWrite(Head, head + 1);
+        return true;
+      }
+    };
+
+    // Filled in on the pump thread for commands that the UI thread waits on.
+    ref class PumpCall {
+    public:
+      bool Done;
+      System::Object ^ Result;
+      System::Exception ^ Error;
+    };
+
+    enum class PumpCommandKind {
+      // Posted; the UI thread does not wait for these.
+      KeyEvent,
+      TextEvent,
+      MouseButton,
+      MouseMoved,
+      MouseWheel,
+      Focus,
+      Unfocus,
+      Move,
+      NavigateTo,
+      GoBack,
+      GoForward,
+      AdjustZoom,
+      ExecuteJavascript,
+      FlushJavascript,
+      FlushInput,
+      InsertCSS,
+      Refresh,
+      Stop,
+      Cut,
+      Copy,
+      Paste,
+      Undo,
+      Redo,
+      DeleteSelection,
+      SelectAll,
+      FlushResize,
+      SetTransparent,
+
+      // Sent; the UI thread blocks until the pump thread has executed them.
+      GetId,
+      GetRect,
+      CanGoBack,
+      CanGoForward,
+      GetWidget,
+      GetWidgetAtPoint,
+      CreateContext,
+      CloneContext,
+      DestroyContext,
+      CreateWindow,
+      DestroyWindow,
+      RebindWindow,
+      DestroyWidget,
+      SetUseBackingStore,
+      SetCoalescePaints,
+      UpdateEventTrace,
+      Shutdown
+    };
+
+    value struct PumpCommand {
+      PumpCommandKind Kind;
+      // A Window, Widget or Context, depending on the kind.
+      System::Object ^ Target;
+      int A, B, C, D;
+      System::String ^ Text, ^ Text2;
+      PumpCall ^ Call;
+    };
+
+    enum class PumpEventKind {
+      AddressBarChanged,
+      StartLoading,
+      Load,
+      ProvisionalLoadError,
+      Crashed,
+      Unresponsive,
+      Responsive,
+      CrashedWorker,
+      CrashedPlugin,
+      ConsoleMessage,
+      CreatedWindow,
+      CursorChanged,
+      WidgetCreated,
+      WidgetDestroyed,
+      WidgetResized,
+      WidgetMoved,
+      LoadingStateChanged,
+      TitleChanged,
+      TooltipChanged,
+      ShowContextMenu,
+      FlushPaints,
+      Error
+    };
+
+    value struct PumpEvent {
+      PumpEventKind Kind;
+      Window ^ Source;
+      // The widget or new window the event is about, if any.
+      System::Object ^ Target;
+      // Any other object the event carries (a Rect, ContextMenuEventArgs or Exception).
+      System::Object ^ Payload;
+      System::String ^ Text, ^ Text2;
+      int A, B;
+      System::IntPtr Handle;
+    };
+
+    // Owns the thread that Berkelium is initialized on and pumped from when BerkeliumSharp.Init is
+    //  asked to use one. Only the pump thread ever calls into Berkelium; the thread that called Init
+    //  (the UI thread) talks to it through a pair of lock-free queues.
+    ref class PumpThread abstract sealed {
+    internal:
+      literal int CommandCapacity = 4096;
+      literal int EventCapacity = 16384;
+      literal int IntervalMilliseconds = 5;
+      // The pump thread sleeps until Chromium or the UI thread wakes it. This is only a safety net.
+      literal int IdleTimeoutMilliseconds = 1000;
+
+      static volatile bool Running;
+      static int UiThreadId, PumpThreadId;
+      static int PaintDispatchDepth;
+      static System::String ^ HomeDirectory;
+      static System::Threading::Thread ^ Worker;
+      static System::Threading::AutoResetEvent ^ CommandsPosted;
+      static System::Threading::AutoResetEvent ^ EventsQueued;
+      static SpscQueue<PumpCommand> ^ Commands;
+      static SpscQueue<PumpEvent> ^ Events;
+      static PumpCall ^ Startup;
+
+      static property bool IsRunning {
+        bool get () {
+          return Running;
+        }
+      }
+
+      static property bool IsPumpThread {
+        bool get () {
+          return Running && (System::Threading::Thread::CurrentThread->ManagedThreadId == PumpThreadId);
+        }
+      }
+
+      // True if a call into Berkelium from the current thread has to be marshalled to the pump thread.
+      static property bool MustMarshal {
+        bool get () {
+          return Running && (System::Threading::Thread::CurrentThread->ManagedThreadId != PumpThreadId);
+        }
+      }
+
+      static void Start (System::String ^ homeDirectory);
+      static void Stop ();
+      static void Run ();
+
+      static bool Post (PumpCommand % command);
+      static System::Object ^ Send (PumpCommand % command);
+      static void Execute (PumpCommand % command);
+
+      static bool Defer (PumpEvent % evt);
+      static bool DispatchEvents (System::TimeSpan budget);
+      static bool Update (System::TimeSpan maxWait, System::TimeSpan budget);
+      static void Dispatch (PumpEvent % evt);
+
+      static void CheckUiThread ();
+      static void Complete (PumpCall ^ call, System::Object ^ result, System::Exception ^ error);
+      static void Wait (PumpCall ^ call);
+
+      static bool Post (System::Object ^ target, PumpCommandKind kind) {
+        return Post(target, kind, 0, 0, 0, 0);
+      }
+
+      static bool Post (System::Object ^ target, PumpCommandKind kind, int a, int b) {
+        return Post(target, kind, a, b, 0, 0);
+      }
+
+      static bool Post (System::Object ^ target, PumpCommandKind kind, int a, int b, int c, int d) {
+        if (!MustMarshal)
+          return false;
+
+        PumpCommand command;
+        command.Kind = kind;
+        command.Target = target;
+        command.A = a;
+        command.B = b;
+        command.C = c;
+        command.D = d;
+        return Post(command);
+      }
+
+      static bool Post (System::Object ^ target, PumpCommandKind kind, System::String ^ text, System::String ^ text2) {
+        if (!MustMarshal)
+          return false;
+
+        PumpCommand command;
+        command.Kind = kind;
+        command.Target = target;
+        command.Text = text;
+        command.Text2 = text2;
+        return Post(command);
+      }
+
+      static System::Object ^ Send (System::Object ^ target, PumpCommandKind kind) {
+        return Send(target, kind, 0, 0, 0);
+      }
+
+      static System::Object ^ Send (System::Object ^ target, PumpCommandKind kind, int a, int b, int c) {
+        PumpCommand command;
+        command.Kind = kind;
+        command.Target = target;
+        command.A = a;
+        command.B = b;
+        command.C = c;
+        return Send(command);
+      }
+
+      static bool Defer (Window ^ source, PumpEventKind kind) {
+        return Defer(source, kind, (System::String ^)nullptr, (System::String ^)nullptr, 0, 0);
+      }
+
+      static bool Defer (Window ^ source, PumpEventKind kind, System::String ^ text) {
+        return Defer(source, kind, text, (System::String ^)nullptr, 0, 0);
+      }
+
+      static bool Defer (Window ^ source, PumpEventKind kind, System::String ^ text, System::String ^ text2, int a, int b) {
+        if (!IsPumpThread)
+          return false;
+
+        PumpEvent evt;
+        evt.Kind = kind;
+        evt.Source = source;
+        evt.Text = text;
+        evt.Text2 = text2;
+        evt.A = a;
+        evt.B = b;
+        return Defer(evt);
+      }
+
+      static bool Defer (Window ^ source, PumpEventKind kind, System::Object ^ target, System::Object ^ payload, int a, int b) {
+        if (!IsPumpThread)
+          return false;
+
+        PumpEvent evt;
+        evt.Kind = kind;
+        evt.Source = source;
+        evt.Target = target;
+        evt.Payload = payload;
+        evt.A = a;
+        evt.B = b;
+        return Defer(evt);
+      }
+    };
+
+  }}
@@ -20,5 +20,5 @@
 #include <msclr\gcroot.h>
 #include <msclr\auto_gcroot.h>
 #include <msclr\auto_handle.h>
-#include <map>
+#include <msclr\lock.h>
 
@@ -19,7 +19,8 @@ namespace BerkeliumWinFormsTest {
             ParentFrame = parent;
             Widget = widget;
 
-            Widget.Paint += Widget_Paint;
+            Widget.FramePainted += Widget_FramePainted;
+            Widget.Resized += Widget_Resized;
             Widget.Destroyed += Widget_Destroyed;
 
             SetStyle(
@@ -33,8 +34,12 @@ namespace BerkeliumWinFormsTest {
             UpdateSizeAndPosition();
         }
 
-        void Widget_Paint (Window window, Widget widget, IntPtr sourceBuffer, Rect rect, int dx, int dy, Rect scrollRect) {
-            WebKitFrame.HandlePaintEvent(Bitmap, sourceBuffer, rect, dx, dy, scrollRect, Invalidate);
+        void Widget_FramePainted (Window window, Widget widget, ref PaintFrame frame) {
+            WebKitFrame.HandlePaintEvent(widget.BackingStore, Invalidate);
+        }
+
+        void Widget_Resized (Window window, Widget widget, int newWidth, int newHeight) {
+            UpdateSizeAndPosition();
         }
 
         void Widget_Destroyed (Window window, Widget widget) {
@@ -55,7 +60,7 @@ namespace BerkeliumWinFormsTest {
             if (Bitmap != null)
                 Bitmap.Dispose();
 
-            Bitmap = new Bitmap(w, h, System.Drawing.Imaging.PixelFormat.Format32bppRgb);
+            Bitmap = WebKitFrame.CreateBackingStoreBitmap(Widget.BackingStore);
 
             SetBounds(l, t, w, h);
         }
@@ -67,7 +72,8 @@ namespace BerkeliumWinFormsTest {
             e.Graphics.SmoothingMode = System.Drawing.Drawing2D.SmoothingMode.None;
             e.Graphics.PixelOffsetMode = System.Drawing.Drawing2D.PixelOffsetMode.HighSpeed;
 
-            e.Graphics.DrawImage(Bitmap, ClientRectangle);
+            if (Bitmap != null)
+                e.Graphics.DrawImage(Bitmap, ClientRectangle);
         }
 
         private void FloatingWindow_MouseMove (object sender, MouseEventArgs e) {
@@ -27,10 +27,10 @@ namespace BerkeliumWinFormsTest {
         public event Action<object, bool> LoadingStateChanged;
         public event Action<object, string> TitleChanged;
 
-        static byte[] TemporaryBuffer;
         Context Context;
         Window Window;
         Bitmap WindowBitmap;
+        IntPtr WindowBitmapBuffer;
         static int InitCount = 0;
 
         protected void WireEventHandlers () {
@@ -274,103 +274,52 @@ namespace BerkeliumWinFormsTest {
             menu.Show(this, args.MouseX, args.MouseY);
         }
 
-        private void WebKit_Paint (Window window, IntPtr sourceBuffer, Rect rect, int dx, int dy, Rect scrollRect) {
-            HandlePaintEvent(WindowBitmap, sourceBuffer, rect, dx, dy, scrollRect, Invalidate);
-        }
-
-        unsafe internal static void HandlePaintEvent (Bitmap windowBitmap, IntPtr sourceBuffer, Rect rect, int dx, int dy, Rect scrollRect, Action<Rectangle> invalidate) {
-            BitmapData sourceData;
-            var clientRect = new Rectangle(rect.Left, rect.Top, rect.Width, rect.Height);
-
-            if (dx != 0 || dy != 0) {
-                var sourceRect = new Rectangle(scrollRect.Left, scrollRect.Top, scrollRect.Width, scrollRect.Height);
-                var destRect = sourceRect;
-                destRect.X += dx;
-                destRect.Y += dy;
-
-                // We want to only draw the overlapping portion of the scrolled and unscrolled
-                //  rectangles, since the scrolled rectangle is probably partially offscreen
-                var overlap = Rectangle.Intersect(destRect, sourceRect);
-
-                // We need to handle scrolling to the left
-                if (destRect.Left < 0) {
-                    sourceRect.X -= destRect.Left;
-                    destRect.X = 0;
-                }
-                // And upward
-                if (destRect.Top < 0) {
-                    sourceRect.Y -= destRect.Top;
-                    destRect.Y = 0;
-                }
-
-                destRect.Width = sourceRect.Width = overlap.Width;
-                destRect.Height = sourceRect.Height = overlap.Height;
-
-                // If the clipping calculations resulted in a rect that contains zero pixels, 
-                //  don't bother trying to do the blit.
-                if ((sourceRect.Width > 0) && (sourceRect.Height > 0)) {
-                    sourceData = windowBitmap.LockBits(
-                        sourceRect, ImageLockMode.ReadOnly,
-                        PixelFormat.Format32bppRgb
-                    );
-
-                    int totalSize = sourceData.Stride * sourceData.Height;
-
-                    if ((TemporaryBuffer == null) || (totalSize > TemporaryBuffer.Length))
-                        TemporaryBuffer = new byte[totalSize];
-
-                    Marshal.Copy(sourceData.Scan0, TemporaryBuffer, 0, totalSize);
-                    windowBitmap.UnlockBits(sourceData);
+        private void WebKit_FramePainted (Window window, ref PaintFrame frame) {
+            UpdateWindowBitmap();
+            HandlePaintEvent(window.BackingStore, Invalidate);
+        }
 
-                    fixed (byte* ptr = &(TemporaryBuffer[0])) {
-                        sourceData.Scan0 = new IntPtr(ptr);
+        // Resizes only reach the backing store at the start of the next update, and the
+        //  store only moves its pixels when it grows, so rather than recreating the bitmap
+        //  on every resize we check it against the store each time we're about to use it.
+        private void UpdateWindowBitmap () {
+            var store = (Window != null) ? Window.BackingStore : null;
 
-                        var destData = windowBitmap.LockBits(
-                            destRect, ImageLockMode.WriteOnly | ImageLockMode.UserInputBuffer,
-                            PixelFormat.Format32bppRgb, sourceData
-                        );
+            if ((WindowBitmap != null) && (store != null) &&
+                (WindowBitmap.Width == store.Width) && (WindowBitmap.Height == store.Height) &&
+                (WindowBitmapBuffer == store.Buffer))
+                return;
 
-                        windowBitmap.UnlockBits(destData);
-                    }
+            if (WindowBitmap != null)
+                WindowBitmap.Dispose();
 
-                    invalidate(destRect);
-                }
-            }
+            WindowBitmap = CreateBackingStoreBitmap(store);
+            WindowBitmapBuffer = (WindowBitmap != null) ? store.Buffer : IntPtr.Zero;
+        }
 
-            // If we get a paint event after a resize, the rect can be larger than the buffer.
-            if ((clientRect.Right > windowBitmap.Width) || (clientRect.Bottom > windowBitmap.Height))
+        // WindowBitmap wraps the window's backing store directly, and the store has
+        //  already had this paint (scroll included) applied to it natively. So all
+        //  we have to do is invalidate the region that changed.
+        internal static void HandlePaintEvent (BackingStore store, Action<Rectangle> invalidate) {
+            if (!store.IsDirty)
                 return;
 
-            // This probably looks wrong when you first read it, but we're filling
-            //  out a BitmapData structure to represent the source buffer.
-            sourceData = new BitmapData();
-            sourceData.Width = clientRect.Width;
-            sourceData.Height = clientRect.Height;
-            sourceData.PixelFormat = PixelFormat.Format32bppRgb;
-            sourceData.Stride = clientRect.Width * 4;
-            sourceData.Scan0 = sourceBuffer;
-
-            // Sometimes this can fail if we process an old paint event after we
-            //  request a resize, so we just eat the exception in that case.
-            // Yes, this is terrible.
-
-            try {
-                // This oddball form of LockBits performs a write to the bitmap's
-                //  internal buffer by copying from another BitmapData you pass in.
-                // In this case we're passing in the source buffer.
-                var bd = windowBitmap.LockBits(
-                    clientRect,
-                    ImageLockMode.WriteOnly | ImageLockMode.UserInputBuffer,
-                    PixelFormat.Format32bppRgb, sourceData
-                );
+            var dirty = store.DirtyRect;
+            invalidate(new Rectangle(dirty.Left, dirty.Top, dirty.Width, dirty.Height));
 
-                // For some reason we still have to unlock the bits afterward.
-                windowBitmap.UnlockBits(bd);
+            store.ClearDirty();
+        }
 
-            } catch {
-            }
+        // Creates a bitmap that shares its pixels with a backing store, so no copying
+        //  is needed. The bitmap must be recreated whenever the store's size or Buffer changes.
+        internal static Bitmap CreateBackingStoreBitmap (BackingStore store) {
+            if ((store == null) || (store.Width < 1) || (store.Height < 1))
+                return null;
 
-            invalidate(clientRect);
+            return new Bitmap(
+                store.Width, store.Height, store.Stride,
+                PixelFormat.Format32bppRgb, store.Buffer
+            );
         }
 
         private void UserControl_Paint (object sender, PaintEventArgs e) {
@@ -383,7 +332,9 @@ namespace BerkeliumWinFormsTest {
             e.Graphics.SmoothingMode = System.Drawing.Drawing2D.SmoothingMode.None;
             e.Graphics.PixelOffsetMode = System.Drawing.Drawing2D.PixelOffsetMode.HighSpeed;
 
-            e.Graphics.DrawImage(WindowBitmap, e.ClipRectangle, e.ClipRectangle, GraphicsUnit.Pixel);
+            UpdateWindowBitmap();
+            if (WindowBitmap != null)
+                e.Graphics.DrawImage(WindowBitmap, e.ClipRectangle, e.ClipRectangle, GraphicsUnit.Pixel);
         }
 
         private void UserControl_MouseMove (object sender, MouseEventArgs e) {
@@ -445,9 +396,6 @@ namespace BerkeliumWinFormsTest {
             if (Window == null)
                 return;
 
-            if (WindowBitmap != null)
-                WindowBitmap.Dispose();
-
             var width = ClientSize.Width;
             var height = ClientSize.Height;
 
@@ -458,14 +406,9 @@ namespace BerkeliumWinFormsTest {
             if (height < 1)
                 height = 1;
 
-            // For efficiency in the case of a shrinking resize, we could reuse the
-            //  existing bitmap. But why bother?
-            using (var g = this.CreateGraphics())
-                WindowBitmap = new Bitmap(width, height, g);
-
-            // Notify WebKit of the resize *after* the buffer is ready,
-            //  not before. Just to be safe.
+            // The bitmap catches up with the backing store once the resize is applied.
             Window.Resize(width, height);
+            Invalidate();
         }
 
         // Note that we probably should be generating AUTOREPEAT_KEY here too,
@@ -582,6 +525,8 @@ namespace BerkeliumWinFormsTest {
                 Context = Window.Context;
             }
 
+            Window.UseBackingStore = true;
+
             WireEventHandlers();
             
             // We just fake a resize to wire up the buffer and everything,
@@ -0,0 +1,162 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.IO;
+using System.IO.Compression;
+using System.Security.Cryptography;
+
+namespace Berkelium.Managed {
+    /// <summary>
+    /// Builds the bundle files that AssetBundleProtocolHandler serves. The layout is described in NativeAssetBundle.h.
+    /// </summary>
+    public class AssetBundleWriter {
+        const int HeaderSize = 16;
+        const int EntrySize = 48;
+        const uint GzipFlag = 1;
+        static readonly byte[] Magic = Encoding.ASCII.GetBytes("BKBNDL01");
+
+        class Entry {
+            public byte[] Path, MimeType, ETag, Data;
+            public bool Compressed;
+        }
+
+        readonly Dictionary<string, Entry> Entries = new Dictionary<string, Entry>();
+        public readonly Func<string, string> SelectMimeType;
+
+        /// <summary>
+        /// When true, entries that aren't images are stored gzip-compressed if that makes them noticeably smaller.
+        /// </summary>
+        public bool Compress = true;
+
+        public AssetBundleWriter ()
+            : this(FileProtocolHandler.AutoSelectMimeType) {
+        }
+
+        public AssetBundleWriter (Func<string, string> selectMimeType) {
+            SelectMimeType = selectMimeType;
+        }
+
+        public int Count {
+            get {
+                return Entries.Count;
+            }
+        }
+
+        /// <summary>
+        /// Adds (or replaces) an entry.
+        /// </summary>
+        /// <param name="path">The path the entry is requested by, relative to the scheme (as in "host/dir/file.html").</param>
+        public void Add (string path, byte[] data) {
+            Add(path, data, SelectMimeType(path));
+        }
+
+        public void Add (string path, byte[] data, string mimeType) {
+            path = path.Replace('\\', '/').Trim('/');
+
+            var entry = new Entry {
+                Path = Encoding.UTF8.GetBytes(path),
+                MimeType = Encoding.UTF8.GetBytes(mimeType),
+                ETag = Encoding.UTF8.GetBytes(ComputeETag(data)),
+                Data = data
+            };
+
+            if (Compress && !mimeType.StartsWith("image/", StringComparison.OrdinalIgnoreCase)) {
+                var compressed = Gzip(data);
+                // Small gains aren't worth making the page decompress the entry.
+                if (compressed.Length < data.Length - (data.Length / 10)) {
+                    entry.Data = compressed;
+                    entry.Compressed = true;
+                }
+            }
+
+            Entries[path] = entry;
+        }
+
+        /// <summary>
+        /// Adds every file under a directory, with paths relative to it and prefixed by prefix.
+        /// </summary>
+        public void AddDirectory (string directory, string prefix) {
+            directory = Path.GetFullPath(directory);
+
+            foreach (var filename in Directory.GetFiles(directory, "*", SearchOption.AllDirectories)) {
+                var relativePath = filename.Substring(directory.Length).TrimStart(Path.DirectorySeparatorChar, Path.AltDirectorySeparatorChar);
+                Add(prefix + "/" + relativePath, File.ReadAllBytes(filename));
+            }
+        }
+
+        public void Save (string filename) {
+            using (var stream = File.Create(filename))
+                Save(stream);
+        }
+
+        public void Save (Stream output) {
+            // The native side binary searches the entries, comparing paths bytewise.
+            var entries = Entries.Values.ToArray();
+            Array.Sort(entries, (a, b) => CompareBytes(a.Path, b.Path));
+
+            // Strings go right after the index, so that their offsets always fit in 32 bits.
+            long stringsStart = HeaderSize + ((long)entries.Length * EntrySize);
+            var strings = new MemoryStream();
+            var stringOffsets = new uint[entries.Length, 3];
+            for (int i = 0; i < entries.Length; i++) {
+                var parts = new[] { entries[i].Path, entries[i].MimeType, entries[i].ETag };
+                for (int j = 0; j < parts.Length; j++) {
+                    stringOffsets[i, j] = checked((uint)(stringsStart + strings.Length));
+                    strings.Write(parts[j], 0, parts[j].Length);
+                }
+            }
+
+            var writer = new BinaryWriter(output);
+            writer.Write(Magic);
+            writer.Write((uint)entries.Length);
+            writer.Write((uint)0);
+
+            long dataOffset = stringsStart + strings.Length;
+            for (int i = 0; i < entries.Length; i++) {
+                var entry = entries[i];
+                writer.Write(stringOffsets[i, 0]);
+                writer.Write((uint)entry.Path.Length);
+                writer.Write(stringOffsets[i, 1]);
+                writer.Write((uint)entry.MimeType.Length);
+                writer.Write(stringOffsets[i, 2]);
+                writer.Write((uint)entry.ETag.Length);
+                writer.Write(entry.Compressed ? GzipFlag : 0);
+                writer.Write((uint)0);
+                writer.Write((ulong)dataOffset);
+                writer.Write((ulong)entry.Data.Length);
+                dataOffset += entry.Data.Length;
+            }
+
+            writer.Write(strings.GetBuffer(), 0, (int)strings.Length);
+            foreach (var entry in entries)
+                writer.Write(entry.Data);
+
+            writer.Flush();
+        }
+
+        static string ComputeETag (byte[] data) {
+            using (var md5 = MD5.Create()) {
+                var hash = md5.ComputeHash(data);
+                return "\"" + BitConverter.ToString(hash, 0, 8).Replace("-", "").ToLowerInvariant() + "\"";
+            }
+        }
+
+        static byte[] Gzip (byte[] data) {
+            var result = new MemoryStream();
+            using (var gzip = new GZipStream(result, CompressionMode.Compress, true))
+                gzip.Write(data, 0, data.Length);
+            return result.ToArray();
+        }
+
+        static int CompareBytes (byte[] a, byte[] b) {
+            int length = Math.Min(a.Length, b.Length);
+            for (int i = 0; i < length; i++) {
+                if (a[i] != b[i])
+                    return a[i].CompareTo(b[i]);
+            }
+
+            return a.Length.CompareTo(b.Length);
+        }
+    }
+}
@@ -46,7 +46,7 @@ namespace Berkelium.Managed {
             }
         }
 
-        protected override bool HandleRequest (string url, ref byte[] responseBody, ref string[] responseHeaders) {
+        protected override ProtocolResponse OpenResponse (string url) {
             var uri = new Uri(url);
             var path = uri.GetLeftPart(UriPartial.Path).Replace(Scheme, "");
 
@@ -56,24 +56,29 @@ namespace Berkelium.Managed {
             var stream = OpenFile(path);
 
             if (stream == null) {
-                responseHeaders = new string[] {
-                    "HTTP/1.1 404 Not Found"
-                };
-                return false;
+                return new ProtocolResponse(new ResponseHeaders(404), null);
             }
 
-            using (stream) {
-                responseBody = new byte[stream.Length];
-                stream.Read(responseBody, 0, responseBody.Length);
-            }
-
-            var mimeType = SelectMimeType(path);
-            responseHeaders = new string[] {
-                "HTTP/1.1 200 OK",
-                String.Format("Content-type: {0}; charset=utf-8", mimeType)
+            // The stream is read as the page consumes it and disposed along with the response.
+            var headers = new ResponseHeaders(200) {
+                ContentType = SelectMimeType(path),
+                Charset = "utf-8"
             };
 
-            return true;
+            if (stream.CanSeek)
+                headers.ContentLength = stream.Length - stream.Position;
+
+            var response = new ProtocolResponse(headers, stream);
+
+            // Files on disk let reloads be answered with 304 Not Modified.
+            var fileStream = stream as FileStream;
+            if (fileStream != null) {
+                var lastModified = File.GetLastWriteTimeUtc(fileStream.Name);
+                response.LastModified = lastModified;
+                response.ETag = String.Format("\"{0:x}-{1:x}\"", fileStream.Length, lastModified.Ticks);
+            }
+
+            return response;
         }
     }
 }
@@ -0,0 +1,54 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+
+namespace Berkelium.Managed {
+    public delegate void HostMessageHandler (Window window, HostMessage message);
+
+    public class HostMessageListener : IDisposable {
+        public event HostMessageHandler Unhandled;
+
+        public readonly Window Window;
+        // Indexed by message Id, so dispatching a message is an array lookup.
+        protected HostMessageHandler[] Handlers = new HostMessageHandler[16];
+
+        public HostMessageListener (Window window) {
+            Window = window;
+            Window.HostMessages += GlobalHandler;
+        }
+
+        public void Dispose () {
+            Array.Clear(Handlers, 0, Handlers.Length);
+            Window.HostMessages -= GlobalHandler;
+        }
+
+        protected void GlobalHandler (Window window, HostMessageBatch messages) {
+            for (int i = 0, count = messages.Count; i < count; i++) {
+                var message = messages[i];
+                var id = message.Id;
+
+                var handler = (id < Handlers.Length) ? Handlers[id] : null;
+                if (handler != null)
+                    handler(window, message);
+                else if (Unhandled != null)
+                    Unhandled(window, message);
+            }
+        }
+
+        public int Register (string name, HostMessageHandler handler) {
+            var id = HostMessage.GetId(name);
+            if (id >= Handlers.Length)
+                Array.Resize(ref Handlers, Math.Max(id + 1, Handlers.Length * 2));
+
+            Handlers[id] = handler;
+            return id;
+        }
+
+        public void Unregister (string name) {
+            var id = HostMessage.GetId(name);
+            if (id < Handlers.Length)
+                Handlers[id] = null;
+        }
+    }
+}
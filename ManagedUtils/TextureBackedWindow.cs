@@ -6,12 +6,15 @@ using Microsoft.Xna.Framework.Graphics;
 using Microsoft.Xna.Framework;
 using System.Runtime.InteropServices;
 using System.Web.Script.Serialization;
-using System.Text.RegularExpressions;
 using System.Threading;
 
 namespace Berkelium.Managed {
     public class TextureBackedWindow : Window {
-        private static Regex ArgumentRegex = new Regex(@"\$(?'id'[0-9]*)", RegexOptions.Compiled);
+        // The most recently used templates, newest first. Callers that build scripts on the fly would otherwise
+        //  leave a template behind for every string they ever ran.
+        private const int MaxTemplates = 64;
+        private static Dictionary<string, LinkedListNode<ScriptTemplate>> Templates = new Dictionary<string, LinkedListNode<ScriptTemplate>>();
+        private static LinkedList<ScriptTemplate> TemplateOrder = new LinkedList<ScriptTemplate>();
         private static int[] TemporaryBuffer;
 
         private Queue<Texture2D> DeadTextures;
@@ -30,49 +33,43 @@ namespace Berkelium.Managed {
 
             Device = device;
             Transparent = true;
+            // Caps texture uploads at one per window (and widget) per update,
+            //  no matter how many times the page repaints in between.
+            CoalescePaints = true;
             DeadTextures = new Queue<Texture2D>();
             WidgetTextures = new Dictionary<Widget, Texture2D>();
             ChromeSend = new ChromeSendListener(this);
             Serializer = new JavaScriptSerializer();
         }
 
+        // The resize itself is queued natively, and the texture is only replaced once the resized page
+        //  paints (see OnPaintFrame), so a window being dragged doesn't churn through textures.
         public override void Resize (int width, int height) {
-            if ((width == Width) && (height == Height))
-                return;
+            // Callers expect a texture as soon as the window has a size.
+            if (Texture == null)
+                ReplaceTexture(width, height);
 
+            base.Resize(width, height);
+        }
+
+        // Nothing is copied over from the old texture: the backing store holds the whole page, and marking it
+        //  dirty uploads all of it.
+        private void ReplaceTexture (int width, int height) {
             if (Lock != null)
                 Monitor.Enter(Lock);
 
-            var oldTexture = Texture;
-            Texture = null;
-            var newTexture = new Texture2D(
-                Device, width, height, 1,
-                TextureUsage.Linear, SurfaceFormat.Color
-            );
-
-            if (oldTexture != null) {
-                int w = Math.Min(oldTexture.Width, newTexture.Width);
-                int h = Math.Min(oldTexture.Height, newTexture.Height);
-                int sz = w * h;
-
-                if ((TemporaryBuffer == null) || (TemporaryBuffer.Length < sz))
-                    TemporaryBuffer = new int[sz];
-
-                oldTexture.GetData(0, new Rectangle(0, 0, w, h), TemporaryBuffer, 0, sz);
-                newTexture.SetData(0, new Rectangle(0, 0, w, h), TemporaryBuffer, 0, sz, SetDataOptions.Discard);
-                oldTexture.Dispose();
-            }
+            if (Texture != null)
+                Texture.Dispose();
 
-            Texture = newTexture;
+            Texture = null;
+            if ((width > 0) && (height > 0))
+                Texture = new Texture2D(
+                    Device, width, height, 1,
+                    TextureUsage.Linear, SurfaceFormat.Color
+                );
 
             if (Lock != null)
                 Monitor.Exit(Lock);
-
-            BerkeliumSharp.Update();
-
-            base.Resize(width, height);
-
-            BerkeliumSharp.Update();
         }
 
         public void Cleanup () {
@@ -81,14 +78,38 @@ namespace Berkelium.Managed {
                     DeadTextures.Dequeue().Dispose();                    
         }
 
+        // The script is parsed into a template the first time it's seen, and runs at the start
+        //  of the next update along with everything else queued for the window. This hides
+        //  Window.ExecuteJavascript(string), which runs right away; it sends whatever is queued
+        //  first, so scripts still run in the order they were issued through either method.
         public void ExecuteJavascript (string javascript, params object[] variables) {
-            var serializedVariables = (from v in variables select Serializer.Serialize(v)).ToArray();
+            // Primitives are converted natively, so only other values need the serializer.
+            for (int i = 0; i < variables.Length; i++) {
+                if (!ScriptTemplate.IsSupportedArgument(variables[i]))
+                    variables[i] = new ScriptLiteral(Serializer.Serialize(variables[i]));
+            }
 
-            javascript = ArgumentRegex.Replace(
-                javascript, (m) => serializedVariables[int.Parse(m.Groups["id"].Value)]
-            );
+            lock (Templates) {
+                LinkedListNode<ScriptTemplate> node;
+                if (Templates.TryGetValue(javascript, out node)) {
+                    TemplateOrder.Remove(node);
+                } else {
+                    if (Templates.Count >= MaxTemplates) {
+                        var oldest = TemplateOrder.Last.Value;
+                        TemplateOrder.RemoveLast();
+                        Templates.Remove(oldest.Source);
+                        oldest.Dispose();
+                    }
+
+                    node = new LinkedListNode<ScriptTemplate>(new ScriptTemplate(javascript));
+                    Templates[javascript] = node;
+                }
+
+                TemplateOrder.AddFirst(node);
 
-            base.ExecuteJavascript(javascript);
+                // Queued under the lock, since an evicted template is disposed right away.
+                QueueJavascript(node.Value, variables);
+            }
         }
 
         protected override void OnWidgetCreated (Widget widget, int zIndex) {
@@ -128,77 +149,59 @@ namespace Berkelium.Managed {
             base.OnWidgetDestroyed(widget);
         }
 
-        protected override void OnPaint (IntPtr sourceBuffer, Rect rect, int dx, int dy, Rect scrollRect) {
-            HandlePaintEvent(Texture, sourceBuffer, rect, dx, dy, scrollRect);
+        protected override void OnPaintFrame (ref PaintFrame frame) {
+            var store = BackingStore;
+            if ((store != null) && ((Texture == null) || (Texture.Width != store.Width) || (Texture.Height != store.Height))) {
+                ReplaceTexture(store.Width, store.Height);
+                store.MarkDirty();
+            }
+
+            HandlePaintEvent(Texture, store);
 
-            base.OnPaint(sourceBuffer, rect, dx, dy, scrollRect);
+            base.OnPaintFrame(ref frame);
         }
 
-        protected override void OnWidgetPaint (Widget widget, IntPtr sourceBuffer, Rect rect, int dx, int dy, Rect scrollRect) {
+        protected override void OnWidgetPaintFrame (Widget widget, ref PaintFrame frame) {
             Texture2D texture;
             if (WidgetTextures.TryGetValue(widget, out texture))
-                HandlePaintEvent(texture, sourceBuffer, rect, dx, dy, scrollRect);
+                HandlePaintEvent(texture, widget.BackingStore);
 
-            base.OnWidgetPaint(widget, sourceBuffer, rect, dx, dy, scrollRect);
+            base.OnWidgetPaintFrame(widget, ref frame);
         }
 
-        protected void HandlePaintEvent (Texture2D texture, IntPtr sourceBuffer, Rect rect, int dx, int dy, Rect scrollRect) {
+        // The backing store has already had the scroll and copy rects applied to it
+        //  natively, so all we need to do is upload whatever regions are now dirty.
+        protected void HandlePaintEvent (Texture2D texture, BackingStore store) {
+            if ((texture == null) || (store == null) || !store.IsDirty)
+                return;
+
             if (Lock != null)
                 Monitor.Enter(Lock);
 
-            var clientRect = new Rectangle(rect.Left, rect.Top, rect.Width, rect.Height);
-
             Device.Textures[0] = null;
 
-            if (dx != 0 || dy != 0) {
-                var sourceRect = new Rectangle(scrollRect.Left, scrollRect.Top, scrollRect.Width, scrollRect.Height);
-                var destRect = sourceRect;
-                destRect.X += dx;
-                destRect.Y += dy;
+            var textureRect = new Rectangle(0, 0, texture.Width, texture.Height);
+            foreach (var dirty in store.DirtyRects) {
+                var destRect = Rectangle.Intersect(
+                    new Rectangle(dirty.Left, dirty.Top, dirty.Width, dirty.Height), textureRect
+                );
+                var copySize = destRect.Width * destRect.Height;
 
-                // We want to only draw the overlapping portion of the scrolled and unscrolled
-                //  rectangles, since the scrolled rectangle is probably partially offscreen
-                var overlap = Rectangle.Intersect(destRect, sourceRect);
+                if (copySize <= 0)
+                    continue;
 
-                // We need to handle scrolling to the left
-                if (destRect.Left < 0) {
-                    sourceRect.X -= destRect.Left;
-                    destRect.X = 0;
-                }
-                // And upward
-                if (destRect.Top < 0) {
-                    sourceRect.Y -= destRect.Top;
-                    destRect.Y = 0;
-                }
+                if ((TemporaryBuffer == null) || (TemporaryBuffer.Length < copySize))
+                    TemporaryBuffer = new int[copySize];
 
-                destRect.Width = sourceRect.Width = overlap.Width;
-                destRect.Height = sourceRect.Height = overlap.Height;
-
-                // If the clipping calculations resulted in a rect that contains zero pixels, 
-                //  don't bother trying to do the blit.
-                if ((sourceRect.Width > 0) && (sourceRect.Height > 0)) {
-                    if ((TemporaryBuffer == null) || (TemporaryBuffer.Length < (sourceRect.Width * sourceRect.Height)))
-                        TemporaryBuffer = new int[sourceRect.Width * sourceRect.Height];
-
-                    if ((sourceRect.Right <= texture.Width) && (sourceRect.Bottom <= texture.Height) &&
-                        (destRect.Right <= texture.Width) && (destRect.Bottom <= texture.Height)) {
-                        // Copy the scrolled portion out of the texture into our temporary buffer
-                        texture.GetData<int>(0, sourceRect, TemporaryBuffer, 0, sourceRect.Width * sourceRect.Height);
-                        // And then copy it back into the new location
-                        texture.SetData<int>(0, destRect, TemporaryBuffer, 0, destRect.Width * destRect.Height, SetDataOptions.Discard);
-                    }
-                }
-            }
+                // Ugh. Why doesn't SetData accept a pointer? Terrible.
+                var rowPtr = store.Buffer.ToInt64() + (destRect.Top * store.Stride) + (destRect.Left * 4);
+                for (int y = 0; y < destRect.Height; y++, rowPtr += store.Stride)
+                    Marshal.Copy(new IntPtr(rowPtr), TemporaryBuffer, y * destRect.Width, destRect.Width);
 
-            if ((TemporaryBuffer == null) || (TemporaryBuffer.Length < (rect.Width * rect.Height)))
-                TemporaryBuffer = new int[rect.Width * rect.Height];
-
-            // Ugh. Why doesn't SetData accept a pointer? Terrible.
-            var copySize = rect.Width * rect.Height;
-            Marshal.Copy(sourceBuffer, TemporaryBuffer, 0, copySize);
+                texture.SetData<int>(0, destRect, TemporaryBuffer, 0, copySize, SetDataOptions.Discard);
+            }
 
-            if ((clientRect.Right <= texture.Width) && (clientRect.Bottom <= texture.Height))
-                texture.SetData<int>(0, clientRect, TemporaryBuffer, 0, copySize, SetDataOptions.Discard);
+            store.ClearDirty();
 
             if (Lock != null)
                 Monitor.Exit(Lock);